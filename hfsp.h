@@ -4,6 +4,11 @@
 #include <sys/buf.h>
 #include <sys/param.h>
 #include <sys/queue.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/taskqueue.h>
 #include <vm/uma.h>
 
 #ifndef _HFSP_H_
@@ -15,11 +20,16 @@
 
 
 struct hfspmount;
+struct hfsp_journal;
+struct hfsp_bitmap;
+struct hfsp_jwriter;
 
 MALLOC_DECLARE(M_HFSPMNT);
 MALLOC_DECLARE(M_HFSPKEYSEARCH);
 MALLOC_DECLARE(M_HFSPKEY);
 
+SYSCTL_DECL(_vfs_hfsp);
+
 /* Signatures used to differentiate between HFS and HFS Plus volumes */
 enum {
     kHFSSigWord             = 0x4244,   /* 'BD' in ASCII */
@@ -43,9 +53,11 @@ typedef u_int32_t   hfsp_cnid;
  * The hu_str member is expecting to be a copy of what is found
  * on disk (BE unichar) whereas the hu_len is convert to host endianness.
  */
+#define HFSP_NAME_MAX   255
+
 struct hfsp_unistr {
     u_int16_t       hu_len;
-    hfsp_unichar    hu_str[255];
+    hfsp_unichar    hu_str[HFSP_NAME_MAX];
 };
 
 /* HFS Plus extent descriptor */
@@ -99,6 +111,18 @@ struct FndrDirInfo {
 } __attribute__((aligned(2), packed));
 typedef struct FndrDirInfo FndrDirInfo;
 
+struct FndrFileInfo {
+    u_int32_t   fdType;     /* file type */
+    u_int32_t   fdCreator;  /* file creator */
+    u_int16_t   fdFlags;    /* Finder flags */
+    struct {
+        __int16_t v;        /* file's location */
+        __int16_t h;
+    } fdLocation;
+    __int16_t   opaque;
+} __attribute__((aligned(2), packed));
+typedef struct FndrFileInfo FndrFileInfo;
+
 struct FndrOpaqueInfo {
     __int8_t opaque[16];
 } __attribute__((aligned(2), packed));
@@ -172,6 +196,12 @@ struct BTHeaderRec {
 } __attribute__((aligned(2), packed));
 typedef struct BTHeaderRec BTHeaderRec;
 
+/* BTHeaderRec keyCompareType of the catalog of an HFSX volume */
+enum {
+    kHFSCaseFolding         = 0xCF,     /* Case insensitive, as HFS+ */
+    kHFSBinaryCompare       = 0xBC      /* Case sensitive, names in binary order */
+};
+
 /* HFS Plus catalog folder record - 88 bytes */
 struct HFSPlusCatalogFolder {
     __int16_t       recordType;     /* == kHFSPlusFolderRecord */
@@ -191,6 +221,52 @@ struct HFSPlusCatalogFolder {
 } __attribute__((aligned(2), packed));
 typedef struct HFSPlusCatalogFolder HFSPlusCatalogFolder;
 
+/* HFS Plus catalog file record - 248 bytes */
+struct HFSPlusCatalogFile {
+    __int16_t       recordType;     /* == kHFSPlusFileRecord */
+    u_int16_t       flags;          /* file flags */
+    u_int32_t       reserved1;      /* reserved - initialized as zero */
+    u_int32_t       fileID;         /* file ID */
+    u_int32_t       createDate;     /* date and time of creation */
+    u_int32_t       contentModDate;     /* date and time of last content modification */
+    u_int32_t       attributeModDate;   /* date and time of last attribute modification */
+    u_int32_t       accessDate;     /* date and time of last access (MacOS X only) */
+    u_int32_t       backupDate;     /* date and time of last backup */
+    HFSPlusBSDInfo      bsdInfo;        /* permissions (for MacOS X) */
+    FndrFileInfo        userInfo;       /* Finder information */
+    FndrOpaqueInfo      finderInfo;     /* additional Finder information */
+    u_int32_t       textEncoding;       /* hint for name conversions */
+    u_int32_t       reserved2;      /* reserved - initialized as zero */
+    struct HFSPlusForkData dataFork;    /* size and block data for data fork */
+    struct HFSPlusForkData resourceFork;    /* size and block data for resource fork */
+} __attribute__((aligned(2), packed));
+typedef struct HFSPlusCatalogFile HFSPlusCatalogFile;
+
+/* Catalog record flags */
+enum {
+    kHFSFileLockedBit       = 0x0000,   /* file is locked and cannot be written to */
+    kHFSFileLockedMask      = 0x0001,
+    kHFSThreadExistsBit     = 0x0001,   /* a file thread record exists for this file */
+    kHFSThreadExistsMask    = 0x0002,
+    kHFSHasLinkChainBit     = 0x0005,   /* has hardlink chain (inode or link) */
+    kHFSHasLinkChainMask    = 0x0020
+};
+
+/* Finder type and creator of the hard link files */
+enum {
+    kHardLinkFileType       = 0x686C6E6B,   /* 'hlnk' */
+    kHFSPlusCreator         = 0x6866732B,   /* 'hfs+' */
+    kHFSAliasType           = 0x66647270,   /* 'fdrp' directory hard link */
+    kHFSAliasCreator        = 0x4D414353    /* 'MACS' */
+};
+
+/* Name of the folder holding the file indirect nodes, it starts with four NUL */
+#define HFSP_PRIVATE_DIR_NAME           "\0\0\0\0HFS+ Private Data"
+#define HFSP_INODE_PREFIX               "iNode"
+/* Name of the folder holding the directory indirect nodes */
+#define HFSP_PRIVATE_DIRDATA_NAME       ".HFS+ Private Directory Data\r"
+#define HFSP_DIRINODE_PREFIX            "dir_"
+
 
 struct hfsp_extent_descriptor {
     u_int32_t   startBlock;     /* first allocation block */
@@ -200,14 +276,39 @@ struct hfsp_extent_descriptor {
 struct hfsp_fork {
     u_int64_t   size;
     u_int32_t   totalBlocks;
+    u_int32_t   clumpSize;      /* Bytes the fork grows by, 0 for the volume default */
     struct hfsp_extent_descriptor first_extents[8];
 };
 
+/*
+ * Interned name.
+ * Every distinct name is stored once per mount, sized to its length, and
+ * shared by reference between keys, thread records, inodes and caches.
+ * Two references to the same name are equal if and only if they are the
+ * same pointer. Like hfsp_unistr the characters are a copy of what is found
+ * on disk (BE unichar).
+ */
+struct hfsp_name {
+    LIST_ENTRY(hfsp_name)   hna_link;
+    u_int32_t               hna_hash;   /* Hash of the case folded name */
+    volatile u_int          hna_refcnt;
+    u_int16_t               hna_len;
+    hfsp_unichar            hna_str[];
+};
+
+/* Per mount table of the interned names */
+struct hfsp_nametab {
+    struct mtx                  hnt_mtx;
+    LIST_HEAD(, hfsp_name) *    hnt_hash;
+    u_long                      hnt_mask;
+    u_int                       hnt_count;
+};
+
 /* In memory content of a thread record */
 struct hfsp_record_thread {
     __int16_t           hrt_recordType;
     hfsp_cnid           hrt_parentCnid;
-    struct hfsp_unistr  hrt_name;
+    struct hfsp_name *  hrt_name;       /* Reference held by the record */
 };
 
 /* In memory content of a folder record */
@@ -222,23 +323,48 @@ struct hfsp_record_folder {
     // XXX: To continue
 };
 
+/* In memory content of a file record */
+struct hfsp_record_file {
+    __int16_t           hrfi_recordType;
+    u_int16_t           hrfi_flags;
+    u_int32_t           hrfi_reserved;
+    u_int32_t           hrfi_createDate;
+    u_int32_t           hrfi_lstAccessDate;
+    u_int32_t           hrfi_lstModifyDate;
+    u_int32_t           hrfi_lstChangeTime;
+    u_int32_t           hrfi_fdType;
+    u_int32_t           hrfi_fdCreator;
+    struct hfsp_fork    hrfi_dataFork;
+};
+
 struct hfsp_record_common {
     __int16_t           hrc_recordType;
 };
 
-/* Key of a record */
+/*
+ * Key of a record.
+ * The name is a view: hk_nameStr points either into the node the key was
+ * read from, into a caller owned hfsp_unistr, or into the interned hk_name.
+ * Keys of records returned by hfsp_btree_find() hold a reference on hk_name,
+ * search keys built by callers only borrow it.
+ */
 struct hfsp_record_key {
-    u_int16_t   hk_len;
-    hfsp_cnid   hk_cnid;
-    struct hfsp_unistr hk_name;
+    u_int16_t               hk_len;
+    hfsp_cnid               hk_cnid;
+    u_int16_t               hk_nameLen;
+    const hfsp_unichar *    hk_nameStr;
+    struct hfsp_name *      hk_name;
 };
 
 /* Record structure */
 struct hfsp_record {
     struct hfsp_record_key  hr_key;
     struct hfsp_node *      hr_node;
+    struct hfspmount *      hr_mount;   /* Mount owning the names referenced by the record */
+    u_int16_t               hr_flags;
     hfsp_cnid               hr_cnid;
     u_int64_t               hr_nodeOffset;
+    u_int16_t               hr_recIdx;  /* Index of the record in the b-tree node. */
     u_int16_t               hr_offset;  /*Offset in the b-tree node. */
     u_int16_t               hr_dataOffset; /* Offset in the b-tree of the start of the data. */
     u_int32_t               hr_ownerId;
@@ -253,6 +379,7 @@ struct hfsp_record {
         struct hfsp_record_common common;
         struct hfsp_record_thread thread;
         struct hfsp_record_folder folder;
+        struct hfsp_record_file file;
         u_int32_t   index;
     } hr_data;
 };
@@ -261,24 +388,87 @@ struct hfsp_record {
 #define hr_parentCnid   hr_key.hk_cnid
 #define hr_thread       hr_data.thread
 #define hr_folder       hr_data.folder
+#define hr_file         hr_data.file
 #define hr_index        hr_data.index
-#define hr_cnid         hr_key.hk_cnid
 #define hr_iNodeNum     hr_special.iNodeNum
 #define hr_linkCount    hr_special.linkCount
 #define hr_rawDevice    hr_special.rawDevice
 
+/* hr_flags */
+#define HFSP_RECORD_THREADNAME  0x0001  /* hr_thread.hrt_name holds a reference */
+
+/*
+ * In core inode, 168 bytes on amd64.
+ * Only the fields needed to serve the vnode operations are kept, in host
+ * endianness, so the hot part fits in the first cache line and the fork
+ * extents in the following ones. The name is attached on demand.
+ */
 struct hfsp_inode {
     struct vnode *          hi_vp;
     struct hfspmount *      hi_mount;
-    struct hfsp_record      hi_record;
-    // XXX Can be remove. File record must contain the correct fork
+    hfsp_cnid               hi_cnid;
+    hfsp_cnid               hi_parentCnid;
+    __int16_t               hi_type;        /* Catalogue record type */
+    u_int16_t               hi_mode;
+    u_int16_t               hi_flags;
+    u_int32_t               hi_uid;
+    u_int32_t               hi_gid;
     union {
-        struct hfsp_fork    fork;
-    } hi_data;
+        u_int32_t           iNodeNum;
+        u_int32_t           linkCount;
+        u_int32_t           rawDevice;
+    } hi_special;
+    u_int32_t               hi_valence;     /* Number of items for folders */
+    u_int32_t               hi_createDate;
+    u_int32_t               hi_accessDate;
+    u_int32_t               hi_modifyDate;
+    u_int32_t               hi_changeDate;
+    struct hfsp_fork        hi_fork;
+    u_int32_t               hi_delayed;     /* Blocks reserved by writes, not allocated yet */
+    struct hfsp_name *      hi_name;        /* Interned, NULL until known */
+    struct hfsp_dir *       hi_dir;         /* Folder state, NULL until needed */
+};
+
+#define hi_iNodeNum     hi_special.iNodeNum
+#define hi_linkCount    hi_special.linkCount
+#define hi_rawDevice    hi_special.rawDevice
+
+/* Per mount cache of the resolved hard link indirect nodes */
+struct hfsp_linkcache {
+    struct mtx                          hlc_mtx;
+    LIST_HEAD(, hfsp_linkentry) *       hlc_hash;
+    u_long                              hlc_mask;
+    TAILQ_HEAD(, hfsp_linkentry)        hlc_lru;
+    u_int                               hlc_count;
+    volatile u_int                      hlc_privState;  /* Look up of the private folders */
+};
+
+/* hlc_privState */
+#define HFSP_LINK_PRIV_NONE     0
+#define HFSP_LINK_PRIV_BUSY     1       /* Being looked up, sleep on the cache */
+#define HFSP_LINK_PRIV_DONE     2       /* hm_privDirCnid and hm_privDirDataCnid are set */
+
+/* Per mount cache of the catalogue records read by readdir */
+struct hfsp_attrcache {
+    struct mtx                          hac_mtx;
+    LIST_HEAD(, hfsp_attrentry) *       hac_byName;
+    u_long                              hac_nameMask;
+    LIST_HEAD(, hfsp_attrentry) *       hac_byCnid;
+    u_long                              hac_cnidMask;
+    TAILQ_HEAD(, hfsp_attrentry)        hac_lru;
+    u_int                               hac_count;
 };
 
-#define hi_fork     hi_data.fork
-#define hi_cnid     hi_record.hr_cnid
+/*
+ * NFS file handle. CNIDs are not reused on a volume, the creation date of the
+ * volume makes the handles of a reformatted volume stale.
+ */
+struct hfsp_fid {
+    u_int16_t                   hf_len;
+    u_int16_t                   hf_pad;
+    u_int32_t                   hf_cnid;
+    u_int32_t                   hf_gen;
+};
 
 struct hfspmount {
     u_int16_t                   hm_signature;  /* ==kHFSPlusSigWord */
@@ -286,17 +476,93 @@ struct hfspmount {
     u_int32_t                   hm_blockSize;  /* Size in byte of allocation block */
     u_int32_t                   hm_totalBlocks;
     u_int32_t                   hm_freeBlocks;
+    u_int32_t                   hm_nextAllocation;  /* Where allocations without a goal start */
+    u_int32_t                   hm_dataClumpSize;
     u_int32_t                   hm_fileCount;
+    u_int32_t                   hm_folderCount;
+    u_int32_t                   hm_createDate;  /* Generation of the file handles */
     u_int32_t                   hm_physBlockSize;
+    u_int32_t                   hm_flags;
     struct cdev *               hm_dev;
     struct vnode *              hm_devvp;
-    struct hfsp_btree *         hm_extent_bp;
+    struct sx                   hm_lock;        /* Opening of hm_extent_bp */
+    struct hfsp_fork            hm_extentsFork;
+    struct hfsp_btree *         hm_extent_bp;   /* NULL until first used */
     struct hfsp_btree *         hm_catalog_bp;
     struct g_consumer *         hm_cp;
+    struct hfsp_nametab         hm_names;
+    hfsp_cnid                   hm_privDirCnid;    /* Folder of the file indirect nodes, 0 if none */
+    hfsp_cnid                   hm_privDirDataCnid; /* Folder of the directory indirect nodes, 0 if none */
+    struct hfsp_linkcache       hm_links;
+    struct hfsp_attrcache       hm_attrs;
+    TAILQ_HEAD(, hfsp_snap)     hm_snapLru;     /* Folder snapshots, least recently used first */
+    u_long                      hm_snapBytes;   /* Memory of the snapshots */
+    struct task                 hm_warmTask;    /* Prefetch of the warmcache manifest */
+    u_int32_t *                 hm_warmNodes;   /* Catalog nodes of the manifest, NULL if none */
+    int                         hm_warmCount;
+    struct task                 hm_hotTask;     /* Prefetch of the hot files */
+    struct hfsp_journal *       hm_journal;     /* Transactions not replayed, NULL if none */
+    struct hfsp_bitmap *        hm_bitmap;      /* Free extents, NULL unless requested */
+    struct hfsp_jwriter *       hm_jwriter;     /* Metadata writes logged, NULL if none */
 };
+
+/* hm_flags */
+#define HFSP_MNT_NFC            0x0001  /* Names are returned precomposed */
+#define HFSP_MNT_CATALOGRAM     0x0002  /* Catalog file held in memory */
+#define HFSP_MNT_HOTFILES       0x0004  /* Hot files prefetch started */
+#define HFSP_MNT_JOURNALED      0x0008  /* Metadata is only written through hm_jwriter */
+
+/*
+ * Map a range of a special file to the device.
+ * ip: The inode of the special file.
+ * fileOffset, size: The range in the file.
+ * blknop: Device block, in DEV_BSIZE units, of the start of the range on exit.
+ * sizep: Size to read, rounded to the sector size, on exit.
+ * runp: If not NULL, number of bytes contiguous on the device from the start on exit.
+ */
+int hfsp_bmap_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, daddr_t * blknop, int * sizep,
+                    u_int64_t * runp);
 int hfsp_bread_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, struct buf ** bpp);
+
+/*
+ * Read blocks of the device as seen through the journal overlay. All the reads
+ * of the volume go through it, the buffers are patched in place.
+ * hmp: The mount.
+ * blkno, size: The blocks, in DEV_BSIZE units, and the size to read.
+ * bpp: Address of the pointer to the buffer on exit.
+ */
+int hfsp_bread_dev(struct hfspmount * hmp, daddr_t blkno, int size, struct buf ** bpp);
+
+/*
+ * Read a range of a special file into a buffer. Unlike hfsp_bread_inode() the
+ * range may cross extents, each physical run is read separately, in buffers
+ * of at most MAXBSIZE bytes.
+ * ip: The inode of the special file.
+ * fileOffset, size: The range in the file.
+ * buf: Buffer of at least size bytes receiving the data.
+ */
+int hfsp_read_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, void * buf);
+
+/*
+ * Allocate an inode.
+ * hmp: The mount.
+ * fork: The on disk fork to decode, NULL if the caller fills hi_fork.
+ * ipp: Address of the pointer to the inode on exit.
+ */
+int hfsp_iget(struct hfspmount * hmp, struct HFSPlusForkData * fork, struct hfsp_inode ** ipp);
 void hfsp_irelease(struct hfsp_inode * ip);
+
+/*
+ * Return the extents overflow B-tree of a mount, opening it on first use.
+ * hmp: The mount.
+ * btreepp: Address of the pointer to the B-tree on exit.
+ */
+int hfsp_extent_btree(struct hfspmount * hmp, struct hfsp_btree ** btreepp);
 void hfsp_vinit(struct vnode * vp, struct hfsp_inode * ip);
+void hfsp_fork_decode(struct hfsp_fork * forkp, struct HFSPlusForkData * rawp);
+void hfsp_inode_fill(struct hfsp_inode * ip, struct hfsp_record * rp);
+int hfsp_iname(struct hfsp_inode * ip, struct hfsp_name ** namepp);
+int hfsp_vget_record(struct mount * mp, struct hfsp_record * rp, int flags, struct vnode ** vpp);
 
 #define VFSTOHFSPMNT(mp)        ((struct hfspmount *)((mp)->mnt_data))
 #define VTOI(vp)                ((struct hfsp_inode *)((vp)->v_data))
@@ -318,5 +584,6 @@ void hfsp_vinit(struct vnode * vp, struct hfsp_inode * ip);
 
 extern struct vop_vector hfsp_vnodeops;
 extern uma_zone_t   uma_record_key;
+extern struct taskqueue * hfsp_taskqueue;   /* Background work of the mounts */
 
 #endif /* !_HFSP_H_ */
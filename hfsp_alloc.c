@@ -0,0 +1,175 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/sysctl.h>
+
+#include <geom/geom.h>
+
+#include "hfsp.h"
+#include "hfsp_alloc.h"
+#include "hfsp_bitmap.h"
+#include "hfsp_jwrite.h"
+#include "hfsp_trace.h"
+
+static u_int hfsp_alloc_prealloc = 16 * 1024 * 1024;
+SYSCTL_UINT(_vfs_hfsp, OID_AUTO, alloc_prealloc, CTLFLAG_RW, &hfsp_alloc_prealloc, 0,
+            "Most bytes a growing fork is given past its clump");
+
+static u_long hfsp_alloc_assigns;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, alloc_assigns, CTLFLAG_RD, &hfsp_alloc_assigns, 0,
+             "Delayed allocations of a fork");
+
+static u_long hfsp_alloc_blocks;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, alloc_blocks, CTLFLAG_RD, &hfsp_alloc_blocks, 0,
+             "Blocks allocated to forks, clumps included");
+
+static u_long hfsp_alloc_extents;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, alloc_extents, CTLFLAG_RD, &hfsp_alloc_extents, 0,
+             "Extents added to forks, alloc_extents / alloc_assigns is the fragmentation");
+
+static u_long hfsp_alloc_inplace;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, alloc_inplace, CTLFLAG_RD, &hfsp_alloc_inplace, 0,
+             "Runs that extended the last extent of a fork");
+
+static u_long hfsp_alloc_overflows;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, alloc_overflows, CTLFLAG_RD, &hfsp_alloc_overflows, 0,
+             "Allocations refused as the fork would need the extents overflow file");
+
+int
+hfsp_alloc_reserve(struct hfsp_inode * ip, u_int64_t size)
+{
+    struct hfspmount * hmp;
+    u_int64_t blocks, have;
+    int error;
+
+    // As for the btree transactions, see hfsp_bttx_begin().
+    hmp = ip->hi_mount;
+    if (hmp->hm_journal != NULL || hmp->hm_cp == NULL || hmp->hm_cp->acw == 0 ||
+        ((hmp->hm_flags & HFSP_MNT_JOURNALED) && hmp->hm_jwriter == NULL))
+        return EROFS;
+
+    blocks = howmany(size, hmp->hm_blockSize);
+    have = (u_int64_t)ip->hi_fork.totalBlocks + ip->hi_delayed;
+    if (blocks <= have)
+        return 0;
+    if (blocks - have > hmp->hm_totalBlocks)
+        return ENOSPC;
+
+    error = hfsp_bitmap_reserve(hmp, blocks - have);
+    if (error == 0)
+        ip->hi_delayed += blocks - have;
+    return error;
+}
+
+int
+hfsp_alloc_assign(struct hfsp_inode * ip)
+{
+    struct hfspmount * hmp;
+    struct hfsp_fork * forkp;
+    struct hfsp_extent_descriptor * ep;
+    u_int32_t clump, total, extra, need, used, got, keep, goal, start, count, mapped;
+    int error, ioerror, n, flags;
+
+    hmp = ip->hi_mount;
+    forkp = &ip->hi_fork;
+    if (ip->hi_delayed == 0)
+        return 0;
+
+    // The end of a fork listed in the extents overflow file can not be grown.
+    for (n = 0, mapped = 0; n < HFSP_FIRSTEXTENT_SIZE && forkp->first_extents[n].blockCount != 0; n++)
+        mapped += forkp->first_extents[n].blockCount;
+    if (mapped != forkp->totalBlocks)
+    {
+        atomic_add_long(&hfsp_alloc_overflows, 1);
+        return EFBIG;
+    }
+    ep = n > 0 ? &forkp->first_extents[n - 1] : NULL;
+
+    // Grow to a whole clump while the blocks are free, the next writes then
+    // extend the last extent. A fork growing again is given as many blocks as
+    // it has, a long sequential write takes a few extents only.
+    clump = howmany(forkp->clumpSize != 0 ? forkp->clumpSize : hmp->hm_dataClumpSize, hmp->hm_blockSize);
+    total = forkp->totalBlocks + ip->hi_delayed;
+    extra = clump > 1 ? roundup(total, clump) - total : 0;
+    extra = MAX(extra, MIN(forkp->totalBlocks, hfsp_alloc_prealloc / hmp->hm_blockSize));
+    if (extra != 0 && hfsp_bitmap_reserve(hmp, extra) != 0)
+        extra = 0;
+    need = ip->hi_delayed + extra;
+
+    if (hmp->hm_jwriter != NULL && (error = hfsp_jwrite_begin(hmp)) != 0)
+    {
+        hfsp_bitmap_unreserve(hmp, extra);
+        return error;
+    }
+
+    error = 0;
+    ioerror = 0;
+    used = 0;
+    got = 0;
+    while (got < need)
+    {
+        // Past the last extent first, the fork keeps its number of extents.
+        goal = ep != NULL ? ep->startBlock + ep->blockCount : hmp->hm_nextAllocation;
+        flags = ep != NULL || n == HFSP_FIRSTEXTENT_SIZE ? HFSP_BITMAP_ATGOAL : 0;
+        error = hfsp_bitmap_alloc(hmp, goal, need - got, flags, &start, &count);
+        if (error == ENOSPC && flags != 0 && n < HFSP_FIRSTEXTENT_SIZE)
+            error = hfsp_bitmap_alloc(hmp, hmp->hm_nextAllocation, need - got, 0, &start, &count);
+        else if (error == ENOSPC && flags != 0)
+        {
+            // The extents overflow file is not written.
+            atomic_add_long(&hfsp_alloc_overflows, 1);
+            error = EFBIG;
+        }
+        if (error)
+            break;
+
+        used += count;
+        error = hfsp_bitmap_mark(hmp, start, count, 1);
+        if (error)
+        {
+            hfsp_bitmap_dealloc(hmp, start, count);
+            ioerror = error;
+            break;
+        }
+
+        if (ep != NULL && ep->startBlock + ep->blockCount == start)
+        {
+            ep->blockCount += count;
+            atomic_add_long(&hfsp_alloc_inplace, 1);
+        }
+        else
+        {
+            ep = &forkp->first_extents[n++];
+            ep->startBlock = start;
+            ep->blockCount = count;
+            atomic_add_long(&hfsp_alloc_extents, 1);
+        }
+        got += count;
+        hmp->hm_nextAllocation = start + count;
+    }
+
+    if (hmp->hm_jwriter != NULL)
+        hfsp_jwrite_end(hmp, ioerror);
+
+    // What the writes still need stays reserved, the rest of the clump does not.
+    forkp->totalBlocks += got;
+    keep = MIN(got < ip->hi_delayed ? ip->hi_delayed - got : 0, need - used);
+    hfsp_bitmap_unreserve(hmp, need - used - keep);
+    ip->hi_delayed = keep;
+
+    atomic_add_long(&hfsp_alloc_assigns, 1);
+    atomic_add_long(&hfsp_alloc_blocks, got);
+    if (error)
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_alloc_assign: Fork of %ju has %ju blocks left to allocate, error %jd.",
+                   ip->hi_cnid, keep, error);
+    return error;
+}
+
+void
+hfsp_alloc_release(struct hfsp_inode * ip)
+{
+    if (ip->hi_delayed == 0)
+        return;
+    hfsp_bitmap_unreserve(ip->hi_mount, ip->hi_delayed);
+    ip->hi_delayed = 0;
+}
@@ -0,0 +1,37 @@
+#include <sys/param.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_ALLOC_H_
+#define _HFSP_ALLOC_H_
+
+/*
+ * Reserve the blocks a fork needs to grow to a size. The blocks are only
+ * chosen by hfsp_alloc_assign(), once the writes buffered so far are known,
+ * so they land in as few extents as possible.
+ * ip: The inode of the fork, locked exclusively.
+ * size: The size of the fork in bytes once written.
+ * Return ENOSPC if not enough blocks are free, EAGAIN if the free extents are
+ * not indexed, the volume is then mounted without bitmap, EROFS if the
+ * volume can not be written.
+ */
+int hfsp_alloc_reserve(struct hfsp_inode * ip, u_int64_t size);
+
+/*
+ * Allocate the blocks reserved for a fork and add them to its extents, in
+ * memory only. The fork grows to a whole clump while the blocks are free, the
+ * runs are taken after its last extent first, then near the next allocation
+ * of the volume. The bits of the allocation file are logged in an operation
+ * of the journal, the caller must not hold one.
+ * ip: The inode of the fork, locked exclusively.
+ * Return EFBIG if the fork would need more extents than its first eight, the
+ * blocks not allocated stay reserved.
+ */
+int hfsp_alloc_assign(struct hfsp_inode * ip);
+
+/*
+ * Give back the blocks reserved for a fork and not allocated.
+ */
+void hfsp_alloc_release(struct hfsp_inode * ip);
+
+#endif /* _HFSP_ALLOC_H_ */
@@ -0,0 +1,254 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+
+#include "hfsp.h"
+#include "hfsp_btree.h"
+#include "hfsp_attr.h"
+#include "hfsp_link.h"
+#include "hfsp_name.h"
+#include "hfsp_unicode.h"
+
+MALLOC_DEFINE(M_HFSPATTR, "hfsp_attr", "HFS+ attribute cache");
+
+/*
+ * A catalogue record seen by readdir. Like the hard link cache the record is a
+ * detached copy holding a reference on its interned name. Links keep their own
+ * record, they are resolved when the vnode is built.
+ */
+struct hfsp_attrentry {
+    LIST_ENTRY(hfsp_attrentry)  hae_name;
+    LIST_ENTRY(hfsp_attrentry)  hae_cnid;
+    TAILQ_ENTRY(hfsp_attrentry) hae_lru;
+    u_int32_t                   hae_hash;
+    u_int16_t                   hae_flags;
+    struct hfsp_record          hae_rec;
+};
+
+/* hae_flags */
+#define HFSP_ATTR_BYCNID        0x0001  /* On the CNID hash */
+
+static u_int hfsp_attrcache_max = 8192;
+SYSCTL_UINT(_vfs_hfsp, OID_AUTO, attrcache_max, CTLFLAG_RW, &hfsp_attrcache_max, 0,
+            "Maximum number of records primed by readdir per mount, 0 to disable");
+
+static u_long hfsp_attrcache_hits;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, attrcache_hits, CTLFLAG_RD, &hfsp_attrcache_hits, 0,
+             "Lookups and vget served from primed records");
+
+static u_long hfsp_attrcache_primed;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, attrcache_primed, CTLFLAG_RD, &hfsp_attrcache_primed, 0,
+             "Records primed by readdir");
+
+#define HFSP_ATTRNAMEHASH(acp, h)       (&(acp)->hac_byName[(h) & (acp)->hac_nameMask])
+#define HFSP_ATTRCNIDHASH(acp, cnid)    (&(acp)->hac_byCnid[(cnid) & (acp)->hac_cnidMask])
+
+/*
+ * Hash of a key, the hash of the name is the one of the name table.
+ */
+static __inline u_int32_t
+hfsp_attr_hash(hfsp_cnid parent, u_int32_t nameHash)
+{
+    return nameHash ^ (parent * 0x9E3779B1U);
+}
+
+void
+hfsp_attrcache_init(struct hfsp_attrcache * acp)
+{
+    mtx_init(&acp->hac_mtx, "hfsp_attrs", NULL, MTX_DEF);
+    acp->hac_byName = hashinit(1024, M_HFSPATTR, &acp->hac_nameMask);
+    acp->hac_byCnid = hashinit(1024, M_HFSPATTR, &acp->hac_cnidMask);
+    TAILQ_INIT(&acp->hac_lru);
+    acp->hac_count = 0;
+}
+
+/*
+ * Unhook an entry, the caller releases its name and frees or reuses it.
+ */
+static void
+hfsp_attrentry_remove(struct hfsp_attrcache * acp, struct hfsp_attrentry * aep)
+{
+    mtx_assert(&acp->hac_mtx, MA_OWNED);
+    TAILQ_REMOVE(&acp->hac_lru, aep, hae_lru);
+    LIST_REMOVE(aep, hae_name);
+    if (aep->hae_flags & HFSP_ATTR_BYCNID)
+        LIST_REMOVE(aep, hae_cnid);
+    aep->hae_flags = 0;
+    acp->hac_count--;
+}
+
+void
+hfsp_attrcache_destroy(struct hfspmount * hmp)
+{
+    struct hfsp_attrcache * acp;
+    struct hfsp_attrentry * aep;
+
+    acp = &hmp->hm_attrs;
+    mtx_lock(&acp->hac_mtx);
+    while ((aep = TAILQ_FIRST(&acp->hac_lru)) != NULL)
+    {
+        hfsp_attrentry_remove(acp, aep);
+        hfsp_name_release(&hmp->hm_names, aep->hae_rec.hr_key.hk_name);
+        free(aep, M_HFSPATTR);
+    }
+    mtx_unlock(&acp->hac_mtx);
+    hashdestroy(acp->hac_byName, M_HFSPATTR, acp->hac_nameMask);
+    hashdestroy(acp->hac_byCnid, M_HFSPATTR, acp->hac_cnidMask);
+    mtx_destroy(&acp->hac_mtx);
+}
+
+static struct hfsp_attrentry *
+hfsp_attr_find(struct hfsp_attrcache * acp, u_int32_t hash, hfsp_cnid parent,
+               const hfsp_unichar * str, int len)
+{
+    struct hfsp_attrentry * aep;
+    struct hfsp_record_key * kp;
+
+    mtx_assert(&acp->hac_mtx, MA_OWNED);
+    LIST_FOREACH(aep, HFSP_ATTRNAMEHASH(acp, hash), hae_name)
+    {
+        kp = &aep->hae_rec.hr_key;
+        if (aep->hae_hash == hash && kp->hk_cnid == parent &&
+            hfsp_unicode_cmp(kp->hk_nameStr, kp->hk_nameLen, str, len) == 0)
+            return aep;
+    }
+    return NULL;
+}
+
+void
+hfsp_attr_prime(struct hfspmount * hmp, struct hfsp_record * rp)
+{
+    struct hfsp_attrcache * acp;
+    struct hfsp_attrentry * aep;
+    struct hfsp_name * oldName, * namep;
+    u_int32_t hash;
+
+    namep = rp->hr_key.hk_name;
+    if (hfsp_attrcache_max == 0 || namep == NULL ||
+        (rp->hr_type != HFSP_FOLDER_RECORD && rp->hr_type != HFSP_FILE_RECORD))
+        return;
+
+    acp = &hmp->hm_attrs;
+    hash = hfsp_attr_hash(rp->hr_parentCnid, namep->hna_hash);
+    oldName = NULL;
+
+    mtx_lock(&acp->hac_mtx);
+    aep = hfsp_attr_find(acp, hash, rp->hr_parentCnid, namep->hna_str, namep->hna_len);
+    if (aep != NULL)
+    {
+        // Listed again, the record can not have changed on a read only volume.
+        TAILQ_REMOVE(&acp->hac_lru, aep, hae_lru);
+        TAILQ_INSERT_TAIL(&acp->hac_lru, aep, hae_lru);
+        mtx_unlock(&acp->hac_mtx);
+        return;
+    }
+
+    // Past the limit the least recently used entry is recycled.
+    if (acp->hac_count >= hfsp_attrcache_max && (aep = TAILQ_FIRST(&acp->hac_lru)) != NULL)
+    {
+        hfsp_attrentry_remove(acp, aep);
+        oldName = aep->hae_rec.hr_key.hk_name;
+    }
+    else
+    {
+        aep = malloc(sizeof(*aep), M_HFSPATTR, M_NOWAIT);
+        if (aep == NULL)
+        {
+            mtx_unlock(&acp->hac_mtx);
+            return;
+        }
+    }
+
+    aep->hae_hash = hash;
+    aep->hae_flags = 0;
+    aep->hae_rec = *rp;
+    aep->hae_rec.hr_node = NULL;
+    aep->hae_rec.hr_flags = 0;
+    aep->hae_rec.hr_key.hk_name = hfsp_name_ref(namep);
+    aep->hae_rec.hr_key.hk_nameStr = namep->hna_str;
+
+    LIST_INSERT_HEAD(HFSP_ATTRNAMEHASH(acp, hash), aep, hae_name);
+    // The CNID of a link is the one of the link record, not of the indirect node.
+    if (!HFSP_RECORD_IS_HARDLINK(rp) && !HFSP_RECORD_IS_DIRLINK(rp))
+    {
+        LIST_INSERT_HEAD(HFSP_ATTRCNIDHASH(acp, rp->hr_cnid), aep, hae_cnid);
+        aep->hae_flags |= HFSP_ATTR_BYCNID;
+    }
+    TAILQ_INSERT_TAIL(&acp->hac_lru, aep, hae_lru);
+    acp->hac_count++;
+    mtx_unlock(&acp->hac_mtx);
+
+    if (oldName != NULL)
+        hfsp_name_release(&hmp->hm_names, oldName);
+    atomic_add_long(&hfsp_attrcache_primed, 1);
+}
+
+/*
+ * Copy out a cached record, taking a reference on its name.
+ */
+static int
+hfsp_attr_copyout(struct hfspmount * hmp, struct hfsp_attrentry * aep, struct hfsp_record ** rpp)
+{
+    struct hfsp_attrcache * acp;
+    struct hfsp_record rec;
+
+    acp = &hmp->hm_attrs;
+    mtx_assert(&acp->hac_mtx, MA_OWNED);
+    if (aep == NULL)
+    {
+        mtx_unlock(&acp->hac_mtx);
+        return ENOENT;
+    }
+
+    TAILQ_REMOVE(&acp->hac_lru, aep, hae_lru);
+    TAILQ_INSERT_TAIL(&acp->hac_lru, aep, hae_lru);
+    rec = aep->hae_rec;
+    hfsp_name_ref(rec.hr_key.hk_name);
+    mtx_unlock(&acp->hac_mtx);
+
+    *rpp = hfsp_brec_alloc();
+    **rpp = rec;
+    atomic_add_long(&hfsp_attrcache_hits, 1);
+    return 0;
+}
+
+int
+hfsp_attr_lookup(struct hfspmount * hmp, struct hfsp_record_key * kp, struct hfsp_record ** rpp)
+{
+    struct hfsp_attrcache * acp;
+    struct hfsp_attrentry * aep;
+    u_int32_t hash;
+
+    acp = &hmp->hm_attrs;
+    if (acp->hac_count == 0)
+        return ENOENT;
+
+    hash = hfsp_attr_hash(kp->hk_cnid, hfsp_name_hash(kp->hk_nameStr, kp->hk_nameLen));
+    mtx_lock(&acp->hac_mtx);
+    aep = hfsp_attr_find(acp, hash, kp->hk_cnid, kp->hk_nameStr, kp->hk_nameLen);
+    return hfsp_attr_copyout(hmp, aep, rpp);
+}
+
+int
+hfsp_attr_get(struct hfspmount * hmp, hfsp_cnid cnid, struct hfsp_record ** rpp)
+{
+    struct hfsp_attrcache * acp;
+    struct hfsp_attrentry * aep;
+
+    acp = &hmp->hm_attrs;
+    if (acp->hac_count == 0)
+        return ENOENT;
+
+    mtx_lock(&acp->hac_mtx);
+    LIST_FOREACH(aep, HFSP_ATTRCNIDHASH(acp, cnid), hae_cnid)
+    {
+        if (aep->hae_rec.hr_cnid == cnid)
+            break;
+    }
+    return hfsp_attr_copyout(hmp, aep, rpp);
+}
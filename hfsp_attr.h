@@ -0,0 +1,50 @@
+#include <sys/param.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_ATTR_H_
+#define _HFSP_ATTR_H_
+
+MALLOC_DECLARE(M_HFSPATTR);
+
+/*
+ * Initialize the attribute cache of a mount.
+ */
+void hfsp_attrcache_init(struct hfsp_attrcache * acp);
+
+/*
+ * Empty and destroy the attribute cache of a mount.
+ * Must be called before the name table is destroyed.
+ */
+void hfsp_attrcache_destroy(struct hfspmount * hmp);
+
+/*
+ * Remember a folder or file record seen while reading a folder, so the lookup
+ * and the stat that usually follow do not read the catalogue again. Must be
+ * called before the hard links are resolved.
+ * hmp: The mount.
+ * rp: A record read from a leaf node.
+ */
+void hfsp_attr_prime(struct hfspmount * hmp, struct hfsp_record * rp);
+
+/*
+ * Find a record by its key.
+ * hmp: The mount.
+ * kp: Parent and name of the record.
+ * rpp: Address of a pointer that will point to a copy of the record on exit,
+ *      to release with hfsp_brec_release_record().
+ * Return 0 on success, ENOENT if the record is not cached.
+ */
+int hfsp_attr_lookup(struct hfspmount * hmp, struct hfsp_record_key * kp, struct hfsp_record ** rpp);
+
+/*
+ * Find a record by its CNID. Hard links are only found by key.
+ * hmp: The mount.
+ * cnid: The CNID of the folder or file.
+ * rpp: Address of a pointer that will point to a copy of the record on exit,
+ *      to release with hfsp_brec_release_record().
+ * Return 0 on success, ENOENT if the record is not cached.
+ */
+int hfsp_attr_get(struct hfspmount * hmp, hfsp_cnid cnid, struct hfsp_record ** rpp);
+
+#endif /* _HFSP_ATTR_H_ */
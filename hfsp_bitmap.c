@@ -0,0 +1,658 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/sx.h>
+#include <sys/malloc.h>
+#include <sys/buf.h>
+#include <sys/conf.h>
+#include <sys/endian.h>
+#include <sys/sysctl.h>
+#include <sys/syslog.h>
+#include <sys/taskqueue.h>
+#include <sys/tree.h>
+
+#include "hfsp.h"
+#include "hfsp_bitmap.h"
+#include "hfsp_jwrite.h"
+#include "hfsp_trace.h"
+
+MALLOC_DEFINE(M_HFSPBITMAP, "hfsp_bitmap", "HFS+ free extents");
+
+static u_int hfsp_bitmap_maxextents = 1024 * 1024;
+SYSCTL_UINT(_vfs_hfsp, OID_AUTO, bitmap_maxextents, CTLFLAG_RW, &hfsp_bitmap_maxextents, 0,
+            "Most free extents indexed per volume, only the free blocks are counted above");
+
+static u_int hfsp_bitmap_scan = 16;
+SYSCTL_UINT(_vfs_hfsp, OID_AUTO, bitmap_scan, CTLFLAG_RW, &hfsp_bitmap_scan, 0,
+            "Free extents past the goal tried before the best fit");
+
+static int
+hfsp_fext_start_cmp(struct hfsp_fextent * l, struct hfsp_fextent * r)
+{
+    return l->hfe_start < r->hfe_start ? -1 : l->hfe_start > r->hfe_start;
+}
+
+static int
+hfsp_fext_size_cmp(struct hfsp_fextent * l, struct hfsp_fextent * r)
+{
+    if (l->hfe_count != r->hfe_count)
+        return l->hfe_count < r->hfe_count ? -1 : 1;
+    return hfsp_fext_start_cmp(l, r);
+}
+
+RB_GENERATE_STATIC(hfsp_fext_start, hfsp_fextent, hfe_byStart, hfsp_fext_start_cmp);
+RB_GENERATE_STATIC(hfsp_fext_size, hfsp_fextent, hfe_bySize, hfsp_fext_size_cmp);
+
+/* Extents and count being built, the index is published once complete */
+struct hfsp_bitmap_build {
+    struct hfsp_fext_start      hbb_byStart;
+    struct hfsp_fext_size       hbb_bySize;
+    u_int64_t                   hbb_free;
+    u_int32_t                   hbb_extents;
+    u_int32_t                   hbb_largest;
+    u_int32_t                   hbb_runStart;
+    int                         hbb_inRun;
+    int                         hbb_indexed;
+};
+
+static void
+hfsp_bitmap_free_tree(struct hfsp_fext_start * byStart)
+{
+    struct hfsp_fextent * fep, * nfep;
+
+    RB_FOREACH_SAFE(fep, hfsp_fext_start, byStart, nfep)
+    {
+        RB_REMOVE(hfsp_fext_start, byStart, fep);
+        free(fep, M_HFSPBITMAP);
+    }
+}
+
+static void
+hfsp_bitmap_add(struct hfsp_bitmap_build * bbp, u_int32_t start, u_int32_t count)
+{
+    struct hfsp_fextent * fep;
+
+    bbp->hbb_largest = max(bbp->hbb_largest, count);
+    if (!bbp->hbb_indexed)
+        return;
+
+    // Too fragmented, keep counting without the index.
+    if (bbp->hbb_extents == hfsp_bitmap_maxextents)
+    {
+        hfsp_bitmap_free_tree(&bbp->hbb_byStart);
+        RB_INIT(&bbp->hbb_bySize);
+        bbp->hbb_indexed = 0;
+        return;
+    }
+
+    fep = malloc(sizeof(*fep), M_HFSPBITMAP, M_WAITOK);
+    fep->hfe_start = start;
+    fep->hfe_count = count;
+    RB_INSERT(hfsp_fext_start, &bbp->hbb_byStart, fep);
+    RB_INSERT(hfsp_fext_size, &bbp->hbb_bySize, fep);
+    bbp->hbb_extents++;
+}
+
+/*
+ * Count the free blocks of 64 bits of the bitmap and extend the free runs.
+ * Allocated blocks have their bit set, the first block is the high bit.
+ */
+static void
+hfsp_bitmap_word(struct hfsp_bitmap_build * bbp, u_int64_t w, u_int32_t base)
+{
+    u_int64_t rest;
+    int bit;
+
+    bbp->hbb_free += 64 - bitcount64(w);
+
+    // Whole words first, they are most of a bitmap.
+    if (w == 0)
+    {
+        if (!bbp->hbb_inRun)
+        {
+            bbp->hbb_runStart = base;
+            bbp->hbb_inRun = 1;
+        }
+        return;
+    }
+    if (w == ~0ULL && !bbp->hbb_inRun)
+        return;
+
+    for (bit = 0; bit < 64; )
+    {
+        if (bbp->hbb_inRun)
+        {
+            // End of the run at the next allocated block.
+            rest = w << bit;
+            if (rest == 0)
+                break;
+            bit += __builtin_clzll(rest);
+            hfsp_bitmap_add(bbp, bbp->hbb_runStart, base + bit - bbp->hbb_runStart);
+            bbp->hbb_inRun = 0;
+        }
+        else
+        {
+            rest = ~w << bit;
+            if (rest == 0)
+                break;
+            bit += __builtin_clzll(rest);
+            bbp->hbb_runStart = base + bit;
+            bbp->hbb_inRun = 1;
+        }
+    }
+}
+
+/*
+ * Stream the allocation file with reads of a whole buffer and build the free
+ * extents.
+ */
+static int
+hfsp_bitmap_read(struct hfspmount * hmp, struct hfsp_bitmap * bmp, struct hfsp_bitmap_build * bbp)
+{
+    u_int8_t * buf;
+    u_int64_t size, offset, w;
+    u_int32_t block, nbits;
+    int error, chunk, i;
+
+    size = howmany((u_int64_t)hmp->hm_totalBlocks, NBBY);
+    if (size > bmp->hbm_ip->hi_fork.size)
+        return EINVAL;
+
+    buf = malloc(MAXBSIZE, M_TEMP, M_WAITOK);
+    error = 0;
+    block = 0;
+    for (offset = 0; offset < size; offset += chunk)
+    {
+        chunk = MIN(size - offset, MAXBSIZE);
+        error = hfsp_read_inode(bmp->hbm_ip, offset, chunk, buf);
+        if (error)
+            break;
+
+        // The bits past the last block are counted as allocated.
+        for (i = chunk; i % sizeof(w) != 0; i++)
+            buf[i] = 0xff;
+
+        for (i = 0; i < chunk; i += sizeof(w), block += 64)
+        {
+            w = be64dec(buf + i);
+            nbits = hmp->hm_totalBlocks - block;
+            if (nbits < 64)
+                w |= ~0ULL >> nbits;
+            hfsp_bitmap_word(bbp, w, block);
+        }
+    }
+    free(buf, M_TEMP);
+
+    if (error == 0 && bbp->hbb_inRun)
+        hfsp_bitmap_add(bbp, bbp->hbb_runStart, hmp->hm_totalBlocks - bbp->hbb_runStart);
+    return error;
+}
+
+static void
+hfsp_bitmap_task(void * arg, int pending)
+{
+    struct hfspmount * hmp;
+    struct hfsp_bitmap * bmp;
+    struct hfsp_bitmap_build bb;
+    int error;
+
+    hmp = arg;
+    bmp = hmp->hm_bitmap;
+    bzero(&bb, sizeof(bb));
+    RB_INIT(&bb.hbb_byStart);
+    RB_INIT(&bb.hbb_bySize);
+    bb.hbb_indexed = 1;
+
+    error = hfsp_bitmap_read(hmp, bmp, &bb);
+    if (error)
+    {
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_bitmap_task: Allocation file not read, error %jd.", error);
+        hfsp_bitmap_free_tree(&bb.hbb_byStart);
+        return;
+    }
+
+    if ((bmp->hbm_flags & HFSP_BITMAP_VERIFY) && bb.hbb_free != hmp->hm_freeBlocks)
+        log(LOG_WARNING, "hfsp: %s: %ju free blocks in the allocation file, %u in the volume header\n",
+            devtoname(hmp->hm_dev), (uintmax_t)bb.hbb_free, hmp->hm_freeBlocks);
+
+    mtx_lock(&bmp->hbm_mtx);
+    bmp->hbm_byStart = bb.hbb_byStart;
+    bmp->hbm_bySize = bb.hbb_bySize;
+    bmp->hbm_free = bb.hbb_free;
+    bmp->hbm_extents = bb.hbb_extents;
+    bmp->hbm_largest = bb.hbb_largest;
+    bmp->hbm_flags |= HFSP_BITMAP_READY | (bb.hbb_indexed ? HFSP_BITMAP_INDEXED : 0);
+    mtx_unlock(&bmp->hbm_mtx);
+
+    HFSP_TRACE(HFSP_TRACE_INFO, "hfsp_bitmap_task: %ju free blocks in %ju extents, largest %ju.",
+               bb.hbb_free, bb.hbb_extents, bb.hbb_largest);
+}
+
+int
+hfsp_bitmap_mount(struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph, int verify)
+{
+    struct hfsp_bitmap * bmp;
+    int error;
+
+    bmp = malloc(sizeof(*bmp), M_HFSPBITMAP, M_WAITOK | M_ZERO);
+    error = hfsp_iget(hmp, &hfsph->allocationFile, &bmp->hbm_ip);
+    if (error)
+    {
+        free(bmp, M_HFSPBITMAP);
+        return error;
+    }
+    // Special file use the device vnode
+    bmp->hbm_ip->hi_vp = hmp->hm_devvp;
+    mtx_init(&bmp->hbm_mtx, "hfsp_bitmap", NULL, MTX_DEF);
+    sx_init(&bmp->hbm_markLock, "hfsp_bitmap_mark");
+    RB_INIT(&bmp->hbm_byStart);
+    RB_INIT(&bmp->hbm_bySize);
+    if (verify)
+        bmp->hbm_flags |= HFSP_BITMAP_VERIFY;
+
+    hmp->hm_bitmap = bmp;
+    TASK_INIT(&bmp->hbm_task, 0, hfsp_bitmap_task, hmp);
+    taskqueue_enqueue(hfsp_taskqueue, &bmp->hbm_task);
+    return 0;
+}
+
+void
+hfsp_bitmap_unmount(struct hfspmount * hmp)
+{
+    struct hfsp_bitmap * bmp;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL)
+        return;
+
+    taskqueue_drain(hfsp_taskqueue, &bmp->hbm_task);
+    hfsp_bitmap_free_tree(&bmp->hbm_byStart);
+    hfsp_irelease(bmp->hbm_ip);
+    sx_destroy(&bmp->hbm_markLock);
+    mtx_destroy(&bmp->hbm_mtx);
+    free(bmp, M_HFSPBITMAP);
+    hmp->hm_bitmap = NULL;
+}
+
+void
+hfsp_bitmap_stat(struct hfspmount * hmp, u_int32_t * freep, u_int32_t * largestp)
+{
+    struct hfsp_bitmap * bmp;
+
+    *freep = hmp->hm_freeBlocks;
+    if (largestp != NULL)
+        *largestp = 0;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL)
+        return;
+    mtx_lock(&bmp->hbm_mtx);
+    if (bmp->hbm_flags & HFSP_BITMAP_READY)
+    {
+        *freep = bmp->hbm_free - bmp->hbm_reserved;
+        if (largestp != NULL)
+            *largestp = bmp->hbm_largest;
+    }
+    mtx_unlock(&bmp->hbm_mtx);
+}
+
+/*
+ * Free extent holding a block, or the next one. Called with hbm_mtx held.
+ */
+static struct hfsp_fextent *
+hfsp_bitmap_lookup(struct hfsp_bitmap * bmp, u_int32_t block)
+{
+    struct hfsp_fextent key, * fep, * pfep;
+
+    // The extent starting before the block may hold it.
+    key.hfe_start = block;
+    fep = RB_NFIND(hfsp_fext_start, &bmp->hbm_byStart, &key);
+    pfep = fep != NULL ? RB_PREV(hfsp_fext_start, &bmp->hbm_byStart, fep) :
+                         RB_MAX(hfsp_fext_start, &bmp->hbm_byStart);
+    if (pfep != NULL && pfep->hfe_start + pfep->hfe_count > block)
+        fep = pfep;
+    return fep;
+}
+
+int
+hfsp_bitmap_next_free(struct hfspmount * hmp, u_int32_t block, u_int32_t * startp, u_int32_t * countp)
+{
+    struct hfsp_bitmap * bmp;
+    struct hfsp_fextent * fep;
+    int error;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL)
+        return EAGAIN;
+
+    mtx_lock(&bmp->hbm_mtx);
+    if (!(bmp->hbm_flags & HFSP_BITMAP_INDEXED))
+    {
+        mtx_unlock(&bmp->hbm_mtx);
+        return EAGAIN;
+    }
+
+    fep = hfsp_bitmap_lookup(bmp, block);
+    error = ENOENT;
+    if (fep != NULL)
+    {
+        *startp = fep->hfe_start;
+        *countp = fep->hfe_count;
+        error = 0;
+    }
+    mtx_unlock(&bmp->hbm_mtx);
+    return error;
+}
+
+int
+hfsp_bitmap_find_fit(struct hfspmount * hmp, u_int32_t count, u_int32_t * startp, u_int32_t * countp)
+{
+    struct hfsp_bitmap * bmp;
+    struct hfsp_fextent key, * fep;
+    int error;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL)
+        return EAGAIN;
+
+    key.hfe_count = count;
+    key.hfe_start = 0;
+    mtx_lock(&bmp->hbm_mtx);
+    if (!(bmp->hbm_flags & HFSP_BITMAP_INDEXED))
+    {
+        mtx_unlock(&bmp->hbm_mtx);
+        return EAGAIN;
+    }
+
+    error = ENOSPC;
+    fep = RB_NFIND(hfsp_fext_size, &bmp->hbm_bySize, &key);
+    if (fep != NULL)
+    {
+        *startp = fep->hfe_start;
+        *countp = fep->hfe_count;
+        error = 0;
+    }
+    mtx_unlock(&bmp->hbm_mtx);
+    return error;
+}
+
+int
+hfsp_bitmap_reserve(struct hfspmount * hmp, u_int32_t count)
+{
+    struct hfsp_bitmap * bmp;
+    int error;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL)
+        return EAGAIN;
+
+    mtx_lock(&bmp->hbm_mtx);
+    if (!(bmp->hbm_flags & HFSP_BITMAP_INDEXED))
+        error = EAGAIN;
+    else if (bmp->hbm_free - bmp->hbm_reserved < count)
+        error = ENOSPC;
+    else
+    {
+        bmp->hbm_reserved += count;
+        error = 0;
+    }
+    mtx_unlock(&bmp->hbm_mtx);
+    return error;
+}
+
+void
+hfsp_bitmap_unreserve(struct hfspmount * hmp, u_int32_t count)
+{
+    struct hfsp_bitmap * bmp;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL || count == 0)
+        return;
+
+    mtx_lock(&bmp->hbm_mtx);
+    bmp->hbm_reserved -= MIN(count, bmp->hbm_reserved);
+    mtx_unlock(&bmp->hbm_mtx);
+}
+
+static u_int32_t
+hfsp_bitmap_largest(struct hfsp_bitmap * bmp)
+{
+    struct hfsp_fextent * fep;
+
+    fep = RB_MAX(hfsp_fext_size, &bmp->hbm_bySize);
+    return fep != NULL ? fep->hfe_count : 0;
+}
+
+/*
+ * Remove a run from the free extent holding it. Called with hbm_mtx held.
+ * sparep: Extent used if the run splits the extent in two, set to NULL then.
+ */
+static void
+hfsp_bitmap_take(struct hfsp_bitmap * bmp, struct hfsp_fextent * fep, u_int32_t start, u_int32_t count,
+                 struct hfsp_fextent ** sparep)
+{
+    struct hfsp_fextent * nfep;
+    u_int32_t end;
+
+    end = fep->hfe_start + fep->hfe_count;
+    RB_REMOVE(hfsp_fext_size, &bmp->hbm_bySize, fep);
+    if (start == fep->hfe_start && start + count == end)
+    {
+        RB_REMOVE(hfsp_fext_start, &bmp->hbm_byStart, fep);
+        free(fep, M_HFSPBITMAP);
+        bmp->hbm_extents--;
+        return;
+    }
+
+    // The extent keeps its place by first block, the free runs do not overlap.
+    if (start == fep->hfe_start)
+    {
+        fep->hfe_start = start + count;
+        fep->hfe_count = end - fep->hfe_start;
+    }
+    else
+    {
+        fep->hfe_count = start - fep->hfe_start;
+        if (start + count < end)
+        {
+            nfep = *sparep;
+            *sparep = NULL;
+            nfep->hfe_start = start + count;
+            nfep->hfe_count = end - nfep->hfe_start;
+            RB_INSERT(hfsp_fext_start, &bmp->hbm_byStart, nfep);
+            RB_INSERT(hfsp_fext_size, &bmp->hbm_bySize, nfep);
+            bmp->hbm_extents++;
+        }
+    }
+    RB_INSERT(hfsp_fext_size, &bmp->hbm_bySize, fep);
+}
+
+int
+hfsp_bitmap_alloc(struct hfspmount * hmp, u_int32_t goal, u_int32_t count, int flags, u_int32_t * startp,
+                  u_int32_t * countp)
+{
+    struct hfsp_bitmap * bmp;
+    struct hfsp_fextent key, * fep, * spare;
+    u_int32_t start, got;
+    u_int i;
+    int error;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL)
+        return EAGAIN;
+    if (count == 0)
+        return EINVAL;
+
+    spare = malloc(sizeof(*spare), M_HFSPBITMAP, M_WAITOK);
+    mtx_lock(&bmp->hbm_mtx);
+    if (!(bmp->hbm_flags & HFSP_BITMAP_INDEXED))
+    {
+        error = EAGAIN;
+        goto out;
+    }
+
+    error = ENOSPC;
+    start = goal;
+    fep = hfsp_bitmap_lookup(bmp, goal);
+    if (flags & HFSP_BITMAP_ATGOAL)
+    {
+        if (fep == NULL || fep->hfe_start > goal)
+            goto out;
+    }
+    else if (fep == NULL || fep->hfe_start > goal || fep->hfe_start + fep->hfe_count - goal < count)
+    {
+        // Near the goal first, the volume fills up from its start.
+        for (i = 0; fep != NULL && fep->hfe_count < count && i < hfsp_bitmap_scan; i++)
+            fep = RB_NEXT(hfsp_fext_start, &bmp->hbm_byStart, fep);
+        if (fep == NULL || fep->hfe_count < count)
+        {
+            key.hfe_count = count;
+            key.hfe_start = 0;
+            fep = RB_NFIND(hfsp_fext_size, &bmp->hbm_bySize, &key);
+        }
+        if (fep == NULL)
+            fep = RB_MAX(hfsp_fext_size, &bmp->hbm_bySize);
+        if (fep == NULL)
+            goto out;
+        start = fep->hfe_start;
+    }
+
+    got = MIN(count, fep->hfe_start + fep->hfe_count - start);
+    hfsp_bitmap_take(bmp, fep, start, got, &spare);
+    bmp->hbm_free -= got;
+    bmp->hbm_reserved -= MIN(got, bmp->hbm_reserved);
+    bmp->hbm_largest = hfsp_bitmap_largest(bmp);
+    *startp = start;
+    *countp = got;
+    error = 0;
+out:
+    mtx_unlock(&bmp->hbm_mtx);
+    if (spare != NULL)
+        free(spare, M_HFSPBITMAP);
+    return error;
+}
+
+void
+hfsp_bitmap_dealloc(struct hfspmount * hmp, u_int32_t start, u_int32_t count)
+{
+    struct hfsp_bitmap * bmp;
+    struct hfsp_fextent key, * fep, * pfep, * nfep;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL || count == 0)
+        return;
+
+    nfep = malloc(sizeof(*nfep), M_HFSPBITMAP, M_WAITOK);
+    mtx_lock(&bmp->hbm_mtx);
+    if (!(bmp->hbm_flags & HFSP_BITMAP_INDEXED))
+        goto out;
+
+    key.hfe_start = start;
+    fep = RB_NFIND(hfsp_fext_start, &bmp->hbm_byStart, &key);
+    pfep = fep != NULL ? RB_PREV(hfsp_fext_start, &bmp->hbm_byStart, fep) :
+                         RB_MAX(hfsp_fext_start, &bmp->hbm_byStart);
+    if (pfep != NULL && pfep->hfe_start + pfep->hfe_count == start)
+    {
+        RB_REMOVE(hfsp_fext_size, &bmp->hbm_bySize, pfep);
+        pfep->hfe_count += count;
+        if (fep != NULL && start + count == fep->hfe_start)
+        {
+            pfep->hfe_count += fep->hfe_count;
+            RB_REMOVE(hfsp_fext_size, &bmp->hbm_bySize, fep);
+            RB_REMOVE(hfsp_fext_start, &bmp->hbm_byStart, fep);
+            free(fep, M_HFSPBITMAP);
+            bmp->hbm_extents--;
+        }
+        RB_INSERT(hfsp_fext_size, &bmp->hbm_bySize, pfep);
+    }
+    else if (fep != NULL && start + count == fep->hfe_start)
+    {
+        RB_REMOVE(hfsp_fext_size, &bmp->hbm_bySize, fep);
+        fep->hfe_start = start;
+        fep->hfe_count += count;
+        RB_INSERT(hfsp_fext_size, &bmp->hbm_bySize, fep);
+    }
+    else
+    {
+        nfep->hfe_start = start;
+        nfep->hfe_count = count;
+        RB_INSERT(hfsp_fext_start, &bmp->hbm_byStart, nfep);
+        RB_INSERT(hfsp_fext_size, &bmp->hbm_bySize, nfep);
+        bmp->hbm_extents++;
+        nfep = NULL;
+    }
+    bmp->hbm_free += count;
+    bmp->hbm_largest = hfsp_bitmap_largest(bmp);
+out:
+    mtx_unlock(&bmp->hbm_mtx);
+    if (nfep != NULL)
+        free(nfep, M_HFSPBITMAP);
+}
+
+int
+hfsp_bitmap_mark(struct hfspmount * hmp, u_int32_t start, u_int32_t count, int set)
+{
+    struct hfsp_bitmap * bmp;
+    struct buf * bp;
+    u_int8_t * data;
+    u_int64_t bitsPerBlock, offset, end, last, block;
+    u_int32_t bit;
+    daddr_t blkno;
+    int error, size;
+
+    bmp = hmp->hm_bitmap;
+    if (bmp == NULL)
+        return EAGAIN;
+    end = (u_int64_t)start + count;
+    if (count == 0 || end > hmp->hm_totalBlocks)
+        return EINVAL;
+
+    bitsPerBlock = (u_int64_t)hmp->hm_blockSize * NBBY;
+    data = malloc(hmp->hm_blockSize, M_TEMP, M_WAITOK);
+    error = 0;
+
+    // Blocks of the allocation file are read through the journal, they may
+    // only be logged yet.
+    sx_xlock(&bmp->hbm_markLock);
+    for (block = start; block < end; block = last)
+    {
+        offset = block / bitsPerBlock * hmp->hm_blockSize;
+        last = MIN(end, (block / bitsPerBlock + 1) * bitsPerBlock);
+        error = hfsp_read_inode(bmp->hbm_ip, offset, hmp->hm_blockSize, data);
+        if (error)
+            break;
+
+        for (; block < last; block++)
+        {
+            bit = block % bitsPerBlock;
+            if (set)
+                data[bit / NBBY] |= 0x80 >> (bit % NBBY);
+            else
+                data[bit / NBBY] &= ~(0x80 >> (bit % NBBY));
+        }
+
+        error = hfsp_bmap_inode(bmp->hbm_ip, offset, hmp->hm_blockSize, &blkno, &size, NULL);
+        if (error)
+            break;
+        if (hmp->hm_jwriter != NULL)
+            error = hfsp_jwrite_log(hmp, blkno, data, size);
+        else
+        {
+            // Synchronous, the blocks are on the disk before a fork uses them.
+            bp = getblk(hmp->hm_devvp, blkno, size, 0, 0, 0);
+            memcpy(bp->b_data, data, size);
+            error = bwrite(bp);
+        }
+        if (error)
+            break;
+    }
+    sx_xunlock(&bmp->hbm_markLock);
+    free(data, M_TEMP);
+
+    if (error)
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_bitmap_mark: Blocks %ju to %ju not marked, error %jd.",
+                   start, end, error);
+    return error;
+}
@@ -0,0 +1,129 @@
+#include <sys/param.h>
+#include <sys/tree.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_BITMAP_H_
+#define _HFSP_BITMAP_H_
+
+MALLOC_DECLARE(M_HFSPBITMAP);
+
+/* Run of free allocation blocks */
+struct hfsp_fextent {
+    RB_ENTRY(hfsp_fextent)      hfe_byStart;
+    RB_ENTRY(hfsp_fextent)      hfe_bySize;
+    u_int32_t                   hfe_start;
+    u_int32_t                   hfe_count;
+};
+
+RB_HEAD(hfsp_fext_start, hfsp_fextent);
+RB_HEAD(hfsp_fext_size, hfsp_fextent);
+
+/* Free space of a volume counted from its allocation file */
+struct hfsp_bitmap {
+    struct mtx                  hbm_mtx;
+    struct sx                   hbm_markLock;   /* Updates of the allocation file */
+    struct task                 hbm_task;
+    struct hfsp_inode *         hbm_ip;         /* The allocation file */
+    struct hfsp_fext_start      hbm_byStart;    /* Free extents by first block */
+    struct hfsp_fext_size       hbm_bySize;     /* Free extents by size, then first block */
+    u_int32_t                   hbm_free;       /* Free blocks counted */
+    u_int32_t                   hbm_reserved;   /* Free blocks promised to delayed allocations */
+    u_int32_t                   hbm_extents;
+    u_int32_t                   hbm_largest;
+    u_int16_t                   hbm_flags;
+};
+
+/* hbm_flags */
+#define HFSP_BITMAP_READY       0x0001  /* hbm_free is valid */
+#define HFSP_BITMAP_INDEXED     0x0002  /* The free extents are indexed */
+#define HFSP_BITMAP_VERIFY      0x0004  /* Report a count different from the header */
+
+/*
+ * Start counting the free blocks of the volume in the background.
+ * hmp: The mount.
+ * hfsph: The volume header.
+ * verify: Report a count different from the header.
+ */
+int hfsp_bitmap_mount(struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph, int verify);
+
+/*
+ * Wait for the count and free the index of a mount.
+ */
+void hfsp_bitmap_unmount(struct hfspmount * hmp);
+
+/*
+ * Free blocks of the volume not reserved, the header count until the bitmap
+ * is read.
+ * hmp: The mount.
+ * freep: Free blocks on exit.
+ * largestp: If not NULL, largest free extent on exit, 0 if unknown.
+ */
+void hfsp_bitmap_stat(struct hfspmount * hmp, u_int32_t * freep, u_int32_t * largestp);
+
+/*
+ * Find the free extent holding a block, or the next one.
+ * hmp: The mount.
+ * block: The allocation block.
+ * startp, countp: The free extent on exit.
+ * Return ENOENT if there is none, EAGAIN if the extents are not indexed.
+ */
+int hfsp_bitmap_next_free(struct hfspmount * hmp, u_int32_t block, u_int32_t * startp, u_int32_t * countp);
+
+/*
+ * Find the smallest free extent of at least count blocks.
+ * hmp: The mount.
+ * count: Number of blocks needed.
+ * startp, countp: The free extent on exit.
+ * Return ENOSPC if there is none, EAGAIN if the extents are not indexed.
+ */
+int hfsp_bitmap_find_fit(struct hfspmount * hmp, u_int32_t count, u_int32_t * startp, u_int32_t * countp);
+
+/*
+ * Reserve free blocks for a later hfsp_bitmap_alloc().
+ * hmp: The mount.
+ * count: Number of blocks.
+ * Return ENOSPC if less blocks are free and not reserved, EAGAIN if the
+ * extents are not indexed.
+ */
+int hfsp_bitmap_reserve(struct hfspmount * hmp, u_int32_t count);
+
+/*
+ * Give back reserved blocks not allocated.
+ */
+void hfsp_bitmap_unreserve(struct hfspmount * hmp, u_int32_t count);
+
+/*
+ * Take a run of reserved blocks out of the free extents. The run starts at
+ * goal if the extent holding it is large enough, else at the first extent
+ * large enough of the few following goal, else at the smallest one large
+ * enough. If none is, the largest extent is taken.
+ * hmp: The mount.
+ * goal: Allocation block the run should start at.
+ * count: Number of blocks wanted, at most the ones reserved.
+ * flags: HFSP_BITMAP_ATGOAL to only take the blocks free from goal on.
+ * startp, countp: The run on exit, countp may be less than count.
+ * Return ENOSPC if no block is free, or goal is not with HFSP_BITMAP_ATGOAL.
+ */
+int hfsp_bitmap_alloc(struct hfspmount * hmp, u_int32_t goal, u_int32_t count, int flags, u_int32_t * startp,
+                      u_int32_t * countp);
+
+/* hfsp_bitmap_alloc() flags */
+#define HFSP_BITMAP_ATGOAL      0x0001  /* Extend a run ending at goal */
+
+/*
+ * Put a run of blocks back in the free extents, merged with its neighbours.
+ */
+void hfsp_bitmap_dealloc(struct hfspmount * hmp, u_int32_t start, u_int32_t count);
+
+/*
+ * Set or clear the bits of a run of blocks in the allocation file. On a
+ * journaled volume the blocks of the allocation file are logged, the caller
+ * holds an operation of the journal.
+ * hmp: The mount.
+ * start, count: The run.
+ * set: Mark the blocks allocated if not 0, free otherwise.
+ */
+int hfsp_bitmap_mark(struct hfspmount * hmp, u_int32_t start, u_int32_t count, int set);
+
+#endif /* _HFSP_BITMAP_H_ */
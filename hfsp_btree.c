@@ -5,19 +5,42 @@
 #include <sys/kernel.h>
 #include <sys/systm.h>
 #include <sys/buf.h>
+#include <sys/sysctl.h>
 #include <sys/endian.h>
 
 #include "hfsp_btree.h"
 #include "hfsp_unicode.h"
+#include "hfsp_trace.h"
+#include "hfsp_name.h"
 
 MALLOC_DEFINE(M_HFSPBTREE, "hfsp_btree", "HFS+ B-Tree");
 MALLOC_DEFINE(M_HFSPNODE, "hfsp_node", "HFS+ B-Tree node");
 MALLOC_DEFINE(M_HFSPREC, "hfsp_record", "HFS+ B-Tree record");
 
+static u_int hfsp_nodecache_max = 512;
+SYSCTL_UINT(_vfs_hfsp, OID_AUTO, nodecache_max, CTLFLAG_RW, &hfsp_nodecache_max, 0,
+            "Maximum number of decoded nodes cached per B-tree, 0 to disable");
+
+static u_long hfsp_nodecache_hits;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, nodecache_hits, CTLFLAG_RD, &hfsp_nodecache_hits, 0,
+             "B-tree nodes found in the node cache");
+
+static u_long hfsp_nodecache_misses;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, nodecache_misses, CTLFLAG_RD, &hfsp_nodecache_misses, 0,
+             "B-tree nodes read and added to the node cache");
+
+#define HFSP_NODEHASH(btreep, num)      (&(btreep)->hb_nodeHash[(num) & (btreep)->hb_nodeMask])
+
+static u_long hfsp_btnode_straddled;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, btnode_straddled, CTLFLAG_RD, &hfsp_btnode_straddled, 0,
+             "B-tree nodes read in pieces across extents");
+
 typedef int (*record_read_t)(struct hfsp_record * recp);
 
 static record_read_t brec_read_op[RECORD_TYPE_COUNT];
 
+static void hfsp_brec_clear(struct hfsp_record * recp);
+
 int
 hfsp_btree_open(struct hfsp_inode * ip, struct hfsp_btree ** btreepp)
 {
@@ -40,25 +63,35 @@ hfsp_btree_open(struct hfsp_inode * ip, struct hfsp_btree ** btreepp)
     error = hfsp_bread_inode(ip, 0, sizeof(*btreeRaw) + sizeof(*btHeaderRaw), &bp);
     if (error)
     {
+        free(btreep, M_HFSPBTREE);
+        *btreepp = NULL;
         return error;
     }
 
     btreeRaw = (struct BTNodeDescriptor*)bp->b_data;
     btHeaderRaw = (struct BTHeaderRec*)(bp->b_data + sizeof(*btreeRaw));
 
-    uprintf("hfsp_btree_open: Buffer size %ld, Buffer offset %ld, Number of records in header node: %d\n", 
-            bp->b_bufsize, bp->b_offset, be16toh(btreeRaw->numRecords));
+    HFSP_TRACE(HFSP_TRACE_DEBUG, "hfsp_btree_open: Buffer size %ju, Buffer offset %jd, Number of records in header node: %ju",
+               bp->b_bufsize, bp->b_offset, be16toh(btreeRaw->numRecords));
 
     btreep->hb_mapNode  = be32toh(btreeRaw->fLink);
     btreep->hb_nodeSize = be16toh(btHeaderRaw->nodeSize);
     btreep->hb_rootNode = be32toh(btHeaderRaw->rootNode);
     btreep->hb_treeDepth = be16toh(btHeaderRaw->treeDepth);
     btreep->hb_firstLeafNode = be32toh(btHeaderRaw->firstLeafNode);
+    btreep->hb_lastLeafNode = be32toh(btHeaderRaw->lastLeafNode);
     btreep->hb_totalNodes = be32toh(btHeaderRaw->totalNodes);
     btreep->hb_freeNodes = be32toh(btHeaderRaw->freeNodes);
-    btreep->hb_totalNodes = be32toh(btHeaderRaw->leafRecords);
+    btreep->hb_leafRecords = be32toh(btHeaderRaw->leafRecords);
+    btreep->hb_maxKeyLength = be16toh(btHeaderRaw->maxKeyLength);
+    btreep->hb_attributes = be32toh(btHeaderRaw->attributes);
+    btreep->hb_keyCompareType = btHeaderRaw->keyCompareType;
     btreep->hb_ip = ip;
     btreep->hb_nodeShift = ffs(btreep->hb_nodeSize) - 1;
+    mtx_init(&btreep->hb_mtx, "hfsp_btree", NULL, MTX_DEF);
+    sx_init(&btreep->hb_txLock, "hfsp_bttx");
+    btreep->hb_nodeHash = hashinit(64, M_HFSPBTREE, &btreep->hb_nodeMask);
+    TAILQ_INIT(&btreep->hb_nodeLru);
 
     brelse(bp);
 
@@ -76,28 +109,17 @@ hfsp_get_btnode_from_idx(struct hfsp_btree * btreep, u_int32_t num, struct hfsp_
     return hfsp_get_btnode_from_offset(btreep, blockOffset, npp);
 }
 
-int
-hfsp_get_btnode_from_offset(struct hfsp_btree * btreep, u_int64_t blockOffset, struct hfsp_node ** npp)
+/*
+ * Decode the descriptor of a node read in memory.
+ */
+static void
+hfsp_btnode_init(struct hfsp_btree * btreep, struct hfsp_node * np, u_int64_t blockOffset, u_int8_t * data)
 {
-    struct buf * bp;
-    struct hfsp_node * np;
     struct BTNodeDescriptor * ndp;
-    int error;
 
-    error = hfsp_bread_inode(btreep->hb_ip, blockOffset, btreep->hb_nodeSize, &bp);
-    if (error)
-    {
-        return error;
-    }
-
-    np = malloc(sizeof(*np), M_HFSPNODE, M_WAITOK | M_ZERO);
-    if (np == NULL)
-        return ENOMEM;
-
-    ndp = (struct BTNodeDescriptor*)bp->b_data;
+    ndp = (struct BTNodeDescriptor*)data;
 
     np->hn_btreep = btreep;
-    np->hn_buffer = bp;
     np->hn_kind = ndp->kind;
     np->hn_height = ndp->height;
     np->hn_nodeSize = btreep->hb_nodeSize;
@@ -105,7 +127,7 @@ hfsp_get_btnode_from_offset(struct hfsp_btree * btreep, u_int64_t blockOffset, s
     np->hn_prev = be32toh(ndp->bLink);
     np->hn_next = be32toh(ndp->fLink);
     np->hn_offset = blockOffset;
-    np->hn_beginBuf = (u_int8_t *)ndp;
+    np->hn_beginBuf = data;
     np->hn_recordTable = (u_int16_t*)(np->hn_beginBuf + np->hn_nodeSize);
     np->hn_inMemory = true;
     switch (np->hn_kind)
@@ -119,34 +141,563 @@ hfsp_get_btnode_from_offset(struct hfsp_btree * btreep, u_int64_t blockOffset, s
         default:
             np->hn_read = hfsp_brec_noops;
     }
+}
+
+/*
+ * Read a node from the disk, bypassing the node cache.
+ */
+static int
+hfsp_btnode_read(struct hfsp_btree * btreep, u_int64_t blockOffset, struct hfsp_node ** npp)
+{
+    struct buf * bp;
+    struct hfsp_node * np;
+    u_int64_t run;
+    daddr_t blkno;
+    int error, size;
+
+    // A loaded btree is never read again.
+    if (btreep->hb_image != NULL)
+    {
+        if (blockOffset + btreep->hb_nodeSize > btreep->hb_imageSize)
+            return EINVAL;
+        np = malloc(sizeof(*np), M_HFSPNODE, M_WAITOK | M_ZERO);
+        hfsp_btnode_init(btreep, np, blockOffset, btreep->hb_image + blockOffset);
+        *npp = np;
+        return 0;
+    }
 
+    error = hfsp_bmap_inode(btreep->hb_ip, blockOffset, btreep->hb_nodeSize, &blkno, &size, &run);
+    if (error)
+    {
+        return error;
+    }
+
+    // A node in a single extent is used in place in its buffer, the node cache
+    // copies it out before keeping it.
+    if (run >= btreep->hb_nodeSize)
+    {
+        error = hfsp_bread_dev(btreep->hb_ip->hi_mount, blkno, size, &bp);
+        if (error)
+            return error;
+
+        np = malloc(sizeof(*np), M_HFSPNODE, M_WAITOK | M_ZERO);
+        np->hn_buffer = bp;
+        hfsp_btnode_init(btreep, np, blockOffset, (u_int8_t *)bp->b_data);
+        *npp = np;
+        return 0;
+    }
+
+    // A node crossing extents is assembled from its pieces.
+    HFSP_TRACE(HFSP_TRACE_DEBUG, "hfsp_get_btnode_from_offset: Node at %ju crosses an extent.", blockOffset);
+    atomic_add_long(&hfsp_btnode_straddled, 1);
+    np = malloc(sizeof(*np) + btreep->hb_nodeSize, M_HFSPNODE, M_WAITOK | M_ZERO);
+    error = hfsp_read_inode(btreep->hb_ip, blockOffset, btreep->hb_nodeSize, np + 1);
+    if (error)
+    {
+        free(np, M_HFSPNODE);
+        return error;
+    }
+    hfsp_btnode_init(btreep, np, blockOffset, (u_int8_t *)(np + 1));
     *npp = np;
+    return 0;
+}
+
+static void
+hfsp_btnode_free(struct hfsp_node * np)
+{
+    // Nodes of a coalesced read hold a copy instead of a buffer.
+    if (np->hn_inMemory && np->hn_buffer != NULL)
+        brelse(np->hn_buffer);
+    np->hn_inMemory = false;
+
+    free(np->hn_keyCnids, M_HFSPNODE);
+    free(np, M_HFSPNODE);
+}
+
+/*
+ * Decode the record table and the keys of an index or leaf node of the
+ * catalogue once, in host endianness. The keys of the other trees do not start
+ * with a parent CNID, their nodes are searched without a table. Left unbuilt if
+ * a record is out of the node.
+ */
+static void
+hfsp_btnode_build_table(struct hfsp_node * np)
+{
+    hfsp_cnid * cnids;
+    u_int16_t * offsets, * keyLens;
+    u_int16_t offset;
+    int i, n;
+
+    n = np->hn_numRecords;
+    if (!(np->hn_btreep->hb_flags & HFSP_BTREE_CATALOG) ||
+        (np->hn_kind != HFSP_NODE_INDEX && np->hn_kind != HFSP_NODE_LEAF) || n == 0)
+        return;
+
+    // One allocation, the widest array first to keep them aligned.
+    cnids = malloc(n * (sizeof(*cnids) + sizeof(*offsets) + sizeof(*keyLens)), M_HFSPNODE, M_WAITOK);
+    offsets = (u_int16_t *)(cnids + n);
+    keyLens = offsets + n;
+    for (i = 0; i < n; i++)
+    {
+        offset = be16toh(*(np->hn_recordTable - (1 + i)));
+        if (offset + sizeof(u_int16_t) + sizeof(u_int32_t) > np->hn_nodeSize)
+        {
+            free(cnids, M_HFSPNODE);
+            return;
+        }
+        offsets[i] = offset;
+        keyLens[i] = PBE16TOH(np->hn_beginBuf + offset);
+        cnids[i] = PBE32TOH(np->hn_beginBuf + offset + sizeof(u_int16_t));
+    }
+    np->hn_keyCnids = cnids;
+    np->hn_recOffsets = offsets;
+    np->hn_keyLens = keyLens;
+}
+
+/*
+ * Return a referenced node of the cache, NULL if it is not cached.
+ */
+static struct hfsp_node *
+hfsp_btnode_cache_find(struct hfsp_btree * btreep, u_int32_t num)
+{
+    struct hfsp_node * np;
+
+    mtx_lock(&btreep->hb_mtx);
+    LIST_FOREACH(np, HFSP_NODEHASH(btreep, num), hn_hash)
+    {
+        if (np->hn_num == num)
+        {
+            np->hn_refcnt++;
+            TAILQ_REMOVE(&btreep->hb_nodeLru, np, hn_lru);
+            TAILQ_INSERT_TAIL(&btreep->hb_nodeLru, np, hn_lru);
+            break;
+        }
+    }
+    mtx_unlock(&btreep->hb_mtx);
+    if (np != NULL)
+        atomic_add_long(&hfsp_nodecache_hits, 1);
+    return np;
+}
+
+/*
+ * Put a node just read in the cache. A node still in its buffer is copied so
+ * the cache does not hold buffers: a cached node lives across many lookups,
+ * its buffer would stay locked all that time, stalling the writes of its block
+ * and pinning up to nodecache_max buffers per tree. The copy of a node is paid
+ * once per miss, the hits then read nothing. The node is consumed, the cached
+ * node is returned referenced.
+ */
+static struct hfsp_node *
+hfsp_btnode_cache_enter(struct hfsp_btree * btreep, struct hfsp_node * np)
+{
+    struct hfsp_node * cnp, * victimp;
+    TAILQ_HEAD(, hfsp_node) victims;
+    u_int32_t num;
+
+    num = np->hn_offset >> btreep->hb_nodeShift;
+    if (np->hn_buffer != NULL)
+    {
+        cnp = malloc(sizeof(*cnp) + btreep->hb_nodeSize, M_HFSPNODE, M_WAITOK | M_ZERO);
+        memcpy(cnp + 1, np->hn_beginBuf, btreep->hb_nodeSize);
+        hfsp_btnode_init(btreep, cnp, np->hn_offset, (u_int8_t *)(cnp + 1));
+        hfsp_btnode_free(np);
+        np = cnp;
+    }
+    hfsp_btnode_build_table(np);
+    np->hn_num = num;
+    np->hn_refcnt = 1;
+    np->hn_flags |= HFSP_NODE_CACHED;
+    atomic_add_long(&hfsp_nodecache_misses, 1);
+
+    TAILQ_INIT(&victims);
+    mtx_lock(&btreep->hb_mtx);
+    LIST_FOREACH(cnp, HFSP_NODEHASH(btreep, num), hn_hash)
+    {
+        if (cnp->hn_num == num)
+            break;
+    }
+    if (cnp != NULL)
+    {
+        // Read concurrently, keep the first one.
+        cnp->hn_refcnt++;
+        mtx_unlock(&btreep->hb_mtx);
+        hfsp_btnode_free(np);
+        return cnp;
+    }
+
+    LIST_INSERT_HEAD(HFSP_NODEHASH(btreep, num), np, hn_hash);
+    TAILQ_INSERT_TAIL(&btreep->hb_nodeLru, np, hn_lru);
+    btreep->hb_nodeCount++;
+
+    // Evict the least recently used nodes nobody holds above the limit.
+    victimp = TAILQ_FIRST(&btreep->hb_nodeLru);
+    while (btreep->hb_nodeCount > hfsp_nodecache_max && victimp != NULL)
+    {
+        cnp = TAILQ_NEXT(victimp, hn_lru);
+        if (victimp->hn_refcnt == 0)
+        {
+            TAILQ_REMOVE(&btreep->hb_nodeLru, victimp, hn_lru);
+            LIST_REMOVE(victimp, hn_hash);
+            btreep->hb_nodeCount--;
+            TAILQ_INSERT_TAIL(&victims, victimp, hn_lru);
+        }
+        victimp = cnp;
+    }
+    mtx_unlock(&btreep->hb_mtx);
+
+    while ((victimp = TAILQ_FIRST(&victims)) != NULL)
+    {
+        TAILQ_REMOVE(&victims, victimp, hn_lru);
+        hfsp_btnode_free(victimp);
+    }
+    return np;
+}
+
+int
+hfsp_get_btnode_from_offset(struct hfsp_btree * btreep, u_int64_t blockOffset, struct hfsp_node ** npp)
+{
+    struct hfsp_node * np;
+    int error;
+
+    if (hfsp_nodecache_max == 0)
+        return hfsp_btnode_read(btreep, blockOffset, npp);
 
+    np = hfsp_btnode_cache_find(btreep, blockOffset >> btreep->hb_nodeShift);
+    if (np == NULL)
+    {
+        error = hfsp_btnode_read(btreep, blockOffset, &np);
+        if (error)
+            return error;
+        np = hfsp_btnode_cache_enter(btreep, np);
+    }
+    *npp = np;
     return 0;
 }
 
+/* Node of a coalesced read, with its place in the arrays of the caller */
+struct hfsp_btnode_io {
+    daddr_t         hbi_blkno;
+    u_int64_t       hbi_run;
+    int             hbi_idx;
+};
+
+static int
+hfsp_btnode_io_cmp(const void * l, const void * r)
+{
+    daddr_t lb, rb;
+
+    lb = ((const struct hfsp_btnode_io *)l)->hbi_blkno;
+    rb = ((const struct hfsp_btnode_io *)r)->hbi_blkno;
+    return lb < rb ? -1 : lb > rb;
+}
+
+int
+hfsp_get_btnodes(struct hfsp_btree * btreep, u_int32_t * nums, int count, struct hfsp_node ** nps)
+{
+    struct hfsp_btnode_io * ios, * iop;
+    struct hfsp_node * np;
+    struct buf * bp;
+    u_int64_t offset;
+    int error, first, last, i, n, size, nodeBlks, maxNodes, total;
+
+    // Nothing to coalesce in memory.
+    if (btreep->hb_image != NULL)
+    {
+        for (i = 0; i < count; i++)
+        {
+            error = hfsp_get_btnode_from_idx(btreep, nums[i], &nps[i]);
+            if (error)
+            {
+                while (i-- > 0)
+                    hfsp_release_btnode(nps[i]);
+                return error;
+            }
+        }
+        return 0;
+    }
+
+    total = count;
+    bzero(nps, count * sizeof(*nps));
+    ios = malloc(count * sizeof(*ios), M_TEMP, M_WAITOK);
+    error = 0;
+    for (i = n = 0; i < count; i++)
+    {
+        // Cached nodes need no I/O.
+        if (hfsp_nodecache_max != 0 && (nps[i] = hfsp_btnode_cache_find(btreep, nums[i])) != NULL)
+            continue;
+        error = hfsp_bmap_inode(btreep->hb_ip, (u_int64_t)nums[i] << btreep->hb_nodeShift, btreep->hb_nodeSize,
+                                &ios[n].hbi_blkno, &size, &ios[n].hbi_run);
+        if (error)
+            goto out;
+        ios[n].hbi_idx = i;
+        n++;
+    }
+    count = n;
+
+    // Physically contiguous nodes are read together, up to the largest
+    // buffer getblk() accepts.
+    qsort(ios, count, sizeof(*ios), hfsp_btnode_io_cmp);
+    nodeBlks = btodb(btreep->hb_nodeSize);
+    maxNodes = max(1, MAXBSIZE / btreep->hb_nodeSize);
+    for (first = 0; first < count; first = last)
+    {
+        iop = &ios[first];
+        for (last = first + 1; last < count && last - first < maxNodes; last++)
+        {
+            if (ios[last].hbi_blkno != iop->hbi_blkno + (last - first) * nodeBlks ||
+                (u_int64_t)(last - first + 1) * btreep->hb_nodeSize > iop->hbi_run)
+                break;
+        }
+
+        // A single node is read alone, in place in its buffer unless the node
+        // cache keeps a copy.
+        if (last - first == 1)
+        {
+            error = hfsp_get_btnode_from_idx(btreep, nums[iop->hbi_idx], &nps[iop->hbi_idx]);
+            if (error)
+                goto out;
+            continue;
+        }
+
+        HFSP_TRACE(HFSP_TRACE_DEBUG, "hfsp_get_btnodes: Reading %jd nodes at block %jd.",
+                   last - first, iop->hbi_blkno);
+        error = hfsp_bread_dev(btreep->hb_ip->hi_mount, iop->hbi_blkno, (last - first) * btreep->hb_nodeSize, &bp);
+        if (error)
+            goto out;
+
+        // Split the run in nodes owning a copy, the large buffer is not kept in the cache.
+        for (i = first; i < last; i++)
+        {
+            np = malloc(sizeof(*np) + btreep->hb_nodeSize, M_HFSPNODE, M_WAITOK | M_ZERO);
+            memcpy(np + 1, bp->b_data + (i - first) * btreep->hb_nodeSize, btreep->hb_nodeSize);
+            offset = (u_int64_t)nums[ios[i].hbi_idx] << btreep->hb_nodeShift;
+            hfsp_btnode_init(btreep, np, offset, (u_int8_t *)(np + 1));
+            if (hfsp_nodecache_max != 0)
+                np = hfsp_btnode_cache_enter(btreep, np);
+            nps[ios[i].hbi_idx] = np;
+        }
+        bp->b_flags |= B_INVAL;
+        brelse(bp);
+    }
+    error = 0;
+
+out:
+    if (error)
+    {
+        for (i = 0; i < total; i++)
+        {
+            if (nps[i] != NULL)
+                hfsp_release_btnode(nps[i]);
+            nps[i] = NULL;
+        }
+    }
+    free(ios, M_TEMP);
+    return error;
+}
+
+int
+hfsp_btree_cached_nodes(struct hfsp_btree * btreep, u_int32_t * nums, int max)
+{
+    struct hfsp_node * np;
+    int count;
+
+    count = 0;
+    mtx_lock(&btreep->hb_mtx);
+    TAILQ_FOREACH_REVERSE(np, &btreep->hb_nodeLru, hfsp_nodelru, hn_lru)
+    {
+        if (count == max)
+            break;
+        nums[count++] = np->hn_num;
+    }
+    mtx_unlock(&btreep->hb_mtx);
+    return count;
+}
+
+static int
+hfsp_btnode_num_cmp(const void * l, const void * r)
+{
+    u_int32_t ln, rn;
+
+    ln = *(const u_int32_t *)l;
+    rn = *(const u_int32_t *)r;
+    return ln < rn ? -1 : ln > rn;
+}
+
+void
+hfsp_btree_prefetch(struct hfsp_btree * btreep, u_int32_t * nums, int count)
+{
+    struct hfsp_node * nps[HFSP_PREFETCH_BATCH];
+    int i, j, n, batch;
+
+    // Nowhere to keep the nodes.
+    if (hfsp_nodecache_max == 0 || btreep->hb_image != NULL)
+        return;
+    count = min(count, hfsp_nodecache_max);
+
+    // Sorted and unique, the nodes of a batch are then likely contiguous on the disk.
+    qsort(nums, count, sizeof(*nums), hfsp_btnode_num_cmp);
+    for (i = n = 0; i < count; i++)
+    {
+        if (nums[i] < btreep->hb_totalNodes && (n == 0 || nums[i] != nums[n - 1]))
+            nums[n++] = nums[i];
+    }
+
+    for (i = 0; i < n; i += batch)
+    {
+        batch = min(n - i, HFSP_PREFETCH_BATCH);
+        if (hfsp_get_btnodes(btreep, nums + i, batch, nps) != 0)
+            continue;
+        for (j = 0; j < batch; j++)
+            hfsp_release_btnode(nps[j]);
+    }
+}
+
 void
 hfsp_release_btnode(struct hfsp_node * np)
 {
-    if (np->hn_inMemory)
+    struct hfsp_btree * btreep;
+    int stale;
+
+    // Cached nodes stay until they are evicted, or rewritten.
+    if (np->hn_flags & HFSP_NODE_CACHED)
     {
-        brelse(np->hn_buffer);
-        np->hn_inMemory = false;
+        btreep = np->hn_btreep;
+        mtx_lock(&btreep->hb_mtx);
+        np->hn_refcnt--;
+        stale = np->hn_refcnt == 0 && (np->hn_flags & HFSP_NODE_STALE);
+        mtx_unlock(&btreep->hb_mtx);
+        if (!stale)
+            return;
+    }
+    hfsp_btnode_free(np);
+}
+
+void
+hfsp_btree_update_node(struct hfsp_btree * btreep, u_int32_t num, u_int8_t * data)
+{
+    struct hfsp_node * np;
+    u_int64_t offset;
+
+    offset = (u_int64_t)num << btreep->hb_nodeShift;
+    if (btreep->hb_image != NULL && offset + btreep->hb_nodeSize <= btreep->hb_imageSize)
+        memcpy(btreep->hb_image + offset, data, btreep->hb_nodeSize);
+
+    mtx_lock(&btreep->hb_mtx);
+    LIST_FOREACH(np, HFSP_NODEHASH(btreep, num), hn_hash)
+    {
+        if (np->hn_num == num)
+            break;
+    }
+    if (np != NULL)
+    {
+        // The next lookup reads the node again, the holders free it.
+        LIST_REMOVE(np, hn_hash);
+        TAILQ_REMOVE(&btreep->hb_nodeLru, np, hn_lru);
+        btreep->hb_nodeCount--;
+        np->hn_flags |= HFSP_NODE_STALE;
+        if (np->hn_refcnt != 0)
+            np = NULL;
     }
+    mtx_unlock(&btreep->hb_mtx);
 
-    free(np, M_HFSPNODE);
+    if (np != NULL)
+        hfsp_btnode_free(np);
 }
 
 void
 hfsp_btree_close(struct hfsp_btree * btreep)
 {
+    struct hfsp_node * np;
+
     if (btreep == NULL)
         return;
 
+    // All the nodes have been released.
+    while ((np = TAILQ_FIRST(&btreep->hb_nodeLru)) != NULL)
+    {
+        TAILQ_REMOVE(&btreep->hb_nodeLru, np, hn_lru);
+        LIST_REMOVE(np, hn_hash);
+        hfsp_btnode_free(np);
+    }
+    hashdestroy(btreep->hb_nodeHash, M_HFSPBTREE, btreep->hb_nodeMask);
+    mtx_destroy(&btreep->hb_mtx);
+    sx_destroy(&btreep->hb_txLock);
+    free(btreep->hb_image, M_HFSPBTREE);
     hfsp_irelease(btreep->hb_ip);
     free(btreep, M_HFSPBTREE);
 }
 
+int
+hfsp_btree_load(struct hfsp_btree * btreep, u_int64_t maxSize)
+{
+    struct hfsp_inode * ip;
+    struct buf * bp;
+    u_int8_t * image;
+    u_int64_t size, done, run;
+    daddr_t blkno;
+    int error, chunk, sizeBread;
+
+    ip = btreep->hb_ip;
+    size = ip->hi_fork.size;
+    if (size > maxSize)
+        return EFBIG;
+    if (size < btreep->hb_nodeSize)
+        return EINVAL;
+
+    // Wired memory, a failure leaves the btree read on demand.
+    image = malloc(size, M_HFSPBTREE, M_NOWAIT);
+    if (image == NULL)
+        return ENOMEM;
+
+    // Large sequential reads over each extent, kept out of the buffer cache.
+    // They go through hfsp_bread_dev() to see the journal overlay, so each is
+    // at most the largest buffer getblk() accepts.
+    for (done = 0; done < size; done += chunk)
+    {
+        error = hfsp_bmap_inode(ip, done, MIN(size - done, MAXBSIZE), &blkno, &sizeBread, &run);
+        if (error)
+            goto fail;
+        chunk = MIN(MIN(run, size - done), MAXBSIZE);
+        error = hfsp_bread_dev(ip->hi_mount, blkno, roundup(chunk, ip->hi_mount->hm_physBlockSize), &bp);
+        if (error)
+            goto fail;
+        memcpy(image + done, bp->b_data, chunk);
+        bp->b_flags |= B_INVAL | B_NOCACHE;
+        brelse(bp);
+    }
+
+    btreep->hb_image = image;
+    btreep->hb_imageSize = size;
+    return 0;
+
+fail:
+    free(image, M_HFSPBTREE);
+    return error;
+}
+
+/*
+ * Make a record found in a node outlive the node.
+ */
+static int
+hfsp_brec_detach(struct hfsp_record * recp, int error)
+{
+    // The key name point into the node, intern it before releasing the node.
+    if (!error && recp->hr_key.hk_name == NULL)
+    {
+        error = hfsp_name_intern(&recp->hr_mount->hm_names, recp->hr_key.hk_nameStr,
+                                 recp->hr_key.hk_nameLen, &recp->hr_key.hk_name);
+        if (!error)
+            recp->hr_key.hk_nameStr = recp->hr_key.hk_name->hna_str;
+    }
+    if (error)
+    {
+        recp->hr_key.hk_nameStr = NULL;
+        recp->hr_key.hk_nameLen = 0;
+    }
+    recp->hr_node = NULL;
+    return error;
+}
+
 int
 hfsp_btree_find(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct hfsp_record ** recpp)
 {
@@ -164,7 +715,7 @@ hfsp_btree_find(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct
         error = hfsp_get_btnode_from_idx(btreep, currentCnid, &np);
         if (error)
         {
-            uprintf("hfsp_btree_find: Getting error reading btnode.");
+            HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_find: Getting error %jd reading btnode %ju.", error, currentCnid);
             return error;
         }
 
@@ -182,7 +733,7 @@ hfsp_btree_find(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct
         }
         else
         {
-            uprintf("hfsp_btree_find: Invalid node type, level: %d,%d\n", np->hn_kind, level);
+            HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_find: Invalid node type, level: %jd,%jd", np->hn_kind, level);
             error = EINVAL;
             break;
         }
@@ -193,10 +744,7 @@ hfsp_btree_find(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct
     }
 
     if (*recpp != NULL)
-    {
-        recp = * recpp;
-        recp->hr_node = NULL;
-    }
+        error = hfsp_brec_detach(*recpp, error);
     hfsp_release_btnode(np);
     return error;
 }
@@ -204,40 +752,350 @@ hfsp_btree_find(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct
 int
 hfsp_btree_find_cnid(struct hfsp_btree * btreep, hfsp_cnid cnid, struct hfsp_record ** recpp)
 {
-    struct hfsp_record_key * rkp;
+    struct hfsp_record_key key;
     struct hfsp_record * rp;
+    struct hfsp_name * namep;
     int error;
 
-    rkp = malloc(sizeof(*rkp), M_HFSPKEY, M_WAITOK | M_ZERO);
-    if (rkp == NULL)
-        return ENOMEM;
-
     // First step find the record thread.
-    rkp->hk_cnid = cnid;
-    error = hfsp_btree_find(btreep, rkp, recpp);
+    bzero(&key, sizeof(key));
+    key.hk_cnid = cnid;
+    error = hfsp_btree_find(btreep, &key, recpp);
     if (error)
-    {
-        free(rkp, M_HFSPKEY);
         return error;
-    }
     rp = *recpp;
 
+    // The search return the closest record, check that we found the thread of this cnid.
+    if (rp->hr_parentCnid != cnid)
+        return ENOENT;
+
     // Check that we have a thread record.
     if (rp->hr_type != HFSP_FILE_THREAD_RECORD && rp->hr_type != HFSP_FOLDER_THREAD_RECORD)
     {
-        uprintf("hfsp_btree_find_cnid: Bad record type: %d.", rp->hr_type);
-        free(rkp, M_HFSPKEY);
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_find_cnid: Bad record type: %jd.", rp->hr_type);
+        return EINVAL;
+    }
+
+    // Second step we do the lookup of the record. The record is reused so
+    // keep our own reference on the name.
+    namep = hfsp_name_ref(rp->hr_thread.hrt_name);
+    key.hk_cnid = rp->hr_thread.hrt_parentCnid;
+    key.hk_nameLen = namep->hna_len;
+    key.hk_nameStr = namep->hna_str;
+    key.hk_name = namep;
+    error = hfsp_btree_find(btreep, &key, recpp);
+    hfsp_name_release(&rp->hr_mount->hm_names, namep);
+    return error;
+}
+
+int
+hfsp_btree_find_exact(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct hfsp_record ** recpp)
+{
+    int error;
+
+    error = hfsp_btree_find(btreep, kp, recpp);
+    if (error)
+        return error;
+
+    // The search return the closest record.
+    if (hfsp_brec_key_cmp(&(*recpp)->hr_key, kp) != 0)
+        return ENOENT;
+    return 0;
+}
+
+/*
+ * Walk the records from a position in a leaf node. The node is released.
+ */
+static int
+hfsp_btree_walk(struct hfsp_node * np, int idx, struct hfsp_record_key * hi, int flags,
+                hfsp_btree_visit_t visit, void * arg)
+{
+    struct hfsp_btree * btreep;
+    struct hfsp_record * rp;
+    u_int32_t next;
+    int error;
+
+    btreep = np->hn_btreep;
+    rp = NULL;
+    error = 0;
+    while (1)
+    {
+        if (idx >= np->hn_numRecords)
+        {
+            next = np->hn_next;
+            if (next == 0)
+                break;
+            // Hold a single node.
+            hfsp_release_btnode(np);
+            np = NULL;
+            error = hfsp_get_btnode_from_idx(btreep, next, &np);
+            if (error)
+                break;
+            idx = 0;
+            continue;
+        }
+
+        error = hfsp_brec_catalogue_lookup_read(np, idx, &rp);
+        if (error)
+            break;
+        if (hi != NULL && hfsp_brec_key_cmp(&rp->hr_key, hi) >= 0)
+            break;
+        if ((flags & HFSP_SCAN_KEYS) == 0)
+        {
+            error = np->hn_read(np, idx, &rp);
+            if (error)
+                break;
+        }
+        error = visit(rp, arg);
+        if (error)
+            break;
+        idx++;
+    }
+
+    if (rp != NULL)
+        hfsp_brec_release_record(&rp);
+    if (np != NULL)
+        hfsp_release_btnode(np);
+    return error;
+}
+
+int
+hfsp_btree_scan(struct hfsp_btree * btreep, struct hfsp_record_key * lo, struct hfsp_record_key * hi,
+                int flags, hfsp_btree_visit_t visit, void * arg)
+{
+    struct hfsp_node * np;
+    struct hfsp_record * rp;
+    u_int32_t nodeNum;
+    int error, level, begin, end, mid;
+
+    rp = NULL;
+    nodeNum = btreep->hb_rootNode;
+    for (level = btreep->hb_treeDepth; ; level--)
+    {
+        error = hfsp_get_btnode_from_idx(btreep, nodeNum, &np);
+        if (error)
+        {
+            HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_scan: Getting error %jd reading btnode %ju.", error, nodeNum);
+            break;
+        }
+        if (level == 1 && np->hn_kind == HFSP_NODE_LEAF)
+            break;
+        if (level <= 1 || np->hn_kind != HFSP_NODE_INDEX)
+        {
+            HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_scan: Invalid node type, level: %jd,%jd", np->hn_kind, level);
+            hfsp_release_btnode(np);
+            error = EINVAL;
+            break;
+        }
+        error = hfsp_brec_find(np, lo, &rp);
+        if (error == 0)
+            nodeNum = rp->hr_index;
+        hfsp_release_btnode(np);
+        if (error)
+            break;
+    }
+
+    if (error == 0)
+    {
+        // First record of the leaf not below lo.
+        begin = 0;
+        end = np->hn_numRecords;
+        while (begin < end)
+        {
+            mid = (begin + end) >> 1;
+            error = hfsp_brec_catalogue_lookup_read(np, mid, &rp);
+            if (error)
+                break;
+            if (hfsp_brec_key_cmp(&rp->hr_key, lo) < 0)
+                begin = mid + 1;
+            else
+                end = mid;
+        }
+        if (error)
+            hfsp_release_btnode(np);
+    }
+
+    if (rp != NULL)
+        hfsp_brec_release_record(&rp);
+    if (error)
+        return error;
+    return hfsp_btree_walk(np, begin, hi, flags, visit, arg);
+}
+
+int
+hfsp_btree_scan_at(struct hfsp_btree * btreep, u_int32_t node, int idx, struct hfsp_record_key * hi,
+                   int flags, hfsp_btree_visit_t visit, void * arg)
+{
+    struct hfsp_node * np;
+    int error;
+
+    error = hfsp_get_btnode_from_idx(btreep, node, &np);
+    if (error)
+        return error;
+    if (np->hn_kind != HFSP_NODE_LEAF)
+    {
+        hfsp_release_btnode(np);
         return EINVAL;
     }
+    return hfsp_btree_walk(np, idx, hi, flags, visit, arg);
+}
+
+/* Key of a batch, with its place in the arrays of the caller */
+struct hfsp_batch_key {
+    struct hfsp_record_key *    hbk_key;
+    int                         hbk_idx;
+};
+
+/* Keys of a batch below a node, a range of the sorted keys */
+struct hfsp_batch_group {
+    u_int32_t                   hbg_node;
+    int                         hbg_lo;
+    int                         hbg_hi;
+};
+
+static int
+hfsp_batch_key_cmp(const void * l, const void * r)
+{
+    return hfsp_brec_key_cmp(((const struct hfsp_batch_key *)l)->hbk_key,
+                             ((const struct hfsp_batch_key *)r)->hbk_key);
+}
+
+int
+hfsp_btree_find_batch(struct hfsp_btree * btreep, struct hfsp_record_key ** keys, int count,
+                      struct hfsp_record ** recs, int * errors)
+{
+    struct hfsp_batch_key * bkeys;
+    struct hfsp_batch_group * groups, * nextGroups, * gp, * tmp;
+    struct hfsp_record * irp, ** rpp;
+    struct hfsp_node * np, ** nps;
+    u_int32_t * nums;
+    int error, i, j, level, ngroups, nnext;
+
+    if (count <= 0)
+        return 0;
+
+    bkeys = malloc(count * (sizeof(*bkeys) + 2 * sizeof(*groups) + sizeof(*nps) + sizeof(*nums)),
+                   M_TEMP, M_WAITOK);
+    groups = (struct hfsp_batch_group *)(bkeys + count);
+    nextGroups = groups + count;
+    nps = (struct hfsp_node **)(nextGroups + count);
+    nums = (u_int32_t *)(nps + count);
+
+    // Sorted keys below a node are contiguous, each node is read once.
+    for (i = 0; i < count; i++)
+    {
+        bkeys[i].hbk_key = keys[i];
+        bkeys[i].hbk_idx = i;
+        errors[i] = ENOENT;
+    }
+    qsort(bkeys, count, sizeof(*bkeys), hfsp_batch_key_cmp);
+
+    groups[0].hbg_node = btreep->hb_rootNode;
+    groups[0].hbg_lo = 0;
+    groups[0].hbg_hi = count;
+    ngroups = 1;
+    irp = NULL;
+    error = 0;
+
+    for (level = btreep->hb_treeDepth; level >= 1 && error == 0; level--)
+    {
+        // The nodes of a level are read together, contiguous ones in a single I/O.
+        for (j = 0; j < ngroups; j++)
+            nums[j] = groups[j].hbg_node;
+        error = hfsp_get_btnodes(btreep, nums, ngroups, nps);
+        if (error)
+        {
+            HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_find_batch: Getting error %jd reading %jd btnodes.",
+                       error, ngroups);
+            break;
+        }
+
+        nnext = 0;
+        for (j = 0; j < ngroups; j++)
+        {
+            gp = &groups[j];
+            np = nps[j];
+            nps[j] = NULL;
+
+            if (level == 1 && np->hn_kind == HFSP_NODE_LEAF)
+            {
+                for (i = gp->hbg_lo; i < gp->hbg_hi; i++)
+                {
+                    rpp = &recs[bkeys[i].hbk_idx];
+                    hfsp_brec_find(np, bkeys[i].hbk_key, rpp);
+                    if (*rpp == NULL)
+                        continue;
+                    // Same outcome as hfsp_btree_find_exact().
+                    if (hfsp_brec_detach(*rpp, 0) == 0)
+                        errors[bkeys[i].hbk_idx] = hfsp_brec_key_cmp(&(*rpp)->hr_key, bkeys[i].hbk_key) ? ENOENT : 0;
+                }
+            }
+            else if (level > 1 && np->hn_kind == HFSP_NODE_INDEX)
+            {
+                for (i = gp->hbg_lo; i < gp->hbg_hi; i++)
+                {
+                    hfsp_brec_find(np, bkeys[i].hbk_key, &irp);
+                    if (irp == NULL)
+                        break;
+                    if (nnext > 0 && nextGroups[nnext - 1].hbg_node == irp->hr_index)
+                        nextGroups[nnext - 1].hbg_hi = i + 1;
+                    else
+                    {
+                        nextGroups[nnext].hbg_node = irp->hr_index;
+                        nextGroups[nnext].hbg_lo = i;
+                        nextGroups[nnext].hbg_hi = i + 1;
+                        nnext++;
+                    }
+                }
+            }
+            else
+            {
+                HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_find_batch: Invalid node type, level: %jd,%jd",
+                           np->hn_kind, level);
+                error = EINVAL;
+            }
+            hfsp_release_btnode(np);
+            if (error)
+                break;
+        }
+        for (; j < ngroups; j++)
+        {
+            if (nps[j] != NULL)
+                hfsp_release_btnode(nps[j]);
+        }
+
+        if (error || level == 1)
+            break;
+
+        tmp = groups;
+        groups = nextGroups;
+        nextGroups = tmp;
+        ngroups = nnext;
+    }
 
-    // Second step we do the lookup of the record.
-    hfsp_unicode_copy(&rp->hr_thread.hrt_name, &rkp->hk_name);
-    rkp->hk_cnid = rp->hr_thread.hrt_parentCnid;
-    error = hfsp_btree_find(btreep, rkp, recpp);
-    free(rkp, M_HFSPKEY);
+    if (irp != NULL)
+        hfsp_brec_release_record(&irp);
+    free(bkeys, M_TEMP);
     return error;
 }
 
+int
+hfsp_search_key_init(struct hfsp_search_key * skp, hfsp_cnid parent, const char * name, size_t len)
+{
+    int error, ulen;
+
+    error = hfsp_unicode_from_utf8(name, len, skp->hsk_str, nitems(skp->hsk_str), &ulen);
+    if (error)
+        return error;
+
+    skp->hsk_key.hk_len = 0;
+    skp->hsk_key.hk_cnid = parent;
+    skp->hsk_key.hk_nameLen = ulen;
+    skp->hsk_key.hk_nameStr = skp->hsk_str;
+    skp->hsk_key.hk_name = NULL;
+    return 0;
+}
+
 int
 hfsp_brec_key_cmp(struct hfsp_record_key * lkp, struct hfsp_record_key * rkp)
 {
@@ -246,8 +1104,11 @@ hfsp_brec_key_cmp(struct hfsp_record_key * lkp, struct hfsp_record_key * rkp)
     if (lkp->hk_cnid > rkp->hk_cnid)
         return 1;
 
-    return hfsp_unicode_cmp(&lkp->hk_name, &rkp->hk_name);
+    // Interned names are equal only if they are the same.
+    if (lkp->hk_name != NULL && lkp->hk_name == rkp->hk_name)
+        return 0;
 
+    return hfsp_unicode_cmp(lkp->hk_nameStr, lkp->hk_nameLen, rkp->hk_nameStr, rkp->hk_nameLen);
 }
 
 u_int16_t
@@ -300,10 +1161,54 @@ hfsp_brec_catalogue_read_init()
 int
 hfsp_brec_catalogue_read_key(struct hfsp_record * rp, struct hfsp_record_key * rkp)
 {
+    struct hfsp_node * np;
+    u_int16_t offset;
+
+    // Cached nodes have the key header decoded already.
+    np = rp->hr_node;
+    if (np->hn_keyLens != NULL && rp->hr_recIdx < np->hn_numRecords)
+    {
+        rkp->hk_len = np->hn_keyLens[rp->hr_recIdx];
+        rkp->hk_cnid = np->hn_keyCnids[rp->hr_recIdx];
+    }
+    else
+    {
+        rkp->hk_len = hfsp_brec_read_u16(rp, 0);
+        rkp->hk_cnid = hfsp_brec_read_u32(rp, sizeof(rkp->hk_len));
+    }
+    offset = sizeof(rkp->hk_len) + sizeof(rkp->hk_cnid);
+    rkp->hk_nameLen = hfsp_brec_read_u16(rp, offset);
+    offset += sizeof(rkp->hk_nameLen);
+    if (rkp->hk_nameLen > HFSP_NAME_MAX ||
+        rp->hr_offset + offset + rkp->hk_nameLen * sizeof(hfsp_unichar) > rp->hr_node->hn_nodeSize)
+    {
+        rkp->hk_nameLen = 0;
+        rkp->hk_nameStr = NULL;
+        return EINVAL;
+    }
+
+    // Zero copy, the name stay in the node.
+    rkp->hk_nameStr = (const hfsp_unichar *)hfsp_brec_read_addr(rp, offset);
+    rkp->hk_name = NULL;
+    return 0;
+}
 
-    rkp->hk_len = hfsp_brec_read_u16(rp, 0);
-    rkp->hk_cnid = hfsp_brec_read_u32(rp, sizeof(rkp->hk_len));
-    return hfsp_brec_read_unistr(rp, sizeof(rkp->hk_len) + sizeof(rkp->hk_cnid), &rkp->hk_name);
+/*
+ * Drop the name references held by a record before it is reused or freed.
+ */
+static void
+hfsp_brec_clear(struct hfsp_record * recp)
+{
+    if (recp->hr_key.hk_name != NULL)
+    {
+        hfsp_name_release(&recp->hr_mount->hm_names, recp->hr_key.hk_name);
+        recp->hr_key.hk_name = NULL;
+    }
+    if (recp->hr_flags & HFSP_RECORD_THREADNAME)
+    {
+        hfsp_name_release(&recp->hr_mount->hm_names, recp->hr_thread.hrt_name);
+        recp->hr_flags &= ~HFSP_RECORD_THREADNAME;
+    }
 }
 
 int
@@ -323,9 +1228,15 @@ hfsp_brec_catalogue_lookup_read(struct hfsp_node * np, int recidx, struct hfsp_r
         }
     }
 
+    hfsp_brec_clear(recp);
     recp->hr_node = np;
+    recp->hr_mount = np->hn_btreep->hb_ip->hi_mount;
     recp->hr_nodeOffset = np->hn_offset;
-    recp->hr_offset = be16toh(*(np->hn_recordTable - (1 + recidx)));
+    recp->hr_recIdx = recidx;
+    if (np->hn_recOffsets != NULL && recidx < np->hn_numRecords)
+        recp->hr_offset = np->hn_recOffsets[recidx];
+    else
+        recp->hr_offset = be16toh(*(np->hn_recordTable - (1 + recidx)));
 
     error = hfsp_brec_catalogue_read_key(recp, &recp->hr_key);
     if (error)
@@ -337,12 +1248,66 @@ hfsp_brec_catalogue_lookup_read(struct hfsp_node * np, int recidx, struct hfsp_r
     return 0;
 }
 
+/*
+ * Search a node with its decoded record table. Only the keys with the parent
+ * of the searched key have their name compared.
+ */
+static int
+hfsp_brec_find_cached(struct hfsp_node * np, struct hfsp_record_key * kp, struct hfsp_record ** recpp)
+{
+    int begin, end, first, rec, error;
+
+    // First record of the parent.
+    begin = 0;
+    end = np->hn_numRecords;
+    while (begin < end)
+    {
+        rec = (begin + end) >> 1;
+        if (np->hn_keyCnids[rec] < kp->hk_cnid)
+            begin = rec + 1;
+        else
+            end = rec;
+    }
+    first = begin;
+
+    // First record past the parent.
+    end = np->hn_numRecords;
+    while (begin < end)
+    {
+        rec = (begin + end) >> 1;
+        if (np->hn_keyCnids[rec] > kp->hk_cnid)
+            end = rec;
+        else
+            begin = rec + 1;
+    }
+    begin = first;
+
+    // First record with a greater name, begin is already past the smaller parents.
+    while (begin < end)
+    {
+        rec = (begin + end) >> 1;
+        error = hfsp_brec_catalogue_lookup_read(np, rec, recpp);
+        if (error)
+            return error;
+        if (hfsp_brec_key_cmp(&(*recpp)->hr_key, kp) <= 0)
+            begin = rec + 1;
+        else
+            end = rec;
+    }
+
+    // The greatest key not after the searched one, or the first one.
+    return np->hn_read(np, begin > 0 ? begin - 1 : 0, recpp);
+}
+
 int
 hfsp_brec_find(struct hfsp_node * np, struct hfsp_record_key * kp, struct hfsp_record ** recpp)
 {
     int begin, end, rec, res, error;
     struct hfsp_record_key * curKeyp;
 
+    if (np->hn_keyCnids != NULL)
+        return hfsp_brec_find_cached(np, kp, recpp);
+
     begin = 0;
     end = np->hn_numRecords - 1;
 
@@ -383,10 +1348,9 @@ done:
 void
 hfsp_copy_record_key(struct hfsp_record_key * dstp, struct hfsp_record_key * srcp)
 {
-    int len;
-
-    len = srcp->hk_len + sizeof(srcp->hk_len);
-    bcopy((void*)srcp, (void*)dstp, len);
+    *dstp = *srcp;
+    if (dstp->hk_name != NULL)
+        hfsp_name_ref(dstp->hk_name);
 }
 
 int
@@ -407,7 +1371,7 @@ hfsp_brec_catalogue_index_read(struct hfsp_node * np, int recidx, struct hfsp_re
         return error;
     recp = *recpp;
 
-    recp->hr_index = hfsp_brec_read_u16(recp, recp->hr_dataOffset);
+    recp->hr_index = hfsp_brec_read_u32(recp, recp->hr_dataOffset);
     return 0;
 }
 
@@ -487,13 +1451,24 @@ hfsp_brec_catalogue_read(struct hfsp_node * np, int recidx, struct hfsp_record *
 int
 hfsp_brec_catalogue_read_thread(struct hfsp_record * recp)
 {
-    int curOffset;
+    u_int16_t len;
+    int curOffset, error;
 
     curOffset = recp->hr_dataOffset + (2 * sizeof(recp->hr_type));
     recp->hr_thread.hrt_parentCnid = hfsp_brec_read_u32(recp, curOffset);
 
     curOffset = curOffset + sizeof(recp->hr_thread.hrt_parentCnid);
-    return hfsp_brec_read_unistr(recp, curOffset, &recp->hr_thread.hrt_name);
+    len = hfsp_brec_read_u16(recp, curOffset);
+    curOffset = curOffset + sizeof(len);
+    if (len > HFSP_NAME_MAX || recp->hr_offset + curOffset + len * sizeof(hfsp_unichar) > recp->hr_node->hn_nodeSize)
+        return EINVAL;
+
+    error = hfsp_name_intern(&recp->hr_mount->hm_names, (const hfsp_unichar *)hfsp_brec_read_addr(recp, curOffset),
+                             len, &recp->hr_thread.hrt_name);
+    if (error)
+        return error;
+    recp->hr_flags |= HFSP_RECORD_THREADNAME;
+    return 0;
 }
 
 int
@@ -529,7 +1504,38 @@ hfsp_brec_catalogue_read_folder(struct hfsp_record * recp)
 int
 hfsp_brec_catalogue_read_file(struct hfsp_record * recp)
 {
-    // XXX Todo.
+    int curOffset;
+    struct HFSPlusBSDInfo * bsdInfo;
+    struct FndrFileInfo * userInfo;
+
+    curOffset = offsetof(struct HFSPlusCatalogFile, flags) + recp->hr_dataOffset;
+    recp->hr_file.hrfi_flags = hfsp_brec_read_u16(recp, curOffset);
+    curOffset = offsetof(struct HFSPlusCatalogFile, fileID) + recp->hr_dataOffset;
+    recp->hr_cnid = hfsp_brec_read_u32(recp, curOffset);
+    curOffset = offsetof(struct HFSPlusCatalogFile, createDate) + recp->hr_dataOffset;
+    recp->hr_file.hrfi_createDate = hfsp_mac2unixtime(hfsp_brec_read_u32(recp, curOffset));
+    curOffset = offsetof(struct HFSPlusCatalogFile, contentModDate) + recp->hr_dataOffset;
+    recp->hr_file.hrfi_lstModifyDate = hfsp_mac2unixtime(hfsp_brec_read_u32(recp, curOffset));
+    curOffset = offsetof(struct HFSPlusCatalogFile, attributeModDate) + recp->hr_dataOffset;
+    recp->hr_file.hrfi_lstChangeTime = hfsp_mac2unixtime(hfsp_brec_read_u32(recp, curOffset));
+    curOffset = offsetof(struct HFSPlusCatalogFile, accessDate) + recp->hr_dataOffset;
+    recp->hr_file.hrfi_lstAccessDate = hfsp_mac2unixtime(hfsp_brec_read_u32(recp, curOffset));
+
+    curOffset = offsetof(struct HFSPlusCatalogFile, bsdInfo) + recp->hr_dataOffset;
+    bsdInfo = (struct HFSPlusBSDInfo *)hfsp_brec_read_addr(recp, curOffset);
+    recp->hr_ownerId = be32toh(bsdInfo->ownerID);
+    recp->hr_groupId = be32toh(bsdInfo->groupID);
+    recp->hr_iNodeNum = be32toh(bsdInfo->special.iNodeNum);
+    recp->hr_fileMode = be16toh(bsdInfo->fileMode);
+
+    curOffset = offsetof(struct HFSPlusCatalogFile, userInfo) + recp->hr_dataOffset;
+    userInfo = (struct FndrFileInfo *)hfsp_brec_read_addr(recp, curOffset);
+    recp->hr_file.hrfi_fdType = be32toh(userInfo->fdType);
+    recp->hr_file.hrfi_fdCreator = be32toh(userInfo->fdCreator);
+
+    curOffset = offsetof(struct HFSPlusCatalogFile, dataFork) + recp->hr_dataOffset;
+    hfsp_fork_decode(&recp->hr_file.hrfi_dataFork,
+                     (struct HFSPlusForkData *)hfsp_brec_read_addr(recp, curOffset));
     return 0;
 }
 
@@ -542,6 +1548,7 @@ hfsp_brec_alloc()
 void
 hfsp_brec_release_record(struct hfsp_record ** rpp)
 {
+    hfsp_brec_clear(*rpp);
     free(*rpp, M_HFSPREC);
     *rpp = NULL;
 }
@@ -46,15 +46,32 @@ struct hfsp_btree {
     u_int16_t           hb_treeDepth;
     u_int32_t           hb_mapNode;
     u_int32_t           hb_firstLeafNode;
+    u_int32_t           hb_lastLeafNode;
     u_int32_t           hb_totalNodes;
     u_int32_t           hb_freeNodes;
     u_int32_t           hb_leafRecords;
+    u_int16_t           hb_maxKeyLength;
+    u_int32_t           hb_attributes;
+    u_int8_t            hb_keyCompareType;
+    u_int16_t           hb_flags;
+    struct sx           hb_txLock;      /* Held by the transaction modifying the btree */
+
+    /* Cache of the decoded nodes */
+    struct mtx                      hb_mtx;
+    LIST_HEAD(, hfsp_node) *        hb_nodeHash;
+    u_long                          hb_nodeMask;
+    TAILQ_HEAD(hfsp_nodelru, hfsp_node) hb_nodeLru;
+    u_int                           hb_nodeCount;
+
+    /* Whole file loaded by hfsp_btree_load(), NULL if nodes are read on demand */
+    u_int8_t *                      hb_image;
+    u_int64_t                       hb_imageSize;
 };
 
 /* In memory node */
 struct hfsp_node {
     struct hfsp_btree * hn_btreep;
-    struct buf *        hn_buffer;          /* Buffer containing the read data */
+    struct buf *        hn_buffer;          /* Buffer containing the read data, NULL if the node holds a copy */
     u_int64_t           hn_offset;          /* Offset from the special file. */
     u_int32_t           hn_next;
     u_int32_t           hn_prev;
@@ -66,13 +83,87 @@ struct hfsp_node {
     u_int8_t            hn_height;
     bool                hn_inMemory;
     btree_record_read_t hn_read;
+
+    /* Cached nodes only */
+    LIST_ENTRY(hfsp_node)   hn_hash;
+    TAILQ_ENTRY(hfsp_node)  hn_lru;
+    u_int32_t           hn_num;
+    u_int               hn_refcnt;
+    u_int16_t           hn_flags;
+
+    /* Host endian copy of the record table and of the keys, NULL if not built */
+    u_int16_t *         hn_recOffsets;
+    u_int16_t *         hn_keyLens;
+    hfsp_cnid *         hn_keyCnids;
+};
+
+/* hb_flags */
+#define HFSP_BTREE_CATALOG      0x0001  /* Keys are a parent CNID then a name, the node table decodes them */
+
+/* hn_flags */
+#define HFSP_NODE_CACHED        0x0001  /* Owned by the node cache of the btree */
+#define HFSP_NODE_STALE         0x0002  /* Rewritten, freed by its last release */
+
+/* BTHeaderRec attributes */
+#define HFSP_BT_BIGKEYS         0x00000002  /* Key length is 16 bits */
+#define HFSP_BT_VARIDXKEYS      0x00000004  /* Index keys are not padded to maxKeyLength */
+
+/* Catalogue search key holding its own name, meant to live on the stack */
+struct hfsp_search_key {
+    struct hfsp_record_key  hsk_key;
+    hfsp_unichar            hsk_str[HFSP_NAME_MAX];
 };
 
 int hfsp_btree_open(struct hfsp_inode * ip, struct hfsp_btree ** btreepp);
 void hfsp_btree_close(struct hfsp_btree * btreep);
+
+/* Nodes read at once by hfsp_btree_prefetch() */
+#define HFSP_PREFETCH_BATCH     64
+
+/*
+ * Copy the numbers of the nodes in the node cache, most recently used first.
+ * nums: Array of at least max entries.
+ * Return the number of nodes copied.
+ */
+int hfsp_btree_cached_nodes(struct hfsp_btree * btreep, u_int32_t * nums, int max);
+
+/*
+ * Read nodes into the node cache, sorted and in coalesced batches. Unknown
+ * nodes are ignored, the array is sorted in place.
+ */
+void hfsp_btree_prefetch(struct hfsp_btree * btreep, u_int32_t * nums, int count);
+
+/*
+ * Read the whole file of a btree in memory, nodes then point into it and are
+ * never read again.
+ * btreep: The btree to load.
+ * maxSize: Size above which the file is not loaded, EFBIG is returned.
+ */
+int hfsp_btree_load(struct hfsp_btree * btreep, u_int64_t maxSize);
 void hfsp_release_btnode(struct hfsp_node * np);
+
+/*
+ * Replace the content of a node written to the disk. The node is dropped from
+ * the node cache, the nodes still held keep the old content until released.
+ * btreep: The btree of the node.
+ * num: The node number.
+ * data: The new content of the node.
+ */
+void hfsp_btree_update_node(struct hfsp_btree * btreep, u_int32_t num, u_int8_t * data);
 int hfsp_get_btnode_from_idx(struct hfsp_btree * btreep, u_int32_t num, struct hfsp_node ** npp);
 int hfsp_get_btnode_from_offset(struct hfsp_btree * btreep, u_int64_t offset, struct hfsp_node ** npp);
+
+/*
+ * Read several nodes, merging the ones that are contiguous on the device into
+ * a single I/O.
+ * btreep: The btree of the nodes.
+ * nums: Array of count node numbers, without duplicates.
+ * count: Number of nodes.
+ * nps: Array of count node pointers, filled on exit. Each node is released with
+ *      hfsp_release_btnode().
+ * Return 0 on success, no node is returned on error.
+ */
+int hfsp_get_btnodes(struct hfsp_btree * btreep, u_int32_t * nums, int count, struct hfsp_node ** nps);
 int hfsp_brec_catalogue_read_key(struct hfsp_record * np, struct hfsp_record_key * rkp);
 
 /*
@@ -90,6 +181,66 @@ void hfsp_copy_record_key(struct hfsp_record_key * dstp, struct hfsp_record_key
  */
 int hfsp_btree_find(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct hfsp_record ** recpp);
 
+/*
+ * Same as hfsp_btree_find but fail with ENOENT if the key is not in the btree.
+ * The record is still returned in that case and must be released.
+ * btree: The btree where to find the record.
+ * kp: The hfsp_record_key structur to find.
+ * recpp: Address to pointer to the hfsp_record that will be fill upon exit.
+ */
+int hfsp_btree_find_exact(struct hfsp_btree * btreep, struct hfsp_record_key * kp, struct hfsp_record ** recpp);
+
+/*
+ * Find the records of several keys with a single descent. The keys are sorted,
+ * each node on the paths is read once and the nodes of a level are read
+ * together with hfsp_get_btnodes().
+ * btreep: The btree where to find the records.
+ * keys: Array of count keys, in any order.
+ * count: Number of keys.
+ * recs: Array of count record pointers. As for hfsp_btree_find, NULL ones are
+ *       allocated and all must be released.
+ * errors: Array of count errors, set as hfsp_btree_find_exact would return.
+ * Return 0 unless a node could not be read.
+ */
+int hfsp_btree_find_batch(struct hfsp_btree * btreep, struct hfsp_record_key ** keys, int count,
+                          struct hfsp_record ** recs, int * errors);
+
+/*
+ * Visitor of a range scan. The record is a view in the node, it is only valid
+ * until the visitor returns.
+ * rp: The record, hr_nodeOffset and hr_recIdx give its position.
+ * arg: Argument given to the scan.
+ * Return 0 to continue, EJUSTRETURN to stop the scan or an error.
+ */
+typedef int (*hfsp_btree_visit_t)(struct hfsp_record * rp, void * arg);
+
+/* Range scan flags */
+#define HFSP_SCAN_KEYS          0x0001  /* Only the keys are read */
+
+/*
+ * Visit in order the records with a key in [lo, hi). The leaf of lo is found
+ * with one descent, then the leaves are followed, holding a single node at a time.
+ * btreep: The btree to scan.
+ * lo: The first key.
+ * hi: The key ending the scan, NULL to scan until the last record.
+ * flags: HFSP_SCAN_* flags.
+ * visit: Called for each record.
+ * arg: Argument of the visitor.
+ * Return 0 at the end of the range, EJUSTRETURN if the visitor stopped the scan,
+ * or an error.
+ */
+int hfsp_btree_scan(struct hfsp_btree * btreep, struct hfsp_record_key * lo, struct hfsp_record_key * hi,
+                    int flags, hfsp_btree_visit_t visit, void * arg);
+
+/*
+ * Same as hfsp_btree_scan but start from a position in a leaf node, as
+ * returned in the records of a previous scan.
+ * node: Number of the leaf node.
+ * idx: Index of the first record, the next node is used past the last record.
+ */
+int hfsp_btree_scan_at(struct hfsp_btree * btreep, u_int32_t node, int idx, struct hfsp_record_key * hi,
+                       int flags, hfsp_btree_visit_t visit, void * arg);
+
 /*
  * Find a record for a given cnid.
  * btree: The btree where to find the record.
@@ -98,6 +249,16 @@ int hfsp_btree_find(struct hfsp_btree * btreep, struct hfsp_record_key * kp, str
  */
 int hfsp_btree_find_cnid(struct hfsp_btree * btreep, hfsp_cnid cnid, struct hfsp_record ** recpp);
 
+/*
+ * Build the catalogue key of a path component, converting the UTF-8 name to
+ * the decomposed form of the catalogue.
+ * skp: The search key to fill.
+ * parent: The CNID of the folder.
+ * name, len: The component name.
+ * Return EINVAL if the name is not valid UTF-8.
+ */
+int hfsp_search_key_init(struct hfsp_search_key * skp, hfsp_cnid parent, const char * name, size_t len);
+
 /*
  * Compare record key.
  * XXX Todo the HFSX case sensitive comparaison.
@@ -0,0 +1,1413 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/endian.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/tree.h>
+#include <sys/vnode.h>
+
+#include <geom/geom.h>
+
+#include "hfsp.h"
+#include "hfsp_btree.h"
+#include "hfsp_btwrite.h"
+#include "hfsp_jwrite.h"
+#include "hfsp_trace.h"
+#include "hfsp_unicode.h"
+
+MALLOC_DEFINE(M_HFSPBTTX, "hfsp_bttx", "HFS+ B-tree transaction");
+
+static int hfsp_btree_check_commit = 0;
+SYSCTL_INT(_vfs_hfsp, OID_AUTO, btree_check, CTLFLAG_RW, &hfsp_btree_check_commit, 0,
+           "Check the invariants of a B-tree after each commit");
+
+static u_long hfsp_bttx_nodes;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, bttx_nodes, CTLFLAG_RD, &hfsp_bttx_nodes, 0,
+             "B-tree nodes written by transactions");
+
+static u_long hfsp_bttx_writes;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, bttx_writes, CTLFLAG_RD, &hfsp_bttx_writes, 0,
+             "Writes of B-tree nodes, contiguous nodes are written at once");
+
+/* Copy of a node owned by a transaction, followed by the node */
+struct hfsp_btshadow {
+    RB_ENTRY(hfsp_btshadow)     hbs_entry;
+    u_int32_t                   hbs_num;
+    int                         hbs_dirty;
+};
+
+#define HFSP_BTSHADOW_DATA(sp)  ((u_int8_t *)((sp) + 1))
+
+struct hfsp_bttx {
+    struct hfsp_btree *                     htx_btreep;
+    hfsp_btkey_cmp_t                        htx_cmp;
+    RB_HEAD(hfsp_btshadows, hfsp_btshadow)  htx_nodes;
+    u_int                                   htx_dirty;
+    int                                     htx_error;  /* The copies are inconsistent, only abort */
+
+    /* Header record, written with the header node */
+    u_int32_t                               htx_rootNode;
+    u_int16_t                               htx_treeDepth;
+    u_int32_t                               htx_leafRecords;
+    u_int32_t                               htx_firstLeafNode;
+    u_int32_t                               htx_lastLeafNode;
+    u_int32_t                               htx_freeNodes;
+};
+
+/* A record of a node being rebuilt */
+struct hfsp_btrecref {
+    const u_int8_t *            hbr_data;
+    int                         hbr_len;
+};
+
+/* Largest key, with its length */
+#define HFSP_BTKEY_MAX          (sizeof(u_int16_t) + 516)
+
+static int
+hfsp_btshadow_cmp(struct hfsp_btshadow * l, struct hfsp_btshadow * r)
+{
+    return l->hbs_num < r->hbs_num ? -1 : l->hbs_num > r->hbs_num;
+}
+
+RB_GENERATE_STATIC(hfsp_btshadows, hfsp_btshadow, hbs_entry, hfsp_btshadow_cmp);
+
+int
+hfsp_btkey_catalog_cmp(const u_int8_t * lkp, const u_int8_t * rkp)
+{
+    u_int32_t lparent, rparent;
+
+    lparent = be32dec(lkp + 2);
+    rparent = be32dec(rkp + 2);
+    if (lparent != rparent)
+        return lparent < rparent ? -1 : 1;
+    return hfsp_unicode_cmp((const hfsp_unichar *)(lkp + 8), be16dec(lkp + 6),
+                            (const hfsp_unichar *)(rkp + 8), be16dec(rkp + 6));
+}
+
+int
+hfsp_btkey_extent_cmp(const u_int8_t * lkp, const u_int8_t * rkp)
+{
+    u_int32_t l, r;
+
+    // File, fork type then start block.
+    l = be32dec(lkp + 4);
+    r = be32dec(rkp + 4);
+    if (l == r)
+    {
+        l = lkp[2];
+        r = rkp[2];
+    }
+    if (l == r)
+    {
+        l = be32dec(lkp + 8);
+        r = be32dec(rkp + 8);
+    }
+    return l < r ? -1 : l > r;
+}
+
+/*
+ * Raw node accessors. The record offsets are at the end of the node, in
+ * reverse order, the one past the last record is the start of the free space.
+ */
+#define HFSP_ND_DESC(nd)        ((struct BTNodeDescriptor *)(nd))
+
+static __inline int
+hfsp_nd_count(u_int8_t * nd)
+{
+    return be16toh(HFSP_ND_DESC(nd)->numRecords);
+}
+
+static __inline u_int16_t
+hfsp_nd_offset(struct hfsp_btree * btreep, u_int8_t * nd, int i)
+{
+    return be16dec(nd + btreep->hb_nodeSize - sizeof(u_int16_t) * (i + 1));
+}
+
+static __inline void
+hfsp_nd_set_offset(struct hfsp_btree * btreep, u_int8_t * nd, int i, u_int16_t offset)
+{
+    be16enc(nd + btreep->hb_nodeSize - sizeof(u_int16_t) * (i + 1), offset);
+}
+
+static __inline u_int8_t *
+hfsp_nd_rec(struct hfsp_btree * btreep, u_int8_t * nd, int i)
+{
+    return nd + hfsp_nd_offset(btreep, nd, i);
+}
+
+static __inline int
+hfsp_nd_reclen(struct hfsp_btree * btreep, u_int8_t * nd, int i)
+{
+    return hfsp_nd_offset(btreep, nd, i + 1) - hfsp_nd_offset(btreep, nd, i);
+}
+
+static __inline int
+hfsp_nd_free(struct hfsp_btree * btreep, u_int8_t * nd)
+{
+    int n;
+
+    n = hfsp_nd_count(nd);
+    return btreep->hb_nodeSize - sizeof(u_int16_t) * (n + 1) - hfsp_nd_offset(btreep, nd, n);
+}
+
+/* Space for the records of a node and their offsets */
+#define HFSP_ND_SPACE(btreep)   ((btreep)->hb_nodeSize - sizeof(struct BTNodeDescriptor) - sizeof(u_int16_t))
+
+/* Size of a key with its length, padded to keep the data aligned */
+static __inline int
+hfsp_btkey_size(const u_int8_t * key)
+{
+    return roundup2(sizeof(u_int16_t) + be16dec(key), 2);
+}
+
+/* Child of an index record */
+static __inline u_int32_t
+hfsp_nd_child(struct hfsp_btree * btreep, u_int8_t * nd, int i)
+{
+    u_int8_t * rec;
+
+    rec = hfsp_nd_rec(btreep, nd, i);
+    return be32dec(rec + hfsp_btkey_size(rec));
+}
+
+static void
+hfsp_nd_init(struct hfsp_btree * btreep, u_int8_t * nd, __int8_t kind, u_int8_t height)
+{
+    bzero(nd, btreep->hb_nodeSize);
+    HFSP_ND_DESC(nd)->kind = kind;
+    HFSP_ND_DESC(nd)->height = height;
+    hfsp_nd_set_offset(btreep, nd, 0, sizeof(struct BTNodeDescriptor));
+}
+
+/*
+ * Insert a record at an index, the caller checked that it fits.
+ */
+static void
+hfsp_nd_insert(struct hfsp_btree * btreep, u_int8_t * nd, int i, const u_int8_t * rec, int len)
+{
+    u_int16_t start, end;
+    int n, j;
+
+    n = hfsp_nd_count(nd);
+    start = hfsp_nd_offset(btreep, nd, i);
+    end = hfsp_nd_offset(btreep, nd, n);
+    bcopy(nd + start, nd + start + len, end - start);
+    memcpy(nd + start, rec, len);
+    for (j = n; j >= i; j--)
+        hfsp_nd_set_offset(btreep, nd, j + 1, hfsp_nd_offset(btreep, nd, j) + len);
+    HFSP_ND_DESC(nd)->numRecords = htobe16(n + 1);
+}
+
+static void
+hfsp_nd_remove(struct hfsp_btree * btreep, u_int8_t * nd, int i)
+{
+    u_int16_t start, end;
+    int n, j, len;
+
+    n = hfsp_nd_count(nd);
+    start = hfsp_nd_offset(btreep, nd, i);
+    end = hfsp_nd_offset(btreep, nd, n);
+    len = hfsp_nd_offset(btreep, nd, i + 1) - start;
+    bcopy(nd + start + len, nd + start, end - start - len);
+    bzero(nd + end - len, len);
+    for (j = i + 1; j <= n; j++)
+        hfsp_nd_set_offset(btreep, nd, j - 1, hfsp_nd_offset(btreep, nd, j) - len);
+    hfsp_nd_set_offset(btreep, nd, n, 0);
+    HFSP_ND_DESC(nd)->numRecords = htobe16(n - 1);
+}
+
+/*
+ * Binary search of a key in a node.
+ * exactp: Set on exit if the record has the key.
+ * Return the index of the last record not above the key, -1 if all are above.
+ */
+static int
+hfsp_nd_search(struct hfsp_bttx * txp, u_int8_t * nd, const u_int8_t * key, int * exactp)
+{
+    int lo, hi, mid, c;
+
+    *exactp = 0;
+    lo = 0;
+    hi = hfsp_nd_count(nd) - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        c = txp->htx_cmp(hfsp_nd_rec(txp->htx_btreep, nd, mid), key);
+        if (c == 0)
+        {
+            *exactp = 1;
+            return mid;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return hi;
+}
+
+/*
+ * Return the copy of a node in the transaction, reading it on first use.
+ * dirty: The node is going to be modified.
+ */
+static int
+hfsp_bttx_node(struct hfsp_bttx * txp, u_int32_t num, int dirty, u_int8_t ** ndp)
+{
+    struct hfsp_btree * btreep;
+    struct hfsp_btshadow key, * sp;
+    struct hfsp_node * np;
+    int error;
+
+    btreep = txp->htx_btreep;
+    key.hbs_num = num;
+    sp = RB_FIND(hfsp_btshadows, &txp->htx_nodes, &key);
+    if (sp == NULL)
+    {
+        if (num >= btreep->hb_totalNodes)
+            return EINVAL;
+        error = hfsp_get_btnode_from_idx(btreep, num, &np);
+        if (error)
+            return error;
+        sp = malloc(sizeof(*sp) + btreep->hb_nodeSize, M_HFSPBTTX, M_WAITOK);
+        sp->hbs_num = num;
+        sp->hbs_dirty = 0;
+        memcpy(HFSP_BTSHADOW_DATA(sp), np->hn_beginBuf, btreep->hb_nodeSize);
+        hfsp_release_btnode(np);
+        RB_INSERT(hfsp_btshadows, &txp->htx_nodes, sp);
+    }
+    if (dirty && !sp->hbs_dirty)
+    {
+        sp->hbs_dirty = 1;
+        txp->htx_dirty++;
+    }
+    *ndp = HFSP_BTSHADOW_DATA(sp);
+    return 0;
+}
+
+/*
+ * Find the bit of a node in the map records, the one of the header node then
+ * the ones of the map nodes.
+ * mapNodep: The node holding the bit on exit, to be marked dirty if it changes.
+ * bytep, maskp: The byte of the map and the bit on exit.
+ */
+static int
+hfsp_bttx_map_bit(struct hfsp_bttx * txp, u_int32_t num, u_int32_t * mapNodep, u_int8_t ** bytep,
+                  u_int8_t * maskp)
+{
+    struct hfsp_btree * btreep;
+    u_int8_t * nd;
+    u_int32_t mapNode, base;
+    int error, rec, len;
+
+    btreep = txp->htx_btreep;
+    mapNode = 0;
+    base = 0;
+    while (1)
+    {
+        error = hfsp_bttx_node(txp, mapNode, 0, &nd);
+        if (error)
+            return error;
+        rec = mapNode == 0 ? 2 : 0;
+        if (hfsp_nd_count(nd) <= rec)
+            return EINVAL;
+        len = hfsp_nd_reclen(btreep, nd, rec);
+        if (num < base + len * NBBY)
+        {
+            *mapNodep = mapNode;
+            *bytep = hfsp_nd_rec(btreep, nd, rec) + (num - base) / NBBY;
+            *maskp = 0x80 >> ((num - base) % NBBY);
+            return 0;
+        }
+        base += len * NBBY;
+        mapNode = be32toh(HFSP_ND_DESC(nd)->fLink);
+        if (mapNode == 0)
+            return EINVAL;
+    }
+}
+
+/*
+ * Allocate a node from the map and initialize its copy.
+ */
+static int
+hfsp_bttx_alloc_node(struct hfsp_bttx * txp, __int8_t kind, u_int8_t height, u_int32_t * nump, u_int8_t ** ndp)
+{
+    struct hfsp_btree * btreep;
+    struct hfsp_btshadow key, * sp;
+    u_int8_t * byte, * nd, mask;
+    u_int32_t num, mapNode;
+    int error;
+
+    btreep = txp->htx_btreep;
+    if (txp->htx_freeNodes == 0)
+        return ENOSPC;
+
+    // Byte by byte, the map is only walked again for the next byte.
+    for (num = 1; num < btreep->hb_totalNodes; num++)
+    {
+        error = hfsp_bttx_map_bit(txp, num, &mapNode, &byte, &mask);
+        if (error)
+            return error;
+        if (*byte == 0xff)
+        {
+            num |= NBBY - 1;
+            continue;
+        }
+        if ((*byte & mask) == 0)
+            break;
+    }
+    if (num >= btreep->hb_totalNodes)
+        return ENOSPC;
+    error = hfsp_bttx_node(txp, mapNode, 1, &nd);
+    if (error)
+        return error;
+    *byte |= mask;
+    txp->htx_freeNodes--;
+
+    // A free node is not read.
+    key.hbs_num = num;
+    sp = RB_FIND(hfsp_btshadows, &txp->htx_nodes, &key);
+    if (sp == NULL)
+    {
+        sp = malloc(sizeof(*sp) + btreep->hb_nodeSize, M_HFSPBTTX, M_WAITOK);
+        sp->hbs_num = num;
+        sp->hbs_dirty = 0;
+        RB_INSERT(hfsp_btshadows, &txp->htx_nodes, sp);
+    }
+    if (!sp->hbs_dirty)
+    {
+        sp->hbs_dirty = 1;
+        txp->htx_dirty++;
+    }
+    hfsp_nd_init(btreep, HFSP_BTSHADOW_DATA(sp), kind, height);
+    *nump = num;
+    *ndp = HFSP_BTSHADOW_DATA(sp);
+    return 0;
+}
+
+static int
+hfsp_bttx_free_node(struct hfsp_bttx * txp, u_int32_t num)
+{
+    u_int8_t * byte, * nd, mask;
+    u_int32_t mapNode;
+    int error;
+
+    error = hfsp_bttx_map_bit(txp, num, &mapNode, &byte, &mask);
+    if (error)
+        return error;
+    if ((*byte & mask) == 0)
+        return EINVAL;
+    error = hfsp_bttx_node(txp, mapNode, 1, &nd);
+    if (error)
+        return error;
+    *byte &= ~mask;
+    txp->htx_freeNodes++;
+
+    error = hfsp_bttx_node(txp, num, 1, &nd);
+    if (error)
+        return error;
+    bzero(nd, txp->htx_btreep->hb_nodeSize);
+    return 0;
+}
+
+/*
+ * Find the node of a given height covering a key.
+ * height: The height of the node, 1 for the leaves.
+ * nump: The node on exit.
+ * idxp: The index of the last record not above the key on exit, -1 if none.
+ * exactp: Set on exit if the record has the key.
+ */
+static int
+hfsp_bttx_descend(struct hfsp_bttx * txp, const u_int8_t * key, int height, u_int32_t * nump, int * idxp,
+                  int * exactp)
+{
+    struct hfsp_btree * btreep;
+    u_int8_t * nd;
+    u_int32_t num;
+    int error, h, idx;
+
+    btreep = txp->htx_btreep;
+    num = txp->htx_rootNode;
+    for (h = txp->htx_treeDepth; h >= height; h--)
+    {
+        error = hfsp_bttx_node(txp, num, 0, &nd);
+        if (error)
+            return error;
+        if (HFSP_ND_DESC(nd)->height != h ||
+            HFSP_ND_DESC(nd)->kind != (h == 1 ? HFSP_NODE_LEAF : HFSP_NODE_INDEX))
+        {
+            HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_bttx_descend: Node %ju has height %jd kind %jd, expected height %jd.",
+                       num, HFSP_ND_DESC(nd)->height, HFSP_ND_DESC(nd)->kind, h);
+            return EINVAL;
+        }
+        idx = hfsp_nd_search(txp, nd, key, exactp);
+        if (h == height)
+        {
+            *nump = num;
+            *idxp = idx;
+            return 0;
+        }
+        if (hfsp_nd_count(nd) == 0)
+            return EINVAL;
+        num = hfsp_nd_child(btreep, nd, MAX(idx, 0));
+    }
+    return EINVAL;
+}
+
+/*
+ * Build the index record pointing to a child from the first key of the child.
+ * Unless the btree has variable index keys, the key is padded to maxKeyLength.
+ * Return the size of the record.
+ */
+static int
+hfsp_bttx_index_rec(struct hfsp_bttx * txp, const u_int8_t * key, u_int32_t child, u_int8_t * rec)
+{
+    struct hfsp_btree * btreep;
+    int keySize;
+
+    btreep = txp->htx_btreep;
+    if (btreep->hb_attributes & HFSP_BT_VARIDXKEYS)
+    {
+        keySize = hfsp_btkey_size(key);
+        bzero(rec, keySize);
+        memcpy(rec, key, sizeof(u_int16_t) + be16dec(key));
+    }
+    else
+    {
+        keySize = roundup2(sizeof(u_int16_t) + btreep->hb_maxKeyLength, 2);
+        bzero(rec, keySize);
+        memcpy(rec, key, sizeof(u_int16_t) + MIN(be16dec(key), btreep->hb_maxKeyLength));
+        be16enc(rec, btreep->hb_maxKeyLength);
+    }
+    be32enc(rec + keySize, child);
+    return keySize + sizeof(u_int32_t);
+}
+
+/*
+ * Copy the key of a record, it is kept across modifications of its node.
+ */
+static u_int8_t *
+hfsp_btkey_dup(const u_int8_t * rec)
+{
+    u_int8_t * key;
+    int len;
+
+    len = MIN(sizeof(u_int16_t) + be16dec(rec), HFSP_BTKEY_MAX);
+    key = malloc(HFSP_BTKEY_MAX, M_TEMP, M_WAITOK);
+    memcpy(key, rec, len);
+    be16enc(key, len - sizeof(u_int16_t));
+    return key;
+}
+
+/*
+ * Append the records of a node to an array.
+ */
+static int
+hfsp_bttx_gather(struct hfsp_btree * btreep, u_int8_t * nd, struct hfsp_btrecref * recs, int n)
+{
+    int i;
+
+    for (i = 0; i < hfsp_nd_count(nd); i++, n++)
+    {
+        recs[n].hbr_data = hfsp_nd_rec(btreep, nd, i);
+        recs[n].hbr_len = hfsp_nd_reclen(btreep, nd, i);
+    }
+    return n;
+}
+
+/*
+ * Rebuild a node with records, keeping its descriptor.
+ */
+static void
+hfsp_bttx_fill(struct hfsp_btree * btreep, u_int8_t * nd, struct hfsp_btrecref * recs, int n)
+{
+    struct BTNodeDescriptor desc;
+    int i;
+
+    desc = *HFSP_ND_DESC(nd);
+    hfsp_nd_init(btreep, nd, desc.kind, desc.height);
+    HFSP_ND_DESC(nd)->fLink = desc.fLink;
+    HFSP_ND_DESC(nd)->bLink = desc.bLink;
+    for (i = 0; i < n; i++)
+        hfsp_nd_insert(btreep, nd, i, recs[i].hbr_data, recs[i].hbr_len);
+}
+
+/*
+ * Share records between two nodes, about half of the bytes in each, none empty.
+ * The records must not point into the nodes.
+ */
+static int
+hfsp_bttx_distribute(struct hfsp_btree * btreep, struct hfsp_btrecref * recs, int n, u_int8_t * lnd, u_int8_t * rnd)
+{
+    int i, k, total, left, space;
+
+    space = HFSP_ND_SPACE(btreep);
+    for (total = 0, i = 0; i < n; i++)
+        total += recs[i].hbr_len + sizeof(u_int16_t);
+
+    for (left = 0, k = 0; k < n && left + recs[k].hbr_len + (int)sizeof(u_int16_t) <= total / 2; k++)
+        left += recs[k].hbr_len + sizeof(u_int16_t);
+    for (; k < n && total - left > space; k++)
+        left += recs[k].hbr_len + sizeof(u_int16_t);
+    if (k == 0)
+        left = recs[k++].hbr_len + sizeof(u_int16_t);
+    else if (k == n)
+        left -= recs[--k].hbr_len + sizeof(u_int16_t);
+    if (n < 2 || left > space || total - left > space)
+        return EINVAL;
+
+    hfsp_bttx_fill(btreep, lnd, recs, k);
+    hfsp_bttx_fill(btreep, rnd, recs + k, n - k);
+    return 0;
+}
+
+static int hfsp_bttx_put(struct hfsp_bttx * txp, u_int32_t num, int idx, const u_int8_t * rec, int len);
+
+/*
+ * Replace the key of the index record of a node whose first key changed.
+ * height: The height of the node.
+ * oldKey: The previous first key of the node, the one of the index record.
+ * newKey: The first key of the node.
+ */
+static int
+hfsp_bttx_fix_key(struct hfsp_bttx * txp, int height, const u_int8_t * oldKey, const u_int8_t * newKey)
+{
+    struct hfsp_btree * btreep;
+    u_int8_t * nd, * rec;
+    u_int32_t num;
+    int error, idx, exact, len, wasRoot;
+
+    btreep = txp->htx_btreep;
+    if (height >= txp->htx_treeDepth || txp->htx_cmp(oldKey, newKey) == 0)
+        return 0;
+
+    error = hfsp_bttx_descend(txp, oldKey, height + 1, &num, &idx, &exact);
+    if (error)
+        return error;
+    if (!exact)
+        return EINVAL;
+    error = hfsp_bttx_node(txp, num, 1, &nd);
+    if (error)
+        return error;
+
+    // The record may grow, it is inserted again. A root split by it gets a
+    // new root built from the new key.
+    rec = malloc(btreep->hb_nodeSize, M_TEMP, M_WAITOK);
+    len = hfsp_bttx_index_rec(txp, newKey, hfsp_nd_child(btreep, nd, idx), rec);
+    wasRoot = num == txp->htx_rootNode;
+    hfsp_nd_remove(btreep, nd, idx);
+    error = hfsp_bttx_put(txp, num, idx, rec, len);
+    free(rec, M_TEMP);
+
+    // The first key of the parent changed as well.
+    if (error == 0 && idx == 0 && !wasRoot)
+        error = hfsp_bttx_fix_key(txp, height + 1, oldKey, newKey);
+    return error;
+}
+
+/*
+ * Split a full node in two while inserting a record. The new node gets the
+ * upper half, its index record is inserted in the parent, a new root is added
+ * when the root is split.
+ */
+static int
+hfsp_bttx_split(struct hfsp_bttx * txp, u_int32_t num, int idx, const u_int8_t * rec, int len)
+{
+    struct hfsp_btree * btreep;
+    struct hfsp_btrecref * recs;
+    struct BTNodeDescriptor * ldesc, * rdesc;
+    u_int8_t * copy, * lnd, * rnd, * nnd, * sep, * lrec;
+    u_int32_t rnum, next, root, pnum;
+    int error, n, seplen, llen, pidx, exact;
+
+    btreep = txp->htx_btreep;
+    error = hfsp_bttx_node(txp, num, 1, &lnd);
+    if (error)
+        return error;
+    ldesc = HFSP_ND_DESC(lnd);
+    error = hfsp_bttx_alloc_node(txp, ldesc->kind, ldesc->height, &rnum, &rnd);
+    if (error)
+        return error;
+    rdesc = HFSP_ND_DESC(rnd);
+
+    // All the records with the new one, from a copy of the node.
+    n = hfsp_nd_count(lnd);
+    copy = malloc(btreep->hb_nodeSize, M_TEMP, M_WAITOK);
+    memcpy(copy, lnd, btreep->hb_nodeSize);
+    recs = malloc((n + 1) * sizeof(*recs), M_TEMP, M_WAITOK);
+    hfsp_bttx_gather(btreep, copy, recs, 0);
+    bcopy(recs + idx, recs + idx + 1, (n - idx) * sizeof(*recs));
+    recs[idx].hbr_data = rec;
+    recs[idx].hbr_len = len;
+    error = hfsp_bttx_distribute(btreep, recs, n + 1, lnd, rnd);
+    free(recs, M_TEMP);
+    free(copy, M_TEMP);
+    if (error)
+        return error;
+
+    // Link the new node after the split one.
+    next = be32toh(ldesc->fLink);
+    rdesc->fLink = ldesc->fLink;
+    rdesc->bLink = htobe32(num);
+    ldesc->fLink = htobe32(rnum);
+    if (next != 0)
+    {
+        error = hfsp_bttx_node(txp, next, 1, &nnd);
+        if (error)
+            return error;
+        HFSP_ND_DESC(nnd)->bLink = htobe32(rnum);
+    }
+    if (ldesc->kind == HFSP_NODE_LEAF && txp->htx_lastLeafNode == num)
+        txp->htx_lastLeafNode = rnum;
+
+    sep = malloc(2 * btreep->hb_nodeSize, M_TEMP, M_WAITOK);
+    lrec = sep + btreep->hb_nodeSize;
+    seplen = hfsp_bttx_index_rec(txp, hfsp_nd_rec(btreep, rnd, 0), rnum, sep);
+    if (num == txp->htx_rootNode)
+    {
+        // The tree grows by the root.
+        error = hfsp_bttx_alloc_node(txp, HFSP_NODE_INDEX, ldesc->height + 1, &root, &nnd);
+        if (error == 0)
+        {
+            llen = hfsp_bttx_index_rec(txp, hfsp_nd_rec(btreep, lnd, 0), num, lrec);
+            hfsp_nd_insert(btreep, nnd, 0, lrec, llen);
+            hfsp_nd_insert(btreep, nnd, 1, sep, seplen);
+            txp->htx_rootNode = root;
+            txp->htx_treeDepth++;
+        }
+    }
+    else
+    {
+        // The key of the new node leads to the index record of the split one.
+        error = hfsp_bttx_descend(txp, hfsp_nd_rec(btreep, rnd, 0), ldesc->height + 1, &pnum, &pidx, &exact);
+        if (error == 0)
+            error = hfsp_bttx_put(txp, pnum, pidx + 1, sep, seplen);
+    }
+    free(sep, M_TEMP);
+    return error;
+}
+
+/*
+ * Insert a record in a node, splitting it if it is full. The index records
+ * are not updated.
+ */
+static int
+hfsp_bttx_put(struct hfsp_bttx * txp, u_int32_t num, int idx, const u_int8_t * rec, int len)
+{
+    struct hfsp_btree * btreep;
+    u_int8_t * nd;
+    int error;
+
+    btreep = txp->htx_btreep;
+    error = hfsp_bttx_node(txp, num, 1, &nd);
+    if (error)
+        return error;
+    if (hfsp_nd_free(btreep, nd) >= len + (int)sizeof(u_int16_t))
+    {
+        hfsp_nd_insert(btreep, nd, idx, rec, len);
+        return 0;
+    }
+    return hfsp_bttx_split(txp, num, idx, rec, len);
+}
+
+static int hfsp_bttx_remove_at(struct hfsp_bttx * txp, u_int32_t num, int idx);
+
+/*
+ * Merge a node less than half full with a sibling, or balance the records
+ * between them when they do not fit in one node.
+ */
+static int
+hfsp_bttx_rebalance(struct hfsp_bttx * txp, u_int32_t num)
+{
+    struct hfsp_btree * btreep;
+    struct hfsp_btrecref * recs;
+    u_int8_t * nd, * lnd, * rnd, * copy, * oldKey;
+    u_int32_t lnum, rnum, next, pnum;
+    int error, n, height, pidx, exact;
+
+    btreep = txp->htx_btreep;
+    error = hfsp_bttx_node(txp, num, 0, &nd);
+    if (error)
+        return error;
+    if (num == txp->htx_rootNode || hfsp_nd_free(btreep, nd) <= btreep->hb_nodeSize / 2)
+        return 0;
+
+    if (HFSP_ND_DESC(nd)->fLink != 0)
+    {
+        lnum = num;
+        rnum = be32toh(HFSP_ND_DESC(nd)->fLink);
+    }
+    else if (HFSP_ND_DESC(nd)->bLink != 0)
+    {
+        lnum = be32toh(HFSP_ND_DESC(nd)->bLink);
+        rnum = num;
+    }
+    else
+        return 0;
+
+    if ((error = hfsp_bttx_node(txp, lnum, 1, &lnd)) != 0 ||
+        (error = hfsp_bttx_node(txp, rnum, 1, &rnd)) != 0)
+        return error;
+    height = HFSP_ND_DESC(rnd)->height;
+    if (hfsp_nd_count(rnd) == 0)
+        return EINVAL;
+
+    copy = malloc(2 * btreep->hb_nodeSize, M_TEMP, M_WAITOK);
+    memcpy(copy, lnd, btreep->hb_nodeSize);
+    memcpy(copy + btreep->hb_nodeSize, rnd, btreep->hb_nodeSize);
+    n = hfsp_nd_count(lnd) + hfsp_nd_count(rnd);
+    recs = malloc(n * sizeof(*recs), M_TEMP, M_WAITOK);
+    hfsp_bttx_gather(btreep, copy + btreep->hb_nodeSize, recs, hfsp_bttx_gather(btreep, copy, recs, 0));
+    oldKey = hfsp_btkey_dup(hfsp_nd_rec(btreep, rnd, 0));
+
+    if (hfsp_nd_free(btreep, lnd) + hfsp_nd_free(btreep, rnd) >= (int)HFSP_ND_SPACE(btreep))
+    {
+        // Both fit in the left node, the right one is unlinked and freed.
+        hfsp_bttx_fill(btreep, lnd, recs, n);
+        next = be32toh(HFSP_ND_DESC(rnd)->fLink);
+        HFSP_ND_DESC(lnd)->fLink = HFSP_ND_DESC(rnd)->fLink;
+        if (next != 0)
+        {
+            error = hfsp_bttx_node(txp, next, 1, &nd);
+            if (error)
+                goto out;
+            HFSP_ND_DESC(nd)->bLink = htobe32(lnum);
+        }
+        if (height == 1 && txp->htx_lastLeafNode == rnum)
+            txp->htx_lastLeafNode = lnum;
+        error = hfsp_bttx_free_node(txp, rnum);
+        if (error)
+            goto out;
+        error = hfsp_bttx_descend(txp, oldKey, height + 1, &pnum, &pidx, &exact);
+        if (error == 0 && !exact)
+            error = EINVAL;
+        if (error == 0)
+            error = hfsp_bttx_remove_at(txp, pnum, pidx);
+    }
+    else
+    {
+        error = hfsp_bttx_distribute(btreep, recs, n, lnd, rnd);
+        if (error == 0)
+            error = hfsp_bttx_fix_key(txp, height, oldKey, hfsp_nd_rec(btreep, rnd, 0));
+    }
+
+out:
+    free(oldKey, M_TEMP);
+    free(recs, M_TEMP);
+    free(copy, M_TEMP);
+    return error;
+}
+
+/*
+ * Shrink the tree while the root is an index node with a single child.
+ */
+static int
+hfsp_bttx_collapse(struct hfsp_bttx * txp)
+{
+    struct hfsp_btree * btreep;
+    u_int8_t * nd;
+    u_int32_t root;
+    int error;
+
+    btreep = txp->htx_btreep;
+    while (txp->htx_rootNode != 0)
+    {
+        root = txp->htx_rootNode;
+        error = hfsp_bttx_node(txp, root, 0, &nd);
+        if (error)
+            return error;
+        if (HFSP_ND_DESC(nd)->kind == HFSP_NODE_LEAF && hfsp_nd_count(nd) == 0)
+        {
+            txp->htx_rootNode = 0;
+            txp->htx_treeDepth = 0;
+            txp->htx_firstLeafNode = 0;
+            txp->htx_lastLeafNode = 0;
+        }
+        else if (HFSP_ND_DESC(nd)->kind == HFSP_NODE_INDEX && hfsp_nd_count(nd) == 1)
+        {
+            txp->htx_rootNode = hfsp_nd_child(btreep, nd, 0);
+            txp->htx_treeDepth--;
+        }
+        else
+            return 0;
+        error = hfsp_bttx_free_node(txp, root);
+        if (error)
+            return error;
+    }
+    return 0;
+}
+
+/*
+ * Remove a record from a node. An empty node is unlinked, freed and its index
+ * record removed, otherwise the index record follows the first key.
+ */
+static int
+hfsp_bttx_remove_at(struct hfsp_bttx * txp, u_int32_t num, int idx)
+{
+    struct hfsp_btree * btreep;
+    struct BTNodeDescriptor * desc;
+    u_int8_t * nd, * snd, * oldKey;
+    u_int32_t prev, next, pnum;
+    int error, height, pidx, exact;
+
+    btreep = txp->htx_btreep;
+    error = hfsp_bttx_node(txp, num, 1, &nd);
+    if (error)
+        return error;
+    desc = HFSP_ND_DESC(nd);
+    height = desc->height;
+    oldKey = hfsp_btkey_dup(hfsp_nd_rec(btreep, nd, 0));
+    hfsp_nd_remove(btreep, nd, idx);
+
+    if (num == txp->htx_rootNode)
+    {
+        error = hfsp_bttx_collapse(txp);
+        goto out;
+    }
+
+    if (hfsp_nd_count(nd) == 0)
+    {
+        prev = be32toh(desc->bLink);
+        next = be32toh(desc->fLink);
+        if (prev != 0)
+        {
+            if ((error = hfsp_bttx_node(txp, prev, 1, &snd)) != 0)
+                goto out;
+            HFSP_ND_DESC(snd)->fLink = htobe32(next);
+        }
+        if (next != 0)
+        {
+            if ((error = hfsp_bttx_node(txp, next, 1, &snd)) != 0)
+                goto out;
+            HFSP_ND_DESC(snd)->bLink = htobe32(prev);
+        }
+        if (height == 1 && txp->htx_firstLeafNode == num)
+            txp->htx_firstLeafNode = next;
+        if (height == 1 && txp->htx_lastLeafNode == num)
+            txp->htx_lastLeafNode = prev;
+        if ((error = hfsp_bttx_free_node(txp, num)) != 0)
+            goto out;
+
+        error = hfsp_bttx_descend(txp, oldKey, height + 1, &pnum, &pidx, &exact);
+        if (error == 0 && !exact)
+            error = EINVAL;
+        if (error == 0)
+            error = hfsp_bttx_remove_at(txp, pnum, pidx);
+        goto out;
+    }
+
+    if (idx == 0)
+        error = hfsp_bttx_fix_key(txp, height, oldKey, hfsp_nd_rec(btreep, nd, 0));
+    if (error == 0)
+        error = hfsp_bttx_rebalance(txp, num);
+
+out:
+    free(oldKey, M_TEMP);
+    return error;
+}
+
+int
+hfsp_bttx_begin(struct hfsp_btree * btreep, hfsp_btkey_cmp_t cmp, struct hfsp_bttx ** txpp)
+{
+    struct hfspmount * hmp;
+    struct hfsp_bttx * txp;
+
+    // Writes would be hidden by the overlay of a journal not replayed, a
+    // journaled volume is only written through its journal.
+    hmp = btreep->hb_ip->hi_mount;
+    if (hmp->hm_journal != NULL || hmp->hm_cp == NULL || hmp->hm_cp->acw == 0 ||
+        ((hmp->hm_flags & HFSP_MNT_JOURNALED) && hmp->hm_jwriter == NULL))
+        return EROFS;
+    if (!(btreep->hb_attributes & HFSP_BT_BIGKEYS) || btreep->hb_treeDepth > HFSP_BTREE_MAXDEPTH)
+        return EINVAL;
+
+    txp = malloc(sizeof(*txp), M_HFSPBTTX, M_WAITOK | M_ZERO);
+    txp->htx_btreep = btreep;
+    txp->htx_cmp = cmp;
+    RB_INIT(&txp->htx_nodes);
+
+    sx_xlock(&btreep->hb_txLock);
+    txp->htx_rootNode = btreep->hb_rootNode;
+    txp->htx_treeDepth = btreep->hb_treeDepth;
+    txp->htx_leafRecords = btreep->hb_leafRecords;
+    txp->htx_firstLeafNode = btreep->hb_firstLeafNode;
+    txp->htx_lastLeafNode = btreep->hb_lastLeafNode;
+    txp->htx_freeNodes = btreep->hb_freeNodes;
+    *txpp = txp;
+    return 0;
+}
+
+int
+hfsp_bttx_insert(struct hfsp_bttx * txp, const u_int8_t * key, const void * data, int len)
+{
+    struct hfsp_btree * btreep;
+    u_int8_t * nd, * rec, * oldKey;
+    u_int32_t num;
+    int error, idx, exact, keySize, recLen;
+
+    btreep = txp->htx_btreep;
+    if (txp->htx_error)
+        return txp->htx_error;
+
+    // Any two records fit in a node.
+    keySize = hfsp_btkey_size(key);
+    recLen = roundup2(keySize + len, 2);
+    if (be16dec(key) > btreep->hb_maxKeyLength || len < 0 ||
+        recLen + sizeof(u_int16_t) > HFSP_ND_SPACE(btreep) / 2)
+        return EINVAL;
+
+    // A split for each level and a new root at most.
+    if (txp->htx_freeNodes < txp->htx_treeDepth + 1 || txp->htx_treeDepth == HFSP_BTREE_MAXDEPTH)
+        return ENOSPC;
+
+    if (txp->htx_rootNode == 0)
+    {
+        error = hfsp_bttx_alloc_node(txp, HFSP_NODE_LEAF, 1, &num, &nd);
+        if (error)
+            goto fail;
+        txp->htx_rootNode = num;
+        txp->htx_firstLeafNode = num;
+        txp->htx_lastLeafNode = num;
+        txp->htx_treeDepth = 1;
+    }
+
+    error = hfsp_bttx_descend(txp, key, 1, &num, &idx, &exact);
+    if (error)
+        goto fail;
+    if (exact)
+        return EEXIST;
+
+    rec = malloc(recLen, M_TEMP, M_WAITOK | M_ZERO);
+    memcpy(rec, key, sizeof(u_int16_t) + be16dec(key));
+    memcpy(rec + keySize, data, len);
+
+    // A new first key: the index records above are updated before the
+    // insertion, a split could move the old first key to the new node.
+    if (idx == -1 && num != txp->htx_rootNode)
+    {
+        error = hfsp_bttx_node(txp, num, 0, &nd);
+        if (error == 0)
+        {
+            oldKey = hfsp_btkey_dup(hfsp_nd_rec(btreep, nd, 0));
+            error = hfsp_bttx_fix_key(txp, 1, oldKey, key);
+            free(oldKey, M_TEMP);
+        }
+    }
+    if (error == 0)
+        error = hfsp_bttx_put(txp, num, idx + 1, rec, recLen);
+    free(rec, M_TEMP);
+    if (error)
+        goto fail;
+
+    txp->htx_leafRecords++;
+    return 0;
+
+fail:
+    txp->htx_error = error;
+    return error;
+}
+
+int
+hfsp_bttx_delete(struct hfsp_bttx * txp, const u_int8_t * key)
+{
+    u_int32_t num;
+    int error, idx, exact;
+
+    if (txp->htx_error)
+        return txp->htx_error;
+    if (txp->htx_rootNode == 0)
+        return ENOENT;
+
+    // A new first key may split the index nodes above, and add a root.
+    if (txp->htx_treeDepth > 1 && txp->htx_freeNodes < txp->htx_treeDepth)
+        return ENOSPC;
+
+    error = hfsp_bttx_descend(txp, key, 1, &num, &idx, &exact);
+    if (error == 0 && !exact)
+        return ENOENT;
+    if (error == 0)
+        error = hfsp_bttx_remove_at(txp, num, idx);
+    if (error)
+    {
+        txp->htx_error = error;
+        return error;
+    }
+
+    txp->htx_leafRecords--;
+    return 0;
+}
+
+static void
+hfsp_bttx_free(struct hfsp_bttx * txp)
+{
+    struct hfsp_btshadow * sp, * nsp;
+
+    RB_FOREACH_SAFE(sp, hfsp_btshadows, &txp->htx_nodes, nsp)
+    {
+        RB_REMOVE(hfsp_btshadows, &txp->htx_nodes, sp);
+        free(sp, M_HFSPBTTX);
+    }
+    sx_xunlock(&txp->htx_btreep->hb_txLock);
+    free(txp, M_HFSPBTTX);
+}
+
+void
+hfsp_bttx_abort(struct hfsp_bttx * txp)
+{
+    hfsp_bttx_free(txp);
+}
+
+/*
+ * Write a range of the device, at most MAXBSIZE bytes. Buffers of single nodes
+ * read before are dropped, the coalesced buffer is not kept either.
+ */
+static int
+hfsp_bttx_write_buf(struct hfsp_bttx * txp, daddr_t blkno, u_int8_t * data, int size, int sync)
+{
+    struct hfspmount * hmp;
+    struct buf * bp;
+    int nodeBlks, i;
+
+    hmp = txp->htx_btreep->hb_ip->hi_mount;
+    nodeBlks = btodb(txp->htx_btreep->hb_nodeSize);
+    for (i = nodeBlks; i < btodb(size); i += nodeBlks)
+    {
+        bp = getblk(hmp->hm_devvp, blkno + i, txp->htx_btreep->hb_nodeSize, 0, 0, GB_NOCREAT);
+        if (bp != NULL)
+        {
+            bp->b_flags |= B_INVAL | B_NOCACHE;
+            brelse(bp);
+        }
+    }
+
+    bp = getblk(hmp->hm_devvp, blkno, size, 0, 0, 0);
+    memcpy(bp->b_data, data, size);
+    bp->b_flags |= B_NOCACHE;
+    atomic_add_long(&hfsp_bttx_writes, 1);
+    if (sync)
+        return bwrite(bp);
+    bawrite(bp);
+    return 0;
+}
+
+/*
+ * Write a node crossing extents piece by piece. The pieces are logged instead
+ * on a journaled volume.
+ */
+static int
+hfsp_bttx_write_pieces(struct hfsp_bttx * txp, u_int32_t num, u_int8_t * nd, int sync)
+{
+    struct hfsp_btree * btreep;
+    u_int64_t offset, run;
+    daddr_t blkno;
+    int error, done, chunk, size;
+
+    btreep = txp->htx_btreep;
+    offset = (u_int64_t)num << btreep->hb_nodeShift;
+    for (done = 0; done < btreep->hb_nodeSize; done += chunk)
+    {
+        error = hfsp_bmap_inode(btreep->hb_ip, offset + done, btreep->hb_nodeSize - done, &blkno, &size, &run);
+        if (error)
+            return error;
+        chunk = MIN(run, (u_int64_t)(btreep->hb_nodeSize - done));
+        if (btreep->hb_ip->hi_mount->hm_jwriter != NULL)
+            error = hfsp_jwrite_log(btreep->hb_ip->hi_mount, blkno, nd + done, chunk);
+        else
+            error = hfsp_bttx_write_buf(txp, blkno, nd + done, chunk, sync);
+        if (error)
+            return error;
+    }
+    return 0;
+}
+
+/* Dirty node with its place on the device */
+struct hfsp_bttx_io {
+    daddr_t                 hti_blkno;
+    u_int64_t               hti_run;
+    struct hfsp_btshadow *  hti_sp;
+};
+
+static int
+hfsp_bttx_io_cmp(const void * l, const void * r)
+{
+    daddr_t lb, rb;
+
+    lb = ((const struct hfsp_bttx_io *)l)->hti_blkno;
+    rb = ((const struct hfsp_bttx_io *)r)->hti_blkno;
+    return lb < rb ? -1 : lb > rb;
+}
+
+/*
+ * Write the dirty nodes, sorted on the device and coalesced up to MAXBSIZE.
+ * The writes are asynchronous, the header node is written synchronously once
+ * they are done so it never points to nodes not on the disk.
+ */
+static int
+hfsp_bttx_write(struct hfsp_bttx * txp)
+{
+    struct hfsp_btree * btreep;
+    struct hfsp_bttx_io * ios, * iop;
+    struct hfsp_btshadow * sp, * header;
+    struct bufobj * bo;
+    u_int8_t * run;
+    int error, werror, i, n, first, last, size, nodeBlks, maxNodes;
+
+    btreep = txp->htx_btreep;
+    ios = malloc(txp->htx_dirty * sizeof(*ios), M_TEMP, M_WAITOK);
+    header = NULL;
+    n = 0;
+    error = 0;
+    RB_FOREACH(sp, hfsp_btshadows, &txp->htx_nodes)
+    {
+        if (!sp->hbs_dirty)
+            continue;
+        if (sp->hbs_num == 0)
+        {
+            header = sp;
+            continue;
+        }
+        error = hfsp_bmap_inode(btreep->hb_ip, (u_int64_t)sp->hbs_num << btreep->hb_nodeShift, btreep->hb_nodeSize,
+                                &ios[n].hti_blkno, &size, &ios[n].hti_run);
+        if (error)
+            goto out;
+        ios[n++].hti_sp = sp;
+    }
+
+    qsort(ios, n, sizeof(*ios), hfsp_bttx_io_cmp);
+    nodeBlks = btodb(btreep->hb_nodeSize);
+    maxNodes = max(1, MAXBSIZE / btreep->hb_nodeSize);
+    run = malloc(maxNodes * btreep->hb_nodeSize, M_TEMP, M_WAITOK);
+    for (first = 0; first < n && error == 0; first = last)
+    {
+        iop = &ios[first];
+        if (iop->hti_run < btreep->hb_nodeSize)
+        {
+            last = first + 1;
+            error = hfsp_bttx_write_pieces(txp, iop->hti_sp->hbs_num, HFSP_BTSHADOW_DATA(iop->hti_sp), 0);
+            continue;
+        }
+        for (last = first + 1; last < n && last - first < maxNodes; last++)
+        {
+            if (ios[last].hti_blkno != iop->hti_blkno + (last - first) * nodeBlks ||
+                (u_int64_t)(last - first + 1) * btreep->hb_nodeSize > iop->hti_run)
+                break;
+        }
+        for (i = first; i < last; i++)
+            memcpy(run + (i - first) * btreep->hb_nodeSize, HFSP_BTSHADOW_DATA(ios[i].hti_sp), btreep->hb_nodeSize);
+        error = hfsp_bttx_write_buf(txp, iop->hti_blkno, run, (last - first) * btreep->hb_nodeSize, 0);
+    }
+    free(run, M_TEMP);
+
+    // The nodes are on the disk before the header pointing to them.
+    bo = &btreep->hb_ip->hi_mount->hm_devvp->v_bufobj;
+    BO_LOCK(bo);
+    werror = bufobj_wwait(bo, 0, 0);
+    BO_UNLOCK(bo);
+    if (error == 0)
+        error = werror;
+    if (error == 0 && header != NULL)
+        error = hfsp_bttx_write_pieces(txp, 0, HFSP_BTSHADOW_DATA(header), 1);
+    if (error == 0)
+        atomic_add_long(&hfsp_bttx_nodes, txp->htx_dirty);
+
+out:
+    free(ios, M_TEMP);
+    return error;
+}
+
+/*
+ * Log the dirty nodes as one operation of the journal, the header node with
+ * them: the transaction is replayed as a whole.
+ */
+static int
+hfsp_bttx_log(struct hfsp_bttx * txp)
+{
+    struct hfspmount * hmp;
+    struct hfsp_btshadow * sp;
+    int error;
+
+    hmp = txp->htx_btreep->hb_ip->hi_mount;
+    error = hfsp_jwrite_begin(hmp);
+    if (error)
+        return error;
+    RB_FOREACH(sp, hfsp_btshadows, &txp->htx_nodes)
+    {
+        if (!sp->hbs_dirty)
+            continue;
+        error = hfsp_bttx_write_pieces(txp, sp->hbs_num, HFSP_BTSHADOW_DATA(sp), 0);
+        if (error)
+            break;
+    }
+    if (error == 0)
+        atomic_add_long(&hfsp_bttx_nodes, txp->htx_dirty);
+    return hfsp_jwrite_end(hmp, error);
+}
+
+int
+hfsp_bttx_commit(struct hfsp_bttx * txp)
+{
+    struct hfsp_btree * btreep;
+    struct hfsp_btshadow * sp;
+    struct BTHeaderRec * hdr;
+    u_int8_t * nd;
+    int error;
+
+    btreep = txp->htx_btreep;
+    error = txp->htx_error;
+    if (error || txp->htx_dirty == 0)
+    {
+        hfsp_bttx_free(txp);
+        return error;
+    }
+
+    error = hfsp_bttx_node(txp, 0, 1, &nd);
+    if (error)
+    {
+        hfsp_bttx_free(txp);
+        return error;
+    }
+    hdr = (struct BTHeaderRec *)(nd + sizeof(struct BTNodeDescriptor));
+    hdr->treeDepth = htobe16(txp->htx_treeDepth);
+    hdr->rootNode = htobe32(txp->htx_rootNode);
+    hdr->leafRecords = htobe32(txp->htx_leafRecords);
+    hdr->firstLeafNode = htobe32(txp->htx_firstLeafNode);
+    hdr->lastLeafNode = htobe32(txp->htx_lastLeafNode);
+    hdr->freeNodes = htobe32(txp->htx_freeNodes);
+
+    if (btreep->hb_ip->hi_mount->hm_jwriter != NULL)
+        error = hfsp_bttx_log(txp);
+    else
+        error = hfsp_bttx_write(txp);
+
+    // Whatever was written, the cached nodes are read again.
+    RB_FOREACH(sp, hfsp_btshadows, &txp->htx_nodes)
+    {
+        if (sp->hbs_dirty)
+            hfsp_btree_update_node(btreep, sp->hbs_num, HFSP_BTSHADOW_DATA(sp));
+    }
+    if (error)
+    {
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_bttx_commit: Writing %ju nodes failed, error %jd.", txp->htx_dirty, error);
+        hfsp_bttx_free(txp);
+        return error;
+    }
+
+    btreep->hb_rootNode = txp->htx_rootNode;
+    btreep->hb_treeDepth = txp->htx_treeDepth;
+    btreep->hb_leafRecords = txp->htx_leafRecords;
+    btreep->hb_firstLeafNode = txp->htx_firstLeafNode;
+    btreep->hb_lastLeafNode = txp->htx_lastLeafNode;
+    btreep->hb_freeNodes = txp->htx_freeNodes;
+
+    // Still holding the btree, nothing else modified it.
+    if (hfsp_btree_check_commit)
+        error = hfsp_btree_check(btreep, txp->htx_cmp);
+    hfsp_bttx_free(txp);
+    return error;
+}
+
+/* Walk of a level of a btree by hfsp_btree_check() */
+#define HFSP_CHECK(cond, fmt, ...) do {                                         \
+    if (!(cond))                                                                \
+    {                                                                           \
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_btree_check: " fmt, __VA_ARGS__);    \
+        error = EINVAL;                                                         \
+        goto out;                                                               \
+    }                                                                           \
+} while (0)
+
+int
+hfsp_btree_check(struct hfsp_btree * btreep, hfsp_btkey_cmp_t cmp)
+{
+    struct hfsp_node * np, * cnp;
+    u_int8_t * nd, * rec, * lastKey;
+    u_int32_t num, prev, leftmost, nextLeftmost, child, records, visited;
+    int error, height, i, n, haveLast;
+
+    if (btreep->hb_rootNode == 0)
+        return btreep->hb_treeDepth == 0 && btreep->hb_leafRecords == 0 ? 0 : EINVAL;
+
+    lastKey = malloc(HFSP_BTKEY_MAX, M_TEMP, M_WAITOK);
+    np = cnp = NULL;
+    records = 0;
+    error = 0;
+    prev = 0;
+    leftmost = btreep->hb_rootNode;
+    for (height = btreep->hb_treeDepth; height >= 1; height--)
+    {
+        haveLast = 0;
+        prev = 0;
+        nextLeftmost = 0;
+        visited = 0;
+        for (num = leftmost; num != 0; prev = num, num = np->hn_next)
+        {
+            if (np != NULL)
+                hfsp_release_btnode(np);
+            np = NULL;
+            HFSP_CHECK(num < btreep->hb_totalNodes && ++visited <= btreep->hb_totalNodes,
+                       "Node %ju out of the tree or looping at height %jd.", num, height);
+            error = hfsp_get_btnode_from_idx(btreep, num, &np);
+            if (error)
+                goto out;
+            nd = np->hn_beginBuf;
+            n = np->hn_numRecords;
+            HFSP_CHECK(np->hn_height == height && np->hn_kind == (height == 1 ? HFSP_NODE_LEAF : HFSP_NODE_INDEX),
+                       "Node %ju has height %jd kind %jd at height %jd.", num, np->hn_height, np->hn_kind, height);
+            HFSP_CHECK(np->hn_prev == prev, "Node %ju links back to %ju instead of %ju.", num, np->hn_prev, prev);
+            HFSP_CHECK(n > 0 && (height != btreep->hb_treeDepth || np->hn_next == 0),
+                       "Node %ju has %jd records or a sibling of the root.", num, n);
+            HFSP_CHECK(hfsp_nd_offset(btreep, nd, 0) == sizeof(struct BTNodeDescriptor) &&
+                       hfsp_nd_offset(btreep, nd, n) <= btreep->hb_nodeSize - sizeof(u_int16_t) * (n + 1),
+                       "Node %ju has records out of the node.", num);
+
+            for (i = 0; i < n; i++)
+            {
+                HFSP_CHECK(hfsp_nd_reclen(btreep, nd, i) >= hfsp_btkey_size(hfsp_nd_rec(btreep, nd, i)),
+                           "Record %jd of node %ju is shorter than its key.", i, num);
+                rec = hfsp_nd_rec(btreep, nd, i);
+                HFSP_CHECK(!haveLast || cmp(lastKey, rec) < 0, "Record %jd of node %ju is out of order.", i, num);
+                memcpy(lastKey, rec, MIN(sizeof(u_int16_t) + be16dec(rec), HFSP_BTKEY_MAX));
+                haveLast = 1;
+                if (height == 1)
+                    continue;
+
+                // The index key is the first key of the child.
+                child = hfsp_nd_child(btreep, nd, i);
+                if (i == 0 && num == leftmost)
+                    nextLeftmost = child;
+                HFSP_CHECK(child != 0 && child < btreep->hb_totalNodes, "Node %ju points to node %ju.", num, child);
+                error = hfsp_get_btnode_from_idx(btreep, child, &cnp);
+                if (error)
+                    goto out;
+                HFSP_CHECK(cnp->hn_numRecords > 0 && cmp(hfsp_nd_rec(btreep, cnp->hn_beginBuf, 0), rec) == 0,
+                           "Record %jd of node %ju is not the first key of node %ju.", i, num, child);
+                hfsp_release_btnode(cnp);
+                cnp = NULL;
+            }
+            if (height == 1)
+                records += n;
+        }
+        if (np != NULL)
+            hfsp_release_btnode(np);
+        np = NULL;
+        if (height == 1)
+            HFSP_CHECK(leftmost == btreep->hb_firstLeafNode && prev == btreep->hb_lastLeafNode,
+                       "Leaves go from %ju to %ju, not as in the header.", leftmost, prev);
+        leftmost = nextLeftmost;
+    }
+    HFSP_CHECK(records == btreep->hb_leafRecords, "%ju leaf records, %ju in the header.",
+               records, btreep->hb_leafRecords);
+
+out:
+    if (cnp != NULL)
+        hfsp_release_btnode(cnp);
+    if (np != NULL)
+        hfsp_release_btnode(np);
+    free(lastKey, M_TEMP);
+    return error;
+}
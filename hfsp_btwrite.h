@@ -0,0 +1,83 @@
+#include <sys/param.h>
+#include <sys/malloc.h>
+
+#include "hfsp.h"
+#include "hfsp_btree.h"
+
+#ifndef _HFSP_BTWRITE_H_
+#define _HFSP_BTWRITE_H_
+
+MALLOC_DECLARE(M_HFSPBTTX);
+
+/* Deepest btree handled, as by Mac OS X */
+#define HFSP_BTREE_MAXDEPTH     16
+
+struct hfsp_bttx;
+
+/*
+ * Compare two keys as laid out on the disk, starting with their length.
+ * lkp, rkp: The keys.
+ * Return -1, 0 or 1.
+ */
+typedef int (*hfsp_btkey_cmp_t)(const u_int8_t * lkp, const u_int8_t * rkp);
+
+int hfsp_btkey_catalog_cmp(const u_int8_t * lkp, const u_int8_t * rkp);
+int hfsp_btkey_extent_cmp(const u_int8_t * lkp, const u_int8_t * rkp);
+
+/*
+ * Start modifying a btree. Transactions of a btree are serialized, the nodes
+ * read or modified are copied in the transaction until it ends.
+ * btreep: The btree to modify.
+ * cmp: The key comparison of the btree.
+ * txpp: Address of the pointer to the transaction on exit.
+ * Return EROFS if the volume can not be written, a journaled volume is
+ * written through its journal only.
+ */
+int hfsp_bttx_begin(struct hfsp_btree * btreep, hfsp_btkey_cmp_t cmp, struct hfsp_bttx ** txpp);
+
+/*
+ * Insert a leaf record. Full nodes are split and the index records updated.
+ * txp: The transaction.
+ * key: The key, starting with its length.
+ * data, len: The data of the record.
+ * Return EEXIST if the key is already in the btree, ENOSPC if the btree file
+ * has not enough free nodes.
+ */
+int hfsp_bttx_insert(struct hfsp_bttx * txp, const u_int8_t * key, const void * data, int len);
+
+/*
+ * Delete a leaf record. Empty nodes are freed and nodes less than half full
+ * are merged with or balanced against a sibling.
+ * txp: The transaction.
+ * key: The key, starting with its length.
+ * Return ENOENT if the key is not in the btree.
+ */
+int hfsp_bttx_delete(struct hfsp_bttx * txp, const u_int8_t * key);
+
+/*
+ * Write the modified nodes and end the transaction. The nodes are sorted by
+ * their place on the device and the contiguous ones written together, the
+ * header node is written last, once the others are on the disk. On a
+ * journaled volume the nodes are logged instead, and committed with the
+ * operations running at the same time.
+ * txp: The transaction, freed on exit.
+ */
+int hfsp_bttx_commit(struct hfsp_bttx * txp);
+
+/*
+ * End a transaction without writing it.
+ */
+void hfsp_bttx_abort(struct hfsp_bttx * txp);
+
+/*
+ * Check the invariants of a btree as found on the disk: height and kind of the
+ * nodes of each level, sibling links, key order within and across the nodes,
+ * index keys equal to the first key of their child, leaves and record count
+ * of the header.
+ * btreep: The btree to check.
+ * cmp: The key comparison of the btree.
+ * Return EINVAL at the first violation, traced.
+ */
+int hfsp_btree_check(struct hfsp_btree * btreep, hfsp_btkey_cmp_t cmp);
+
+#endif /* _HFSP_BTWRITE_H_ */
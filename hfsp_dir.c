@@ -0,0 +1,752 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <sys/eventhandler.h>
+#include <sys/endian.h>
+#include <sys/stat.h>
+#include <sys/dirent.h>
+#include <sys/uio.h>
+
+#include "hfsp.h"
+#include "hfsp_btree.h"
+#include "hfsp_dir.h"
+#include "hfsp_name.h"
+#include "hfsp_trace.h"
+#include "hfsp_link.h"
+#include "hfsp_attr.h"
+#include "hfsp_unicode.h"
+
+MALLOC_DEFINE(M_HFSPDIR, "hfsp_dir", "HFS+ folder state");
+
+/* Bits per name and number of probes, about 1% of false positives */
+#define HFSP_BLOOM_BITS     10
+#define HFSP_BLOOM_PROBES   5
+
+static struct mtx hfsp_dir_mtx;
+static TAILQ_HEAD(, hfsp_dir) hfsp_dir_list = TAILQ_HEAD_INITIALIZER(hfsp_dir_list);
+static eventhandler_tag hfsp_dir_lowmem_tag;
+
+static SYSCTL_NODE(_vfs_hfsp, OID_AUTO, bloom, CTLFLAG_RW, 0, "HFS+ negative lookup filters");
+
+static u_int hfsp_bloom_misses = 16;
+SYSCTL_UINT(_vfs_hfsp_bloom, OID_AUTO, misses, CTLFLAG_RW, &hfsp_bloom_misses, 0,
+            "Misses in a folder before its filter is built, 0 to disable");
+
+static u_int hfsp_bloom_maxbytes = 1024 * 1024;
+SYSCTL_UINT(_vfs_hfsp_bloom, OID_AUTO, maxbytes, CTLFLAG_RW, &hfsp_bloom_maxbytes, 0,
+            "Largest filter of a folder");
+
+static u_long hfsp_bloom_bytes;
+SYSCTL_ULONG(_vfs_hfsp_bloom, OID_AUTO, bytes, CTLFLAG_RD, &hfsp_bloom_bytes, 0,
+             "Memory used by the filters");
+
+static u_long hfsp_bloom_builds;
+SYSCTL_ULONG(_vfs_hfsp_bloom, OID_AUTO, builds, CTLFLAG_RD, &hfsp_bloom_builds, 0,
+             "Filters built");
+
+static u_long hfsp_bloom_hits;
+SYSCTL_ULONG(_vfs_hfsp_bloom, OID_AUTO, hits, CTLFLAG_RD, &hfsp_bloom_hits, 0,
+             "Lookups answered by a filter");
+
+static u_long hfsp_bloom_false;
+SYSCTL_ULONG(_vfs_hfsp_bloom, OID_AUTO, false_positives, CTLFLAG_RD, &hfsp_bloom_false, 0,
+             "Misses a filter did not catch");
+
+static SYSCTL_NODE(_vfs_hfsp, OID_AUTO, snapshot, CTLFLAG_RW, 0, "HFS+ folder snapshots");
+
+static u_int hfsp_snap_maxentries = 4096;
+SYSCTL_UINT(_vfs_hfsp_snapshot, OID_AUTO, maxentries, CTLFLAG_RW, &hfsp_snap_maxentries, 0,
+            "Largest folder kept as a snapshot, 0 to disable");
+
+static u_long hfsp_snap_budget = 8 * 1024 * 1024;
+SYSCTL_ULONG(_vfs_hfsp_snapshot, OID_AUTO, budget, CTLFLAG_RW, &hfsp_snap_budget, 0,
+             "Memory of the snapshots of a mount");
+
+static u_long hfsp_snap_builds;
+SYSCTL_ULONG(_vfs_hfsp_snapshot, OID_AUTO, builds, CTLFLAG_RD, &hfsp_snap_builds, 0,
+             "Snapshots built");
+
+static u_long hfsp_snap_evictions;
+SYSCTL_ULONG(_vfs_hfsp_snapshot, OID_AUTO, evictions, CTLFLAG_RD, &hfsp_snap_evictions, 0,
+             "Snapshots evicted over the budget");
+
+static u_long hfsp_snap_hits;
+SYSCTL_ULONG(_vfs_hfsp_snapshot, OID_AUTO, hits, CTLFLAG_RD, &hfsp_snap_hits, 0,
+             "Readdir and lookups served from a snapshot");
+
+static void hfsp_snap_detach(struct hfsp_snap * sp);
+static void hfsp_snap_drop(struct hfsp_snap * sp);
+
+#define HFSP_BLOOM_SIZE(nbits)  (sizeof(struct hfsp_bloom) + (nbits) / 8)
+
+/*
+ * Second hash for the double hashing of the probes, always odd.
+ */
+static __inline u_int32_t
+hfsp_bloom_hash2(u_int32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    return h | 1;
+}
+
+static void
+hfsp_bloom_add(struct hfsp_bloom * bp, u_int32_t h)
+{
+    u_int32_t h2, bit;
+    int i;
+
+    h2 = hfsp_bloom_hash2(h);
+    for (i = 0; i < HFSP_BLOOM_PROBES; i++, h += h2)
+    {
+        bit = h & bp->hbl_mask;
+        bp->hbl_bits[bit >> 6] |= 1ULL << (bit & 63);
+    }
+    bp->hbl_count++;
+}
+
+static bool
+hfsp_bloom_test(struct hfsp_bloom * bp, u_int32_t h)
+{
+    u_int32_t h2, bit;
+    int i;
+
+    h2 = hfsp_bloom_hash2(h);
+    for (i = 0; i < HFSP_BLOOM_PROBES; i++, h += h2)
+    {
+        bit = h & bp->hbl_mask;
+        if ((bp->hbl_bits[bit >> 6] & (1ULL << (bit & 63))) == 0)
+            return false;
+    }
+    return true;
+}
+
+static void
+hfsp_bloom_free(struct hfsp_bloom * bp)
+{
+    atomic_subtract_long(&hfsp_bloom_bytes, HFSP_BLOOM_SIZE(bp->hbl_mask + 1));
+    free(bp, M_HFSPDIR);
+}
+
+static int
+hfsp_bloom_visit(struct hfsp_record * rp, void * arg)
+{
+    // Only the key is read, its name stays in the node. The thread has no name.
+    if (rp->hr_key.hk_nameLen != 0)
+        hfsp_bloom_add(arg, hfsp_name_hash(rp->hr_key.hk_nameStr, rp->hr_key.hk_nameLen));
+    return 0;
+}
+
+/*
+ * Build the Bloom filter of a folder from a scan of its records in the leaf chain.
+ */
+static int
+hfsp_bloom_build(struct hfsp_inode * dip, struct hfsp_bloom ** bpp)
+{
+    struct hfsp_record_key lo, hi;
+    struct hfsp_bloom * bp;
+    u_int64_t nbits;
+    int error;
+
+    // Keep a power of 2 of at least 64 bits per filter.
+    nbits = (u_int64_t)max(dip->hi_valence, 1) * HFSP_BLOOM_BITS;
+    nbits = MAX(nbits, 64);
+    nbits = 1ULL << flsl(nbits - 1);
+    if (HFSP_BLOOM_SIZE(nbits) > hfsp_bloom_maxbytes)
+        return EFBIG;
+
+    // Do not add to the memory pressure.
+    bp = malloc(HFSP_BLOOM_SIZE(nbits), M_HFSPDIR, M_NOWAIT | M_ZERO);
+    if (bp == NULL)
+        return ENOMEM;
+    bp->hbl_mask = nbits - 1;
+    atomic_add_long(&hfsp_bloom_bytes, HFSP_BLOOM_SIZE(nbits));
+
+    hfsp_dir_range(dip, &lo, &hi);
+    error = hfsp_btree_scan(dip->hi_mount->hm_catalog_bp, &lo, &hi, HFSP_SCAN_KEYS, hfsp_bloom_visit, bp);
+    if (error)
+    {
+        hfsp_bloom_free(bp);
+        return error;
+    }
+
+    *bpp = bp;
+    return 0;
+}
+
+/*
+ * Release the memory of all the folders, the filters are rebuilt on demand.
+ */
+static void
+hfsp_dir_lowmem(void * arg __unused, int flags __unused)
+{
+    struct hfsp_dir * dp;
+    struct hfsp_bloom * bp;
+    struct hfsp_snap * sp;
+
+    mtx_lock(&hfsp_dir_mtx);
+    while ((dp = TAILQ_FIRST(&hfsp_dir_list)) != NULL)
+    {
+        TAILQ_REMOVE(&hfsp_dir_list, dp, hd_link);
+        dp->hd_flags &= ~HFSP_DIR_LISTED;
+        bp = dp->hd_bloom;
+        dp->hd_bloom = NULL;
+        dp->hd_misses = 0;
+        sp = dp->hd_snap;
+        if (sp != NULL)
+            hfsp_snap_detach(sp);
+        if (bp != NULL || sp != NULL)
+        {
+            mtx_unlock(&hfsp_dir_mtx);
+            if (bp != NULL)
+                hfsp_bloom_free(bp);
+            if (sp != NULL)
+                hfsp_snap_drop(sp);
+            mtx_lock(&hfsp_dir_mtx);
+        }
+    }
+    mtx_unlock(&hfsp_dir_mtx);
+}
+
+void
+hfsp_dir_init(void)
+{
+    mtx_init(&hfsp_dir_mtx, "hfsp_dir", NULL, MTX_DEF);
+    hfsp_dir_lowmem_tag = EVENTHANDLER_REGISTER(vm_lowmem, hfsp_dir_lowmem, NULL,
+                                                EVENTHANDLER_PRI_FIRST);
+}
+
+void
+hfsp_dir_uninit(void)
+{
+    EVENTHANDLER_DEREGISTER(vm_lowmem, hfsp_dir_lowmem_tag);
+    mtx_destroy(&hfsp_dir_mtx);
+}
+
+void
+hfsp_dir_release(struct hfsp_inode * ip)
+{
+    struct hfsp_dir * dp;
+    struct hfsp_bloom * bp;
+    struct hfsp_snap * sp;
+
+    dp = ip->hi_dir;
+    if (dp == NULL)
+        return;
+
+    mtx_lock(&hfsp_dir_mtx);
+    if (dp->hd_flags & HFSP_DIR_LISTED)
+        TAILQ_REMOVE(&hfsp_dir_list, dp, hd_link);
+    bp = dp->hd_bloom;
+    dp->hd_bloom = NULL;
+    sp = dp->hd_snap;
+    if (sp != NULL)
+        hfsp_snap_detach(sp);
+    mtx_unlock(&hfsp_dir_mtx);
+
+    if (bp != NULL)
+        hfsp_bloom_free(bp);
+    if (sp != NULL)
+        hfsp_snap_drop(sp);
+    free(dp, M_HFSPDIR);
+    ip->hi_dir = NULL;
+}
+
+/*
+ * Put a folder holding memory on the list released under memory pressure.
+ */
+static void
+hfsp_dir_list_insert(struct hfsp_dir * dp)
+{
+    mtx_assert(&hfsp_dir_mtx, MA_OWNED);
+    if ((dp->hd_flags & HFSP_DIR_LISTED) == 0)
+    {
+        TAILQ_INSERT_TAIL(&hfsp_dir_list, dp, hd_link);
+        dp->hd_flags |= HFSP_DIR_LISTED;
+    }
+}
+
+/*
+ * Return the directory state of a folder, allocating it.
+ */
+static struct hfsp_dir *
+hfsp_dir_get(struct hfsp_inode * dip)
+{
+    struct hfsp_dir * dp;
+
+    if (dip->hi_dir != NULL)
+        return dip->hi_dir;
+
+    dp = malloc(sizeof(*dp), M_HFSPDIR, M_WAITOK | M_ZERO);
+    dp->hd_ip = dip;
+    // Lookups run with a shared lock, an other thread may have won.
+    if (!atomic_cmpset_ptr((volatile uintptr_t *)&dip->hi_dir, (uintptr_t)NULL, (uintptr_t)dp))
+        free(dp, M_HFSPDIR);
+    return dip->hi_dir;
+}
+
+bool
+hfsp_dir_absent(struct hfsp_inode * dip, struct hfsp_record_key * kp)
+{
+    struct hfsp_dir * dp;
+    u_int32_t h;
+    bool absent;
+
+    dp = dip->hi_dir;
+    if (dp == NULL || dp->hd_bloom == NULL)
+        return false;
+
+    h = hfsp_name_hash(kp->hk_nameStr, kp->hk_nameLen);
+    mtx_lock(&hfsp_dir_mtx);
+    absent = dp->hd_bloom != NULL && !hfsp_bloom_test(dp->hd_bloom, h);
+    mtx_unlock(&hfsp_dir_mtx);
+
+    if (absent)
+        atomic_add_long(&hfsp_bloom_hits, 1);
+    return absent;
+}
+
+void
+hfsp_dir_miss(struct hfsp_inode * dip)
+{
+    struct hfsp_dir * dp;
+    struct hfsp_bloom * bp;
+    int error;
+
+    if (hfsp_bloom_misses == 0)
+        return;
+
+    dp = hfsp_dir_get(dip);
+    mtx_lock(&hfsp_dir_mtx);
+    if (dp->hd_bloom != NULL)
+    {
+        mtx_unlock(&hfsp_dir_mtx);
+        atomic_add_long(&hfsp_bloom_false, 1);
+        return;
+    }
+    if (++dp->hd_misses < hfsp_bloom_misses || (dp->hd_flags & HFSP_DIR_BUILDING))
+    {
+        mtx_unlock(&hfsp_dir_mtx);
+        return;
+    }
+    dp->hd_flags |= HFSP_DIR_BUILDING;
+    mtx_unlock(&hfsp_dir_mtx);
+
+    error = hfsp_bloom_build(dip, &bp);
+
+    mtx_lock(&hfsp_dir_mtx);
+    dp->hd_flags &= ~HFSP_DIR_BUILDING;
+    if (error)
+    {
+        // Try again after as many misses.
+        dp->hd_misses = 0;
+        mtx_unlock(&hfsp_dir_mtx);
+        HFSP_TRACE(HFSP_TRACE_INFO, "hfsp_dir_miss: No filter for folder %ju, error %jd.",
+                   dip->hi_cnid, error);
+        return;
+    }
+    dp->hd_bloom = bp;
+    hfsp_dir_list_insert(dp);
+    mtx_unlock(&hfsp_dir_mtx);
+    atomic_add_long(&hfsp_bloom_builds, 1);
+}
+
+void
+hfsp_dir_range(struct hfsp_inode * dip, struct hfsp_record_key * lop, struct hfsp_record_key * hip)
+{
+    // The thread record, keyed by the folder and an empty name, comes first.
+    bzero(lop, sizeof(*lop));
+    lop->hk_cnid = dip->hi_cnid;
+    bzero(hip, sizeof(*hip));
+    hip->hk_cnid = dip->hi_cnid + 1;
+}
+
+static u_int8_t
+hfsp_dir_dtype(struct hfsp_record * rp)
+{
+    if (rp->hr_type == HFSP_FOLDER_RECORD)
+        return DT_DIR;
+    if (rp->hr_fileMode & S_IFMT)
+        return IFTODT(rp->hr_fileMode);
+    return DT_REG;
+}
+
+int
+hfsp_dir_dirent(struct hfspmount * hmp, struct hfsp_record * rp, struct dirent * dp, int utf8Flags)
+{
+    size_t len;
+    int error;
+
+    error = hfsp_unicode_to_utf8(rp->hr_key.hk_nameStr, rp->hr_key.hk_nameLen,
+                                 dp->d_name, sizeof(dp->d_name), &len, utf8Flags);
+    if (error)
+        return error;
+
+    // The stat of the entry that usually follows will not read the catalogue.
+    hfsp_attr_prime(hmp, rp);
+
+    // Hard links are listed with the identity of their indirect node.
+    if (hfsp_link_resolve(hmp, rp) != 0)
+        HFSP_TRACE(HFSP_TRACE_WARN, "hfsp_dir_dirent: Unresolved hard link %ju.", rp->hr_cnid);
+
+    dp->d_fileno = rp->hr_cnid;
+    dp->d_type = hfsp_dir_dtype(rp);
+    dp->d_namlen = len;
+    dp->d_reclen = GENERIC_DIRSIZ(dp);
+    // Do not leak what is left of a longer name.
+    bzero(dp->d_name + len, dp->d_reclen - offsetof(struct dirent, d_name) - len);
+    return 0;
+}
+
+/*
+ * Take a reference on the snapshot of a folder, NULL if it has none.
+ */
+static struct hfsp_snap *
+hfsp_snap_hold(struct hfsp_inode * dip)
+{
+    struct hfsp_dir * dp;
+    struct hfsp_snap * sp;
+
+    dp = dip->hi_dir;
+    if (dp == NULL || dp->hd_snap == NULL)
+        return NULL;
+
+    mtx_lock(&hfsp_dir_mtx);
+    sp = dp->hd_snap;
+    if (sp != NULL)
+    {
+        sp->hs_refcnt++;
+        TAILQ_REMOVE(&sp->hs_mount->hm_snapLru, sp, hs_lru);
+        TAILQ_INSERT_TAIL(&sp->hs_mount->hm_snapLru, sp, hs_lru);
+    }
+    mtx_unlock(&hfsp_dir_mtx);
+    return sp;
+}
+
+static void
+hfsp_snap_drop(struct hfsp_snap * sp)
+{
+    u_int refcnt;
+
+    mtx_lock(&hfsp_dir_mtx);
+    refcnt = --sp->hs_refcnt;
+    mtx_unlock(&hfsp_dir_mtx);
+
+    if (refcnt == 0)
+        free(sp, M_HFSPDIR);
+}
+
+/*
+ * Unhook a snapshot from its folder and from the LRU of the mount. The caller
+ * inherits the reference of the folder and must drop it.
+ */
+static void
+hfsp_snap_detach(struct hfsp_snap * sp)
+{
+    mtx_assert(&hfsp_dir_mtx, MA_OWNED);
+    TAILQ_REMOVE(&sp->hs_mount->hm_snapLru, sp, hs_lru);
+    sp->hs_mount->hm_snapBytes -= sp->hs_size;
+    sp->hs_dir->hd_snap = NULL;
+    sp->hs_dir = NULL;
+}
+
+/*
+ * Hook a snapshot to its folder and evict the least recently used snapshots of
+ * the mount over the budget.
+ */
+static void
+hfsp_snap_install(struct hfsp_dir * dp, struct hfsp_snap * sp)
+{
+    struct hfspmount * hmp;
+    struct hfsp_snap * victimp;
+
+    hmp = sp->hs_mount;
+    mtx_lock(&hfsp_dir_mtx);
+    if (dp->hd_snap != NULL)
+    {
+        // Built concurrently, keep the first one.
+        mtx_unlock(&hfsp_dir_mtx);
+        free(sp, M_HFSPDIR);
+        return;
+    }
+
+    sp->hs_dir = dp;
+    sp->hs_refcnt = 1;
+    dp->hd_snap = sp;
+    TAILQ_INSERT_TAIL(&hmp->hm_snapLru, sp, hs_lru);
+    hmp->hm_snapBytes += sp->hs_size;
+    hfsp_dir_list_insert(dp);
+
+    while (hmp->hm_snapBytes > hfsp_snap_budget &&
+           (victimp = TAILQ_FIRST(&hmp->hm_snapLru)) != sp)
+    {
+        hfsp_snap_detach(victimp);
+        atomic_add_long(&hfsp_snap_evictions, 1);
+        if (--victimp->hs_refcnt == 0)
+        {
+            mtx_unlock(&hfsp_dir_mtx);
+            free(victimp, M_HFSPDIR);
+            mtx_lock(&hfsp_dir_mtx);
+        }
+    }
+    mtx_unlock(&hfsp_dir_mtx);
+}
+
+/*
+ * Growable staging buffer for a snapshot being built.
+ */
+static void *
+hfsp_snap_grow(void * bufp, size_t * sizep, size_t need)
+{
+    size_t size;
+
+    if (need <= *sizep)
+        return bufp;
+    size = max(*sizep * 2, need);
+    bufp = realloc(bufp, size, M_HFSPDIR, M_WAITOK);
+    *sizep = size;
+    return bufp;
+}
+
+/* A snapshot being built, staged in growable buffers */
+struct hfsp_snap_build {
+    struct hfspmount *          hsb_mount;
+    struct hfsp_snap_entry *    hsb_entries;
+    hfsp_unichar *              hsb_names;
+    char *                      hsb_dirents;
+    struct dirent *             hsb_dent;
+    size_t                      hsb_entriesSize;
+    size_t                      hsb_namesSize;
+    size_t                      hsb_direntsSize;
+    size_t                      hsb_namesLen;
+    size_t                      hsb_direntsLen;
+    u_int32_t                   hsb_count;
+    off_t                       hsb_end;
+    int                         hsb_utf8Flags;
+};
+
+static int
+hfsp_snap_visit(struct hfsp_record * rp, void * arg)
+{
+    struct hfsp_snap_build * sbp;
+    struct hfsp_snap_entry * ep;
+    struct dirent * dentp;
+    off_t pos;
+
+    sbp = arg;
+    dentp = sbp->hsb_dent;
+    pos = HFSP_DIRCOOKIE(rp->hr_nodeOffset >> sbp->hsb_mount->hm_catalog_bp->hb_nodeShift, rp->hr_recIdx);
+    sbp->hsb_end = pos + 1;
+    if (rp->hr_type != HFSP_FOLDER_RECORD && rp->hr_type != HFSP_FILE_RECORD)
+        return 0;
+
+    // The walk of hfsp_readdir() would skip it, cookies would not match.
+    if (sbp->hsb_count >= hfsp_snap_maxentries ||
+        hfsp_dir_dirent(sbp->hsb_mount, rp, dentp, sbp->hsb_utf8Flags) != 0)
+        return EFBIG;
+
+    sbp->hsb_entries = hfsp_snap_grow(sbp->hsb_entries, &sbp->hsb_entriesSize,
+                                      (sbp->hsb_count + 1) * sizeof(*ep));
+    sbp->hsb_names = hfsp_snap_grow(sbp->hsb_names, &sbp->hsb_namesSize,
+                                    (sbp->hsb_namesLen + rp->hr_key.hk_nameLen) * sizeof(hfsp_unichar));
+    sbp->hsb_dirents = hfsp_snap_grow(sbp->hsb_dirents, &sbp->hsb_direntsSize,
+                                      sbp->hsb_direntsLen + dentp->d_reclen);
+
+    ep = &sbp->hsb_entries[sbp->hsb_count++];
+    ep->hse_pos = pos;
+    ep->hse_cnid = rp->hr_cnid;
+    ep->hse_type = rp->hr_type;
+    ep->hse_name = sbp->hsb_namesLen;
+    ep->hse_nameLen = rp->hr_key.hk_nameLen;
+    memcpy(sbp->hsb_names + sbp->hsb_namesLen, rp->hr_key.hk_nameStr, ep->hse_nameLen * sizeof(hfsp_unichar));
+    sbp->hsb_namesLen += ep->hse_nameLen;
+    ep->hse_dirent = sbp->hsb_direntsLen;
+    memcpy(sbp->hsb_dirents + sbp->hsb_direntsLen, dentp, dentp->d_reclen);
+    sbp->hsb_direntsLen += dentp->d_reclen;
+    return 0;
+}
+
+/*
+ * Build the snapshot of a folder from a scan of its records in the leaf chain.
+ * Everything is staged in growable buffers, then copied into a single allocation.
+ */
+static int
+hfsp_snap_build(struct hfsp_inode * dip, struct hfsp_snap ** spp)
+{
+    struct hfsp_snap_build sb;
+    struct hfsp_record_key lo, hi;
+    struct hfsp_snap * sp;
+    size_t size;
+    int error;
+
+    bzero(&sb, sizeof(sb));
+    sb.hsb_mount = dip->hi_mount;
+    sb.hsb_utf8Flags = (sb.hsb_mount->hm_flags & HFSP_MNT_NFC) ? HFSP_UTF8_NFC : 0;
+    sb.hsb_dent = malloc(sizeof(*sb.hsb_dent), M_HFSPDIR, M_WAITOK | M_ZERO);
+
+    hfsp_dir_range(dip, &lo, &hi);
+    error = hfsp_btree_scan(sb.hsb_mount->hm_catalog_bp, &lo, &hi, 0, hfsp_snap_visit, &sb);
+    // The thread record is always there, the end is known.
+    if (error == 0 && sb.hsb_end == 0)
+        error = ENOENT;
+    if (error)
+        goto out;
+
+    size = sizeof(*sp) + sb.hsb_count * sizeof(*sb.hsb_entries) + sb.hsb_direntsLen +
+           sb.hsb_namesLen * sizeof(hfsp_unichar);
+    sp = malloc(size, M_HFSPDIR, M_WAITOK | M_ZERO);
+    sp->hs_mount = sb.hsb_mount;
+    sp->hs_size = size;
+    sp->hs_count = sb.hsb_count;
+    sp->hs_direntBytes = sb.hsb_direntsLen;
+    sp->hs_end = sb.hsb_end;
+    sp->hs_entries = (struct hfsp_snap_entry *)(sp + 1);
+    sp->hs_dirents = (char *)(sp->hs_entries + sb.hsb_count);
+    sp->hs_names = (hfsp_unichar *)(sp->hs_dirents + sb.hsb_direntsLen);
+    if (sb.hsb_count != 0)
+    {
+        memcpy(sp->hs_entries, sb.hsb_entries, sb.hsb_count * sizeof(*sb.hsb_entries));
+        memcpy(sp->hs_dirents, sb.hsb_dirents, sb.hsb_direntsLen);
+        memcpy(sp->hs_names, sb.hsb_names, sb.hsb_namesLen * sizeof(hfsp_unichar));
+    }
+    *spp = sp;
+
+out:
+    free(sb.hsb_entries, M_HFSPDIR);
+    free(sb.hsb_names, M_HFSPDIR);
+    free(sb.hsb_dirents, M_HFSPDIR);
+    free(sb.hsb_dent, M_HFSPDIR);
+    return error;
+}
+
+/*
+ * Index of the entry a readdir cookie resumes at, -1 if the cookie was not
+ * returned for this snapshot. hfsp_readdir() may return either the position of
+ * the next record or the one past the previous record.
+ */
+static int
+hfsp_snap_cookie2idx(struct hfsp_snap * sp, off_t cookie)
+{
+    u_int32_t i;
+
+    if (cookie == HFSP_DIRCOOKIE_FIRST)
+        return 0;
+    if (cookie == sp->hs_end)
+        return sp->hs_count;
+    for (i = 0; i < sp->hs_count; i++)
+    {
+        if (sp->hs_entries[i].hse_pos == cookie ||
+            (i > 0 && sp->hs_entries[i - 1].hse_pos + 1 == cookie))
+            return i;
+    }
+    return -1;
+}
+
+int
+hfsp_snap_readdir(struct hfsp_inode * dip, struct uio * uio, off_t * cookiep, bool * eofp,
+                  struct hfsp_cookies * hcp)
+{
+    struct hfsp_snap * sp;
+    struct dirent * dentp;
+    size_t bytes;
+    int error, first, last;
+
+    if (hfsp_snap_maxentries == 0)
+        return EAGAIN;
+
+    sp = hfsp_snap_hold(dip);
+    if (sp == NULL)
+    {
+        // Built on the first pass only, a folder read from the middle is a poor candidate.
+        if (*cookiep != HFSP_DIRCOOKIE_FIRST || dip->hi_valence > hfsp_snap_maxentries)
+            return EAGAIN;
+        error = hfsp_snap_build(dip, &sp);
+        if (error)
+        {
+            HFSP_TRACE(HFSP_TRACE_INFO, "hfsp_snap_readdir: No snapshot for folder %ju, error %jd.",
+                       dip->hi_cnid, error);
+            return EAGAIN;
+        }
+        atomic_add_long(&hfsp_snap_builds, 1);
+        hfsp_snap_install(hfsp_dir_get(dip), sp);
+        sp = hfsp_snap_hold(dip);
+        if (sp == NULL)
+            return EAGAIN;
+    }
+
+    first = hfsp_snap_cookie2idx(sp, *cookiep);
+    if (first < 0)
+    {
+        hfsp_snap_drop(sp);
+        return EAGAIN;
+    }
+
+    // Copy as many whole entries as fit in one move.
+    bytes = 0;
+    for (last = first; last < sp->hs_count; last++)
+    {
+        dentp = (struct dirent *)(sp->hs_dirents + sp->hs_entries[last].hse_dirent);
+        if (bytes + dentp->d_reclen > uio->uio_resid ||
+            (hcp != NULL && hcp->hc_count == hcp->hc_max))
+            break;
+        bytes += dentp->d_reclen;
+        // The position past the entry, where hfsp_readdir() resumes too.
+        if (hcp != NULL)
+            hcp->hc_cookies[hcp->hc_count++] = sp->hs_entries[last].hse_pos + 1;
+    }
+
+    error = 0;
+    if (bytes != 0)
+        error = uiomove(sp->hs_dirents + sp->hs_entries[first].hse_dirent, bytes, uio);
+    if (error == 0)
+    {
+        *cookiep = last < sp->hs_count ? sp->hs_entries[last].hse_pos : sp->hs_end;
+        *eofp = last == sp->hs_count;
+        atomic_add_long(&hfsp_snap_hits, 1);
+    }
+    hfsp_snap_drop(sp);
+    return error;
+}
+
+int
+hfsp_snap_lookup(struct hfsp_inode * dip, struct hfsp_record_key * kp, hfsp_cnid * cnidp)
+{
+    struct hfsp_snap * sp;
+    struct hfsp_snap_entry * ep;
+    int lo, hi, mid, res, error;
+
+    sp = hfsp_snap_hold(dip);
+    if (sp == NULL)
+        return EAGAIN;
+
+    // Entries are in catalogue order.
+    error = ENOENT;
+    lo = 0;
+    hi = (int)sp->hs_count - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) >> 1;
+        ep = &sp->hs_entries[mid];
+        res = hfsp_unicode_cmp(sp->hs_names + ep->hse_name, ep->hse_nameLen, kp->hk_nameStr, kp->hk_nameLen);
+        if (res == 0)
+        {
+            *cnidp = ep->hse_cnid;
+            error = 0;
+            break;
+        }
+        if (res < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    atomic_add_long(&hfsp_snap_hits, 1);
+    hfsp_snap_drop(sp);
+    return error;
+}
@@ -0,0 +1,155 @@
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_DIR_H_
+#define _HFSP_DIR_H_
+
+MALLOC_DECLARE(M_HFSPDIR);
+
+struct dirent;
+struct uio;
+
+/*
+ * Readdir cookies. 0 and 1 are '.' and '..', 2 is the first entry. Past the
+ * first entry the cookie is the position of the next record in the leaf chain,
+ * which does not move on a read only volume.
+ */
+#define HFSP_DIRCOOKIE_DOT      0
+#define HFSP_DIRCOOKIE_DOTDOT   1
+#define HFSP_DIRCOOKIE_FIRST    2
+#define HFSP_DIRCOOKIE(node, idx)       (((off_t)(node) << 16) | (idx))
+#define HFSP_DIRCOOKIE_NODE(c)          ((u_int32_t)((c) >> 16))
+#define HFSP_DIRCOOKIE_IDX(c)           ((int)((c) & 0xFFFF))
+
+/* Smallest dirent, the bound of the number of entries a readdir returns */
+#define HFSP_DIRENT_MINSIZE     (sizeof(struct dirent) - (MAXNAMLEN + 1) + 4)
+
+/* Cookies of the entries returned by a readdir, for the NFS server */
+struct hfsp_cookies {
+    u_long *            hc_cookies;
+    int                 hc_count;
+    int                 hc_max;
+};
+
+/* Bloom filter of the names of a folder */
+struct hfsp_bloom {
+    u_int32_t           hbl_mask;       /* Number of bits minus 1, a power of 2 */
+    u_int32_t           hbl_count;      /* Number of names added */
+    u_int64_t           hbl_bits[];
+};
+
+/* Entry of a folder snapshot */
+struct hfsp_snap_entry {
+    off_t               hse_pos;        /* Readdir cookie of the record */
+    hfsp_cnid           hse_cnid;       /* Hard links resolved */
+    u_int32_t           hse_dirent;     /* Offset of the entry in hs_dirents */
+    u_int32_t           hse_name;       /* Offset of the name in hs_names */
+    u_int16_t           hse_nameLen;
+    __int16_t           hse_type;       /* Record type, hard links resolved */
+};
+
+/*
+ * Materialized listing of a folder, in catalogue order. It is immutable once
+ * built and reference counted so it can be evicted while in use.
+ */
+struct hfsp_snap {
+    TAILQ_ENTRY(hfsp_snap)      hs_lru;     /* On the LRU of the mount */
+    struct hfsp_dir *           hs_dir;     /* NULL once evicted */
+    struct hfspmount *          hs_mount;
+    u_int                       hs_refcnt;
+    size_t                      hs_size;    /* Bytes allocated */
+    u_int32_t                   hs_count;
+    u_int32_t                   hs_direntBytes;
+    off_t                       hs_end;     /* Cookie past the last entry */
+    struct hfsp_snap_entry *    hs_entries;
+    hfsp_unichar *              hs_names;   /* Names as stored in the catalogue */
+    char *                      hs_dirents; /* Packed struct dirent */
+};
+
+/*
+ * In core state of a folder, allocated on first use and hung off the inode.
+ * Protected by the global directory state mutex.
+ */
+struct hfsp_dir {
+    TAILQ_ENTRY(hfsp_dir)   hd_link;    /* On the list of the folders holding memory */
+    struct hfsp_inode *     hd_ip;
+    u_int32_t               hd_misses;  /* Lookups that did not find a name */
+    u_int16_t               hd_flags;
+    struct hfsp_bloom *     hd_bloom;
+    struct hfsp_snap *      hd_snap;
+};
+
+/* hd_flags */
+#define HFSP_DIR_BUILDING   0x0001  /* A thread is building the Bloom filter */
+#define HFSP_DIR_LISTED     0x0002  /* On the list of the folders holding memory */
+
+/*
+ * Set up and tear down the directory state shared by all mounts.
+ */
+void hfsp_dir_init(void);
+void hfsp_dir_uninit(void);
+
+/*
+ * Free the directory state of an inode.
+ */
+void hfsp_dir_release(struct hfsp_inode * ip);
+
+/*
+ * Answer a lookup from the Bloom filter of a folder.
+ * dip: The folder inode.
+ * kp: The search key.
+ * Return true if the name is certainly not in the folder.
+ */
+bool hfsp_dir_absent(struct hfsp_inode * dip, struct hfsp_record_key * kp);
+
+/*
+ * Account a lookup that did not find its name. The Bloom filter of the folder
+ * is built once the folder takes vfs.hfsp.bloom_misses misses.
+ * dip: The folder inode.
+ */
+void hfsp_dir_miss(struct hfsp_inode * dip);
+
+/*
+ * Fill a directory entry from a catalogue record, resolving hard links.
+ * hmp: The mount.
+ * rp: A folder or file record, it is updated if it is a hard link.
+ * dp: The entry to fill, d_reclen is set and the name padded with NUL.
+ * utf8Flags: Flags of hfsp_unicode_to_utf8().
+ * Return ENAMETOOLONG if the name can not be represented.
+ */
+int hfsp_dir_dirent(struct hfspmount * hmp, struct hfsp_record * rp, struct dirent * dp, int utf8Flags);
+
+/*
+ * Key range of the records of a folder in the catalogue, its thread record
+ * first.
+ * dip: The folder inode.
+ * lop: The first key, filled on exit.
+ * hip: The key past the range, filled on exit.
+ */
+void hfsp_dir_range(struct hfsp_inode * dip, struct hfsp_record_key * lop, struct hfsp_record_key * hip);
+
+/*
+ * Serve a readdir from the snapshot of a folder, building it on the first pass
+ * over a small enough folder.
+ * dip: The folder inode.
+ * uio: The readdir uio.
+ * cookiep: The cookie to start from, updated on exit.
+ * eofp: Set if the end of the folder is reached.
+ * hcp: Where to add the cookie of each entry, NULL if they are not wanted.
+ * Return EAGAIN if there is no usable snapshot.
+ */
+int hfsp_snap_readdir(struct hfsp_inode * dip, struct uio * uio, off_t * cookiep, bool * eofp,
+                      struct hfsp_cookies * hcp);
+
+/*
+ * Look a name up in the snapshot of a folder.
+ * dip: The folder inode.
+ * kp: The search key.
+ * cnidp: The CNID of the entry on exit, hard links resolved.
+ * Return 0 if found, ENOENT if absent and EAGAIN if the folder has no snapshot.
+ */
+int hfsp_snap_lookup(struct hfsp_inode * dip, struct hfsp_record_key * kp, hfsp_cnid * cnidp);
+
+#endif /* _HFSP_DIR_H_ */
@@ -0,0 +1,162 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/buf.h>
+#include <sys/endian.h>
+#include <sys/sysctl.h>
+#include <sys/taskqueue.h>
+
+#include "hfsp.h"
+#include "hfsp_btree.h"
+#include "hfsp_attr.h"
+#include "hfsp_hotfile.h"
+#include "hfsp_trace.h"
+
+static u_int hfsp_hotfile_max = 1000;
+SYSCTL_UINT(_vfs_hfsp, OID_AUTO, hotfiles_max, CTLFLAG_RW, &hfsp_hotfile_max, 0,
+            "Number of the hottest files prefetched by the hotfiles mount option");
+
+static u_long hfsp_hotfile_prefetched;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, hotfiles_prefetched, CTLFLAG_RD, &hfsp_hotfile_prefetched, 0,
+             "Hot files whose catalogue record was prefetched");
+
+/*
+ * Open the hot files B-tree of the volume.
+ */
+static int
+hfsp_hotfile_open(struct hfspmount * hmp, struct hfsp_btree ** btreepp)
+{
+    struct hfsp_search_key key;
+    struct hfsp_record * rp;
+    struct hfsp_inode * ip;
+    int error;
+
+    rp = NULL;
+    error = hfsp_search_key_init(&key, HFSP_ROOT_FOLDER_CNID, HFSP_HOTFILE_NAME, strlen(HFSP_HOTFILE_NAME));
+    if (error == 0)
+        error = hfsp_btree_find_exact(hmp->hm_catalog_bp, &key.hsk_key, &rp);
+    if (error == 0 && rp->hr_type != HFSP_FILE_RECORD)
+        error = ENOENT;
+    if (error == 0)
+        error = hfsp_iget(hmp, NULL, &ip);
+    if (error == 0)
+    {
+        // Like the special files it is read through the device.
+        ip->hi_fork = rp->hr_file.hrfi_dataFork;
+        ip->hi_vp = hmp->hm_devvp;
+        error = hfsp_btree_open(ip, btreepp);
+        if (error)
+            hfsp_irelease(ip);
+    }
+
+    if (rp != NULL)
+        hfsp_brec_release_record(&rp);
+    return error;
+}
+
+/*
+ * Collect the hottest data forks, from the last leaf backward. The records
+ * giving the temperature of a file sort after all the others and are skipped.
+ * Return the number of files found.
+ */
+static int
+hfsp_hotfile_collect(struct hfsp_btree * btreep, hfsp_cnid * cnids, int max)
+{
+    struct hfsp_node * np;
+    struct HotFileKey * kp;
+    u_int32_t num, prev;
+    u_int16_t offset;
+    int count, i, error;
+
+    count = 0;
+    for (num = btreep->hb_lastLeafNode; num != 0 && count < max; num = prev)
+    {
+        error = hfsp_get_btnode_from_idx(btreep, num, &np);
+        if (error)
+            break;
+        if (np->hn_kind != HFSP_NODE_LEAF)
+        {
+            hfsp_release_btnode(np);
+            break;
+        }
+
+        for (i = np->hn_numRecords - 1; i >= 0 && count < max; i--)
+        {
+            offset = be16toh(*(np->hn_recordTable - (1 + i)));
+            if (offset + sizeof(*kp) > np->hn_nodeSize)
+                continue;
+            kp = (struct HotFileKey *)(np->hn_beginBuf + offset);
+            if (be32toh(kp->temperature) == HFSP_HOTFILE_LOOKUPTAG || kp->forkType != 0)
+                continue;
+            cnids[count++] = be32toh(kp->fileID);
+        }
+
+        prev = np->hn_prev;
+        hfsp_release_btnode(np);
+    }
+    return count;
+}
+
+/*
+ * Read the catalogue record of a file. The data is not read, the driver has
+ * no read path for it.
+ */
+static void
+hfsp_hotfile_prefetch(struct hfspmount * hmp, hfsp_cnid cnid)
+{
+    struct hfsp_record * rp;
+    int error;
+
+    rp = NULL;
+    error = hfsp_btree_find_cnid(hmp->hm_catalog_bp, cnid, &rp);
+    if (error == 0 && rp->hr_type == HFSP_FILE_RECORD)
+    {
+        hfsp_attr_prime(hmp, rp);
+        atomic_add_long(&hfsp_hotfile_prefetched, 1);
+    }
+
+    if (rp != NULL)
+        hfsp_brec_release_record(&rp);
+}
+
+static void
+hfsp_hotfile_task(void * arg, int pending)
+{
+    struct hfspmount * hmp;
+    struct hfsp_btree * btreep;
+    hfsp_cnid * cnids;
+    int count, i, error;
+
+    hmp = arg;
+    error = hfsp_hotfile_open(hmp, &btreep);
+    if (error)
+    {
+        HFSP_TRACE(HFSP_TRACE_INFO, "hfsp_hotfile_task: No hot files B-tree, error %jd.", error);
+        return;
+    }
+
+    cnids = malloc(max(hfsp_hotfile_max, 1) * sizeof(*cnids), M_TEMP, M_WAITOK);
+    count = hfsp_hotfile_collect(btreep, cnids, hfsp_hotfile_max);
+    hfsp_btree_close(btreep);
+
+    HFSP_TRACE(HFSP_TRACE_INFO, "hfsp_hotfile_task: Prefetching %ju hot files.", count);
+    for (i = 0; i < count; i++)
+        hfsp_hotfile_prefetch(hmp, cnids[i]);
+    free(cnids, M_TEMP);
+}
+
+void
+hfsp_hotfile_mount(struct hfspmount * hmp)
+{
+    TASK_INIT(&hmp->hm_hotTask, 0, hfsp_hotfile_task, hmp);
+    hmp->hm_flags |= HFSP_MNT_HOTFILES;
+    taskqueue_enqueue(hfsp_taskqueue, &hmp->hm_hotTask);
+}
+
+void
+hfsp_hotfile_unmount(struct hfspmount * hmp)
+{
+    if (hmp->hm_flags & HFSP_MNT_HOTFILES)
+        taskqueue_drain(hfsp_taskqueue, &hmp->hm_hotTask);
+}
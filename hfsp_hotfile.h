@@ -0,0 +1,34 @@
+#include <sys/param.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_HOTFILE_H_
+#define _HFSP_HOTFILE_H_
+
+/* Name of the hot files B-tree, in the root folder */
+#define HFSP_HOTFILE_NAME       ".hotfiles.btree"
+
+/* Key temperature of the records mapping a file to its temperature */
+#define HFSP_HOTFILE_LOOKUPTAG  0xFFFFFFFF
+
+/* Hot files B-tree key, in big endian on disk */
+struct HotFileKey {
+    u_int16_t   keyLength;      /* length of key, excluding this field */
+    u_int8_t    forkType;       /* 0 = data fork, FF = resource fork */
+    u_int8_t    pad;            /* make the other fields align on 32-bit boundary */
+    u_int32_t   temperature;    /* temperature recorded */
+    u_int32_t   fileID;         /* file ID */
+} __attribute__((aligned(2), packed));
+
+/*
+ * Start reading, in the background, the catalogue records of the hottest
+ * files of the volume. Nothing is done if the volume has no hot files B-tree.
+ */
+void hfsp_hotfile_mount(struct hfspmount * hmp);
+
+/*
+ * Wait for the hot files prefetch of a mount, before the B-trees are closed.
+ */
+void hfsp_hotfile_unmount(struct hfspmount * hmp);
+
+#endif /* _HFSP_HOTFILE_H_ */
@@ -6,28 +6,25 @@
 #include <sys/systm.h>
 #include <sys/buf.h>
 
+#include <sys/endian.h>
+
 #include "hfsp.h"
+#include "hfsp_btree.h"
+#include "hfsp_name.h"
+#include "hfsp_trace.h"
+#include "hfsp_journal.h"
 
-/*
- * Given an inode we read from the disk the specified size.
- * Read happen at physical block size granularity.
- *
- * This function is helper for internal file system usage.
- **/
 int
-hfsp_bread_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, struct buf ** bpp)
+hfsp_bmap_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, daddr_t * blknop, int * sizep,
+                u_int64_t * runp)
 {
-    struct vnode *                  vp;
     struct hfsp_fork *              fork;
     struct hfsp_extent_descriptor * ep;
-    int i, found, blkOffsetFile, blkCount, blk, blkFactor, sizeBread;
-
-    vp = ip->hi_vp;
-    sizeBread = (max(1, size / ip->hi_mount->hm_physBlockSize)) * ip->hi_mount->hm_physBlockSize;
+    u_int64_t blkOffsetFile, blkCount, physOffset, blockSize;
+    int i, found;
 
-    blkOffsetFile = fileOffset / ip->hi_mount->hm_blockSize;
-
-    blkFactor = ip->hi_mount->hm_blockSize / ip->hi_mount->hm_physBlockSize;
+    blockSize = ip->hi_mount->hm_blockSize;
+    blkOffsetFile = fileOffset / blockSize;
 
     found = 0;
     fork = &ip->hi_fork;
@@ -42,7 +39,6 @@ hfsp_bread_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, struct
         if (blkCount + ep->blockCount > blkOffsetFile)
         {
             found = 1;
-            blk = ep->startBlock + (blkOffsetFile - blkCount);
             break;
         }
         blkCount += ep->blockCount;
@@ -54,6 +50,182 @@ hfsp_bread_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, struct
         return EINVAL;
     }
 
-    return bread(vp, blk * blkFactor, sizeBread, NOCRED, bpp);
+    // The device is addressed in DEV_BSIZE units whatever its sector size.
+    physOffset = (ep->startBlock + (blkOffsetFile - blkCount)) * blockSize + fileOffset % blockSize;
+    *blknop = btodb(physOffset);
+    *sizep = roundup(size, ip->hi_mount->hm_physBlockSize);
+    if (runp != NULL)
+        *runp = (blkCount + ep->blockCount) * blockSize - fileOffset;
+    return 0;
+}
+
+int
+hfsp_bread_dev(struct hfspmount * hmp, daddr_t blkno, int size, struct buf ** bpp)
+{
+    int error;
+
+    error = bread(hmp->hm_devvp, blkno, size, NOCRED, bpp);
+    if (error == 0)
+        hfsp_journal_patch(hmp, blkno, (*bpp)->b_data, size);
+    return error;
+}
+
+/*
+ * Given an inode we read from the disk the specified size.
+ * Read happen at physical block size granularity.
+ *
+ * This function is helper for internal file system usage.
+ **/
+int
+hfsp_bread_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, struct buf ** bpp)
+{
+    u_int64_t run;
+    daddr_t blkno;
+    int error, sizeBread;
+
+    error = hfsp_bmap_inode(ip, fileOffset, size, &blkno, &sizeBread, &run);
+    if (error)
+        return error;
+
+    // A single buffer can not span two extents, see hfsp_read_inode().
+    if (run < size)
+    {
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_bread_inode: Range at %ju of %jd bytes crosses an extent.",
+                   fileOffset, size);
+        return EINVAL;
+    }
+
+    return hfsp_bread_dev(ip->hi_mount, blkno, sizeBread, bpp);
 }
 
+int
+hfsp_read_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, void * buf)
+{
+    struct buf * bp;
+    u_int64_t run;
+    daddr_t blkno;
+    int error, chunk, done, sizeBread;
+
+    // One read per physical run, extents end on allocation block boundaries.
+    // A run longer than a buffer is read in several.
+    for (done = 0; done < size; done += chunk)
+    {
+        error = hfsp_bmap_inode(ip, fileOffset + done, size - done, &blkno, &sizeBread, &run);
+        if (error)
+            return error;
+        chunk = MIN(MIN(run, (u_int64_t)(size - done)), MAXBSIZE);
+        error = hfsp_bread_dev(ip->hi_mount, blkno, roundup(chunk, ip->hi_mount->hm_physBlockSize), &bp);
+        if (error)
+            return error;
+        memcpy((char *)buf + done, bp->b_data, chunk);
+        brelse(bp);
+    }
+    return 0;
+}
+
+
+/*
+ * Decode an on disk fork into its in memory representation.
+ */
+void
+hfsp_fork_decode(struct hfsp_fork * forkp, struct HFSPlusForkData * rawp)
+{
+    int i;
+
+    forkp->size = be64toh(rawp->logicalSize);
+    forkp->totalBlocks = be32toh(rawp->totalBlocks);
+    forkp->clumpSize = be32toh(rawp->clumpSize);
+
+    for (i = 0; i < HFSP_FIRSTEXTENT_SIZE; i++)
+    {
+        forkp->first_extents[i].startBlock = be32toh(rawp->extents[i].startBlock);
+        forkp->first_extents[i].blockCount = be32toh(rawp->extents[i].blockCount);
+    }
+}
+
+/*
+ * Copy the fields of a folder or file record needed by the vnode
+ * operations into the inode. The inode shares the interned name of the key.
+ */
+void
+hfsp_inode_fill(struct hfsp_inode * ip, struct hfsp_record * rp)
+{
+    if (ip->hi_name == NULL && rp->hr_key.hk_name != NULL)
+        ip->hi_name = hfsp_name_ref(rp->hr_key.hk_name);
+
+    ip->hi_cnid = rp->hr_cnid;
+    ip->hi_parentCnid = rp->hr_parentCnid;
+    ip->hi_type = rp->hr_type;
+    ip->hi_mode = rp->hr_fileMode;
+    ip->hi_uid = rp->hr_ownerId;
+    ip->hi_gid = rp->hr_groupId;
+    ip->hi_special.linkCount = rp->hr_linkCount;
+
+    switch (rp->hr_type)
+    {
+        case HFSP_FOLDER_RECORD:
+            ip->hi_flags = rp->hr_folder.hrfo_flags;
+            ip->hi_valence = rp->hr_folder.hrfo_valence;
+            ip->hi_createDate = rp->hr_folder.hrfo_createDate;
+            ip->hi_accessDate = rp->hr_folder.hrfo_lstAccessDate;
+            ip->hi_modifyDate = rp->hr_folder.hrfo_lstModifyDate;
+            ip->hi_changeDate = rp->hr_folder.hrfo_lstChangeTime;
+            break;
+        case HFSP_FILE_RECORD:
+            ip->hi_flags = rp->hr_file.hrfi_flags;
+            ip->hi_valence = 0;
+            ip->hi_createDate = rp->hr_file.hrfi_createDate;
+            ip->hi_accessDate = rp->hr_file.hrfi_lstAccessDate;
+            ip->hi_modifyDate = rp->hr_file.hrfi_lstModifyDate;
+            ip->hi_changeDate = rp->hr_file.hrfi_lstChangeTime;
+            ip->hi_fork = rp->hr_file.hrfi_dataFork;
+            break;
+    }
+}
+
+/*
+ * Return the name of an inode, reading it from the thread record when the
+ * inode was not created with it.
+ * ip: The inode.
+ * namepp: Address of a pointer that will point to the interned name on exit.
+ * The reference belongs to the inode.
+ */
+int
+hfsp_iname(struct hfsp_inode * ip, struct hfsp_name ** namepp)
+{
+    struct hfsp_record_key key;
+    struct hfsp_record * rp;
+    struct hfsp_name * namep;
+    int error;
+
+    if (ip->hi_name != NULL)
+    {
+        *namepp = ip->hi_name;
+        return 0;
+    }
+
+    bzero(&key, sizeof(key));
+    key.hk_cnid = ip->hi_cnid;
+    rp = NULL;
+    error = hfsp_btree_find(ip->hi_mount->hm_catalog_bp, &key, &rp);
+    if (error)
+        goto out;
+
+    if (rp->hr_parentCnid != ip->hi_cnid ||
+        (rp->hr_type != HFSP_FILE_THREAD_RECORD && rp->hr_type != HFSP_FOLDER_THREAD_RECORD))
+    {
+        error = ENOENT;
+        goto out;
+    }
+
+    // Callers may hold a shared lock, the reference of the loser is dropped.
+    namep = hfsp_name_ref(rp->hr_thread.hrt_name);
+    if (!atomic_cmpset_ptr((volatile uintptr_t *)&ip->hi_name, (uintptr_t)NULL, (uintptr_t)namep))
+        hfsp_name_release(&ip->hi_mount->hm_names, namep);
+    *namepp = ip->hi_name;
+
+out:
+    if (rp != NULL)
+        hfsp_brec_release_record(&rp);
+    return error;
+}
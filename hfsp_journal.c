@@ -0,0 +1,459 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/buf.h>
+#include <sys/endian.h>
+#include <sys/conf.h>
+#include <sys/sysctl.h>
+#include <sys/syslog.h>
+
+#include "hfsp.h"
+#include "hfsp_journal.h"
+#include "hfsp_trace.h"
+
+MALLOC_DEFINE(M_HFSPJOURNAL, "hfsp_journal", "HFS+ journal overlay");
+
+static u_long hfsp_journal_max = 256 * 1024 * 1024;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, journal_max, CTLFLAG_RW, &hfsp_journal_max, 0,
+             "Largest journal overlay in bytes, volumes needing more are not mounted");
+
+/* Largest alignment used to hash the blocks */
+#define HFSP_JOURNAL_MAXSHIFT           16
+
+/* State of the walk of the transactions */
+struct hfsp_jreader {
+    struct hfspmount *  hjr_mount;
+    off_t               hjr_offset;     /* Journal offset on the device */
+    int64_t             hjr_size;
+    int64_t             hjr_hdrSize;    /* Transactions wrap after the header */
+    int                 hjr_swap;       /* Written by a host of the other endianness */
+};
+
+#define HFSP_J16(jrp, v)    ((jrp)->hjr_swap ? bswap16(v) : (v))
+#define HFSP_J32(jrp, v)    ((jrp)->hjr_swap ? bswap32(v) : (v))
+#define HFSP_J64(jrp, v)    ((jrp)->hjr_swap ? bswap64(v) : (v))
+
+#define HFSP_JHASH(jp, off) (&(jp)->hj_hash[((off) >> (jp)->hj_shift) & (jp)->hj_mask])
+
+int32_t
+hfsp_journal_cksum(const void * ptr, int len)
+{
+    const u_int8_t * p;
+    u_int32_t cksum;
+    int i;
+
+    p = ptr;
+    cksum = 0;
+    for (i = 0; i < len; i++)
+        cksum = (cksum << 8) ^ (cksum + p[i]);
+    return ~cksum;
+}
+
+/*
+ * Read bytes of the device at any offset, at most MAXBSIZE per buffer. The
+ * buffers are not kept, the journal is read once.
+ */
+static int
+hfsp_journal_read_dev(struct hfspmount * hmp, off_t offset, void * buf, size_t len)
+{
+    struct buf * bp;
+    off_t start;
+    size_t chunk, skip;
+    int error, size;
+
+    while (len > 0)
+    {
+        start = rounddown(offset, hmp->hm_physBlockSize);
+        skip = offset - start;
+        size = roundup(MIN(skip + len, MAXBSIZE), hmp->hm_physBlockSize);
+        chunk = MIN(len, size - skip);
+        error = bread(hmp->hm_devvp, btodb(start), size, NOCRED, &bp);
+        if (error)
+            return error;
+        memcpy(buf, bp->b_data + skip, chunk);
+        bp->b_flags |= B_INVAL | B_NOCACHE;
+        brelse(bp);
+
+        buf = (char *)buf + chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Move a position in the journal, wrapping after its end.
+ */
+static int64_t
+hfsp_journal_advance(struct hfsp_jreader * jrp, int64_t pos, int64_t len)
+{
+    pos += len;
+    if (pos >= jrp->hjr_size)
+        pos = jrp->hjr_hdrSize + (pos - jrp->hjr_size);
+    return pos;
+}
+
+/*
+ * Read bytes of the journal, wrapping after its end.
+ */
+static int
+hfsp_journal_read(struct hfsp_jreader * jrp, int64_t * posp, void * buf, size_t len)
+{
+    size_t chunk;
+    int error;
+
+    while (len > 0)
+    {
+        chunk = MIN(len, (size_t)(jrp->hjr_size - *posp));
+        if (buf != NULL)
+        {
+            error = hfsp_journal_read_dev(jrp->hjr_mount, jrp->hjr_offset + *posp, buf, chunk);
+            if (error)
+                return error;
+            buf = (char *)buf + chunk;
+        }
+        *posp = hfsp_journal_advance(jrp, *posp, chunk);
+        len -= chunk;
+    }
+    return 0;
+}
+
+static void
+hfsp_journal_free(struct hfsp_journal * jp)
+{
+    struct hfsp_jblock * jbp;
+    u_long i;
+
+    for (i = 0; i <= jp->hj_mask; i++)
+    {
+        while ((jbp = LIST_FIRST(&jp->hj_hash[i])) != NULL)
+        {
+            LIST_REMOVE(jbp, hjb_hash);
+            free(jbp, M_HFSPJOURNAL);
+        }
+    }
+    hashdestroy(jp->hj_hash, M_HFSPJOURNAL, jp->hj_mask);
+    free(jp, M_HFSPJOURNAL);
+}
+
+/*
+ * Copy the overlapping part of a block into a range of the device.
+ */
+static __inline void
+hfsp_jblock_copy(struct hfsp_jblock * jbp, off_t offset, u_int8_t * data, off_t size)
+{
+    off_t start, end;
+
+    start = MAX(offset, jbp->hjb_offset);
+    end = MIN(offset + size, jbp->hjb_offset + jbp->hjb_size);
+    if (start < end)
+        memcpy(data + (start - offset), jbp->hjb_data + (start - jbp->hjb_offset), end - start);
+}
+
+/*
+ * Add a block, in the order of the transactions. The blocks it overlaps take
+ * its content, so the blocks can be applied in any order.
+ */
+static void
+hfsp_journal_insert(struct hfsp_journal * jp, struct hfsp_jblock * jbp)
+{
+    struct hfsp_jblock * ojbp;
+    off_t key, first, last;
+
+    first = MAX(jbp->hjb_offset - jp->hj_maxSize + 1, 0) >> jp->hj_shift;
+    last = (jbp->hjb_offset + jbp->hjb_size - 1) >> jp->hj_shift;
+    for (key = first; key <= last; key++)
+    {
+        LIST_FOREACH(ojbp, HFSP_JHASH(jp, key << jp->hj_shift), hjb_hash)
+        {
+            if ((ojbp->hjb_offset >> jp->hj_shift) != key)
+                continue;
+            if (ojbp->hjb_offset == jbp->hjb_offset && ojbp->hjb_size == jbp->hjb_size)
+            {
+                // Logged again, the newer copy replaces the data.
+                memcpy(ojbp->hjb_data, jbp->hjb_data, jbp->hjb_size);
+                free(jbp, M_HFSPJOURNAL);
+                return;
+            }
+            hfsp_jblock_copy(jbp, ojbp->hjb_offset, ojbp->hjb_data, ojbp->hjb_size);
+        }
+    }
+    LIST_INSERT_HEAD(HFSP_JHASH(jp, jbp->hjb_offset), jbp, hjb_hash);
+    jp->hj_count++;
+    jp->hj_bytes += jbp->hjb_size;
+}
+
+void
+hfsp_journal_apply(struct hfsp_journal * jp, daddr_t blkno, void * data, int size)
+{
+    struct hfsp_jblock * jbp;
+    off_t offset, key, first, last;
+
+    offset = dbtob(blkno);
+    first = MAX(offset - jp->hj_maxSize + 1, 0) >> jp->hj_shift;
+    last = (offset + size - 1) >> jp->hj_shift;
+    for (key = first; key <= last; key++)
+    {
+        LIST_FOREACH(jbp, HFSP_JHASH(jp, key << jp->hj_shift), hjb_hash)
+        {
+            if ((jbp->hjb_offset >> jp->hj_shift) == key)
+                hfsp_jblock_copy(jbp, offset, data, size);
+        }
+    }
+}
+
+/*
+ * Read the blocks of the transactions from start to end, in order.
+ * blocksp, countp: Array of the blocks read, allocated in M_TEMP, on exit.
+ */
+static int
+hfsp_journal_collect(struct hfsp_jreader * jrp, int64_t start, int64_t end, int blhdrSize,
+                     struct hfsp_jblock *** blocksp, int * countp)
+{
+    struct block_list_header * blhp;
+    struct hfsp_jblock * jbp, ** blocks, ** nblocks;
+    u_int64_t total;
+    int64_t pos, next, bnum;
+    int32_t cksum, used;
+    u_int32_t bsize;
+    int error, count, max, i, num;
+
+    blhp = malloc(blhdrSize, M_TEMP, M_WAITOK);
+    max = 64;
+    blocks = malloc(max * sizeof(*blocks), M_TEMP, M_WAITOK);
+    count = 0;
+    total = 0;
+    error = 0;
+
+    for (pos = start; pos != end; pos = next)
+    {
+        error = hfsp_journal_read(jrp, &pos, blhp, blhdrSize);
+        if (error)
+            break;
+        num = HFSP_J16(jrp, blhp->num_blocks);
+        used = HFSP_J32(jrp, blhp->bytes_used);
+        cksum = HFSP_J32(jrp, blhp->checksum);
+        blhp->checksum = 0;
+        if (hfsp_journal_cksum(blhp, BLHDR_CHECKSUM_SIZE) != cksum || num < 1 ||
+            sizeof(*blhp) + (num - 1) * sizeof(blhp->binfo[0]) > blhdrSize ||
+            used < blhdrSize || used > jrp->hjr_size - jrp->hjr_hdrSize)
+        {
+            HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_journal_collect: Bad transaction at %ju.", pos);
+            error = EINVAL;
+            break;
+        }
+        // The header has been read, the transaction starts blhdrSize bytes back.
+        next = hfsp_journal_advance(jrp, pos, used - blhdrSize);
+
+        for (i = 1; i < num; i++)
+        {
+            bnum = HFSP_J64(jrp, blhp->binfo[i].bnum);
+            bsize = HFSP_J32(jrp, blhp->binfo[i].bsize);
+            // A block is logged from a single buffer of the writer.
+            if (bsize == 0 || bsize > MAXBSIZE)
+            {
+                error = EINVAL;
+                break;
+            }
+            // Cancelled blocks keep their room in the transaction.
+            if (bnum == -1)
+            {
+                error = hfsp_journal_read(jrp, &pos, NULL, bsize);
+                if (error)
+                    break;
+                continue;
+            }
+            if (bnum < 0)
+            {
+                error = EINVAL;
+                break;
+            }
+
+            total += bsize;
+            if (total > hfsp_journal_max)
+            {
+                error = EFBIG;
+                break;
+            }
+            jbp = malloc(sizeof(*jbp) + bsize, M_HFSPJOURNAL, M_WAITOK);
+            jbp->hjb_offset = bnum * jrp->hjr_hdrSize;
+            jbp->hjb_size = bsize;
+            jbp->hjb_data = (u_int8_t *)(jbp + 1);
+            error = hfsp_journal_read(jrp, &pos, jbp->hjb_data, bsize);
+            if (error)
+            {
+                free(jbp, M_HFSPJOURNAL);
+                break;
+            }
+
+            if (count == max)
+            {
+                nblocks = malloc(2 * max * sizeof(*blocks), M_TEMP, M_WAITOK);
+                memcpy(nblocks, blocks, max * sizeof(*blocks));
+                free(blocks, M_TEMP);
+                blocks = nblocks;
+                max *= 2;
+            }
+            blocks[count++] = jbp;
+        }
+        if (error)
+            break;
+    }
+    free(blhp, M_TEMP);
+
+    if (error)
+    {
+        while (count-- > 0)
+            free(blocks[count], M_HFSPJOURNAL);
+        free(blocks, M_TEMP);
+        return error;
+    }
+    *blocksp = blocks;
+    *countp = count;
+    return 0;
+}
+
+/*
+ * Hash the blocks read from the transactions.
+ */
+static struct hfsp_journal *
+hfsp_journal_build(struct hfsp_jblock ** blocks, int count)
+{
+    struct hfsp_journal * jp;
+    u_int64_t align;
+    int i;
+
+    jp = malloc(sizeof(*jp), M_HFSPJOURNAL, M_WAITOK | M_ZERO);
+    align = 1 << HFSP_JOURNAL_MAXSHIFT;
+    for (i = 0; i < count; i++)
+    {
+        align |= blocks[i]->hjb_offset | blocks[i]->hjb_size;
+        jp->hj_maxSize = max(jp->hj_maxSize, blocks[i]->hjb_size);
+    }
+    // Bounded by HFSP_JOURNAL_MAXSHIFT, the low word is enough.
+    jp->hj_shift = ffs((u_int)align) - 1;
+    jp->hj_hash = hashinit(max(count, 16), M_HFSPJOURNAL, &jp->hj_mask);
+
+    for (i = 0; i < count; i++)
+        hfsp_journal_insert(jp, blocks[i]);
+    return jp;
+}
+
+int
+hfsp_journal_header(struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph, struct hfsp_jinfo * jip)
+{
+    struct JournalInfoBlock jib;
+    struct journal_header jh;
+    u_int32_t flags;
+    int32_t cksum;
+    int error, swap;
+
+    if (!(be32toh(hfsph->attributes) & kHFSVolumeJournaledMask) || hfsph->journalInfoBlock == 0)
+        return ENOENT;
+
+    error = hfsp_journal_read_dev(hmp, (off_t)be32toh(hfsph->journalInfoBlock) * hmp->hm_blockSize,
+                                  &jib, sizeof(jib));
+    if (error)
+        return error;
+    flags = be32toh(jib.flags);
+    if (flags & kJIJournalNeedInitMask)
+        return ENOENT;
+    if (!(flags & kJIJournalInFSMask))
+    {
+        log(LOG_WARNING, "hfsp: %s: journal on another device, not supported\n", devtoname(hmp->hm_dev));
+        return EOPNOTSUPP;
+    }
+
+    bzero(jip, sizeof(*jip));
+    jip->hji_offset = be64toh(jib.offset);
+    error = hfsp_journal_read_dev(hmp, jip->hji_offset, &jh, sizeof(jh));
+    if (error)
+        return error;
+    if (jh.magic == JOURNAL_HEADER_MAGIC && jh.endian == JOURNAL_HEADER_ENDIAN)
+        swap = 0;
+    else if (jh.magic == bswap32(JOURNAL_HEADER_MAGIC) && jh.endian == bswap32(JOURNAL_HEADER_ENDIAN))
+        swap = 1;
+    else
+        return EINVAL;
+
+    // The checksum covers the header as written.
+    cksum = swap ? bswap32(jh.checksum) : jh.checksum;
+    jh.checksum = 0;
+    if (hfsp_journal_cksum(&jh, JOURNAL_HEADER_CKSUM_SIZE) != cksum)
+    {
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_journal_header: Bad journal header checksum.");
+        return EINVAL;
+    }
+    if (swap)
+    {
+        jh.start = bswap64(jh.start);
+        jh.end = bswap64(jh.end);
+        jh.size = bswap64(jh.size);
+        jh.blhdr_size = bswap32(jh.blhdr_size);
+        jh.jhdr_size = bswap32(jh.jhdr_size);
+    }
+    jip->hji_swap = swap;
+    jip->hji_size = jh.size;
+    jip->hji_hdrSize = jh.jhdr_size;
+    jip->hji_blhdrSize = jh.blhdr_size;
+    jip->hji_start = jh.start;
+    jip->hji_end = jh.end;
+    if (jip->hji_hdrSize < DEV_BSIZE || !powerof2(jip->hji_hdrSize) ||
+        jip->hji_size <= jip->hji_hdrSize || jip->hji_size > be64toh(jib.size) ||
+        jip->hji_start < jip->hji_hdrSize || jip->hji_start >= jip->hji_size ||
+        jip->hji_end < jip->hji_hdrSize || jip->hji_end >= jip->hji_size ||
+        jip->hji_blhdrSize < sizeof(struct block_list_header) ||
+        jip->hji_blhdrSize > jip->hji_size - jip->hji_hdrSize)
+    {
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_journal_header: Bad journal header.");
+        return EINVAL;
+    }
+    return 0;
+}
+
+int
+hfsp_journal_mount(struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph)
+{
+    struct hfsp_jinfo ji;
+    struct hfsp_jreader jr;
+    struct hfsp_jblock ** blocks;
+    int error, count;
+
+    if (be32toh(hfsph->attributes) & kHFSVolumeUnmountedMask)
+        return 0;
+    error = hfsp_journal_header(hmp, hfsph, &ji);
+    if (error == ENOENT)
+        return 0;
+    if (error)
+        return error;
+    if (ji.hji_start == ji.hji_end)
+        return 0;
+
+    bzero(&jr, sizeof(jr));
+    jr.hjr_mount = hmp;
+    jr.hjr_offset = ji.hji_offset;
+    jr.hjr_size = ji.hji_size;
+    jr.hjr_hdrSize = ji.hji_hdrSize;
+    jr.hjr_swap = ji.hji_swap;
+    error = hfsp_journal_collect(&jr, ji.hji_start, ji.hji_end, ji.hji_blhdrSize, &blocks, &count);
+    if (error)
+    {
+        log(LOG_WARNING, "hfsp: %s: journal can not be read, error %d\n", devtoname(hmp->hm_dev), error);
+        return error;
+    }
+    hmp->hm_journal = hfsp_journal_build(blocks, count);
+    free(blocks, M_TEMP);
+
+    log(LOG_INFO, "hfsp: %s: journal not replayed, %u blocks of %ju bytes read over the volume\n",
+        devtoname(hmp->hm_dev), hmp->hm_journal->hj_count, (uintmax_t)hmp->hm_journal->hj_bytes);
+    return 0;
+}
+
+void
+hfsp_journal_unmount(struct hfspmount * hmp)
+{
+    if (hmp->hm_journal != NULL)
+        hfsp_journal_free(hmp->hm_journal);
+    hmp->hm_journal = NULL;
+}
@@ -0,0 +1,147 @@
+#include <sys/param.h>
+
+#include "hfsp.h"
+#include "hfsp_jwrite.h"
+
+#ifndef _HFSP_JOURNAL_H_
+#define _HFSP_JOURNAL_H_
+
+MALLOC_DECLARE(M_HFSPJOURNAL);
+
+/* Volume attribute of the journaled volumes */
+#define kHFSVolumeJournaledBit          13
+#define kHFSVolumeJournaledMask         (1 << kHFSVolumeJournaledBit)
+
+/* Volume attribute of the cleanly unmounted volumes, their journal is empty */
+#define kHFSVolumeUnmountedMask         (1 << 8)
+
+/* JournalInfoBlock flags */
+#define kJIJournalInFSMask              0x00000001
+#define kJIJournalOnOtherDeviceMask     0x00000002
+#define kJIJournalNeedInitMask          0x00000004
+
+/* Where the journal is, in big endian */
+struct JournalInfoBlock {
+    u_int32_t   flags;
+    u_int32_t   device_signature[8];
+    u_int64_t   offset;             /* byte offset of the journal on the device */
+    u_int64_t   size;               /* size in bytes of the journal */
+    u_int32_t   reserved[32];
+} __attribute__((aligned(2), packed));
+
+/* Journal header, in the endianness of the host that wrote it */
+#define JOURNAL_HEADER_MAGIC            0x4a4e4c78  /* 'JNLx' */
+#define JOURNAL_HEADER_ENDIAN           0x12345678
+
+struct journal_header {
+    int32_t     magic;
+    int32_t     endian;
+    int64_t     start;              /* offset of the first transaction in the journal */
+    int64_t     end;                /* offset past the last transaction */
+    int64_t     size;               /* size of the journal, header included */
+    int32_t     blhdr_size;         /* size of a block list header */
+    int32_t     checksum;
+    int32_t     jhdr_size;          /* size of the header, unit of the block numbers */
+} __attribute__((aligned(2), packed));
+
+#define JOURNAL_HEADER_CKSUM_SIZE       sizeof(struct journal_header)
+
+/* A block logged by a transaction */
+struct block_info {
+    int64_t     bnum;               /* block on the device in jhdr_size units, -1 if cancelled */
+    u_int32_t   bsize;              /* size in bytes */
+    u_int32_t   next;
+} __attribute__((aligned(2), packed));
+
+/* Start of a transaction, followed by the data of its blocks */
+struct block_list_header {
+    u_int16_t   max_blocks;
+    u_int16_t   num_blocks;         /* blocks in binfo, binfo[0] included */
+    int32_t     bytes_used;         /* size of the transaction, header included */
+    int32_t     checksum;           /* checksum of the header and of binfo[0] */
+    int32_t     flags;
+    struct block_info binfo[1];     /* binfo[0] is not a block */
+} __attribute__((aligned(2), packed));
+
+#define BLHDR_CHECKSUM_SIZE             sizeof(struct block_list_header)
+
+/* In memory copy of a logged block */
+struct hfsp_jblock {
+    LIST_ENTRY(hfsp_jblock)     hjb_hash;
+    off_t                       hjb_offset;     /* Byte offset on the device */
+    u_int32_t                   hjb_size;
+    u_int8_t *                  hjb_data;
+};
+
+/* Blocks of the transactions not replayed to the volume, never changed once built */
+struct hfsp_journal {
+    LIST_HEAD(, hfsp_jblock) *  hj_hash;
+    u_long                      hj_mask;
+    int                         hj_shift;       /* Blocks are aligned on 1 << hj_shift bytes */
+    u_int32_t                   hj_maxSize;     /* Largest block */
+    u_int                       hj_count;
+    u_int64_t                   hj_bytes;
+};
+
+/* Place and state of a journal, in the endianness of the host */
+struct hfsp_jinfo {
+    off_t                       hji_offset;     /* Journal offset on the device */
+    int64_t                     hji_size;
+    int64_t                     hji_hdrSize;    /* Transactions wrap after the header */
+    int32_t                     hji_blhdrSize;
+    int64_t                     hji_start;
+    int64_t                     hji_end;
+    int                         hji_swap;       /* Written by a host of the other endianness */
+};
+
+/*
+ * Checksum of the journal and block list headers.
+ */
+int32_t hfsp_journal_cksum(const void * ptr, int len);
+
+/*
+ * Read and check the journal header of a volume.
+ * hmp: The mount, hm_devvp, hm_blockSize and hm_physBlockSize must be set.
+ * hfsph: The volume header as read from the device.
+ * jip: The journal on exit.
+ * Return ENOENT if the volume has no journal in use, EOPNOTSUPP if the
+ * journal is on another device.
+ */
+int hfsp_journal_header(struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph, struct hfsp_jinfo * jip);
+
+/*
+ * Build the overlay of a volume whose journal was not replayed. Nothing is
+ * written to the device. hm_journal is left NULL if the journal is empty.
+ * hmp: The mount, hm_devvp and hm_physBlockSize must be set.
+ * hfsph: The volume header as read from the device.
+ * Return 0 on success.
+ */
+int hfsp_journal_mount(struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph);
+
+/*
+ * Free the overlay of a mount.
+ */
+void hfsp_journal_unmount(struct hfspmount * hmp);
+
+/*
+ * Copy the logged blocks over the data just read from the device.
+ * jp: The overlay.
+ * blkno: Device block, in DEV_BSIZE units, of the data.
+ * data, size: The data read.
+ */
+void hfsp_journal_apply(struct hfsp_journal * jp, daddr_t blkno, void * data, int size);
+
+/*
+ * Copy the blocks not on the volume yet over the data just read from the
+ * device: the journal overlay, then the blocks logged and not checkpointed.
+ */
+static __inline void
+hfsp_journal_patch(struct hfspmount * hmp, daddr_t blkno, void * data, int size)
+{
+    if (hmp->hm_journal != NULL)
+        hfsp_journal_apply(hmp->hm_journal, blkno, data, size);
+    if (hmp->hm_jwriter != NULL)
+        hfsp_jwrite_apply(hmp->hm_jwriter, blkno, data, size);
+}
+
+#endif /* _HFSP_JOURNAL_H_ */
@@ -0,0 +1,814 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/conf.h>
+#include <sys/endian.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/sysctl.h>
+#include <sys/syslog.h>
+#include <sys/taskqueue.h>
+#include <sys/tree.h>
+#include <sys/vnode.h>
+
+#include <geom/geom.h>
+
+#include "hfsp.h"
+#include "hfsp_journal.h"
+#include "hfsp_jwrite.h"
+#include "hfsp_trace.h"
+
+MALLOC_DEFINE(M_HFSPJWRITE, "hfsp_jwrite", "HFS+ journal transactions");
+
+static int hfsp_jwrite_delay = 20;
+SYSCTL_INT(_vfs_hfsp, OID_AUTO, jwrite_delay, CTLFLAG_RW, &hfsp_jwrite_delay, 0,
+           "Milliseconds a journal transaction stays open to group the operations");
+
+static u_long hfsp_jwrite_max = 8 * 1024 * 1024;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, jwrite_max, CTLFLAG_RW, &hfsp_jwrite_max, 0,
+             "Bytes logged by a journal transaction before new operations wait for its commit");
+
+static u_long hfsp_jwrite_commits;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, jwrite_commits, CTLFLAG_RD, &hfsp_jwrite_commits, 0,
+             "Journal transactions committed");
+
+static u_long hfsp_jwrite_ops;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, jwrite_ops, CTLFLAG_RD, &hfsp_jwrite_ops, 0,
+             "Operations grouped in the committed transactions");
+
+static u_long hfsp_jwrite_flushes;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, jwrite_flushes, CTLFLAG_RD, &hfsp_jwrite_flushes, 0,
+             "Cache flushes of the journaled devices");
+
+/* A block logged by a transaction, followed by its content */
+struct hfsp_jwblock {
+    RB_ENTRY(hfsp_jwblock)      hwb_entry;
+    off_t                       hwb_offset;     /* Byte offset on the device */
+    u_int32_t                   hwb_size;
+};
+
+#define HFSP_JWBLOCK_DATA(wbp)  ((u_int8_t *)((wbp) + 1))
+
+/* Operations committed together */
+struct hfsp_jtrans {
+    TAILQ_ENTRY(hfsp_jtrans)                htr_link;
+    RB_HEAD(hfsp_jwblocks, hfsp_jwblock)    htr_blocks;
+    u_int64_t                               htr_seq;
+    u_int                                   htr_count;
+    u_int                                   htr_ops;
+    u_int64_t                               htr_bytes;
+    u_int32_t                               htr_maxSize;
+};
+
+struct hfsp_jwriter {
+    struct mtx                  hjw_mtx;
+    struct hfspmount *          hjw_mount;
+    struct g_consumer *         hjw_cp;
+    struct timeout_task         hjw_task;
+    int                         hjw_due;        /* Ticks when the task runs */
+    int                         hjw_flags;
+    int                         hjw_error;      /* Journal aborted */
+
+    /* Journal, as in its header on the disk */
+    off_t                       hjw_offset;
+    int64_t                     hjw_size;
+    int64_t                     hjw_hdrSize;
+    int32_t                     hjw_blhdrSize;
+    int                         hjw_maxBlocks;  /* Blocks of a block list */
+    int64_t                     hjw_start;
+    int64_t                     hjw_end;
+    u_int8_t *                  hjw_header;     /* Header block, the fields not known kept */
+
+    /* Transactions, swapped and freed by the task only */
+    struct hfsp_jtrans *        hjw_open;       /* Logging the operations */
+    struct hfsp_jtrans *        hjw_commit;     /* Being written to the journal */
+    TAILQ_HEAD(, hfsp_jtrans)   hjw_done;       /* In the journal, written in place */
+    int                         hjw_ops;        /* Operations running in hjw_open */
+
+    u_int64_t                   hjw_committed;  /* Last transaction in the journal */
+    u_int64_t                   hjw_durable;    /* Last transaction flushed to the disk */
+    u_int64_t                   hjw_wanted;     /* Last transaction waited for */
+};
+
+/* hjw_flags */
+#define HFSP_JW_QUEUED          0x0001  /* Task scheduled */
+#define HFSP_JW_SWAP            0x0002  /* hjw_open waits for its operations, new ones wait */
+
+static int
+hfsp_jwblock_cmp(struct hfsp_jwblock * l, struct hfsp_jwblock * r)
+{
+    if (l->hwb_offset != r->hwb_offset)
+        return l->hwb_offset < r->hwb_offset ? -1 : 1;
+    return l->hwb_size < r->hwb_size ? -1 : l->hwb_size > r->hwb_size;
+}
+
+RB_GENERATE_STATIC(hfsp_jwblocks, hfsp_jwblock, hwb_entry, hfsp_jwblock_cmp);
+
+static struct hfsp_jtrans *
+hfsp_jtrans_alloc(u_int64_t seq)
+{
+    struct hfsp_jtrans * tp;
+
+    tp = malloc(sizeof(*tp), M_HFSPJWRITE, M_WAITOK | M_ZERO);
+    RB_INIT(&tp->htr_blocks);
+    tp->htr_seq = seq;
+    return tp;
+}
+
+static void
+hfsp_jtrans_free(struct hfsp_jtrans * tp)
+{
+    struct hfsp_jwblock * wbp;
+
+    while ((wbp = RB_MIN(hfsp_jwblocks, &tp->htr_blocks)) != NULL)
+    {
+        RB_REMOVE(hfsp_jwblocks, &tp->htr_blocks, wbp);
+        free(wbp, M_HFSPJWRITE);
+    }
+    free(tp, M_HFSPJWRITE);
+}
+
+/*
+ * Copy the overlapping part of a block into a range of the device.
+ */
+static __inline void
+hfsp_jwblock_copy(struct hfsp_jwblock * wbp, off_t offset, u_int8_t * data, off_t size)
+{
+    off_t start, end;
+
+    start = MAX(offset, wbp->hwb_offset);
+    end = MIN(offset + size, wbp->hwb_offset + wbp->hwb_size);
+    if (start < end)
+        memcpy(data + (start - offset), HFSP_JWBLOCK_DATA(wbp) + (start - wbp->hwb_offset), end - start);
+}
+
+/*
+ * Copy the blocks of a transaction overlapping a range of the device.
+ * toBlocks: Copy the range into the blocks instead.
+ */
+static void
+hfsp_jtrans_overlap(struct hfsp_jtrans * tp, off_t offset, u_int8_t * data, int size, int toBlocks)
+{
+    struct hfsp_jwblock key, * wbp;
+    off_t start;
+
+    if (tp->htr_count == 0)
+        return;
+    key.hwb_offset = offset - tp->htr_maxSize + 1;
+    key.hwb_size = 0;
+    for (wbp = RB_NFIND(hfsp_jwblocks, &tp->htr_blocks, &key);
+         wbp != NULL && wbp->hwb_offset < offset + size;
+         wbp = RB_NEXT(hfsp_jwblocks, &tp->htr_blocks, wbp))
+    {
+        if (!toBlocks)
+            hfsp_jwblock_copy(wbp, offset, data, size);
+        else if (wbp->hwb_offset + wbp->hwb_size > offset)
+        {
+            // The content of the older block is kept up to date, the blocks of
+            // a transaction are replayed in any order.
+            start = MAX(offset, wbp->hwb_offset);
+            memcpy(HFSP_JWBLOCK_DATA(wbp) + (start - wbp->hwb_offset), data + (start - offset),
+                   MIN(offset + size, wbp->hwb_offset + wbp->hwb_size) - start);
+        }
+    }
+}
+
+void
+hfsp_jwrite_apply(struct hfsp_jwriter * jwp, daddr_t blkno, void * data, int size)
+{
+    struct hfsp_jtrans * tp;
+    off_t offset;
+
+    // Oldest first, the newest content wins.
+    offset = dbtob(blkno);
+    mtx_lock(&jwp->hjw_mtx);
+    TAILQ_FOREACH(tp, &jwp->hjw_done, htr_link)
+        hfsp_jtrans_overlap(tp, offset, data, size, 0);
+    if (jwp->hjw_commit != NULL)
+        hfsp_jtrans_overlap(jwp->hjw_commit, offset, data, size, 0);
+    hfsp_jtrans_overlap(jwp->hjw_open, offset, data, size, 0);
+    mtx_unlock(&jwp->hjw_mtx);
+}
+
+/*
+ * Run the task in delay ticks at the latest.
+ */
+static void
+hfsp_jwrite_schedule(struct hfsp_jwriter * jwp, int delay)
+{
+    mtx_assert(&jwp->hjw_mtx, MA_OWNED);
+    if (!(jwp->hjw_flags & HFSP_JW_QUEUED) || jwp->hjw_due - ticks > delay)
+    {
+        jwp->hjw_flags |= HFSP_JW_QUEUED;
+        jwp->hjw_due = ticks + delay;
+        taskqueue_enqueue_timeout(hfsp_taskqueue, &jwp->hjw_task, delay);
+    }
+}
+
+static void
+hfsp_jwrite_abort(struct hfsp_jwriter * jwp, int error)
+{
+    mtx_assert(&jwp->hjw_mtx, MA_OWNED);
+    if (jwp->hjw_error != 0)
+        return;
+    jwp->hjw_error = error;
+    log(LOG_ERR, "hfsp: %s: journal aborted, error %d, the volume is read only\n",
+        devtoname(jwp->hjw_mount->hm_dev), error);
+    wakeup(&jwp->hjw_flags);
+    wakeup(&jwp->hjw_durable);
+}
+
+int
+hfsp_jwrite_begin(struct hfspmount * hmp)
+{
+    struct hfsp_jwriter * jwp;
+    u_int64_t max;
+    int error;
+
+    jwp = hmp->hm_jwriter;
+    max = MIN(hfsp_jwrite_max, (u_int64_t)(jwp->hjw_size - jwp->hjw_hdrSize) / 2);
+    mtx_lock(&jwp->hjw_mtx);
+    while (jwp->hjw_error == 0 && ((jwp->hjw_flags & HFSP_JW_SWAP) || jwp->hjw_open->htr_bytes >= max))
+    {
+        if (!(jwp->hjw_flags & HFSP_JW_SWAP))
+            hfsp_jwrite_schedule(jwp, 0);
+        msleep(&jwp->hjw_flags, &jwp->hjw_mtx, PRIBIO, "hfspjw", 0);
+    }
+    error = jwp->hjw_error ? EROFS : 0;
+    if (error == 0)
+    {
+        jwp->hjw_ops++;
+        jwp->hjw_open->htr_ops++;
+    }
+    mtx_unlock(&jwp->hjw_mtx);
+    return error;
+}
+
+int
+hfsp_jwrite_log(struct hfspmount * hmp, daddr_t blkno, const void * data, int size)
+{
+    struct hfsp_jwriter * jwp;
+    struct hfsp_jwblock * wbp, * owbp;
+    struct hfsp_jtrans * tp;
+    struct buf * bp;
+
+    jwp = hmp->hm_jwriter;
+    if (dbtob(blkno) % jwp->hjw_hdrSize != 0 || size <= 0 || size % jwp->hjw_hdrSize != 0 || size > MAXBSIZE)
+        return EINVAL;
+
+    wbp = malloc(sizeof(*wbp) + size, M_HFSPJWRITE, M_WAITOK);
+    wbp->hwb_offset = dbtob(blkno);
+    wbp->hwb_size = size;
+    memcpy(HFSP_JWBLOCK_DATA(wbp), data, size);
+
+    mtx_lock(&jwp->hjw_mtx);
+    KASSERT(jwp->hjw_ops > 0, ("hfsp_jwrite_log: No operation"));
+    tp = jwp->hjw_open;
+    hfsp_jtrans_overlap(tp, wbp->hwb_offset, HFSP_JWBLOCK_DATA(wbp), size, 1);
+    owbp = RB_INSERT(hfsp_jwblocks, &tp->htr_blocks, wbp);
+    if (owbp == NULL)
+    {
+        tp->htr_count++;
+        tp->htr_bytes += size;
+        tp->htr_maxSize = max(tp->htr_maxSize, (u_int32_t)size);
+    }
+    mtx_unlock(&jwp->hjw_mtx);
+    if (owbp != NULL)
+        free(wbp, M_HFSPJWRITE);
+
+    // A buffer read before would hide the logged block.
+    bp = getblk(hmp->hm_devvp, blkno, size, 0, 0, GB_NOCREAT);
+    if (bp != NULL)
+    {
+        bp->b_flags |= B_INVAL | B_NOCACHE;
+        brelse(bp);
+    }
+    return 0;
+}
+
+int
+hfsp_jwrite_end(struct hfspmount * hmp, int error)
+{
+    struct hfsp_jwriter * jwp;
+
+    jwp = hmp->hm_jwriter;
+    mtx_lock(&jwp->hjw_mtx);
+    // Part of the operation is in the transaction, it can not be committed.
+    if (error)
+        hfsp_jwrite_abort(jwp, error);
+    if (--jwp->hjw_ops == 0 && (jwp->hjw_flags & HFSP_JW_SWAP))
+        wakeup(&jwp->hjw_ops);
+    if (jwp->hjw_error == 0)
+        hfsp_jwrite_schedule(jwp, max(1, hfsp_jwrite_delay * hz / 1000));
+    mtx_unlock(&jwp->hjw_mtx);
+    return error;
+}
+
+int
+hfsp_jwrite_flush(struct hfspmount * hmp, int wait)
+{
+    struct hfsp_jwriter * jwp;
+    u_int64_t seq;
+    int error;
+
+    jwp = hmp->hm_jwriter;
+    if (jwp == NULL)
+        return 0;
+    mtx_lock(&jwp->hjw_mtx);
+    seq = jwp->hjw_open->htr_count != 0 ? jwp->hjw_open->htr_seq : jwp->hjw_committed;
+    if (jwp->hjw_error == 0 && jwp->hjw_durable < seq)
+    {
+        if (wait)
+            jwp->hjw_wanted = MAX(jwp->hjw_wanted, seq);
+        hfsp_jwrite_schedule(jwp, 0);
+    }
+    while (wait && jwp->hjw_error == 0 && jwp->hjw_durable < seq)
+        msleep(&jwp->hjw_durable, &jwp->hjw_mtx, PRIBIO, "hfspjf", 0);
+    error = jwp->hjw_error;
+    mtx_unlock(&jwp->hjw_mtx);
+    return error;
+}
+
+/*
+ * Write a range of the device asynchronously, at most MAXBSIZE bytes. The
+ * buffer is not kept.
+ */
+static void
+hfsp_jwrite_dev(struct hfsp_jwriter * jwp, off_t offset, const u_int8_t * data, int size)
+{
+    struct buf * bp;
+
+    bp = getblk(jwp->hjw_mount->hm_devvp, btodb(offset), size, 0, 0, 0);
+    memcpy(bp->b_data, data, size);
+    bp->b_flags |= B_NOCACHE;
+    bawrite(bp);
+}
+
+/*
+ * Wait for the writes of the device and flush its cache.
+ */
+static int
+hfsp_jwrite_sync(struct hfsp_jwriter * jwp)
+{
+    struct bufobj * bo;
+    int error;
+
+    bo = &jwp->hjw_mount->hm_devvp->v_bufobj;
+    BO_LOCK(bo);
+    error = bufobj_wwait(bo, 0, 0);
+    BO_UNLOCK(bo);
+    if (error == 0)
+        error = g_io_flush(jwp->hjw_cp);
+    atomic_add_long(&hfsp_jwrite_flushes, 1);
+    return error;
+}
+
+/*
+ * Write the journal header, once the transactions it points to are on the disk.
+ */
+static int
+hfsp_jwrite_header(struct hfsp_jwriter * jwp, int64_t start, int64_t end)
+{
+    struct journal_header * jhp;
+    struct buf * bp;
+    int error;
+
+    jhp = (struct journal_header *)jwp->hjw_header;
+    jhp->magic = JOURNAL_HEADER_MAGIC;
+    jhp->endian = JOURNAL_HEADER_ENDIAN;
+    jhp->start = start;
+    jhp->end = end;
+    jhp->size = jwp->hjw_size;
+    jhp->blhdr_size = jwp->hjw_blhdrSize;
+    jhp->jhdr_size = jwp->hjw_hdrSize;
+    jhp->checksum = 0;
+    jhp->checksum = hfsp_journal_cksum(jhp, JOURNAL_HEADER_CKSUM_SIZE);
+
+    bp = getblk(jwp->hjw_mount->hm_devvp, btodb(jwp->hjw_offset), jwp->hjw_hdrSize, 0, 0, 0);
+    memcpy(bp->b_data, jwp->hjw_header, jwp->hjw_hdrSize);
+    bp->b_flags |= B_NOCACHE;
+    error = bwrite(bp);
+    if (error == 0)
+    {
+        jwp->hjw_start = start;
+        jwp->hjw_end = end;
+    }
+    return error;
+}
+
+/*
+ * Forget the transactions written in place: once the writes are on the disk
+ * the journal is emptied.
+ */
+static int
+hfsp_jwrite_retire(struct hfsp_jwriter * jwp)
+{
+    struct hfsp_jtrans * tp;
+    int error;
+
+    error = hfsp_jwrite_sync(jwp);
+    if (error == 0 && jwp->hjw_start != jwp->hjw_end)
+        error = hfsp_jwrite_header(jwp, jwp->hjw_end, jwp->hjw_end);
+    if (error)
+        return error;
+
+    mtx_lock(&jwp->hjw_mtx);
+    while ((tp = TAILQ_FIRST(&jwp->hjw_done)) != NULL)
+    {
+        TAILQ_REMOVE(&jwp->hjw_done, tp, htr_link);
+        hfsp_jtrans_free(tp);
+    }
+    mtx_unlock(&jwp->hjw_mtx);
+    return 0;
+}
+
+/* Sequential writer of the journal, wrapping after its end */
+struct hfsp_jstream {
+    struct hfsp_jwriter *       hjs_jwp;
+    int64_t                     hjs_pos;        /* Position of the buffer in the journal */
+    int                         hjs_fill;
+    u_int8_t *                  hjs_buf;
+};
+
+static void
+hfsp_jstream_flush(struct hfsp_jstream * jsp)
+{
+    struct hfsp_jwriter * jwp;
+
+    jwp = jsp->hjs_jwp;
+    if (jsp->hjs_fill == 0)
+        return;
+    hfsp_jwrite_dev(jwp, jwp->hjw_offset + jsp->hjs_pos, jsp->hjs_buf, jsp->hjs_fill);
+    jsp->hjs_pos += jsp->hjs_fill;
+    if (jsp->hjs_pos == jwp->hjw_size)
+        jsp->hjs_pos = jwp->hjw_hdrSize;
+    jsp->hjs_fill = 0;
+}
+
+static void
+hfsp_jstream_put(struct hfsp_jstream * jsp, const void * data, int len)
+{
+    int chunk;
+
+    while (len > 0)
+    {
+        chunk = MIN(len, MIN(MAXBSIZE - jsp->hjs_fill, jsp->hjs_jwp->hjw_size - jsp->hjs_pos - jsp->hjs_fill));
+        memcpy(jsp->hjs_buf + jsp->hjs_fill, data, chunk);
+        jsp->hjs_fill += chunk;
+        data = (const u_int8_t *)data + chunk;
+        len -= chunk;
+        if (jsp->hjs_fill == MAXBSIZE || jsp->hjs_pos + jsp->hjs_fill == jsp->hjs_jwp->hjw_size)
+            hfsp_jstream_flush(jsp);
+    }
+}
+
+/*
+ * Bytes of a transaction in the journal.
+ */
+static int64_t
+hfsp_jtrans_length(struct hfsp_jwriter * jwp, struct hfsp_jtrans * tp)
+{
+    return howmany(tp->htr_count, jwp->hjw_maxBlocks) * jwp->hjw_blhdrSize + tp->htr_bytes;
+}
+
+/*
+ * Write the block lists of a transaction after the end of the journal.
+ * endp: Journal position past the transaction on exit.
+ */
+static void
+hfsp_jtrans_write(struct hfsp_jwriter * jwp, struct hfsp_jtrans * tp, int64_t * endp)
+{
+    struct block_list_header * blhp;
+    struct hfsp_jstream js;
+    struct hfsp_jwblock * wbp, * first;
+    int n, used;
+
+    blhp = malloc(jwp->hjw_blhdrSize, M_TEMP, M_WAITOK);
+    js.hjs_jwp = jwp;
+    js.hjs_pos = jwp->hjw_end;
+    js.hjs_fill = 0;
+    js.hjs_buf = malloc(MAXBSIZE, M_TEMP, M_WAITOK);
+
+    for (wbp = RB_MIN(hfsp_jwblocks, &tp->htr_blocks); wbp != NULL; )
+    {
+        bzero(blhp, jwp->hjw_blhdrSize);
+        used = jwp->hjw_blhdrSize;
+        first = wbp;
+        for (n = 1; wbp != NULL && n <= jwp->hjw_maxBlocks; n++)
+        {
+            blhp->binfo[n].bnum = wbp->hwb_offset / jwp->hjw_hdrSize;
+            blhp->binfo[n].bsize = wbp->hwb_size;
+            used += wbp->hwb_size;
+            wbp = RB_NEXT(hfsp_jwblocks, &tp->htr_blocks, wbp);
+        }
+        blhp->max_blocks = jwp->hjw_maxBlocks;
+        blhp->num_blocks = n;
+        blhp->bytes_used = used;
+        blhp->checksum = hfsp_journal_cksum(blhp, BLHDR_CHECKSUM_SIZE);
+
+        hfsp_jstream_put(&js, blhp, jwp->hjw_blhdrSize);
+        for (; first != wbp; first = RB_NEXT(hfsp_jwblocks, &tp->htr_blocks, first))
+            hfsp_jstream_put(&js, HFSP_JWBLOCK_DATA(first), first->hwb_size);
+    }
+    hfsp_jstream_flush(&js);
+    *endp = js.hjs_pos;
+    free(js.hjs_buf, M_TEMP);
+    free(blhp, M_TEMP);
+}
+
+/*
+ * Write the blocks of a committed transaction in place, contiguous ones
+ * together. The writes are not waited for.
+ */
+static void
+hfsp_jtrans_checkpoint(struct hfsp_jwriter * jwp, struct hfsp_jtrans * tp)
+{
+    struct hfsp_jwblock * wbp;
+    struct buf * bp;
+    u_int8_t * run;
+    off_t offset;
+    int fill;
+
+    run = malloc(MAXBSIZE, M_TEMP, M_WAITOK);
+    for (wbp = RB_MIN(hfsp_jwblocks, &tp->htr_blocks); wbp != NULL; )
+    {
+        offset = wbp->hwb_offset;
+        fill = 0;
+        do
+        {
+            // The buffers inside the run would not see the write.
+            if (fill != 0)
+            {
+                bp = getblk(jwp->hjw_mount->hm_devvp, btodb(wbp->hwb_offset), wbp->hwb_size, 0, 0, GB_NOCREAT);
+                if (bp != NULL)
+                {
+                    bp->b_flags |= B_INVAL | B_NOCACHE;
+                    brelse(bp);
+                }
+            }
+            memcpy(run + fill, HFSP_JWBLOCK_DATA(wbp), wbp->hwb_size);
+            fill += wbp->hwb_size;
+            wbp = RB_NEXT(hfsp_jwblocks, &tp->htr_blocks, wbp);
+        } while (wbp != NULL && wbp->hwb_offset == offset + fill && fill + wbp->hwb_size <= MAXBSIZE);
+        hfsp_jwrite_dev(jwp, offset, run, fill);
+    }
+    free(run, M_TEMP);
+}
+
+/*
+ * Commit a transaction: one sequential write of its block lists, one cache
+ * flush and the journal header. The flush also puts on the disk the blocks of
+ * the transactions before written in place, the header drops them from the
+ * journal. The blocks are then written in place asynchronously.
+ * sync: Flush the header as well.
+ */
+static int
+hfsp_jwrite_commit(struct hfsp_jwriter * jwp, struct hfsp_jtrans * tp, int sync)
+{
+    struct hfsp_jtrans * dtp;
+    int64_t length, room, used, start, end;
+    int error;
+
+    length = hfsp_jtrans_length(jwp, tp);
+    room = jwp->hjw_size - jwp->hjw_hdrSize;
+    if (length >= room)
+        return EFBIG;
+    used = jwp->hjw_end - jwp->hjw_start;
+    if (used < 0)
+        used += room;
+    // Start and end only meet when the journal is empty.
+    if (length >= room - used)
+    {
+        error = hfsp_jwrite_retire(jwp);
+        if (error)
+            return error;
+    }
+
+    start = jwp->hjw_end;
+    hfsp_jtrans_write(jwp, tp, &end);
+    error = hfsp_jwrite_sync(jwp);
+    if (error == 0)
+        error = hfsp_jwrite_header(jwp, start, end);
+    if (error == 0 && sync)
+        error = hfsp_jwrite_sync(jwp);
+    if (error)
+        return error;
+
+    mtx_lock(&jwp->hjw_mtx);
+    while ((dtp = TAILQ_FIRST(&jwp->hjw_done)) != NULL)
+    {
+        TAILQ_REMOVE(&jwp->hjw_done, dtp, htr_link);
+        hfsp_jtrans_free(dtp);
+    }
+    mtx_unlock(&jwp->hjw_mtx);
+
+    hfsp_jtrans_checkpoint(jwp, tp);
+    atomic_add_long(&hfsp_jwrite_commits, 1);
+    atomic_add_long(&hfsp_jwrite_ops, tp->htr_ops);
+    return 0;
+}
+
+/*
+ * Commit the open transaction, or empty the journal when nothing was logged
+ * since the last commit.
+ */
+static void
+hfsp_jwrite_task(void * context, int pending)
+{
+    struct hfsp_jwriter * jwp;
+    struct hfsp_jtrans * tp;
+    u_int64_t durable;
+    int error, sync;
+
+    jwp = context;
+    mtx_lock(&jwp->hjw_mtx);
+    jwp->hjw_flags &= ~HFSP_JW_QUEUED;
+    if (jwp->hjw_error)
+    {
+        mtx_unlock(&jwp->hjw_mtx);
+        return;
+    }
+
+    tp = jwp->hjw_open;
+    if (tp->htr_count == 0)
+    {
+        mtx_unlock(&jwp->hjw_mtx);
+        error = hfsp_jwrite_retire(jwp);
+        mtx_lock(&jwp->hjw_mtx);
+        if (error)
+            hfsp_jwrite_abort(jwp, error);
+        else
+            jwp->hjw_durable = jwp->hjw_committed;
+        wakeup(&jwp->hjw_durable);
+        mtx_unlock(&jwp->hjw_mtx);
+        return;
+    }
+
+    // The operations running end in this transaction, the new ones in the next.
+    jwp->hjw_flags |= HFSP_JW_SWAP;
+    while (jwp->hjw_ops > 0)
+        msleep(&jwp->hjw_ops, &jwp->hjw_mtx, PRIBIO, "hfspjc", 0);
+    jwp->hjw_commit = tp;
+    jwp->hjw_open = hfsp_jtrans_alloc(tp->htr_seq + 1);
+    jwp->hjw_flags &= ~HFSP_JW_SWAP;
+    wakeup(&jwp->hjw_flags);
+    sync = jwp->hjw_wanted >= tp->htr_seq;
+    durable = jwp->hjw_committed;
+    mtx_unlock(&jwp->hjw_mtx);
+
+    error = hfsp_jwrite_commit(jwp, tp, sync);
+
+    mtx_lock(&jwp->hjw_mtx);
+    // Read from until it is written in place, even if it never will be.
+    jwp->hjw_commit = NULL;
+    TAILQ_INSERT_TAIL(&jwp->hjw_done, tp, htr_link);
+    if (error)
+    {
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_jwrite_task: Commit of %ju blocks failed, error %jd.", tp->htr_count, error);
+        hfsp_jwrite_abort(jwp, error);
+    }
+    else
+    {
+        jwp->hjw_committed = tp->htr_seq;
+        jwp->hjw_durable = sync ? tp->htr_seq : durable;
+        // The journal is emptied later if nothing else is logged.
+        hfsp_jwrite_schedule(jwp, hz);
+    }
+    wakeup(&jwp->hjw_durable);
+    mtx_unlock(&jwp->hjw_mtx);
+}
+
+/*
+ * Mark the volume as cleanly unmounted or not, with its journal empty.
+ */
+static int
+hfsp_jwrite_volume(struct hfsp_jwriter * jwp, int clean)
+{
+    struct HFSPlusVolumeHeader * hfsph;
+    struct buf * bp;
+    u_int32_t attributes;
+    int error;
+
+    error = bread(jwp->hjw_mount->hm_devvp, 2, 512, NOCRED, &bp);
+    if (error)
+        return error;
+    hfsph = (struct HFSPlusVolumeHeader *)bp->b_data;
+    attributes = be32toh(hfsph->attributes);
+    if (clean)
+        attributes |= kHFSVolumeUnmountedMask;
+    else
+        attributes &= ~kHFSVolumeUnmountedMask;
+    hfsph->attributes = htobe32(attributes);
+    bp->b_flags |= B_NOCACHE;
+    error = bwrite(bp);
+    if (error == 0)
+        error = hfsp_jwrite_sync(jwp);
+    return error;
+}
+
+static void
+hfsp_jwrite_free(struct hfsp_jwriter * jwp)
+{
+    struct hfsp_jtrans * tp;
+
+    while ((tp = TAILQ_FIRST(&jwp->hjw_done)) != NULL)
+    {
+        TAILQ_REMOVE(&jwp->hjw_done, tp, htr_link);
+        hfsp_jtrans_free(tp);
+    }
+    hfsp_jtrans_free(jwp->hjw_open);
+    free(jwp->hjw_header, M_HFSPJWRITE);
+    mtx_destroy(&jwp->hjw_mtx);
+    free(jwp, M_HFSPJWRITE);
+}
+
+int
+hfsp_jwrite_mount(struct hfspmount * hmp, struct g_consumer * cp, struct HFSPlusVolumeHeader * hfsph)
+{
+    struct hfsp_jwriter * jwp;
+    struct hfsp_jinfo ji;
+    struct buf * bp;
+    int error;
+
+    if (cp->acw == 0 || hmp->hm_journal != NULL)
+        return 0;
+    error = hfsp_journal_header(hmp, hfsph, &ji);
+    if (error == ENOENT)
+        return 0;
+    // Without a journal to log them, no metadata is written.
+    if (error == 0 && (ji.hji_start != ji.hji_end || ji.hji_hdrSize % hmp->hm_physBlockSize != 0 ||
+                       ji.hji_hdrSize > MAXBSIZE || ji.hji_size % ji.hji_hdrSize != 0 ||
+                       ji.hji_offset % hmp->hm_physBlockSize != 0 || ji.hji_blhdrSize % ji.hji_hdrSize != 0 ||
+                       ji.hji_blhdrSize < sizeof(struct block_list_header) + sizeof(struct block_info)))
+        error = EINVAL;
+    if (error)
+    {
+        log(LOG_WARNING, "hfsp: %s: journal can not be written, error %d, metadata is read only\n",
+            devtoname(hmp->hm_dev), error);
+        return 0;
+    }
+
+    jwp = malloc(sizeof(*jwp), M_HFSPJWRITE, M_WAITOK | M_ZERO);
+    mtx_init(&jwp->hjw_mtx, "hfsp_jwrite", NULL, MTX_DEF);
+    TIMEOUT_TASK_INIT(hfsp_taskqueue, &jwp->hjw_task, 0, hfsp_jwrite_task, jwp);
+    TAILQ_INIT(&jwp->hjw_done);
+    jwp->hjw_mount = hmp;
+    jwp->hjw_cp = cp;
+    jwp->hjw_offset = ji.hji_offset;
+    jwp->hjw_size = ji.hji_size;
+    jwp->hjw_hdrSize = ji.hji_hdrSize;
+    jwp->hjw_blhdrSize = ji.hji_blhdrSize;
+    jwp->hjw_maxBlocks = min((ji.hji_blhdrSize - sizeof(struct block_list_header)) / sizeof(struct block_info), 0xFFFE);
+    jwp->hjw_start = ji.hji_start;
+    jwp->hjw_end = ji.hji_end;
+    jwp->hjw_open = hfsp_jtrans_alloc(1);
+
+    // The header is rewritten in the byte order of this host.
+    jwp->hjw_header = malloc(ji.hji_hdrSize, M_HFSPJWRITE, M_WAITOK);
+    error = bread(hmp->hm_devvp, btodb(ji.hji_offset), ji.hji_hdrSize, NOCRED, &bp);
+    if (error == 0)
+    {
+        memcpy(jwp->hjw_header, bp->b_data, ji.hji_hdrSize);
+        bp->b_flags |= B_INVAL | B_NOCACHE;
+        brelse(bp);
+    }
+
+    // A crash from now on is replayed at the next mount.
+    if (error == 0)
+        error = hfsp_jwrite_volume(jwp, 0);
+    if (error)
+    {
+        hfsp_jwrite_free(jwp);
+        return error;
+    }
+    hmp->hm_jwriter = jwp;
+    return 0;
+}
+
+void
+hfsp_jwrite_unmount(struct hfspmount * hmp)
+{
+    struct hfsp_jwriter * jwp;
+    int error;
+
+    jwp = hmp->hm_jwriter;
+    if (jwp == NULL)
+        return;
+
+    error = hfsp_jwrite_flush(hmp, 1);
+    while (taskqueue_cancel_timeout(hfsp_taskqueue, &jwp->hjw_task, NULL) != 0)
+        taskqueue_drain_timeout(hfsp_taskqueue, &jwp->hjw_task);
+    if (error == 0)
+        error = hfsp_jwrite_retire(jwp);
+    if (error == 0)
+        error = hfsp_jwrite_volume(jwp, 1);
+    if (error)
+        log(LOG_WARNING, "hfsp: %s: journal not emptied, error %d, it is replayed at the next mount\n",
+            devtoname(hmp->hm_dev), error);
+
+    hmp->hm_jwriter = NULL;
+    hfsp_jwrite_free(jwp);
+}
@@ -0,0 +1,70 @@
+#include <sys/param.h>
+#include <sys/malloc.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_JWRITE_H_
+#define _HFSP_JWRITE_H_
+
+MALLOC_DECLARE(M_HFSPJWRITE);
+
+struct g_consumer;
+
+/*
+ * Log the metadata writes of a journaled volume mounted on a writable device.
+ * The journal must be empty, the volume is marked as not cleanly unmounted so
+ * a crash is replayed at the next mount. hm_jwriter is left NULL if the volume
+ * is not journaled or the device is read only.
+ * hmp: The mount, hm_journal must be NULL.
+ * cp: The consumer of the device.
+ * hfsph: The volume header as read from the device.
+ * Return 0 on success.
+ */
+int hfsp_jwrite_mount(struct hfspmount * hmp, struct g_consumer * cp, struct HFSPlusVolumeHeader * hfsph);
+
+/*
+ * Commit the open transaction, write everything in place and leave the
+ * journal empty and the volume marked as cleanly unmounted.
+ */
+void hfsp_jwrite_unmount(struct hfspmount * hmp);
+
+/*
+ * Start an operation. The blocks it logs are committed in the same
+ * transaction, with the ones of the operations running with it. Operations do
+ * not nest.
+ * Return EROFS if the journal was aborted.
+ */
+int hfsp_jwrite_begin(struct hfspmount * hmp);
+
+/*
+ * Log a block of metadata. The block is read from the transaction until it is
+ * written in place.
+ * blkno: Device block, in DEV_BSIZE units, aligned on the journal blocks.
+ * data, size: The content, a multiple of the journal block size, at most
+ * MAXBSIZE bytes.
+ * Return EINVAL if the block is not aligned or too large.
+ */
+int hfsp_jwrite_log(struct hfspmount * hmp, daddr_t blkno, const void * data, int size);
+
+/*
+ * End an operation. The transaction is committed once the operations in it
+ * end and it stayed open vfs.hfsp.jwrite_delay milliseconds.
+ * error: Not 0 if the operation logged part of its blocks only, the journal
+ * is then aborted and the volume read only.
+ * Return error.
+ */
+int hfsp_jwrite_end(struct hfspmount * hmp, int error);
+
+/*
+ * Commit the open transaction now.
+ * wait: Wait until every transaction ended so far is on the disk.
+ */
+int hfsp_jwrite_flush(struct hfspmount * hmp, int wait);
+
+/*
+ * Copy the blocks logged and not yet written in place over the data just
+ * read from the device.
+ */
+void hfsp_jwrite_apply(struct hfsp_jwriter * jwp, daddr_t blkno, void * data, int size);
+
+#endif /* _HFSP_JWRITE_H_ */
@@ -0,0 +1,315 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/malloc.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <sys/endian.h>
+
+#include "hfsp.h"
+#include "hfsp_btree.h"
+#include "hfsp_link.h"
+#include "hfsp_name.h"
+#include "hfsp_trace.h"
+
+MALLOC_DEFINE(M_HFSPLINK, "hfsp_link", "HFS+ hard link cache");
+
+/*
+ * A resolved indirect node. The record is a detached copy, it does not
+ * reference a node but holds a reference on its interned name.
+ */
+struct hfsp_linkentry {
+    LIST_ENTRY(hfsp_linkentry)  hle_hash;
+    TAILQ_ENTRY(hfsp_linkentry) hle_lru;
+    u_int32_t                   hle_iNodeNum;
+    int                         hle_kind;
+    struct hfsp_record          hle_rec;
+};
+
+/* hle_kind */
+enum {
+    HFSP_LINK_FILE      = 0,
+    HFSP_LINK_DIR       = 1
+};
+
+static u_int hfsp_linkcache_max = 4096;
+SYSCTL_UINT(_vfs_hfsp, OID_AUTO, linkcache_max, CTLFLAG_RW, &hfsp_linkcache_max, 0,
+            "Maximum number of indirect nodes cached per mount");
+
+static u_long hfsp_linkcache_hits;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, linkcache_hits, CTLFLAG_RD, &hfsp_linkcache_hits, 0,
+             "Hard links resolved from the cache");
+
+static u_long hfsp_linkcache_misses;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, linkcache_misses, CTLFLAG_RD, &hfsp_linkcache_misses, 0,
+             "Hard links resolved from the catalogue");
+
+#define HFSP_LINKHASH(lcp, num, kind) (&(lcp)->hlc_hash[((num) * 2 + (kind)) & (lcp)->hlc_mask])
+
+static void
+hfsp_linkentry_free(struct hfspmount * hmp, struct hfsp_linkentry * lep)
+{
+    if (lep->hle_rec.hr_key.hk_name != NULL)
+        hfsp_name_release(&hmp->hm_names, lep->hle_rec.hr_key.hk_name);
+    free(lep, M_HFSPLINK);
+}
+
+void
+hfsp_linkcache_init(struct hfsp_linkcache * lcp)
+{
+    mtx_init(&lcp->hlc_mtx, "hfsp_links", NULL, MTX_DEF);
+    lcp->hlc_hash = hashinit(256, M_HFSPLINK, &lcp->hlc_mask);
+    TAILQ_INIT(&lcp->hlc_lru);
+    lcp->hlc_count = 0;
+}
+
+void
+hfsp_linkcache_destroy(struct hfspmount * hmp)
+{
+    struct hfsp_linkcache * lcp;
+    struct hfsp_linkentry * lep;
+
+    lcp = &hmp->hm_links;
+    while ((lep = TAILQ_FIRST(&lcp->hlc_lru)) != NULL)
+    {
+        TAILQ_REMOVE(&lcp->hlc_lru, lep, hle_lru);
+        LIST_REMOVE(lep, hle_hash);
+        hfsp_linkentry_free(hmp, lep);
+    }
+    lcp->hlc_count = 0;
+    hashdestroy(lcp->hlc_hash, M_HFSPLINK, lcp->hlc_mask);
+    mtx_destroy(&lcp->hlc_mtx);
+}
+
+/*
+ * Copy the type, identity and attributes of an indirect node over a link record.
+ */
+static void
+hfsp_link_apply(struct hfsp_record * rp, struct hfsp_record * inodep)
+{
+    rp->hr_cnid = inodep->hr_cnid;
+    rp->hr_ownerId = inodep->hr_ownerId;
+    rp->hr_groupId = inodep->hr_groupId;
+    rp->hr_fileMode = inodep->hr_fileMode;
+    rp->hr_special = inodep->hr_special;
+    rp->hr_data = inodep->hr_data;
+}
+
+/*
+ * Build a search key in the catalogue from an ASCII name.
+ * kp: The key to fill.
+ * parent: The parent folder.
+ * str: The name, it may contain NUL characters.
+ * len: Length of the name.
+ * buf: Storage for the unicode name, at least len characters.
+ */
+static void
+hfsp_link_key(struct hfsp_record_key * kp, hfsp_cnid parent, const char * str, int len,
+              hfsp_unichar * buf)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = htobe16((u_char)str[i]);
+
+    bzero(kp, sizeof(*kp));
+    kp->hk_cnid = parent;
+    kp->hk_nameLen = len;
+    kp->hk_nameStr = buf;
+}
+
+void
+hfsp_link_mount(struct hfspmount * hmp)
+{
+    static const char fileDir[] = HFSP_PRIVATE_DIR_NAME;
+    static const char dirDir[] = HFSP_PRIVATE_DIRDATA_NAME;
+    hfsp_unichar fileBuf[sizeof(fileDir)], dirBuf[sizeof(dirDir)];
+    struct hfsp_record_key fileKey, dirKey, * keys[2];
+    struct hfsp_record * recs[2];
+    struct hfsp_linkcache * lcp;
+    hfsp_cnid cnids[2];
+    int error, errors[2], i;
+
+    lcp = &hmp->hm_links;
+    mtx_lock(&lcp->hlc_mtx);
+    while (lcp->hlc_privState == HFSP_LINK_PRIV_BUSY)
+        msleep(lcp, &lcp->hlc_mtx, PVFS, "hfsppr", 0);
+    if (lcp->hlc_privState == HFSP_LINK_PRIV_DONE)
+    {
+        mtx_unlock(&lcp->hlc_mtx);
+        return;
+    }
+    lcp->hlc_privState = HFSP_LINK_PRIV_BUSY;
+    mtx_unlock(&lcp->hlc_mtx);
+
+    // Both folders are in the root folder, look them up in one descent.
+    hfsp_link_key(&fileKey, HFSP_ROOT_FOLDER_CNID, fileDir, sizeof(fileDir) - 1, fileBuf);
+    hfsp_link_key(&dirKey, HFSP_ROOT_FOLDER_CNID, dirDir, sizeof(dirDir) - 1, dirBuf);
+    keys[0] = &fileKey;
+    keys[1] = &dirKey;
+    recs[0] = recs[1] = NULL;
+
+    error = hfsp_btree_find_batch(hmp->hm_catalog_bp, keys, nitems(keys), recs, errors);
+    for (i = 0; i < nitems(keys); i++)
+    {
+        cnids[i] = 0;
+        if (error == 0 && errors[i] == 0 && recs[i]->hr_type == HFSP_FOLDER_RECORD)
+            cnids[i] = recs[i]->hr_cnid;
+        if (recs[i] != NULL)
+            hfsp_brec_release_record(&recs[i]);
+    }
+
+    // Set once, readers see them after the state with the acquire load.
+    mtx_lock(&lcp->hlc_mtx);
+    hmp->hm_privDirCnid = cnids[0];
+    hmp->hm_privDirDataCnid = cnids[1];
+    atomic_store_rel_int(&lcp->hlc_privState, HFSP_LINK_PRIV_DONE);
+    wakeup(lcp);
+    mtx_unlock(&lcp->hlc_mtx);
+    HFSP_TRACE(HFSP_TRACE_INFO, "hfsp_link_mount: Private folders %ju and %ju.",
+               hmp->hm_privDirCnid, hmp->hm_privDirDataCnid);
+}
+
+/*
+ * Read the indirect node of a link from the catalogue into a cache entry.
+ */
+static int
+hfsp_link_read(struct hfspmount * hmp, u_int32_t iNodeNum, int kind, struct hfsp_linkentry ** lepp)
+{
+    hfsp_unichar buf[sizeof(HFSP_INODE_PREFIX) + 10];
+    char name[sizeof(HFSP_INODE_PREFIX) + 10];
+    struct hfsp_record_key key;
+    struct hfsp_record * rp;
+    struct hfsp_linkentry * lep;
+    hfsp_cnid privDir;
+    int error, len, type;
+
+    // Most volumes have no links, the private folders are looked up by the first one.
+    if (atomic_load_acq_int(&hmp->hm_links.hlc_privState) != HFSP_LINK_PRIV_DONE)
+        hfsp_link_mount(hmp);
+
+    if (kind == HFSP_LINK_DIR)
+    {
+        privDir = hmp->hm_privDirDataCnid;
+        len = snprintf(name, sizeof(name), HFSP_DIRINODE_PREFIX "%u", iNodeNum);
+        type = HFSP_FOLDER_RECORD;
+    }
+    else
+    {
+        privDir = hmp->hm_privDirCnid;
+        len = snprintf(name, sizeof(name), HFSP_INODE_PREFIX "%u", iNodeNum);
+        type = HFSP_FILE_RECORD;
+    }
+
+    if (privDir == 0)
+    {
+        HFSP_TRACE(HFSP_TRACE_WARN, "hfsp_link_read: No private folder for link kind %jd.", kind);
+        return ENOENT;
+    }
+
+    hfsp_link_key(&key, privDir, name, len, buf);
+    rp = NULL;
+    error = hfsp_btree_find_exact(hmp->hm_catalog_bp, &key, &rp);
+    if (error == 0 && rp->hr_type != type)
+        error = ENOENT;
+    if (error)
+    {
+        HFSP_TRACE(HFSP_TRACE_WARN, "hfsp_link_read: Indirect node %ju of kind %jd not found, error %jd.",
+                   iNodeNum, kind, error);
+        if (rp != NULL)
+            hfsp_brec_release_record(&rp);
+        return error;
+    }
+
+    lep = malloc(sizeof(*lep), M_HFSPLINK, M_WAITOK | M_ZERO);
+    lep->hle_iNodeNum = iNodeNum;
+    lep->hle_kind = kind;
+    lep->hle_rec = *rp;
+    lep->hle_rec.hr_node = NULL;
+    lep->hle_rec.hr_flags = 0;
+    lep->hle_rec.hr_key.hk_nameStr = NULL;
+    if (lep->hle_rec.hr_key.hk_name != NULL)
+    {
+        hfsp_name_ref(lep->hle_rec.hr_key.hk_name);
+        lep->hle_rec.hr_key.hk_nameStr = lep->hle_rec.hr_key.hk_name->hna_str;
+    }
+    hfsp_brec_release_record(&rp);
+
+    *lepp = lep;
+    return 0;
+}
+
+int
+hfsp_link_resolve(struct hfspmount * hmp, struct hfsp_record * rp)
+{
+    struct hfsp_linkcache * lcp;
+    struct hfsp_linkentry * lep, * newp;
+    u_int32_t iNodeNum;
+    int error, kind;
+
+    if (HFSP_RECORD_IS_HARDLINK(rp))
+        kind = HFSP_LINK_FILE;
+    else if (HFSP_RECORD_IS_DIRLINK(rp))
+        kind = HFSP_LINK_DIR;
+    else
+        return 0;
+
+    lcp = &hmp->hm_links;
+    iNodeNum = rp->hr_iNodeNum;
+
+    mtx_lock(&lcp->hlc_mtx);
+    LIST_FOREACH(lep, HFSP_LINKHASH(lcp, iNodeNum, kind), hle_hash)
+    {
+        if (lep->hle_iNodeNum == iNodeNum && lep->hle_kind == kind)
+        {
+            TAILQ_REMOVE(&lcp->hlc_lru, lep, hle_lru);
+            TAILQ_INSERT_TAIL(&lcp->hlc_lru, lep, hle_lru);
+            hfsp_link_apply(rp, &lep->hle_rec);
+            mtx_unlock(&lcp->hlc_mtx);
+            atomic_add_long(&hfsp_linkcache_hits, 1);
+            return 0;
+        }
+    }
+    mtx_unlock(&lcp->hlc_mtx);
+
+    atomic_add_long(&hfsp_linkcache_misses, 1);
+    error = hfsp_link_read(hmp, iNodeNum, kind, &newp);
+    if (error)
+        return error;
+    hfsp_link_apply(rp, &newp->hle_rec);
+
+    // Someone may have raced us in, keep the first entry.
+    mtx_lock(&lcp->hlc_mtx);
+    LIST_FOREACH(lep, HFSP_LINKHASH(lcp, iNodeNum, kind), hle_hash)
+    {
+        if (lep->hle_iNodeNum == iNodeNum && lep->hle_kind == kind)
+            break;
+    }
+    if (lep != NULL)
+    {
+        mtx_unlock(&lcp->hlc_mtx);
+        hfsp_linkentry_free(hmp, newp);
+        return 0;
+    }
+
+    LIST_INSERT_HEAD(HFSP_LINKHASH(lcp, iNodeNum, kind), newp, hle_hash);
+    TAILQ_INSERT_TAIL(&lcp->hlc_lru, newp, hle_lru);
+    lcp->hlc_count++;
+
+    // Evict the least recently used entries above the limit.
+    lep = NULL;
+    if (lcp->hlc_count > hfsp_linkcache_max && lcp->hlc_count > 1)
+    {
+        lep = TAILQ_FIRST(&lcp->hlc_lru);
+        TAILQ_REMOVE(&lcp->hlc_lru, lep, hle_lru);
+        LIST_REMOVE(lep, hle_hash);
+        lcp->hlc_count--;
+    }
+    mtx_unlock(&lcp->hlc_mtx);
+
+    if (lep != NULL)
+        hfsp_linkentry_free(hmp, lep);
+    return 0;
+}
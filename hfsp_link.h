@@ -0,0 +1,59 @@
+#include <sys/param.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_LINK_H_
+#define _HFSP_LINK_H_
+
+MALLOC_DECLARE(M_HFSPLINK);
+
+/*
+ * True if a catalogue record is a file hard link. The content of the file is
+ * held by the indirect node named after hr_iNodeNum in the private data folder.
+ */
+#define HFSP_RECORD_IS_HARDLINK(rp)                                     \
+    ((rp)->hr_type == HFSP_FILE_RECORD &&                               \
+     (rp)->hr_file.hrfi_fdType == kHardLinkFileType &&                  \
+     (rp)->hr_file.hrfi_fdCreator == kHFSPlusCreator)
+
+/*
+ * True if a catalogue record is a directory hard link. The folder is the
+ * "dir_" indirect node of the private directory data folder.
+ */
+#define HFSP_RECORD_IS_DIRLINK(rp)                                      \
+    ((rp)->hr_type == HFSP_FILE_RECORD &&                               \
+     (rp)->hr_file.hrfi_fdType == kHFSAliasType &&                      \
+     (rp)->hr_file.hrfi_fdCreator == kHFSAliasCreator &&                \
+     ((rp)->hr_file.hrfi_flags & kHFSHasLinkChainMask))
+
+/*
+ * Initialize the hard link cache of a mount.
+ */
+void hfsp_linkcache_init(struct hfsp_linkcache * lcp);
+
+/*
+ * Empty and destroy the hard link cache of a mount.
+ * Must be called before the name table is destroyed.
+ */
+void hfsp_linkcache_destroy(struct hfspmount * hmp);
+
+/*
+ * Look up the private folders holding the indirect nodes. Called when the
+ * first link is resolved, a volume without hard links has none of them.
+ * The folders are looked up once, concurrent callers wait for it.
+ * hmp: The mount, the catalogue must be opened.
+ */
+void hfsp_link_mount(struct hfspmount * hmp);
+
+/*
+ * Resolve a file or directory hard link record to its indirect node. On success
+ * the record keeps the key of the link, its parent and name, while the type,
+ * identity and attributes are the ones of the indirect node. Other records are
+ * left untouched.
+ * hmp: The mount.
+ * rp: A catalogue record.
+ * Return 0 on success.
+ */
+int hfsp_link_resolve(struct hfspmount * hmp, struct hfsp_record * rp);
+
+#endif /* _HFSP_LINK_H_ */
@@ -0,0 +1,180 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/malloc.h>
+#include <sys/refcount.h>
+#include <sys/vnode.h>
+#include <sys/endian.h>
+
+#include "hfsp.h"
+#include "hfsp_name.h"
+#include "hfsp_unicode.h"
+
+MALLOC_DEFINE(M_HFSPNAME, "hfsp_name", "HFS+ interned name");
+
+#define HFSP_FNV_OFFSET 2166136261U
+#define HFSP_FNV_PRIME  16777619U
+
+// Buckets of a new table, most mounts only ever see a few names.
+#define HFSP_NAMETAB_MIN    64
+
+void
+hfsp_nametab_init(struct hfsp_nametab * ntp)
+{
+    mtx_init(&ntp->hnt_mtx, "hfsp_names", NULL, MTX_DEF);
+    ntp->hnt_hash = hashinit(HFSP_NAMETAB_MIN, M_HFSPNAME, &ntp->hnt_mask);
+    ntp->hnt_count = 0;
+}
+
+/*
+ * Grow the table once it holds more than two names per bucket, up to a bucket
+ * for eight vnodes.
+ */
+static void
+hfsp_nametab_grow(struct hfsp_nametab * ntp)
+{
+    LIST_HEAD(, hfsp_name) * hash, * old;
+    struct hfsp_name * namep;
+    u_long mask, oldMask, i;
+
+    mtx_lock(&ntp->hnt_mtx);
+    oldMask = ntp->hnt_mask;
+    mtx_unlock(&ntp->hnt_mtx);
+    if ((oldMask + 1) * 4 > max(desiredvnodes / 8, HFSP_NAMETAB_MIN))
+        return;
+    hash = hashinit((oldMask + 1) * 4, M_HFSPNAME, &mask);
+
+    mtx_lock(&ntp->hnt_mtx);
+    if (ntp->hnt_mask != oldMask)
+    {
+        // Grown by an other thread meanwhile.
+        mtx_unlock(&ntp->hnt_mtx);
+        hashdestroy(hash, M_HFSPNAME, mask);
+        return;
+    }
+    old = (void *)ntp->hnt_hash;
+    for (i = 0; i <= oldMask; i++)
+    {
+        while ((namep = LIST_FIRST(&old[i])) != NULL)
+        {
+            LIST_REMOVE(namep, hna_link);
+            LIST_INSERT_HEAD(&hash[namep->hna_hash & mask], namep, hna_link);
+        }
+    }
+    ntp->hnt_hash = (void *)hash;
+    ntp->hnt_mask = mask;
+    mtx_unlock(&ntp->hnt_mtx);
+
+    hashdestroy(old, M_HFSPNAME, oldMask);
+}
+
+void
+hfsp_nametab_destroy(struct hfsp_nametab * ntp)
+{
+    KASSERT(ntp->hnt_count == 0, ("hfsp_nametab_destroy: %u names still referenced", ntp->hnt_count));
+    hashdestroy(ntp->hnt_hash, M_HFSPNAME, ntp->hnt_mask);
+    mtx_destroy(&ntp->hnt_mtx);
+}
+
+u_int32_t
+hfsp_name_hash(const hfsp_unichar * str, int len)
+{
+    u_int32_t hash;
+    u_int16_t c;
+
+    hash = HFSP_FNV_OFFSET;
+    while (len--)
+    {
+        c = hfsp_foldcase(be16toh(*(str++)));
+        if (c == 0)
+            continue;
+        hash = (hash ^ (c & 0xFF)) * HFSP_FNV_PRIME;
+        hash = (hash ^ (c >> 8)) * HFSP_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+int
+hfsp_name_intern(struct hfsp_nametab * ntp, const hfsp_unichar * str, u_int16_t len,
+                 struct hfsp_name ** namepp)
+{
+    struct hfsp_name * namep, * newp;
+    u_int32_t hash;
+    size_t size;
+    int grow;
+
+    hash = hfsp_name_hash(str, len);
+    size = len * sizeof(hfsp_unichar);
+    newp = NULL;
+
+    mtx_lock(&ntp->hnt_mtx);
+    while (1)
+    {
+        LIST_FOREACH(namep, &ntp->hnt_hash[hash & ntp->hnt_mask], hna_link)
+        {
+            if (namep->hna_hash == hash && namep->hna_len == len && bcmp(namep->hna_str, str, size) == 0)
+            {
+                refcount_acquire(&namep->hna_refcnt);
+                mtx_unlock(&ntp->hnt_mtx);
+                if (newp != NULL)
+                    free(newp, M_HFSPNAME);
+                *namepp = namep;
+                return 0;
+            }
+        }
+
+        if (newp != NULL)
+            break;
+
+        // Not found, allocate outside of the lock and search again.
+        mtx_unlock(&ntp->hnt_mtx);
+        newp = malloc(sizeof(*newp) + size, M_HFSPNAME, M_WAITOK);
+        newp->hna_hash = hash;
+        newp->hna_len = len;
+        refcount_init(&newp->hna_refcnt, 1);
+        bcopy(str, newp->hna_str, size);
+        mtx_lock(&ntp->hnt_mtx);
+    }
+
+    LIST_INSERT_HEAD(&ntp->hnt_hash[hash & ntp->hnt_mask], newp, hna_link);
+    ntp->hnt_count++;
+    grow = ntp->hnt_count > 2 * (ntp->hnt_mask + 1);
+    mtx_unlock(&ntp->hnt_mtx);
+
+    if (grow)
+        hfsp_nametab_grow(ntp);
+
+    *namepp = newp;
+    return 0;
+}
+
+struct hfsp_name *
+hfsp_name_ref(struct hfsp_name * namep)
+{
+    refcount_acquire(&namep->hna_refcnt);
+    return namep;
+}
+
+void
+hfsp_name_release(struct hfsp_nametab * ntp, struct hfsp_name * namep)
+{
+    // Lookups take their reference under the table lock, so the last one
+    // is only dropped with the lock held.
+    if (refcount_release_if_not_last(&namep->hna_refcnt))
+        return;
+
+    mtx_lock(&ntp->hnt_mtx);
+    if (!refcount_release(&namep->hna_refcnt))
+    {
+        mtx_unlock(&ntp->hnt_mtx);
+        return;
+    }
+    LIST_REMOVE(namep, hna_link);
+    ntp->hnt_count--;
+    mtx_unlock(&ntp->hnt_mtx);
+
+    free(namep, M_HFSPNAME);
+}
@@ -0,0 +1,49 @@
+#include <sys/param.h>
+
+#include "hfsp.h"
+
+#ifndef _HFSP_NAME_H_
+#define _HFSP_NAME_H_
+
+MALLOC_DECLARE(M_HFSPNAME);
+
+/*
+ * Initialize the name table of a mount.
+ */
+void hfsp_nametab_init(struct hfsp_nametab * ntp);
+
+/*
+ * Destroy the name table of a mount. All the references must have been
+ * released.
+ */
+void hfsp_nametab_destroy(struct hfsp_nametab * ntp);
+
+/*
+ * Hash of the case folded name, ignorable characters are skipped so names
+ * that compare equal with hfsp_unicode_cmp() hash the same.
+ * str: BE unicode characters.
+ * len: Number of characters.
+ */
+u_int32_t hfsp_name_hash(const hfsp_unichar * str, int len);
+
+/*
+ * Return a referenced interned copy of a name.
+ * ntp: The name table of the mount.
+ * str: BE unicode characters.
+ * len: Number of characters.
+ * namepp: Address of a pointer that will point to the interned name on exit.
+ */
+int hfsp_name_intern(struct hfsp_nametab * ntp, const hfsp_unichar * str, u_int16_t len,
+                     struct hfsp_name ** namepp);
+
+/*
+ * Take an additional reference on an interned name.
+ */
+struct hfsp_name * hfsp_name_ref(struct hfsp_name * namep);
+
+/*
+ * Release a reference on an interned name, freeing it with the last one.
+ */
+void hfsp_name_release(struct hfsp_nametab * ntp, struct hfsp_name * namep);
+
+#endif /* _HFSP_NAME_H_ */
@@ -0,0 +1,111 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/smp.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+
+#include "hfsp.h"
+#include "hfsp_trace.h"
+
+#ifdef HFSP_TRACING
+
+MALLOC_DEFINE(M_HFSPTRACE, "hfsp_trace", "HFS+ trace rings");
+
+/*
+ * One ring per CPU. Writers only touch the ring of the CPU they run on
+ * inside a critical section, so no lock is needed.
+ */
+struct hfsp_trace_ring {
+    u_int                   htr_head;
+    struct hfsp_trace_entry htr_entries[HFSP_TRACE_RING_SIZE];
+} __aligned(CACHE_LINE_SIZE);
+
+static struct hfsp_trace_ring * hfsp_trace_rings;
+
+int hfsp_trace_level = HFSP_TRACE_INFO;
+SYSCTL_INT(_vfs_hfsp, OID_AUTO, trace_level, CTLFLAG_RW, &hfsp_trace_level, 0,
+           "HFS+ trace level (1 error, 2 warn, 3 info, 4 debug)");
+
+static int hfsp_trace_sysctl(SYSCTL_HANDLER_ARGS);
+SYSCTL_PROC(_vfs_hfsp, OID_AUTO, trace, CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+            NULL, 0, hfsp_trace_sysctl, "A", "Dump the HFS+ trace rings");
+
+void
+hfsp_trace_init()
+{
+    hfsp_trace_rings = malloc(sizeof(*hfsp_trace_rings) * (mp_maxid + 1), M_HFSPTRACE,
+                              M_WAITOK | M_ZERO);
+}
+
+void
+hfsp_trace_uninit()
+{
+    free(hfsp_trace_rings, M_HFSPTRACE);
+    hfsp_trace_rings = NULL;
+}
+
+void
+hfsp_trace_log(int level, const char * fmt, uintmax_t a0, uintmax_t a1, uintmax_t a2, uintmax_t a3)
+{
+    struct hfsp_trace_ring * ringp;
+    struct hfsp_trace_entry * ep;
+
+    if (hfsp_trace_rings == NULL)
+        return;
+
+    critical_enter();
+    ringp = &hfsp_trace_rings[curcpu];
+    ep = &ringp->htr_entries[ringp->htr_head++ & (HFSP_TRACE_RING_SIZE - 1)];
+    ep->hte_fmt = fmt;
+    ep->hte_time = sbinuptime();
+    ep->hte_level = level;
+    ep->hte_args[0] = a0;
+    ep->hte_args[1] = a1;
+    ep->hte_args[2] = a2;
+    ep->hte_args[3] = a3;
+    critical_exit();
+}
+
+static int
+hfsp_trace_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    struct hfsp_trace_ring * ringp;
+    struct hfsp_trace_entry * ep;
+    struct sbuf sb;
+    u_int head, idx;
+    int cpu, error;
+
+    error = sysctl_wire_old_buffer(req, 0);
+    if (error)
+        return error;
+
+    sbuf_new_for_sysctl(&sb, NULL, 4096, req);
+    sbuf_printf(&sb, "\n");
+    CPU_FOREACH(cpu)
+    {
+        ringp = &hfsp_trace_rings[cpu];
+        head = ringp->htr_head;
+        idx = head > HFSP_TRACE_RING_SIZE ? head - HFSP_TRACE_RING_SIZE : 0;
+        for (; idx != head; idx++)
+        {
+            ep = &ringp->htr_entries[idx & (HFSP_TRACE_RING_SIZE - 1)];
+            if (ep->hte_fmt == NULL)
+                continue;
+            sbuf_printf(&sb, "cpu%d %ju.%09ju [%d] ", cpu, (uintmax_t)(ep->hte_time >> 32),
+                        (uintmax_t)(((ep->hte_time & 0xffffffff) * 1000000000) >> 32), ep->hte_level);
+            sbuf_printf(&sb, ep->hte_fmt, ep->hte_args[0], ep->hte_args[1], ep->hte_args[2],
+                        ep->hte_args[3]);
+            sbuf_printf(&sb, "\n");
+        }
+    }
+
+    error = sbuf_finish(&sb);
+    sbuf_delete(&sb);
+    return error;
+}
+
+#endif /* HFSP_TRACING */
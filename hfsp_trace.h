@@ -0,0 +1,65 @@
+#include <sys/param.h>
+#include <sys/systm.h>
+
+#ifndef _HFSP_TRACE_H_
+#define _HFSP_TRACE_H_
+
+/*
+ * Lightweight tracing for the hot paths.
+ *
+ * Trace points only record the format string pointer and up to four integer
+ * arguments in a per-CPU ring, formatting happens when the rings are dumped
+ * through the vfs.hfsp.trace sysctl. Formats must therefore consume uintmax_t
+ * arguments (%ju, %jx, %jd).
+ *
+ * Everything is compiled out unless the module is built with HFSP_TRACE=on.
+ */
+enum {
+    HFSP_TRACE_ERROR    = 1,
+    HFSP_TRACE_WARN     = 2,
+    HFSP_TRACE_INFO     = 3,
+    HFSP_TRACE_DEBUG    = 4
+};
+
+#ifdef HFSP_TRACING
+
+#define HFSP_TRACE_NARGS        4
+#define HFSP_TRACE_RING_SIZE    1024    /* Entries per CPU, power of two */
+
+struct hfsp_trace_entry {
+    const char *    hte_fmt;
+    sbintime_t      hte_time;
+    uintmax_t       hte_args[HFSP_TRACE_NARGS];
+    int             hte_level;
+};
+
+extern int hfsp_trace_level;
+
+void hfsp_trace_init(void);
+void hfsp_trace_uninit(void);
+
+/*
+ * Record a trace entry in the ring of the current CPU.
+ * level: One of the HFSP_TRACE_* level.
+ * fmt: Static format string, only the pointer is kept.
+ */
+void hfsp_trace_log(int level, const char * fmt, uintmax_t a0, uintmax_t a1, uintmax_t a2, uintmax_t a3);
+
+#define HFSP_TRACE(level, ...) \
+    _HFSP_TRACE(level, __VA_ARGS__, 0, 0, 0, 0)
+
+#define _HFSP_TRACE(level, fmt, a0, a1, a2, a3, ...) do {                   \
+    if ((level) <= hfsp_trace_level)                                        \
+        hfsp_trace_log((level), (fmt), (uintmax_t)(a0), (uintmax_t)(a1),    \
+                       (uintmax_t)(a2), (uintmax_t)(a3));                   \
+} while (0)
+
+#else /* !HFSP_TRACING */
+
+#define hfsp_trace_init()           do { } while (0)
+#define hfsp_trace_uninit()         do { } while (0)
+#define HFSP_TRACE(level, ...)      do { } while (0)
+
+#endif /* HFSP_TRACING */
+
+#endif /* _HFSP_TRACE_H_ */
@@ -1,6 +1,8 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/endian.h>
+#include <sys/errno.h>
+#include <sys/systm.h>
 
 #include "hfsp_unicode.h"
 
@@ -244,24 +246,14 @@ hfsp_foldcase(u_int16_t ch)
     return ch;
 }
 
-void
-hfsp_unicode_copy(struct hfsp_unistr * srcp, struct hfsp_unistr * dstp)
-{
-    bcopy((void*)srcp, (void*)dstp, (srcp->hu_len * 2) + sizeof(srcp->hu_len));
-}
-
 int
-hfsp_unicode_cmp(struct hfsp_unistr * lstrp, struct hfsp_unistr * rstrp)
+hfsp_unicode_cmp(const hfsp_unichar * lstr, int llen, const hfsp_unichar * rstr, int rlen)
 {
-    int llen, rlen;
     u_int16_t lc, rc;
-    u_int16_t * lsp, * rsp;
+    const u_int16_t * lsp, * rsp;
 
-    llen = lstrp->hu_len;
-    rlen = rstrp->hu_len;
-
-    lsp = lstrp->hu_str;
-    rsp = rstrp->hu_str;
+    lsp = lstr;
+    rsp = rstr;
 
     while (1)
     {
@@ -293,3 +285,1026 @@ hfsp_unicode_cmp(struct hfsp_unistr * lstrp, struct hfsp_unistr * rstrp)
             return 0;
     }
 }
+
+/*
+ * Canonical compositions of the BMP, the inverse of hfsp_decomp_tab: a pair
+ * composes only when hfsp_unicode_from_utf8() decomposes the result back to
+ * the base and the mark, so a name listed composed is found again. Composition
+ * exclusions and Hangul syllables are left out, the latter are composed
+ * algorithmically. The pairs are grouped by combining mark, each group sorted
+ * by base character.
+ */
+static const struct hfsp_compose_mark {
+    u_int16_t   hcm_mark;
+    u_int16_t   hcm_start;
+    u_int16_t   hcm_count;
+} hfsp_compose_marks[] = {
+    {0x0300,   0,  84}, {0x0301,  84, 117}, {0x0302, 201,  32}, {0x0303, 233,  28},
+    {0x0304, 261,  44}, {0x0306, 305,  32}, {0x0307, 337,  46}, {0x0308, 383,  54},
+    {0x0309, 437,  24}, {0x030A, 461,   6}, {0x030B, 467,   6}, {0x030C, 473,  37},
+    {0x030F, 510,  14}, {0x0311, 524,  12}, {0x0313, 536,  14}, {0x0314, 550,  16},
+    {0x031B, 566,   4}, {0x0323, 570,  42}, {0x0324, 612,   2}, {0x0325, 614,   2},
+    {0x0326, 616,   4}, {0x0327, 620,  22}, {0x0328, 642,  10}, {0x032D, 652,  12},
+    {0x032E, 664,   2}, {0x0330, 666,   6}, {0x0331, 672,  17}, {0x0342, 689,  29},
+    {0x0345, 718,  63}, {0x0653, 781,   1}, {0x0654, 782,   6}, {0x0655, 788,   1},
+    {0x093C, 789,   3}, {0x09BE, 792,   1}, {0x09D7, 793,   1}, {0x0B3E, 794,   1},
+    {0x0B56, 795,   1}, {0x0B57, 796,   1}, {0x0BBE, 797,   2}, {0x0BD7, 799,   2},
+    {0x0C56, 801,   1}, {0x0CC2, 802,   1}, {0x0CD5, 803,   3}, {0x0CD6, 806,   1},
+    {0x0D3E, 807,   2}, {0x0D57, 809,   1}, {0x0DCA, 810,   2}, {0x0DCF, 812,   1},
+    {0x0DDF, 813,   1}, {0x102E, 814,   1}, {0x3099, 815,  48}, {0x309A, 863,  10},
+};
+
+static const struct hfsp_compose_pair {
+    u_int16_t   hcp_base;
+    u_int16_t   hcp_composed;
+} hfsp_compose_pairs[] = {
+    {0x0041, 0x00C0}, {0x0045, 0x00C8}, {0x0049, 0x00CC}, {0x004E, 0x01F8}, {0x004F, 0x00D2}, {0x0055, 0x00D9},
+    {0x0057, 0x1E80}, {0x0059, 0x1EF2}, {0x0061, 0x00E0}, {0x0065, 0x00E8}, {0x0069, 0x00EC}, {0x006E, 0x01F9},
+    {0x006F, 0x00F2}, {0x0075, 0x00F9}, {0x0077, 0x1E81}, {0x0079, 0x1EF3}, {0x00A8, 0x1FED}, {0x00C2, 0x1EA6},
+    {0x00CA, 0x1EC0}, {0x00D4, 0x1ED2}, {0x00DC, 0x01DB}, {0x00E2, 0x1EA7}, {0x00EA, 0x1EC1}, {0x00F4, 0x1ED3},
+    {0x00FC, 0x01DC}, {0x0102, 0x1EB0}, {0x0103, 0x1EB1}, {0x0112, 0x1E14}, {0x0113, 0x1E15}, {0x014C, 0x1E50},
+    {0x014D, 0x1E51}, {0x01A0, 0x1EDC}, {0x01A1, 0x1EDD}, {0x01AF, 0x1EEA}, {0x01B0, 0x1EEB}, {0x0391, 0x1FBA},
+    {0x0395, 0x1FC8}, {0x0397, 0x1FCA}, {0x0399, 0x1FDA}, {0x039F, 0x1FF8}, {0x03A5, 0x1FEA}, {0x03A9, 0x1FFA},
+    {0x03B1, 0x1F70}, {0x03B5, 0x1F72}, {0x03B7, 0x1F74}, {0x03B9, 0x1F76}, {0x03BF, 0x1F78}, {0x03C5, 0x1F7A},
+    {0x03C9, 0x1F7C}, {0x03CA, 0x1FD2}, {0x03CB, 0x1FE2}, {0x0415, 0x0400}, {0x0418, 0x040D}, {0x0435, 0x0450},
+    {0x0438, 0x045D}, {0x1F00, 0x1F02}, {0x1F01, 0x1F03}, {0x1F08, 0x1F0A}, {0x1F09, 0x1F0B}, {0x1F10, 0x1F12},
+    {0x1F11, 0x1F13}, {0x1F18, 0x1F1A}, {0x1F19, 0x1F1B}, {0x1F20, 0x1F22}, {0x1F21, 0x1F23}, {0x1F28, 0x1F2A},
+    {0x1F29, 0x1F2B}, {0x1F30, 0x1F32}, {0x1F31, 0x1F33}, {0x1F38, 0x1F3A}, {0x1F39, 0x1F3B}, {0x1F40, 0x1F42},
+    {0x1F41, 0x1F43}, {0x1F48, 0x1F4A}, {0x1F49, 0x1F4B}, {0x1F50, 0x1F52}, {0x1F51, 0x1F53}, {0x1F59, 0x1F5B},
+    {0x1F60, 0x1F62}, {0x1F61, 0x1F63}, {0x1F68, 0x1F6A}, {0x1F69, 0x1F6B}, {0x1FBF, 0x1FCD}, {0x1FFE, 0x1FDD},
+    {0x0041, 0x00C1}, {0x0043, 0x0106}, {0x0045, 0x00C9}, {0x0047, 0x01F4}, {0x0049, 0x00CD}, {0x004B, 0x1E30},
+    {0x004C, 0x0139}, {0x004D, 0x1E3E}, {0x004E, 0x0143}, {0x004F, 0x00D3}, {0x0050, 0x1E54}, {0x0052, 0x0154},
+    {0x0053, 0x015A}, {0x0055, 0x00DA}, {0x0057, 0x1E82}, {0x0059, 0x00DD}, {0x005A, 0x0179}, {0x0061, 0x00E1},
+    {0x0063, 0x0107}, {0x0065, 0x00E9}, {0x0067, 0x01F5}, {0x0069, 0x00ED}, {0x006B, 0x1E31}, {0x006C, 0x013A},
+    {0x006D, 0x1E3F}, {0x006E, 0x0144}, {0x006F, 0x00F3}, {0x0070, 0x1E55}, {0x0072, 0x0155}, {0x0073, 0x015B},
+    {0x0075, 0x00FA}, {0x0077, 0x1E83}, {0x0079, 0x00FD}, {0x007A, 0x017A}, {0x00A8, 0x0385}, {0x00C2, 0x1EA4},
+    {0x00C5, 0x01FA}, {0x00C6, 0x01FC}, {0x00C7, 0x1E08}, {0x00CA, 0x1EBE}, {0x00CF, 0x1E2E}, {0x00D4, 0x1ED0},
+    {0x00D5, 0x1E4C}, {0x00D8, 0x01FE}, {0x00DC, 0x01D7}, {0x00E2, 0x1EA5}, {0x00E5, 0x01FB}, {0x00E6, 0x01FD},
+    {0x00E7, 0x1E09}, {0x00EA, 0x1EBF}, {0x00EF, 0x1E2F}, {0x00F4, 0x1ED1}, {0x00F5, 0x1E4D}, {0x00F8, 0x01FF},
+    {0x00FC, 0x01D8}, {0x0102, 0x1EAE}, {0x0103, 0x1EAF}, {0x0112, 0x1E16}, {0x0113, 0x1E17}, {0x014C, 0x1E52},
+    {0x014D, 0x1E53}, {0x0168, 0x1E78}, {0x0169, 0x1E79}, {0x01A0, 0x1EDA}, {0x01A1, 0x1EDB}, {0x01AF, 0x1EE8},
+    {0x01B0, 0x1EE9}, {0x0391, 0x0386}, {0x0395, 0x0388}, {0x0397, 0x0389}, {0x0399, 0x038A}, {0x039F, 0x038C},
+    {0x03A5, 0x038E}, {0x03A9, 0x038F}, {0x03B1, 0x03AC}, {0x03B5, 0x03AD}, {0x03B7, 0x03AE}, {0x03B9, 0x03AF},
+    {0x03BF, 0x03CC}, {0x03C5, 0x03CD}, {0x03C9, 0x03CE}, {0x03CA, 0x0390}, {0x03CB, 0x03B0}, {0x03D2, 0x03D3},
+    {0x0413, 0x0403}, {0x041A, 0x040C}, {0x0433, 0x0453}, {0x043A, 0x045C}, {0x1F00, 0x1F04}, {0x1F01, 0x1F05},
+    {0x1F08, 0x1F0C}, {0x1F09, 0x1F0D}, {0x1F10, 0x1F14}, {0x1F11, 0x1F15}, {0x1F18, 0x1F1C}, {0x1F19, 0x1F1D},
+    {0x1F20, 0x1F24}, {0x1F21, 0x1F25}, {0x1F28, 0x1F2C}, {0x1F29, 0x1F2D}, {0x1F30, 0x1F34}, {0x1F31, 0x1F35},
+    {0x1F38, 0x1F3C}, {0x1F39, 0x1F3D}, {0x1F40, 0x1F44}, {0x1F41, 0x1F45}, {0x1F48, 0x1F4C}, {0x1F49, 0x1F4D},
+    {0x1F50, 0x1F54}, {0x1F51, 0x1F55}, {0x1F59, 0x1F5D}, {0x1F60, 0x1F64}, {0x1F61, 0x1F65}, {0x1F68, 0x1F6C},
+    {0x1F69, 0x1F6D}, {0x1FBF, 0x1FCE}, {0x1FFE, 0x1FDE}, {0x0041, 0x00C2}, {0x0043, 0x0108}, {0x0045, 0x00CA},
+    {0x0047, 0x011C}, {0x0048, 0x0124}, {0x0049, 0x00CE}, {0x004A, 0x0134}, {0x004F, 0x00D4}, {0x0053, 0x015C},
+    {0x0055, 0x00DB}, {0x0057, 0x0174}, {0x0059, 0x0176}, {0x005A, 0x1E90}, {0x0061, 0x00E2}, {0x0063, 0x0109},
+    {0x0065, 0x00EA}, {0x0067, 0x011D}, {0x0068, 0x0125}, {0x0069, 0x00EE}, {0x006A, 0x0135}, {0x006F, 0x00F4},
+    {0x0073, 0x015D}, {0x0075, 0x00FB}, {0x0077, 0x0175}, {0x0079, 0x0177}, {0x007A, 0x1E91}, {0x1EA0, 0x1EAC},
+    {0x1EA1, 0x1EAD}, {0x1EB8, 0x1EC6}, {0x1EB9, 0x1EC7}, {0x1ECC, 0x1ED8}, {0x1ECD, 0x1ED9}, {0x0041, 0x00C3},
+    {0x0045, 0x1EBC}, {0x0049, 0x0128}, {0x004E, 0x00D1}, {0x004F, 0x00D5}, {0x0055, 0x0168}, {0x0056, 0x1E7C},
+    {0x0059, 0x1EF8}, {0x0061, 0x00E3}, {0x0065, 0x1EBD}, {0x0069, 0x0129}, {0x006E, 0x00F1}, {0x006F, 0x00F5},
+    {0x0075, 0x0169}, {0x0076, 0x1E7D}, {0x0079, 0x1EF9}, {0x00C2, 0x1EAA}, {0x00CA, 0x1EC4}, {0x00D4, 0x1ED6},
+    {0x00E2, 0x1EAB}, {0x00EA, 0x1EC5}, {0x00F4, 0x1ED7}, {0x0102, 0x1EB4}, {0x0103, 0x1EB5}, {0x01A0, 0x1EE0},
+    {0x01A1, 0x1EE1}, {0x01AF, 0x1EEE}, {0x01B0, 0x1EEF}, {0x0041, 0x0100}, {0x0045, 0x0112}, {0x0047, 0x1E20},
+    {0x0049, 0x012A}, {0x004F, 0x014C}, {0x0055, 0x016A}, {0x0059, 0x0232}, {0x0061, 0x0101}, {0x0065, 0x0113},
+    {0x0067, 0x1E21}, {0x0069, 0x012B}, {0x006F, 0x014D}, {0x0075, 0x016B}, {0x0079, 0x0233}, {0x00C4, 0x01DE},
+    {0x00C6, 0x01E2}, {0x00D5, 0x022C}, {0x00D6, 0x022A}, {0x00DC, 0x01D5}, {0x00E4, 0x01DF}, {0x00E6, 0x01E3},
+    {0x00F5, 0x022D}, {0x00F6, 0x022B}, {0x00FC, 0x01D6}, {0x01EA, 0x01EC}, {0x01EB, 0x01ED}, {0x0226, 0x01E0},
+    {0x0227, 0x01E1}, {0x022E, 0x0230}, {0x022F, 0x0231}, {0x0391, 0x1FB9}, {0x0399, 0x1FD9}, {0x03A5, 0x1FE9},
+    {0x03B1, 0x1FB1}, {0x03B9, 0x1FD1}, {0x03C5, 0x1FE1}, {0x0418, 0x04E2}, {0x0423, 0x04EE}, {0x0438, 0x04E3},
+    {0x0443, 0x04EF}, {0x1E36, 0x1E38}, {0x1E37, 0x1E39}, {0x1E5A, 0x1E5C}, {0x1E5B, 0x1E5D}, {0x0041, 0x0102},
+    {0x0045, 0x0114}, {0x0047, 0x011E}, {0x0049, 0x012C}, {0x004F, 0x014E}, {0x0055, 0x016C}, {0x0061, 0x0103},
+    {0x0065, 0x0115}, {0x0067, 0x011F}, {0x0069, 0x012D}, {0x006F, 0x014F}, {0x0075, 0x016D}, {0x0228, 0x1E1C},
+    {0x0229, 0x1E1D}, {0x0391, 0x1FB8}, {0x0399, 0x1FD8}, {0x03A5, 0x1FE8}, {0x03B1, 0x1FB0}, {0x03B9, 0x1FD0},
+    {0x03C5, 0x1FE0}, {0x0410, 0x04D0}, {0x0415, 0x04D6}, {0x0416, 0x04C1}, {0x0418, 0x0419}, {0x0423, 0x040E},
+    {0x0430, 0x04D1}, {0x0435, 0x04D7}, {0x0436, 0x04C2}, {0x0438, 0x0439}, {0x0443, 0x045E}, {0x1EA0, 0x1EB6},
+    {0x1EA1, 0x1EB7}, {0x0041, 0x0226}, {0x0042, 0x1E02}, {0x0043, 0x010A}, {0x0044, 0x1E0A}, {0x0045, 0x0116},
+    {0x0046, 0x1E1E}, {0x0047, 0x0120}, {0x0048, 0x1E22}, {0x0049, 0x0130}, {0x004D, 0x1E40}, {0x004E, 0x1E44},
+    {0x004F, 0x022E}, {0x0050, 0x1E56}, {0x0052, 0x1E58}, {0x0053, 0x1E60}, {0x0054, 0x1E6A}, {0x0057, 0x1E86},
+    {0x0058, 0x1E8A}, {0x0059, 0x1E8E}, {0x005A, 0x017B}, {0x0061, 0x0227}, {0x0062, 0x1E03}, {0x0063, 0x010B},
+    {0x0064, 0x1E0B}, {0x0065, 0x0117}, {0x0066, 0x1E1F}, {0x0067, 0x0121}, {0x0068, 0x1E23}, {0x006D, 0x1E41},
+    {0x006E, 0x1E45}, {0x006F, 0x022F}, {0x0070, 0x1E57}, {0x0072, 0x1E59}, {0x0073, 0x1E61}, {0x0074, 0x1E6B},
+    {0x0077, 0x1E87}, {0x0078, 0x1E8B}, {0x0079, 0x1E8F}, {0x007A, 0x017C}, {0x015A, 0x1E64}, {0x015B, 0x1E65},
+    {0x0160, 0x1E66}, {0x0161, 0x1E67}, {0x017F, 0x1E9B}, {0x1E62, 0x1E68}, {0x1E63, 0x1E69}, {0x0041, 0x00C4},
+    {0x0045, 0x00CB}, {0x0048, 0x1E26}, {0x0049, 0x00CF}, {0x004F, 0x00D6}, {0x0055, 0x00DC}, {0x0057, 0x1E84},
+    {0x0058, 0x1E8C}, {0x0059, 0x0178}, {0x0061, 0x00E4}, {0x0065, 0x00EB}, {0x0068, 0x1E27}, {0x0069, 0x00EF},
+    {0x006F, 0x00F6}, {0x0074, 0x1E97}, {0x0075, 0x00FC}, {0x0077, 0x1E85}, {0x0078, 0x1E8D}, {0x0079, 0x00FF},
+    {0x00D5, 0x1E4E}, {0x00F5, 0x1E4F}, {0x016A, 0x1E7A}, {0x016B, 0x1E7B}, {0x0399, 0x03AA}, {0x03A5, 0x03AB},
+    {0x03B9, 0x03CA}, {0x03C5, 0x03CB}, {0x03D2, 0x03D4}, {0x0406, 0x0407}, {0x0410, 0x04D2}, {0x0415, 0x0401},
+    {0x0416, 0x04DC}, {0x0417, 0x04DE}, {0x0418, 0x04E4}, {0x041E, 0x04E6}, {0x0423, 0x04F0}, {0x0427, 0x04F4},
+    {0x042B, 0x04F8}, {0x042D, 0x04EC}, {0x0430, 0x04D3}, {0x0435, 0x0451}, {0x0436, 0x04DD}, {0x0437, 0x04DF},
+    {0x0438, 0x04E5}, {0x043E, 0x04E7}, {0x0443, 0x04F1}, {0x0447, 0x04F5}, {0x044B, 0x04F9}, {0x044D, 0x04ED},
+    {0x0456, 0x0457}, {0x04D8, 0x04DA}, {0x04D9, 0x04DB}, {0x04E8, 0x04EA}, {0x04E9, 0x04EB}, {0x0041, 0x1EA2},
+    {0x0045, 0x1EBA}, {0x0049, 0x1EC8}, {0x004F, 0x1ECE}, {0x0055, 0x1EE6}, {0x0059, 0x1EF6}, {0x0061, 0x1EA3},
+    {0x0065, 0x1EBB}, {0x0069, 0x1EC9}, {0x006F, 0x1ECF}, {0x0075, 0x1EE7}, {0x0079, 0x1EF7}, {0x00C2, 0x1EA8},
+    {0x00CA, 0x1EC2}, {0x00D4, 0x1ED4}, {0x00E2, 0x1EA9}, {0x00EA, 0x1EC3}, {0x00F4, 0x1ED5}, {0x0102, 0x1EB2},
+    {0x0103, 0x1EB3}, {0x01A0, 0x1EDE}, {0x01A1, 0x1EDF}, {0x01AF, 0x1EEC}, {0x01B0, 0x1EED}, {0x0041, 0x00C5},
+    {0x0055, 0x016E}, {0x0061, 0x00E5}, {0x0075, 0x016F}, {0x0077, 0x1E98}, {0x0079, 0x1E99}, {0x004F, 0x0150},
+    {0x0055, 0x0170}, {0x006F, 0x0151}, {0x0075, 0x0171}, {0x0423, 0x04F2}, {0x0443, 0x04F3}, {0x0041, 0x01CD},
+    {0x0043, 0x010C}, {0x0044, 0x010E}, {0x0045, 0x011A}, {0x0047, 0x01E6}, {0x0048, 0x021E}, {0x0049, 0x01CF},
+    {0x004B, 0x01E8}, {0x004C, 0x013D}, {0x004E, 0x0147}, {0x004F, 0x01D1}, {0x0052, 0x0158}, {0x0053, 0x0160},
+    {0x0054, 0x0164}, {0x0055, 0x01D3}, {0x005A, 0x017D}, {0x0061, 0x01CE}, {0x0063, 0x010D}, {0x0064, 0x010F},
+    {0x0065, 0x011B}, {0x0067, 0x01E7}, {0x0068, 0x021F}, {0x0069, 0x01D0}, {0x006A, 0x01F0}, {0x006B, 0x01E9},
+    {0x006C, 0x013E}, {0x006E, 0x0148}, {0x006F, 0x01D2}, {0x0072, 0x0159}, {0x0073, 0x0161}, {0x0074, 0x0165},
+    {0x0075, 0x01D4}, {0x007A, 0x017E}, {0x00DC, 0x01D9}, {0x00FC, 0x01DA}, {0x01B7, 0x01EE}, {0x0292, 0x01EF},
+    {0x0041, 0x0200}, {0x0045, 0x0204}, {0x0049, 0x0208}, {0x004F, 0x020C}, {0x0052, 0x0210}, {0x0055, 0x0214},
+    {0x0061, 0x0201}, {0x0065, 0x0205}, {0x0069, 0x0209}, {0x006F, 0x020D}, {0x0072, 0x0211}, {0x0075, 0x0215},
+    {0x0474, 0x0476}, {0x0475, 0x0477}, {0x0041, 0x0202}, {0x0045, 0x0206}, {0x0049, 0x020A}, {0x004F, 0x020E},
+    {0x0052, 0x0212}, {0x0055, 0x0216}, {0x0061, 0x0203}, {0x0065, 0x0207}, {0x0069, 0x020B}, {0x006F, 0x020F},
+    {0x0072, 0x0213}, {0x0075, 0x0217}, {0x0391, 0x1F08}, {0x0395, 0x1F18}, {0x0397, 0x1F28}, {0x0399, 0x1F38},
+    {0x039F, 0x1F48}, {0x03A9, 0x1F68}, {0x03B1, 0x1F00}, {0x03B5, 0x1F10}, {0x03B7, 0x1F20}, {0x03B9, 0x1F30},
+    {0x03BF, 0x1F40}, {0x03C1, 0x1FE4}, {0x03C5, 0x1F50}, {0x03C9, 0x1F60}, {0x0391, 0x1F09}, {0x0395, 0x1F19},
+    {0x0397, 0x1F29}, {0x0399, 0x1F39}, {0x039F, 0x1F49}, {0x03A1, 0x1FEC}, {0x03A5, 0x1F59}, {0x03A9, 0x1F69},
+    {0x03B1, 0x1F01}, {0x03B5, 0x1F11}, {0x03B7, 0x1F21}, {0x03B9, 0x1F31}, {0x03BF, 0x1F41}, {0x03C1, 0x1FE5},
+    {0x03C5, 0x1F51}, {0x03C9, 0x1F61}, {0x004F, 0x01A0}, {0x0055, 0x01AF}, {0x006F, 0x01A1}, {0x0075, 0x01B0},
+    {0x0041, 0x1EA0}, {0x0042, 0x1E04}, {0x0044, 0x1E0C}, {0x0045, 0x1EB8}, {0x0048, 0x1E24}, {0x0049, 0x1ECA},
+    {0x004B, 0x1E32}, {0x004C, 0x1E36}, {0x004D, 0x1E42}, {0x004E, 0x1E46}, {0x004F, 0x1ECC}, {0x0052, 0x1E5A},
+    {0x0053, 0x1E62}, {0x0054, 0x1E6C}, {0x0055, 0x1EE4}, {0x0056, 0x1E7E}, {0x0057, 0x1E88}, {0x0059, 0x1EF4},
+    {0x005A, 0x1E92}, {0x0061, 0x1EA1}, {0x0062, 0x1E05}, {0x0064, 0x1E0D}, {0x0065, 0x1EB9}, {0x0068, 0x1E25},
+    {0x0069, 0x1ECB}, {0x006B, 0x1E33}, {0x006C, 0x1E37}, {0x006D, 0x1E43}, {0x006E, 0x1E47}, {0x006F, 0x1ECD},
+    {0x0072, 0x1E5B}, {0x0073, 0x1E63}, {0x0074, 0x1E6D}, {0x0075, 0x1EE5}, {0x0076, 0x1E7F}, {0x0077, 0x1E89},
+    {0x0079, 0x1EF5}, {0x007A, 0x1E93}, {0x01A0, 0x1EE2}, {0x01A1, 0x1EE3}, {0x01AF, 0x1EF0}, {0x01B0, 0x1EF1},
+    {0x0055, 0x1E72}, {0x0075, 0x1E73}, {0x0041, 0x1E00}, {0x0061, 0x1E01}, {0x0053, 0x0218}, {0x0054, 0x021A},
+    {0x0073, 0x0219}, {0x0074, 0x021B}, {0x0043, 0x00C7}, {0x0044, 0x1E10}, {0x0045, 0x0228}, {0x0047, 0x0122},
+    {0x0048, 0x1E28}, {0x004B, 0x0136}, {0x004C, 0x013B}, {0x004E, 0x0145}, {0x0052, 0x0156}, {0x0053, 0x015E},
+    {0x0054, 0x0162}, {0x0063, 0x00E7}, {0x0064, 0x1E11}, {0x0065, 0x0229}, {0x0067, 0x0123}, {0x0068, 0x1E29},
+    {0x006B, 0x0137}, {0x006C, 0x013C}, {0x006E, 0x0146}, {0x0072, 0x0157}, {0x0073, 0x015F}, {0x0074, 0x0163},
+    {0x0041, 0x0104}, {0x0045, 0x0118}, {0x0049, 0x012E}, {0x004F, 0x01EA}, {0x0055, 0x0172}, {0x0061, 0x0105},
+    {0x0065, 0x0119}, {0x0069, 0x012F}, {0x006F, 0x01EB}, {0x0075, 0x0173}, {0x0044, 0x1E12}, {0x0045, 0x1E18},
+    {0x004C, 0x1E3C}, {0x004E, 0x1E4A}, {0x0054, 0x1E70}, {0x0055, 0x1E76}, {0x0064, 0x1E13}, {0x0065, 0x1E19},
+    {0x006C, 0x1E3D}, {0x006E, 0x1E4B}, {0x0074, 0x1E71}, {0x0075, 0x1E77}, {0x0048, 0x1E2A}, {0x0068, 0x1E2B},
+    {0x0045, 0x1E1A}, {0x0049, 0x1E2C}, {0x0055, 0x1E74}, {0x0065, 0x1E1B}, {0x0069, 0x1E2D}, {0x0075, 0x1E75},
+    {0x0042, 0x1E06}, {0x0044, 0x1E0E}, {0x004B, 0x1E34}, {0x004C, 0x1E3A}, {0x004E, 0x1E48}, {0x0052, 0x1E5E},
+    {0x0054, 0x1E6E}, {0x005A, 0x1E94}, {0x0062, 0x1E07}, {0x0064, 0x1E0F}, {0x0068, 0x1E96}, {0x006B, 0x1E35},
+    {0x006C, 0x1E3B}, {0x006E, 0x1E49}, {0x0072, 0x1E5F}, {0x0074, 0x1E6F}, {0x007A, 0x1E95}, {0x00A8, 0x1FC1},
+    {0x03B1, 0x1FB6}, {0x03B7, 0x1FC6}, {0x03B9, 0x1FD6}, {0x03C5, 0x1FE6}, {0x03C9, 0x1FF6}, {0x03CA, 0x1FD7},
+    {0x03CB, 0x1FE7}, {0x1F00, 0x1F06}, {0x1F01, 0x1F07}, {0x1F08, 0x1F0E}, {0x1F09, 0x1F0F}, {0x1F20, 0x1F26},
+    {0x1F21, 0x1F27}, {0x1F28, 0x1F2E}, {0x1F29, 0x1F2F}, {0x1F30, 0x1F36}, {0x1F31, 0x1F37}, {0x1F38, 0x1F3E},
+    {0x1F39, 0x1F3F}, {0x1F50, 0x1F56}, {0x1F51, 0x1F57}, {0x1F59, 0x1F5F}, {0x1F60, 0x1F66}, {0x1F61, 0x1F67},
+    {0x1F68, 0x1F6E}, {0x1F69, 0x1F6F}, {0x1FBF, 0x1FCF}, {0x1FFE, 0x1FDF}, {0x0391, 0x1FBC}, {0x0397, 0x1FCC},
+    {0x03A9, 0x1FFC}, {0x03AC, 0x1FB4}, {0x03AE, 0x1FC4}, {0x03B1, 0x1FB3}, {0x03B7, 0x1FC3}, {0x03C9, 0x1FF3},
+    {0x03CE, 0x1FF4}, {0x1F00, 0x1F80}, {0x1F01, 0x1F81}, {0x1F02, 0x1F82}, {0x1F03, 0x1F83}, {0x1F04, 0x1F84},
+    {0x1F05, 0x1F85}, {0x1F06, 0x1F86}, {0x1F07, 0x1F87}, {0x1F08, 0x1F88}, {0x1F09, 0x1F89}, {0x1F0A, 0x1F8A},
+    {0x1F0B, 0x1F8B}, {0x1F0C, 0x1F8C}, {0x1F0D, 0x1F8D}, {0x1F0E, 0x1F8E}, {0x1F0F, 0x1F8F}, {0x1F20, 0x1F90},
+    {0x1F21, 0x1F91}, {0x1F22, 0x1F92}, {0x1F23, 0x1F93}, {0x1F24, 0x1F94}, {0x1F25, 0x1F95}, {0x1F26, 0x1F96},
+    {0x1F27, 0x1F97}, {0x1F28, 0x1F98}, {0x1F29, 0x1F99}, {0x1F2A, 0x1F9A}, {0x1F2B, 0x1F9B}, {0x1F2C, 0x1F9C},
+    {0x1F2D, 0x1F9D}, {0x1F2E, 0x1F9E}, {0x1F2F, 0x1F9F}, {0x1F60, 0x1FA0}, {0x1F61, 0x1FA1}, {0x1F62, 0x1FA2},
+    {0x1F63, 0x1FA3}, {0x1F64, 0x1FA4}, {0x1F65, 0x1FA5}, {0x1F66, 0x1FA6}, {0x1F67, 0x1FA7}, {0x1F68, 0x1FA8},
+    {0x1F69, 0x1FA9}, {0x1F6A, 0x1FAA}, {0x1F6B, 0x1FAB}, {0x1F6C, 0x1FAC}, {0x1F6D, 0x1FAD}, {0x1F6E, 0x1FAE},
+    {0x1F6F, 0x1FAF}, {0x1F70, 0x1FB2}, {0x1F74, 0x1FC2}, {0x1F7C, 0x1FF2}, {0x1FB6, 0x1FB7}, {0x1FC6, 0x1FC7},
+    {0x1FF6, 0x1FF7}, {0x0627, 0x0622}, {0x0627, 0x0623}, {0x0648, 0x0624}, {0x064A, 0x0626}, {0x06C1, 0x06C2},
+    {0x06D2, 0x06D3}, {0x06D5, 0x06C0}, {0x0627, 0x0625}, {0x0928, 0x0929}, {0x0930, 0x0931}, {0x0933, 0x0934},
+    {0x09C7, 0x09CB}, {0x09C7, 0x09CC}, {0x0B47, 0x0B4B}, {0x0B47, 0x0B48}, {0x0B47, 0x0B4C}, {0x0BC6, 0x0BCA},
+    {0x0BC7, 0x0BCB}, {0x0B92, 0x0B94}, {0x0BC6, 0x0BCC}, {0x0C46, 0x0C48}, {0x0CC6, 0x0CCA}, {0x0CBF, 0x0CC0},
+    {0x0CC6, 0x0CC7}, {0x0CCA, 0x0CCB}, {0x0CC6, 0x0CC8}, {0x0D46, 0x0D4A}, {0x0D47, 0x0D4B}, {0x0D46, 0x0D4C},
+    {0x0DD9, 0x0DDA}, {0x0DDC, 0x0DDD}, {0x0DD9, 0x0DDC}, {0x0DD9, 0x0DDE}, {0x1025, 0x1026}, {0x3046, 0x3094},
+    {0x304B, 0x304C}, {0x304D, 0x304E}, {0x304F, 0x3050}, {0x3051, 0x3052}, {0x3053, 0x3054}, {0x3055, 0x3056},
+    {0x3057, 0x3058}, {0x3059, 0x305A}, {0x305B, 0x305C}, {0x305D, 0x305E}, {0x305F, 0x3060}, {0x3061, 0x3062},
+    {0x3064, 0x3065}, {0x3066, 0x3067}, {0x3068, 0x3069}, {0x306F, 0x3070}, {0x3072, 0x3073}, {0x3075, 0x3076},
+    {0x3078, 0x3079}, {0x307B, 0x307C}, {0x309D, 0x309E}, {0x30A6, 0x30F4}, {0x30AB, 0x30AC}, {0x30AD, 0x30AE},
+    {0x30AF, 0x30B0}, {0x30B1, 0x30B2}, {0x30B3, 0x30B4}, {0x30B5, 0x30B6}, {0x30B7, 0x30B8}, {0x30B9, 0x30BA},
+    {0x30BB, 0x30BC}, {0x30BD, 0x30BE}, {0x30BF, 0x30C0}, {0x30C1, 0x30C2}, {0x30C4, 0x30C5}, {0x30C6, 0x30C7},
+    {0x30C8, 0x30C9}, {0x30CF, 0x30D0}, {0x30D2, 0x30D3}, {0x30D5, 0x30D6}, {0x30D8, 0x30D9}, {0x30DB, 0x30DC},
+    {0x30EF, 0x30F7}, {0x30F0, 0x30F8}, {0x30F1, 0x30F9}, {0x30F2, 0x30FA}, {0x30FD, 0x30FE}, {0x306F, 0x3071},
+    {0x3072, 0x3074}, {0x3075, 0x3077}, {0x3078, 0x307A}, {0x307B, 0x307D}, {0x30CF, 0x30D1}, {0x30D2, 0x30D4},
+    {0x30D5, 0x30D7}, {0x30D8, 0x30DA}, {0x30DB, 0x30DD},
+};
+
+/* Hangul syllables are composed algorithmically */
+#define HFSP_HANGUL_SBASE   0xAC00
+#define HFSP_HANGUL_LBASE   0x1100
+#define HFSP_HANGUL_VBASE   0x1161
+#define HFSP_HANGUL_TBASE   0x11A7
+#define HFSP_HANGUL_LCOUNT  19
+#define HFSP_HANGUL_VCOUNT  21
+#define HFSP_HANGUL_TCOUNT  28
+#define HFSP_HANGUL_SCOUNT  (HFSP_HANGUL_LCOUNT * HFSP_HANGUL_VCOUNT * HFSP_HANGUL_TCOUNT)
+
+/*
+ * Memory image of 4 BE characters below 0x80: the high byte and the top bit
+ * of the low byte are clear.
+ */
+#define HFSP_ASCII_MASK     htobe64(0xFF80FF80FF80FF80ULL)
+#define HFSP_HASZERO32(v)   (((v) - 0x01010101U) & ~(v) & 0x80808080U)
+
+/*
+ * Pack the low bytes of the 4 BE characters of a memory image so they can be
+ * stored with a single 32 bit write.
+ */
+static __inline u_int32_t
+hfsp_ascii_pack(u_int64_t w)
+{
+#if BYTE_ORDER == LITTLE_ENDIAN
+    w = (w >> 8) & 0x00FF00FF00FF00FFULL;
+#else
+    w &= 0x00FF00FF00FF00FFULL;
+#endif
+    w = (w | (w >> 8)) & 0x0000FFFF0000FFFFULL;
+    return (u_int32_t)(w | (w >> 16));
+}
+
+u_int16_t
+hfsp_unicode_compose(u_int16_t base, u_int16_t mark)
+{
+    const struct hfsp_compose_pair * pairs;
+    int lo, hi, mid;
+
+    // No combining character below the combining diacritical marks.
+    if (mark < 0x0300)
+        return 0;
+
+    if ((u_int)(base - HFSP_HANGUL_LBASE) < HFSP_HANGUL_LCOUNT &&
+        (u_int)(mark - HFSP_HANGUL_VBASE) < HFSP_HANGUL_VCOUNT)
+        return HFSP_HANGUL_SBASE + ((base - HFSP_HANGUL_LBASE) * HFSP_HANGUL_VCOUNT +
+                                    (mark - HFSP_HANGUL_VBASE)) * HFSP_HANGUL_TCOUNT;
+    if ((u_int)(base - HFSP_HANGUL_SBASE) < HFSP_HANGUL_SCOUNT &&
+        (base - HFSP_HANGUL_SBASE) % HFSP_HANGUL_TCOUNT == 0 &&
+        (u_int)(mark - HFSP_HANGUL_TBASE - 1) < HFSP_HANGUL_TCOUNT - 1)
+        return base + (mark - HFSP_HANGUL_TBASE);
+
+    lo = 0;
+    hi = nitems(hfsp_compose_marks) - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (hfsp_compose_marks[mid].hcm_mark == mark)
+            break;
+        if (hfsp_compose_marks[mid].hcm_mark < mark)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    if (lo > hi)
+        return 0;
+
+    pairs = hfsp_compose_pairs + hfsp_compose_marks[mid].hcm_start;
+    lo = 0;
+    hi = hfsp_compose_marks[mid].hcm_count - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (pairs[mid].hcp_base == base)
+            return pairs[mid].hcp_composed;
+        if (pairs[mid].hcp_base < base)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return 0;
+}
+
+int
+hfsp_unicode_to_utf8(const hfsp_unichar * ustr, int ulen, char * buf, size_t size, size_t * lenp,
+                     int flags)
+{
+    u_int64_t w;
+    u_int32_t c, c2, v;
+    u_int16_t comp;
+    size_t len;
+    int i;
+    bool nfc;
+
+    nfc = (flags & HFSP_UTF8_NFC) != 0;
+    len = 0;
+    i = 0;
+    while (i < ulen)
+    {
+        // Copy blocks of 4 ASCII characters, the bulk of most names.
+        while (i + 4 <= ulen && len + 4 < size)
+        {
+            memcpy(&w, ustr + i, sizeof(w));
+            if (w & HFSP_ASCII_MASK)
+                break;
+            v = hfsp_ascii_pack(w);
+            // NUL and '/' are mapped.
+            if (HFSP_HASZERO32(v) || HFSP_HASZERO32(v ^ 0x2F2F2F2FU))
+                break;
+            // The last one may be the base of a combining sequence.
+            if (nfc && i + 4 < ulen && be16toh(ustr[i + 4]) >= 0x0300)
+                break;
+            memcpy(buf + len, &v, sizeof(v));
+            len += 4;
+            i += 4;
+        }
+        if (i >= ulen)
+            break;
+
+        c = be16toh(ustr[i]);
+        if (c < 0x80 && c != '/' && c != 0 && (!nfc || i + 1 == ulen || be16toh(ustr[i + 1]) < 0x0300))
+        {
+            if (len + 1 >= size)
+                return ENAMETOOLONG;
+            buf[len++] = c;
+            i++;
+            continue;
+        }
+
+        i++;
+        if (c >= 0xD800 && c < 0xDC00 && i < ulen &&
+            (c2 = be16toh(ustr[i])) >= 0xDC00 && c2 < 0xE000)
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+            i++;
+        }
+        else if (nfc)
+        {
+            while (i < ulen && (comp = hfsp_unicode_compose(c, be16toh(ustr[i]))) != 0)
+            {
+                c = comp;
+                i++;
+            }
+        }
+
+        // '/' is the path separator, the Finder shows ':' as '/'.
+        if (c == '/')
+            c = ':';
+        else if (c == 0)
+            c = HFSP_UNICODE_NUL;
+        else if (c >= 0xD800 && c < 0xE000)
+            c = HFSP_UNICODE_REPLACEMENT;
+
+        if (c < 0x80)
+        {
+            if (len + 1 >= size)
+                return ENAMETOOLONG;
+            buf[len++] = c;
+        }
+        else if (c < 0x800)
+        {
+            if (len + 2 >= size)
+                return ENAMETOOLONG;
+            buf[len++] = 0xC0 | (c >> 6);
+            buf[len++] = 0x80 | (c & 0x3F);
+        }
+        else if (c < 0x10000)
+        {
+            if (len + 3 >= size)
+                return ENAMETOOLONG;
+            buf[len++] = 0xE0 | (c >> 12);
+            buf[len++] = 0x80 | ((c >> 6) & 0x3F);
+            buf[len++] = 0x80 | (c & 0x3F);
+        }
+        else
+        {
+            if (len + 4 >= size)
+                return ENAMETOOLONG;
+            buf[len++] = 0xF0 | (c >> 18);
+            buf[len++] = 0x80 | ((c >> 12) & 0x3F);
+            buf[len++] = 0x80 | ((c >> 6) & 0x3F);
+            buf[len++] = 0x80 | (c & 0x3F);
+        }
+    }
+
+    if (len >= size)
+        return ENAMETOOLONG;
+    buf[len] = '\0';
+    *lenp = len;
+    return 0;
+}
+
+/*
+ * Canonical decompositions used by HFS+, generated from the Unicode 3.2 data
+ * the volume format is frozen on (TN1150). U+2000-U+2FFF and U+F900-U+FAFF are
+ * not decomposed, Hangul syllables are decomposed algorithmically.
+ * hdc_seq holds the offset in hfsp_decomp_seq shifted by 2 and the length minus 1.
+ */
+static const struct hfsp_decomp {
+    u_int16_t   hdc_char;
+    u_int16_t   hdc_seq;
+} hfsp_decomp_tab[] = {
+    {0x00C0, 0x0001}, {0x00C1, 0x0009}, {0x00C2, 0x0011}, {0x00C3, 0x0019}, {0x00C4, 0x0021}, {0x00C5, 0x0029},
+    {0x00C7, 0x0031}, {0x00C8, 0x0039}, {0x00C9, 0x0041}, {0x00CA, 0x0049}, {0x00CB, 0x0051}, {0x00CC, 0x0059},
+    {0x00CD, 0x0061}, {0x00CE, 0x0069}, {0x00CF, 0x0071}, {0x00D1, 0x0079}, {0x00D2, 0x0081}, {0x00D3, 0x0089},
+    {0x00D4, 0x0091}, {0x00D5, 0x0099}, {0x00D6, 0x00A1}, {0x00D9, 0x00A9}, {0x00DA, 0x00B1}, {0x00DB, 0x00B9},
+    {0x00DC, 0x00C1}, {0x00DD, 0x00C9}, {0x00E0, 0x00D1}, {0x00E1, 0x00D9}, {0x00E2, 0x00E1}, {0x00E3, 0x00E9},
+    {0x00E4, 0x00F1}, {0x00E5, 0x00F9}, {0x00E7, 0x0101}, {0x00E8, 0x0109}, {0x00E9, 0x0111}, {0x00EA, 0x0119},
+    {0x00EB, 0x0121}, {0x00EC, 0x0129}, {0x00ED, 0x0131}, {0x00EE, 0x0139}, {0x00EF, 0x0141}, {0x00F1, 0x0149},
+    {0x00F2, 0x0151}, {0x00F3, 0x0159}, {0x00F4, 0x0161}, {0x00F5, 0x0169}, {0x00F6, 0x0171}, {0x00F9, 0x0179},
+    {0x00FA, 0x0181}, {0x00FB, 0x0189}, {0x00FC, 0x0191}, {0x00FD, 0x0199}, {0x00FF, 0x01A1}, {0x0100, 0x01A9},
+    {0x0101, 0x01B1}, {0x0102, 0x01B9}, {0x0103, 0x01C1}, {0x0104, 0x01C9}, {0x0105, 0x01D1}, {0x0106, 0x01D9},
+    {0x0107, 0x01E1}, {0x0108, 0x01E9}, {0x0109, 0x01F1}, {0x010A, 0x01F9}, {0x010B, 0x0201}, {0x010C, 0x0209},
+    {0x010D, 0x0211}, {0x010E, 0x0219}, {0x010F, 0x0221}, {0x0112, 0x0229}, {0x0113, 0x0231}, {0x0114, 0x0239},
+    {0x0115, 0x0241}, {0x0116, 0x0249}, {0x0117, 0x0251}, {0x0118, 0x0259}, {0x0119, 0x0261}, {0x011A, 0x0269},
+    {0x011B, 0x0271}, {0x011C, 0x0279}, {0x011D, 0x0281}, {0x011E, 0x0289}, {0x011F, 0x0291}, {0x0120, 0x0299},
+    {0x0121, 0x02A1}, {0x0122, 0x02A9}, {0x0123, 0x02B1}, {0x0124, 0x02B9}, {0x0125, 0x02C1}, {0x0128, 0x02C9},
+    {0x0129, 0x02D1}, {0x012A, 0x02D9}, {0x012B, 0x02E1}, {0x012C, 0x02E9}, {0x012D, 0x02F1}, {0x012E, 0x02F9},
+    {0x012F, 0x0301}, {0x0130, 0x0309}, {0x0134, 0x0311}, {0x0135, 0x0319}, {0x0136, 0x0321}, {0x0137, 0x0329},
+    {0x0139, 0x0331}, {0x013A, 0x0339}, {0x013B, 0x0341}, {0x013C, 0x0349}, {0x013D, 0x0351}, {0x013E, 0x0359},
+    {0x0143, 0x0361}, {0x0144, 0x0369}, {0x0145, 0x0371}, {0x0146, 0x0379}, {0x0147, 0x0381}, {0x0148, 0x0389},
+    {0x014C, 0x0391}, {0x014D, 0x0399}, {0x014E, 0x03A1}, {0x014F, 0x03A9}, {0x0150, 0x03B1}, {0x0151, 0x03B9},
+    {0x0154, 0x03C1}, {0x0155, 0x03C9}, {0x0156, 0x03D1}, {0x0157, 0x03D9}, {0x0158, 0x03E1}, {0x0159, 0x03E9},
+    {0x015A, 0x03F1}, {0x015B, 0x03F9}, {0x015C, 0x0401}, {0x015D, 0x0409}, {0x015E, 0x0411}, {0x015F, 0x0419},
+    {0x0160, 0x0421}, {0x0161, 0x0429}, {0x0162, 0x0431}, {0x0163, 0x0439}, {0x0164, 0x0441}, {0x0165, 0x0449},
+    {0x0168, 0x0451}, {0x0169, 0x0459}, {0x016A, 0x0461}, {0x016B, 0x0469}, {0x016C, 0x0471}, {0x016D, 0x0479},
+    {0x016E, 0x0481}, {0x016F, 0x0489}, {0x0170, 0x0491}, {0x0171, 0x0499}, {0x0172, 0x04A1}, {0x0173, 0x04A9},
+    {0x0174, 0x04B1}, {0x0175, 0x04B9}, {0x0176, 0x04C1}, {0x0177, 0x04C9}, {0x0178, 0x04D1}, {0x0179, 0x04D9},
+    {0x017A, 0x04E1}, {0x017B, 0x04E9}, {0x017C, 0x04F1}, {0x017D, 0x04F9}, {0x017E, 0x0501}, {0x01A0, 0x0509},
+    {0x01A1, 0x0511}, {0x01AF, 0x0519}, {0x01B0, 0x0521}, {0x01CD, 0x0529}, {0x01CE, 0x0531}, {0x01CF, 0x0539},
+    {0x01D0, 0x0541}, {0x01D1, 0x0549}, {0x01D2, 0x0551}, {0x01D3, 0x0559}, {0x01D4, 0x0561}, {0x01D5, 0x056A},
+    {0x01D6, 0x0576}, {0x01D7, 0x0582}, {0x01D8, 0x058E}, {0x01D9, 0x059A}, {0x01DA, 0x05A6}, {0x01DB, 0x05B2},
+    {0x01DC, 0x05BE}, {0x01DE, 0x05CA}, {0x01DF, 0x05D6}, {0x01E0, 0x05E2}, {0x01E1, 0x05EE}, {0x01E2, 0x05F9},
+    {0x01E3, 0x0601}, {0x01E6, 0x0609}, {0x01E7, 0x0611}, {0x01E8, 0x0619}, {0x01E9, 0x0621}, {0x01EA, 0x0629},
+    {0x01EB, 0x0631}, {0x01EC, 0x063A}, {0x01ED, 0x0646}, {0x01EE, 0x0651}, {0x01EF, 0x0659}, {0x01F0, 0x0661},
+    {0x01F4, 0x0669}, {0x01F5, 0x0671}, {0x01F8, 0x0679}, {0x01F9, 0x0681}, {0x01FA, 0x068A}, {0x01FB, 0x0696},
+    {0x01FC, 0x06A1}, {0x01FD, 0x06A9}, {0x01FE, 0x06B1}, {0x01FF, 0x06B9}, {0x0200, 0x06C1}, {0x0201, 0x06C9},
+    {0x0202, 0x06D1}, {0x0203, 0x06D9}, {0x0204, 0x06E1}, {0x0205, 0x06E9}, {0x0206, 0x06F1}, {0x0207, 0x06F9},
+    {0x0208, 0x0701}, {0x0209, 0x0709}, {0x020A, 0x0711}, {0x020B, 0x0719}, {0x020C, 0x0721}, {0x020D, 0x0729},
+    {0x020E, 0x0731}, {0x020F, 0x0739}, {0x0210, 0x0741}, {0x0211, 0x0749}, {0x0212, 0x0751}, {0x0213, 0x0759},
+    {0x0214, 0x0761}, {0x0215, 0x0769}, {0x0216, 0x0771}, {0x0217, 0x0779}, {0x0218, 0x0781}, {0x0219, 0x0789},
+    {0x021A, 0x0791}, {0x021B, 0x0799}, {0x021E, 0x07A1}, {0x021F, 0x07A9}, {0x0226, 0x05E1}, {0x0227, 0x05ED},
+    {0x0228, 0x07B1}, {0x0229, 0x07B9}, {0x022A, 0x07C2}, {0x022B, 0x07CE}, {0x022C, 0x07DA}, {0x022D, 0x07E6},
+    {0x022E, 0x07F1}, {0x022F, 0x07F9}, {0x0230, 0x0802}, {0x0231, 0x080E}, {0x0232, 0x0819}, {0x0233, 0x0821},
+    {0x0340, 0x0004}, {0x0341, 0x000C}, {0x0343, 0x0828}, {0x0344, 0x0585}, {0x0374, 0x082C}, {0x037E, 0x0830},
+    {0x0385, 0x0835}, {0x0386, 0x083D}, {0x0387, 0x0844}, {0x0388, 0x0849}, {0x0389, 0x0851}, {0x038A, 0x0859},
+    {0x038C, 0x0861}, {0x038E, 0x0869}, {0x038F, 0x0871}, {0x0390, 0x087A}, {0x03AA, 0x0885}, {0x03AB, 0x088D},
+    {0x03AC, 0x0895}, {0x03AD, 0x089D}, {0x03AE, 0x08A5}, {0x03AF, 0x08AD}, {0x03B0, 0x08B6}, {0x03CA, 0x0879},
+    {0x03CB, 0x08B5}, {0x03CC, 0x08C1}, {0x03CD, 0x08C9}, {0x03CE, 0x08D1}, {0x03D3, 0x08D9}, {0x03D4, 0x08E1},
+    {0x0400, 0x08E9}, {0x0401, 0x08F1}, {0x0403, 0x08F9}, {0x0407, 0x0901}, {0x040C, 0x0909}, {0x040D, 0x0911},
+    {0x040E, 0x0919}, {0x0419, 0x0921}, {0x0439, 0x0929}, {0x0450, 0x0931}, {0x0451, 0x0939}, {0x0453, 0x0941},
+    {0x0457, 0x0949}, {0x045C, 0x0951}, {0x045D, 0x0959}, {0x045E, 0x0961}, {0x0476, 0x0969}, {0x0477, 0x0971},
+    {0x04C1, 0x0979}, {0x04C2, 0x0981}, {0x04D0, 0x0989}, {0x04D1, 0x0991}, {0x04D2, 0x0999}, {0x04D3, 0x09A1},
+    {0x04D6, 0x09A9}, {0x04D7, 0x09B1}, {0x04DA, 0x09B9}, {0x04DB, 0x09C1}, {0x04DC, 0x09C9}, {0x04DD, 0x09D1},
+    {0x04DE, 0x09D9}, {0x04DF, 0x09E1}, {0x04E2, 0x09E9}, {0x04E3, 0x09F1}, {0x04E4, 0x09F9}, {0x04E5, 0x0A01},
+    {0x04E6, 0x0A09}, {0x04E7, 0x0A11}, {0x04EA, 0x0A19}, {0x04EB, 0x0A21}, {0x04EC, 0x0A29}, {0x04ED, 0x0A31},
+    {0x04EE, 0x0A39}, {0x04EF, 0x0A41}, {0x04F0, 0x0A49}, {0x04F1, 0x0A51}, {0x04F2, 0x0A59}, {0x04F3, 0x0A61},
+    {0x04F4, 0x0A69}, {0x04F5, 0x0A71}, {0x04F8, 0x0A79}, {0x04F9, 0x0A81}, {0x0622, 0x0A89}, {0x0623, 0x0A91},
+    {0x0624, 0x0A99}, {0x0625, 0x0AA1}, {0x0626, 0x0AA9}, {0x06C0, 0x0AB1}, {0x06C2, 0x0AB9}, {0x06D3, 0x0AC1},
+    {0x0929, 0x0AC9}, {0x0931, 0x0AD1}, {0x0934, 0x0AD9}, {0x0958, 0x0AE1}, {0x0959, 0x0AE9}, {0x095A, 0x0AF1},
+    {0x095B, 0x0AF9}, {0x095C, 0x0B01}, {0x095D, 0x0B09}, {0x095E, 0x0B11}, {0x095F, 0x0B19}, {0x09CB, 0x0B21},
+    {0x09CC, 0x0B29}, {0x09DC, 0x0B31}, {0x09DD, 0x0B39}, {0x09DF, 0x0B41}, {0x0A33, 0x0B49}, {0x0A36, 0x0B51},
+    {0x0A59, 0x0B59}, {0x0A5A, 0x0B61}, {0x0A5B, 0x0B69}, {0x0A5E, 0x0B71}, {0x0B48, 0x0B79}, {0x0B4B, 0x0B81},
+    {0x0B4C, 0x0B89}, {0x0B5C, 0x0B91}, {0x0B5D, 0x0B99}, {0x0B94, 0x0BA1}, {0x0BCA, 0x0BA9}, {0x0BCB, 0x0BB1},
+    {0x0BCC, 0x0BB9}, {0x0C48, 0x0BC1}, {0x0CC0, 0x0BC9}, {0x0CC7, 0x0BD1}, {0x0CC8, 0x0BD9}, {0x0CCA, 0x0BE1},
+    {0x0CCB, 0x0BEA}, {0x0D4A, 0x0BF5}, {0x0D4B, 0x0BFD}, {0x0D4C, 0x0C05}, {0x0DDA, 0x0C0D}, {0x0DDC, 0x0C15},
+    {0x0DDD, 0x0C1E}, {0x0DDE, 0x0C29}, {0x0F43, 0x0C31}, {0x0F4D, 0x0C39}, {0x0F52, 0x0C41}, {0x0F57, 0x0C49},
+    {0x0F5C, 0x0C51}, {0x0F69, 0x0C59}, {0x0F73, 0x0C61}, {0x0F75, 0x0C69}, {0x0F76, 0x0C71}, {0x0F78, 0x0C79},
+    {0x0F81, 0x0C81}, {0x0F93, 0x0C89}, {0x0F9D, 0x0C91}, {0x0FA2, 0x0C99}, {0x0FA7, 0x0CA1}, {0x0FAC, 0x0CA9},
+    {0x0FB9, 0x0CB1}, {0x1026, 0x0CB9}, {0x1E00, 0x0CC1}, {0x1E01, 0x0CC9}, {0x1E02, 0x0CD1}, {0x1E03, 0x0CD9},
+    {0x1E04, 0x0CE1}, {0x1E05, 0x0CE9}, {0x1E06, 0x0CF1}, {0x1E07, 0x0CF9}, {0x1E08, 0x0D02}, {0x1E09, 0x0D0E},
+    {0x1E0A, 0x0D19}, {0x1E0B, 0x0D21}, {0x1E0C, 0x0D29}, {0x1E0D, 0x0D31}, {0x1E0E, 0x0D39}, {0x1E0F, 0x0D41},
+    {0x1E10, 0x0D49}, {0x1E11, 0x0D51}, {0x1E12, 0x0D59}, {0x1E13, 0x0D61}, {0x1E14, 0x0D6A}, {0x1E15, 0x0D76},
+    {0x1E16, 0x0D82}, {0x1E17, 0x0D8E}, {0x1E18, 0x0D99}, {0x1E19, 0x0DA1}, {0x1E1A, 0x0DA9}, {0x1E1B, 0x0DB1},
+    {0x1E1C, 0x0DBA}, {0x1E1D, 0x0DC6}, {0x1E1E, 0x0DD1}, {0x1E1F, 0x0DD9}, {0x1E20, 0x0DE1}, {0x1E21, 0x0DE9},
+    {0x1E22, 0x0DF1}, {0x1E23, 0x0DF9}, {0x1E24, 0x0E01}, {0x1E25, 0x0E09}, {0x1E26, 0x0E11}, {0x1E27, 0x0E19},
+    {0x1E28, 0x0E21}, {0x1E29, 0x0E29}, {0x1E2A, 0x0E31}, {0x1E2B, 0x0E39}, {0x1E2C, 0x0E41}, {0x1E2D, 0x0E49},
+    {0x1E2E, 0x0E52}, {0x1E2F, 0x0E5E}, {0x1E30, 0x0E69}, {0x1E31, 0x0E71}, {0x1E32, 0x0E79}, {0x1E33, 0x0E81},
+    {0x1E34, 0x0E89}, {0x1E35, 0x0E91}, {0x1E36, 0x0E99}, {0x1E37, 0x0EA1}, {0x1E38, 0x0EAA}, {0x1E39, 0x0EB6},
+    {0x1E3A, 0x0EC1}, {0x1E3B, 0x0EC9}, {0x1E3C, 0x0ED1}, {0x1E3D, 0x0ED9}, {0x1E3E, 0x0EE1}, {0x1E3F, 0x0EE9},
+    {0x1E40, 0x0EF1}, {0x1E41, 0x0EF9}, {0x1E42, 0x0F01}, {0x1E43, 0x0F09}, {0x1E44, 0x0F11}, {0x1E45, 0x0F19},
+    {0x1E46, 0x0F21}, {0x1E47, 0x0F29}, {0x1E48, 0x0F31}, {0x1E49, 0x0F39}, {0x1E4A, 0x0F41}, {0x1E4B, 0x0F49},
+    {0x1E4C, 0x0F52}, {0x1E4D, 0x0F5E}, {0x1E4E, 0x0F6A}, {0x1E4F, 0x0F76}, {0x1E50, 0x0F82}, {0x1E51, 0x0F8E},
+    {0x1E52, 0x0F9A}, {0x1E53, 0x0FA6}, {0x1E54, 0x0FB1}, {0x1E55, 0x0FB9}, {0x1E56, 0x0FC1}, {0x1E57, 0x0FC9},
+    {0x1E58, 0x0FD1}, {0x1E59, 0x0FD9}, {0x1E5A, 0x0FE1}, {0x1E5B, 0x0FE9}, {0x1E5C, 0x0FF2}, {0x1E5D, 0x0FFE},
+    {0x1E5E, 0x1009}, {0x1E5F, 0x1011}, {0x1E60, 0x1019}, {0x1E61, 0x1021}, {0x1E62, 0x1029}, {0x1E63, 0x1031},
+    {0x1E64, 0x103A}, {0x1E65, 0x1046}, {0x1E66, 0x1052}, {0x1E67, 0x105E}, {0x1E68, 0x106A}, {0x1E69, 0x1076},
+    {0x1E6A, 0x1081}, {0x1E6B, 0x1089}, {0x1E6C, 0x1091}, {0x1E6D, 0x1099}, {0x1E6E, 0x10A1}, {0x1E6F, 0x10A9},
+    {0x1E70, 0x10B1}, {0x1E71, 0x10B9}, {0x1E72, 0x10C1}, {0x1E73, 0x10C9}, {0x1E74, 0x10D1}, {0x1E75, 0x10D9},
+    {0x1E76, 0x10E1}, {0x1E77, 0x10E9}, {0x1E78, 0x10F2}, {0x1E79, 0x10FE}, {0x1E7A, 0x110A}, {0x1E7B, 0x1116},
+    {0x1E7C, 0x1121}, {0x1E7D, 0x1129}, {0x1E7E, 0x1131}, {0x1E7F, 0x1139}, {0x1E80, 0x1141}, {0x1E81, 0x1149},
+    {0x1E82, 0x1151}, {0x1E83, 0x1159}, {0x1E84, 0x1161}, {0x1E85, 0x1169}, {0x1E86, 0x1171}, {0x1E87, 0x1179},
+    {0x1E88, 0x1181}, {0x1E89, 0x1189}, {0x1E8A, 0x1191}, {0x1E8B, 0x1199}, {0x1E8C, 0x11A1}, {0x1E8D, 0x11A9},
+    {0x1E8E, 0x11B1}, {0x1E8F, 0x11B9}, {0x1E90, 0x11C1}, {0x1E91, 0x11C9}, {0x1E92, 0x11D1}, {0x1E93, 0x11D9},
+    {0x1E94, 0x11E1}, {0x1E95, 0x11E9}, {0x1E96, 0x11F1}, {0x1E97, 0x11F9}, {0x1E98, 0x1201}, {0x1E99, 0x1209},
+    {0x1E9B, 0x1211}, {0x1EA0, 0x1219}, {0x1EA1, 0x1221}, {0x1EA2, 0x1229}, {0x1EA3, 0x1231}, {0x1EA4, 0x123A},
+    {0x1EA5, 0x1246}, {0x1EA6, 0x1252}, {0x1EA7, 0x125E}, {0x1EA8, 0x126A}, {0x1EA9, 0x1276}, {0x1EAA, 0x1282},
+    {0x1EAB, 0x128E}, {0x1EAC, 0x129A}, {0x1EAD, 0x12A6}, {0x1EAE, 0x12B2}, {0x1EAF, 0x12BE}, {0x1EB0, 0x12CA},
+    {0x1EB1, 0x12D6}, {0x1EB2, 0x12E2}, {0x1EB3, 0x12EE}, {0x1EB4, 0x12FA}, {0x1EB5, 0x1306}, {0x1EB6, 0x1312},
+    {0x1EB7, 0x131E}, {0x1EB8, 0x1329}, {0x1EB9, 0x1331}, {0x1EBA, 0x1339}, {0x1EBB, 0x1341}, {0x1EBC, 0x1349},
+    {0x1EBD, 0x1351}, {0x1EBE, 0x135A}, {0x1EBF, 0x1366}, {0x1EC0, 0x1372}, {0x1EC1, 0x137E}, {0x1EC2, 0x138A},
+    {0x1EC3, 0x1396}, {0x1EC4, 0x13A2}, {0x1EC5, 0x13AE}, {0x1EC6, 0x13BA}, {0x1EC7, 0x13C6}, {0x1EC8, 0x13D1},
+    {0x1EC9, 0x13D9}, {0x1ECA, 0x13E1}, {0x1ECB, 0x13E9}, {0x1ECC, 0x13F1}, {0x1ECD, 0x13F9}, {0x1ECE, 0x1401},
+    {0x1ECF, 0x1409}, {0x1ED0, 0x1412}, {0x1ED1, 0x141E}, {0x1ED2, 0x142A}, {0x1ED3, 0x1436}, {0x1ED4, 0x1442},
+    {0x1ED5, 0x144E}, {0x1ED6, 0x145A}, {0x1ED7, 0x1466}, {0x1ED8, 0x1472}, {0x1ED9, 0x147E}, {0x1EDA, 0x148A},
+    {0x1EDB, 0x1496}, {0x1EDC, 0x14A2}, {0x1EDD, 0x14AE}, {0x1EDE, 0x14BA}, {0x1EDF, 0x14C6}, {0x1EE0, 0x14D2},
+    {0x1EE1, 0x14DE}, {0x1EE2, 0x14EA}, {0x1EE3, 0x14F6}, {0x1EE4, 0x1501}, {0x1EE5, 0x1509}, {0x1EE6, 0x1511},
+    {0x1EE7, 0x1519}, {0x1EE8, 0x1522}, {0x1EE9, 0x152E}, {0x1EEA, 0x153A}, {0x1EEB, 0x1546}, {0x1EEC, 0x1552},
+    {0x1EED, 0x155E}, {0x1EEE, 0x156A}, {0x1EEF, 0x1576}, {0x1EF0, 0x1582}, {0x1EF1, 0x158E}, {0x1EF2, 0x1599},
+    {0x1EF3, 0x15A1}, {0x1EF4, 0x15A9}, {0x1EF5, 0x15B1}, {0x1EF6, 0x15B9}, {0x1EF7, 0x15C1}, {0x1EF8, 0x15C9},
+    {0x1EF9, 0x15D1}, {0x1F00, 0x15D9}, {0x1F01, 0x15E1}, {0x1F02, 0x15EA}, {0x1F03, 0x15F6}, {0x1F04, 0x1602},
+    {0x1F05, 0x160E}, {0x1F06, 0x161A}, {0x1F07, 0x1626}, {0x1F08, 0x1631}, {0x1F09, 0x1639}, {0x1F0A, 0x1642},
+    {0x1F0B, 0x164E}, {0x1F0C, 0x165A}, {0x1F0D, 0x1666}, {0x1F0E, 0x1672}, {0x1F0F, 0x167E}, {0x1F10, 0x1689},
+    {0x1F11, 0x1691}, {0x1F12, 0x169A}, {0x1F13, 0x16A6}, {0x1F14, 0x16B2}, {0x1F15, 0x16BE}, {0x1F18, 0x16C9},
+    {0x1F19, 0x16D1}, {0x1F1A, 0x16DA}, {0x1F1B, 0x16E6}, {0x1F1C, 0x16F2}, {0x1F1D, 0x16FE}, {0x1F20, 0x1709},
+    {0x1F21, 0x1711}, {0x1F22, 0x171A}, {0x1F23, 0x1726}, {0x1F24, 0x1732}, {0x1F25, 0x173E}, {0x1F26, 0x174A},
+    {0x1F27, 0x1756}, {0x1F28, 0x1761}, {0x1F29, 0x1769}, {0x1F2A, 0x1772}, {0x1F2B, 0x177E}, {0x1F2C, 0x178A},
+    {0x1F2D, 0x1796}, {0x1F2E, 0x17A2}, {0x1F2F, 0x17AE}, {0x1F30, 0x17B9}, {0x1F31, 0x17C1}, {0x1F32, 0x17CA},
+    {0x1F33, 0x17D6}, {0x1F34, 0x17E2}, {0x1F35, 0x17EE}, {0x1F36, 0x17FA}, {0x1F37, 0x1806}, {0x1F38, 0x1811},
+    {0x1F39, 0x1819}, {0x1F3A, 0x1822}, {0x1F3B, 0x182E}, {0x1F3C, 0x183A}, {0x1F3D, 0x1846}, {0x1F3E, 0x1852},
+    {0x1F3F, 0x185E}, {0x1F40, 0x1869}, {0x1F41, 0x1871}, {0x1F42, 0x187A}, {0x1F43, 0x1886}, {0x1F44, 0x1892},
+    {0x1F45, 0x189E}, {0x1F48, 0x18A9}, {0x1F49, 0x18B1}, {0x1F4A, 0x18BA}, {0x1F4B, 0x18C6}, {0x1F4C, 0x18D2},
+    {0x1F4D, 0x18DE}, {0x1F50, 0x18E9}, {0x1F51, 0x18F1}, {0x1F52, 0x18FA}, {0x1F53, 0x1906}, {0x1F54, 0x1912},
+    {0x1F55, 0x191E}, {0x1F56, 0x192A}, {0x1F57, 0x1936}, {0x1F59, 0x1941}, {0x1F5B, 0x194A}, {0x1F5D, 0x1956},
+    {0x1F5F, 0x1962}, {0x1F60, 0x196D}, {0x1F61, 0x1975}, {0x1F62, 0x197E}, {0x1F63, 0x198A}, {0x1F64, 0x1996},
+    {0x1F65, 0x19A2}, {0x1F66, 0x19AE}, {0x1F67, 0x19BA}, {0x1F68, 0x19C5}, {0x1F69, 0x19CD}, {0x1F6A, 0x19D6},
+    {0x1F6B, 0x19E2}, {0x1F6C, 0x19EE}, {0x1F6D, 0x19FA}, {0x1F6E, 0x1A06}, {0x1F6F, 0x1A12}, {0x1F70, 0x1A1D},
+    {0x1F71, 0x0895}, {0x1F72, 0x1A25}, {0x1F73, 0x089D}, {0x1F74, 0x1A2D}, {0x1F75, 0x08A5}, {0x1F76, 0x1A35},
+    {0x1F77, 0x08AD}, {0x1F78, 0x1A3D}, {0x1F79, 0x08C1}, {0x1F7A, 0x1A45}, {0x1F7B, 0x08C9}, {0x1F7C, 0x1A4D},
+    {0x1F7D, 0x08D1}, {0x1F80, 0x1A56}, {0x1F81, 0x1A62}, {0x1F82, 0x1A6F}, {0x1F83, 0x1A7F}, {0x1F84, 0x1A8F},
+    {0x1F85, 0x1A9F}, {0x1F86, 0x1AAF}, {0x1F87, 0x1ABF}, {0x1F88, 0x1ACE}, {0x1F89, 0x1ADA}, {0x1F8A, 0x1AE7},
+    {0x1F8B, 0x1AF7}, {0x1F8C, 0x1B07}, {0x1F8D, 0x1B17}, {0x1F8E, 0x1B27}, {0x1F8F, 0x1B37}, {0x1F90, 0x1B46},
+    {0x1F91, 0x1B52}, {0x1F92, 0x1B5F}, {0x1F93, 0x1B6F}, {0x1F94, 0x1B7F}, {0x1F95, 0x1B8F}, {0x1F96, 0x1B9F},
+    {0x1F97, 0x1BAF}, {0x1F98, 0x1BBE}, {0x1F99, 0x1BCA}, {0x1F9A, 0x1BD7}, {0x1F9B, 0x1BE7}, {0x1F9C, 0x1BF7},
+    {0x1F9D, 0x1C07}, {0x1F9E, 0x1C17}, {0x1F9F, 0x1C27}, {0x1FA0, 0x1C36}, {0x1FA1, 0x1C42}, {0x1FA2, 0x1C4F},
+    {0x1FA3, 0x1C5F}, {0x1FA4, 0x1C6F}, {0x1FA5, 0x1C7F}, {0x1FA6, 0x1C8F}, {0x1FA7, 0x1C9F}, {0x1FA8, 0x1CAE},
+    {0x1FA9, 0x1CBA}, {0x1FAA, 0x1CC7}, {0x1FAB, 0x1CD7}, {0x1FAC, 0x1CE7}, {0x1FAD, 0x1CF7}, {0x1FAE, 0x1D07},
+    {0x1FAF, 0x1D17}, {0x1FB0, 0x1D25}, {0x1FB1, 0x1D2D}, {0x1FB2, 0x1D36}, {0x1FB3, 0x1D41}, {0x1FB4, 0x1D4A},
+    {0x1FB6, 0x1D55}, {0x1FB7, 0x1D5E}, {0x1FB8, 0x1D69}, {0x1FB9, 0x1D71}, {0x1FBA, 0x1D79}, {0x1FBB, 0x083D},
+    {0x1FBC, 0x1D81}, {0x1FBE, 0x0878}, {0x1FC1, 0x1D89}, {0x1FC2, 0x1D92}, {0x1FC3, 0x1D9D}, {0x1FC4, 0x1DA6},
+    {0x1FC6, 0x1DB1}, {0x1FC7, 0x1DBA}, {0x1FC8, 0x1DC5}, {0x1FC9, 0x0849}, {0x1FCA, 0x1DCD}, {0x1FCB, 0x0851},
+    {0x1FCC, 0x1DD5}, {0x1FCD, 0x1DDD}, {0x1FCE, 0x1DE5}, {0x1FCF, 0x1DED}, {0x1FD0, 0x1DF5}, {0x1FD1, 0x1DFD},
+    {0x1FD2, 0x1E06}, {0x1FD3, 0x087A}, {0x1FD6, 0x1E11}, {0x1FD7, 0x1E1A}, {0x1FD8, 0x1E25}, {0x1FD9, 0x1E2D},
+    {0x1FDA, 0x1E35}, {0x1FDB, 0x0859}, {0x1FDD, 0x1E3D}, {0x1FDE, 0x1E45}, {0x1FDF, 0x1E4D}, {0x1FE0, 0x1E55},
+    {0x1FE1, 0x1E5D}, {0x1FE2, 0x1E66}, {0x1FE3, 0x08B6}, {0x1FE4, 0x1E71}, {0x1FE5, 0x1E79}, {0x1FE6, 0x1E81},
+    {0x1FE7, 0x1E8A}, {0x1FE8, 0x1E95}, {0x1FE9, 0x1E9D}, {0x1FEA, 0x1EA5}, {0x1FEB, 0x0869}, {0x1FEC, 0x1EAD},
+    {0x1FED, 0x1EB5}, {0x1FEE, 0x0835}, {0x1FEF, 0x1EBC}, {0x1FF2, 0x1EC2}, {0x1FF3, 0x1ECD}, {0x1FF4, 0x1ED6},
+    {0x1FF6, 0x1EE1}, {0x1FF7, 0x1EEA}, {0x1FF8, 0x1EF5}, {0x1FF9, 0x0861}, {0x1FFA, 0x1EFD}, {0x1FFB, 0x0871},
+    {0x1FFC, 0x1F05}, {0x1FFD, 0x1F0C}, {0x304C, 0x1F11}, {0x304E, 0x1F19}, {0x3050, 0x1F21}, {0x3052, 0x1F29},
+    {0x3054, 0x1F31}, {0x3056, 0x1F39}, {0x3058, 0x1F41}, {0x305A, 0x1F49}, {0x305C, 0x1F51}, {0x305E, 0x1F59},
+    {0x3060, 0x1F61}, {0x3062, 0x1F69}, {0x3065, 0x1F71}, {0x3067, 0x1F79}, {0x3069, 0x1F81}, {0x3070, 0x1F89},
+    {0x3071, 0x1F91}, {0x3073, 0x1F99}, {0x3074, 0x1FA1}, {0x3076, 0x1FA9}, {0x3077, 0x1FB1}, {0x3079, 0x1FB9},
+    {0x307A, 0x1FC1}, {0x307C, 0x1FC9}, {0x307D, 0x1FD1}, {0x3094, 0x1FD9}, {0x309E, 0x1FE1}, {0x30AC, 0x1FE9},
+    {0x30AE, 0x1FF1}, {0x30B0, 0x1FF9}, {0x30B2, 0x2001}, {0x30B4, 0x2009}, {0x30B6, 0x2011}, {0x30B8, 0x2019},
+    {0x30BA, 0x2021}, {0x30BC, 0x2029}, {0x30BE, 0x2031}, {0x30C0, 0x2039}, {0x30C2, 0x2041}, {0x30C5, 0x2049},
+    {0x30C7, 0x2051}, {0x30C9, 0x2059}, {0x30D0, 0x2061}, {0x30D1, 0x2069}, {0x30D3, 0x2071}, {0x30D4, 0x2079},
+    {0x30D6, 0x2081}, {0x30D7, 0x2089}, {0x30D9, 0x2091}, {0x30DA, 0x2099}, {0x30DC, 0x20A1}, {0x30DD, 0x20A9},
+    {0x30F4, 0x20B1}, {0x30F7, 0x20B9}, {0x30F8, 0x20C1}, {0x30F9, 0x20C9}, {0x30FA, 0x20D1}, {0x30FE, 0x20D9},
+    {0xFB1D, 0x20E1}, {0xFB1F, 0x20E9}, {0xFB2A, 0x20F1}, {0xFB2B, 0x20F9}, {0xFB2C, 0x2102}, {0xFB2D, 0x210E},
+    {0xFB2E, 0x2119}, {0xFB2F, 0x2121}, {0xFB30, 0x2129}, {0xFB31, 0x2131}, {0xFB32, 0x2139}, {0xFB33, 0x2141},
+    {0xFB34, 0x2149}, {0xFB35, 0x2151}, {0xFB36, 0x2159}, {0xFB38, 0x2161}, {0xFB39, 0x2169}, {0xFB3A, 0x2171},
+    {0xFB3B, 0x2179}, {0xFB3C, 0x2181}, {0xFB3E, 0x2189}, {0xFB40, 0x2191}, {0xFB41, 0x2199}, {0xFB43, 0x21A1},
+    {0xFB44, 0x21A9}, {0xFB46, 0x21B1}, {0xFB47, 0x21B9}, {0xFB48, 0x21C1}, {0xFB49, 0x2101}, {0xFB4A, 0x21C9},
+    {0xFB4B, 0x21D1}, {0xFB4C, 0x21D9}, {0xFB4D, 0x21E1}, {0xFB4E, 0x21E9},
+};
+
+static const u_int16_t hfsp_decomp_seq[] = {
+    0x0041, 0x0300, 0x0041, 0x0301, 0x0041, 0x0302, 0x0041, 0x0303, 0x0041, 0x0308,
+    0x0041, 0x030A, 0x0043, 0x0327, 0x0045, 0x0300, 0x0045, 0x0301, 0x0045, 0x0302,
+    0x0045, 0x0308, 0x0049, 0x0300, 0x0049, 0x0301, 0x0049, 0x0302, 0x0049, 0x0308,
+    0x004E, 0x0303, 0x004F, 0x0300, 0x004F, 0x0301, 0x004F, 0x0302, 0x004F, 0x0303,
+    0x004F, 0x0308, 0x0055, 0x0300, 0x0055, 0x0301, 0x0055, 0x0302, 0x0055, 0x0308,
+    0x0059, 0x0301, 0x0061, 0x0300, 0x0061, 0x0301, 0x0061, 0x0302, 0x0061, 0x0303,
+    0x0061, 0x0308, 0x0061, 0x030A, 0x0063, 0x0327, 0x0065, 0x0300, 0x0065, 0x0301,
+    0x0065, 0x0302, 0x0065, 0x0308, 0x0069, 0x0300, 0x0069, 0x0301, 0x0069, 0x0302,
+    0x0069, 0x0308, 0x006E, 0x0303, 0x006F, 0x0300, 0x006F, 0x0301, 0x006F, 0x0302,
+    0x006F, 0x0303, 0x006F, 0x0308, 0x0075, 0x0300, 0x0075, 0x0301, 0x0075, 0x0302,
+    0x0075, 0x0308, 0x0079, 0x0301, 0x0079, 0x0308, 0x0041, 0x0304, 0x0061, 0x0304,
+    0x0041, 0x0306, 0x0061, 0x0306, 0x0041, 0x0328, 0x0061, 0x0328, 0x0043, 0x0301,
+    0x0063, 0x0301, 0x0043, 0x0302, 0x0063, 0x0302, 0x0043, 0x0307, 0x0063, 0x0307,
+    0x0043, 0x030C, 0x0063, 0x030C, 0x0044, 0x030C, 0x0064, 0x030C, 0x0045, 0x0304,
+    0x0065, 0x0304, 0x0045, 0x0306, 0x0065, 0x0306, 0x0045, 0x0307, 0x0065, 0x0307,
+    0x0045, 0x0328, 0x0065, 0x0328, 0x0045, 0x030C, 0x0065, 0x030C, 0x0047, 0x0302,
+    0x0067, 0x0302, 0x0047, 0x0306, 0x0067, 0x0306, 0x0047, 0x0307, 0x0067, 0x0307,
+    0x0047, 0x0327, 0x0067, 0x0327, 0x0048, 0x0302, 0x0068, 0x0302, 0x0049, 0x0303,
+    0x0069, 0x0303, 0x0049, 0x0304, 0x0069, 0x0304, 0x0049, 0x0306, 0x0069, 0x0306,
+    0x0049, 0x0328, 0x0069, 0x0328, 0x0049, 0x0307, 0x004A, 0x0302, 0x006A, 0x0302,
+    0x004B, 0x0327, 0x006B, 0x0327, 0x004C, 0x0301, 0x006C, 0x0301, 0x004C, 0x0327,
+    0x006C, 0x0327, 0x004C, 0x030C, 0x006C, 0x030C, 0x004E, 0x0301, 0x006E, 0x0301,
+    0x004E, 0x0327, 0x006E, 0x0327, 0x004E, 0x030C, 0x006E, 0x030C, 0x004F, 0x0304,
+    0x006F, 0x0304, 0x004F, 0x0306, 0x006F, 0x0306, 0x004F, 0x030B, 0x006F, 0x030B,
+    0x0052, 0x0301, 0x0072, 0x0301, 0x0052, 0x0327, 0x0072, 0x0327, 0x0052, 0x030C,
+    0x0072, 0x030C, 0x0053, 0x0301, 0x0073, 0x0301, 0x0053, 0x0302, 0x0073, 0x0302,
+    0x0053, 0x0327, 0x0073, 0x0327, 0x0053, 0x030C, 0x0073, 0x030C, 0x0054, 0x0327,
+    0x0074, 0x0327, 0x0054, 0x030C, 0x0074, 0x030C, 0x0055, 0x0303, 0x0075, 0x0303,
+    0x0055, 0x0304, 0x0075, 0x0304, 0x0055, 0x0306, 0x0075, 0x0306, 0x0055, 0x030A,
+    0x0075, 0x030A, 0x0055, 0x030B, 0x0075, 0x030B, 0x0055, 0x0328, 0x0075, 0x0328,
+    0x0057, 0x0302, 0x0077, 0x0302, 0x0059, 0x0302, 0x0079, 0x0302, 0x0059, 0x0308,
+    0x005A, 0x0301, 0x007A, 0x0301, 0x005A, 0x0307, 0x007A, 0x0307, 0x005A, 0x030C,
+    0x007A, 0x030C, 0x004F, 0x031B, 0x006F, 0x031B, 0x0055, 0x031B, 0x0075, 0x031B,
+    0x0041, 0x030C, 0x0061, 0x030C, 0x0049, 0x030C, 0x0069, 0x030C, 0x004F, 0x030C,
+    0x006F, 0x030C, 0x0055, 0x030C, 0x0075, 0x030C, 0x0055, 0x0308, 0x0304, 0x0075,
+    0x0308, 0x0304, 0x0055, 0x0308, 0x0301, 0x0075, 0x0308, 0x0301, 0x0055, 0x0308,
+    0x030C, 0x0075, 0x0308, 0x030C, 0x0055, 0x0308, 0x0300, 0x0075, 0x0308, 0x0300,
+    0x0041, 0x0308, 0x0304, 0x0061, 0x0308, 0x0304, 0x0041, 0x0307, 0x0304, 0x0061,
+    0x0307, 0x0304, 0x00C6, 0x0304, 0x00E6, 0x0304, 0x0047, 0x030C, 0x0067, 0x030C,
+    0x004B, 0x030C, 0x006B, 0x030C, 0x004F, 0x0328, 0x006F, 0x0328, 0x004F, 0x0328,
+    0x0304, 0x006F, 0x0328, 0x0304, 0x01B7, 0x030C, 0x0292, 0x030C, 0x006A, 0x030C,
+    0x0047, 0x0301, 0x0067, 0x0301, 0x004E, 0x0300, 0x006E, 0x0300, 0x0041, 0x030A,
+    0x0301, 0x0061, 0x030A, 0x0301, 0x00C6, 0x0301, 0x00E6, 0x0301, 0x00D8, 0x0301,
+    0x00F8, 0x0301, 0x0041, 0x030F, 0x0061, 0x030F, 0x0041, 0x0311, 0x0061, 0x0311,
+    0x0045, 0x030F, 0x0065, 0x030F, 0x0045, 0x0311, 0x0065, 0x0311, 0x0049, 0x030F,
+    0x0069, 0x030F, 0x0049, 0x0311, 0x0069, 0x0311, 0x004F, 0x030F, 0x006F, 0x030F,
+    0x004F, 0x0311, 0x006F, 0x0311, 0x0052, 0x030F, 0x0072, 0x030F, 0x0052, 0x0311,
+    0x0072, 0x0311, 0x0055, 0x030F, 0x0075, 0x030F, 0x0055, 0x0311, 0x0075, 0x0311,
+    0x0053, 0x0326, 0x0073, 0x0326, 0x0054, 0x0326, 0x0074, 0x0326, 0x0048, 0x030C,
+    0x0068, 0x030C, 0x0045, 0x0327, 0x0065, 0x0327, 0x004F, 0x0308, 0x0304, 0x006F,
+    0x0308, 0x0304, 0x004F, 0x0303, 0x0304, 0x006F, 0x0303, 0x0304, 0x004F, 0x0307,
+    0x006F, 0x0307, 0x004F, 0x0307, 0x0304, 0x006F, 0x0307, 0x0304, 0x0059, 0x0304,
+    0x0079, 0x0304, 0x0313, 0x02B9, 0x003B, 0x00A8, 0x0301, 0x0391, 0x0301, 0x00B7,
+    0x0395, 0x0301, 0x0397, 0x0301, 0x0399, 0x0301, 0x039F, 0x0301, 0x03A5, 0x0301,
+    0x03A9, 0x0301, 0x03B9, 0x0308, 0x0301, 0x0399, 0x0308, 0x03A5, 0x0308, 0x03B1,
+    0x0301, 0x03B5, 0x0301, 0x03B7, 0x0301, 0x03B9, 0x0301, 0x03C5, 0x0308, 0x0301,
+    0x03BF, 0x0301, 0x03C5, 0x0301, 0x03C9, 0x0301, 0x03D2, 0x0301, 0x03D2, 0x0308,
+    0x0415, 0x0300, 0x0415, 0x0308, 0x0413, 0x0301, 0x0406, 0x0308, 0x041A, 0x0301,
+    0x0418, 0x0300, 0x0423, 0x0306, 0x0418, 0x0306, 0x0438, 0x0306, 0x0435, 0x0300,
+    0x0435, 0x0308, 0x0433, 0x0301, 0x0456, 0x0308, 0x043A, 0x0301, 0x0438, 0x0300,
+    0x0443, 0x0306, 0x0474, 0x030F, 0x0475, 0x030F, 0x0416, 0x0306, 0x0436, 0x0306,
+    0x0410, 0x0306, 0x0430, 0x0306, 0x0410, 0x0308, 0x0430, 0x0308, 0x0415, 0x0306,
+    0x0435, 0x0306, 0x04D8, 0x0308, 0x04D9, 0x0308, 0x0416, 0x0308, 0x0436, 0x0308,
+    0x0417, 0x0308, 0x0437, 0x0308, 0x0418, 0x0304, 0x0438, 0x0304, 0x0418, 0x0308,
+    0x0438, 0x0308, 0x041E, 0x0308, 0x043E, 0x0308, 0x04E8, 0x0308, 0x04E9, 0x0308,
+    0x042D, 0x0308, 0x044D, 0x0308, 0x0423, 0x0304, 0x0443, 0x0304, 0x0423, 0x0308,
+    0x0443, 0x0308, 0x0423, 0x030B, 0x0443, 0x030B, 0x0427, 0x0308, 0x0447, 0x0308,
+    0x042B, 0x0308, 0x044B, 0x0308, 0x0627, 0x0653, 0x0627, 0x0654, 0x0648, 0x0654,
+    0x0627, 0x0655, 0x064A, 0x0654, 0x06D5, 0x0654, 0x06C1, 0x0654, 0x06D2, 0x0654,
+    0x0928, 0x093C, 0x0930, 0x093C, 0x0933, 0x093C, 0x0915, 0x093C, 0x0916, 0x093C,
+    0x0917, 0x093C, 0x091C, 0x093C, 0x0921, 0x093C, 0x0922, 0x093C, 0x092B, 0x093C,
+    0x092F, 0x093C, 0x09C7, 0x09BE, 0x09C7, 0x09D7, 0x09A1, 0x09BC, 0x09A2, 0x09BC,
+    0x09AF, 0x09BC, 0x0A32, 0x0A3C, 0x0A38, 0x0A3C, 0x0A16, 0x0A3C, 0x0A17, 0x0A3C,
+    0x0A1C, 0x0A3C, 0x0A2B, 0x0A3C, 0x0B47, 0x0B56, 0x0B47, 0x0B3E, 0x0B47, 0x0B57,
+    0x0B21, 0x0B3C, 0x0B22, 0x0B3C, 0x0B92, 0x0BD7, 0x0BC6, 0x0BBE, 0x0BC7, 0x0BBE,
+    0x0BC6, 0x0BD7, 0x0C46, 0x0C56, 0x0CBF, 0x0CD5, 0x0CC6, 0x0CD5, 0x0CC6, 0x0CD6,
+    0x0CC6, 0x0CC2, 0x0CC6, 0x0CC2, 0x0CD5, 0x0D46, 0x0D3E, 0x0D47, 0x0D3E, 0x0D46,
+    0x0D57, 0x0DD9, 0x0DCA, 0x0DD9, 0x0DCF, 0x0DD9, 0x0DCF, 0x0DCA, 0x0DD9, 0x0DDF,
+    0x0F42, 0x0FB7, 0x0F4C, 0x0FB7, 0x0F51, 0x0FB7, 0x0F56, 0x0FB7, 0x0F5B, 0x0FB7,
+    0x0F40, 0x0FB5, 0x0F71, 0x0F72, 0x0F71, 0x0F74, 0x0FB2, 0x0F80, 0x0FB3, 0x0F80,
+    0x0F71, 0x0F80, 0x0F92, 0x0FB7, 0x0F9C, 0x0FB7, 0x0FA1, 0x0FB7, 0x0FA6, 0x0FB7,
+    0x0FAB, 0x0FB7, 0x0F90, 0x0FB5, 0x1025, 0x102E, 0x0041, 0x0325, 0x0061, 0x0325,
+    0x0042, 0x0307, 0x0062, 0x0307, 0x0042, 0x0323, 0x0062, 0x0323, 0x0042, 0x0331,
+    0x0062, 0x0331, 0x0043, 0x0327, 0x0301, 0x0063, 0x0327, 0x0301, 0x0044, 0x0307,
+    0x0064, 0x0307, 0x0044, 0x0323, 0x0064, 0x0323, 0x0044, 0x0331, 0x0064, 0x0331,
+    0x0044, 0x0327, 0x0064, 0x0327, 0x0044, 0x032D, 0x0064, 0x032D, 0x0045, 0x0304,
+    0x0300, 0x0065, 0x0304, 0x0300, 0x0045, 0x0304, 0x0301, 0x0065, 0x0304, 0x0301,
+    0x0045, 0x032D, 0x0065, 0x032D, 0x0045, 0x0330, 0x0065, 0x0330, 0x0045, 0x0327,
+    0x0306, 0x0065, 0x0327, 0x0306, 0x0046, 0x0307, 0x0066, 0x0307, 0x0047, 0x0304,
+    0x0067, 0x0304, 0x0048, 0x0307, 0x0068, 0x0307, 0x0048, 0x0323, 0x0068, 0x0323,
+    0x0048, 0x0308, 0x0068, 0x0308, 0x0048, 0x0327, 0x0068, 0x0327, 0x0048, 0x032E,
+    0x0068, 0x032E, 0x0049, 0x0330, 0x0069, 0x0330, 0x0049, 0x0308, 0x0301, 0x0069,
+    0x0308, 0x0301, 0x004B, 0x0301, 0x006B, 0x0301, 0x004B, 0x0323, 0x006B, 0x0323,
+    0x004B, 0x0331, 0x006B, 0x0331, 0x004C, 0x0323, 0x006C, 0x0323, 0x004C, 0x0323,
+    0x0304, 0x006C, 0x0323, 0x0304, 0x004C, 0x0331, 0x006C, 0x0331, 0x004C, 0x032D,
+    0x006C, 0x032D, 0x004D, 0x0301, 0x006D, 0x0301, 0x004D, 0x0307, 0x006D, 0x0307,
+    0x004D, 0x0323, 0x006D, 0x0323, 0x004E, 0x0307, 0x006E, 0x0307, 0x004E, 0x0323,
+    0x006E, 0x0323, 0x004E, 0x0331, 0x006E, 0x0331, 0x004E, 0x032D, 0x006E, 0x032D,
+    0x004F, 0x0303, 0x0301, 0x006F, 0x0303, 0x0301, 0x004F, 0x0303, 0x0308, 0x006F,
+    0x0303, 0x0308, 0x004F, 0x0304, 0x0300, 0x006F, 0x0304, 0x0300, 0x004F, 0x0304,
+    0x0301, 0x006F, 0x0304, 0x0301, 0x0050, 0x0301, 0x0070, 0x0301, 0x0050, 0x0307,
+    0x0070, 0x0307, 0x0052, 0x0307, 0x0072, 0x0307, 0x0052, 0x0323, 0x0072, 0x0323,
+    0x0052, 0x0323, 0x0304, 0x0072, 0x0323, 0x0304, 0x0052, 0x0331, 0x0072, 0x0331,
+    0x0053, 0x0307, 0x0073, 0x0307, 0x0053, 0x0323, 0x0073, 0x0323, 0x0053, 0x0301,
+    0x0307, 0x0073, 0x0301, 0x0307, 0x0053, 0x030C, 0x0307, 0x0073, 0x030C, 0x0307,
+    0x0053, 0x0323, 0x0307, 0x0073, 0x0323, 0x0307, 0x0054, 0x0307, 0x0074, 0x0307,
+    0x0054, 0x0323, 0x0074, 0x0323, 0x0054, 0x0331, 0x0074, 0x0331, 0x0054, 0x032D,
+    0x0074, 0x032D, 0x0055, 0x0324, 0x0075, 0x0324, 0x0055, 0x0330, 0x0075, 0x0330,
+    0x0055, 0x032D, 0x0075, 0x032D, 0x0055, 0x0303, 0x0301, 0x0075, 0x0303, 0x0301,
+    0x0055, 0x0304, 0x0308, 0x0075, 0x0304, 0x0308, 0x0056, 0x0303, 0x0076, 0x0303,
+    0x0056, 0x0323, 0x0076, 0x0323, 0x0057, 0x0300, 0x0077, 0x0300, 0x0057, 0x0301,
+    0x0077, 0x0301, 0x0057, 0x0308, 0x0077, 0x0308, 0x0057, 0x0307, 0x0077, 0x0307,
+    0x0057, 0x0323, 0x0077, 0x0323, 0x0058, 0x0307, 0x0078, 0x0307, 0x0058, 0x0308,
+    0x0078, 0x0308, 0x0059, 0x0307, 0x0079, 0x0307, 0x005A, 0x0302, 0x007A, 0x0302,
+    0x005A, 0x0323, 0x007A, 0x0323, 0x005A, 0x0331, 0x007A, 0x0331, 0x0068, 0x0331,
+    0x0074, 0x0308, 0x0077, 0x030A, 0x0079, 0x030A, 0x017F, 0x0307, 0x0041, 0x0323,
+    0x0061, 0x0323, 0x0041, 0x0309, 0x0061, 0x0309, 0x0041, 0x0302, 0x0301, 0x0061,
+    0x0302, 0x0301, 0x0041, 0x0302, 0x0300, 0x0061, 0x0302, 0x0300, 0x0041, 0x0302,
+    0x0309, 0x0061, 0x0302, 0x0309, 0x0041, 0x0302, 0x0303, 0x0061, 0x0302, 0x0303,
+    0x0041, 0x0323, 0x0302, 0x0061, 0x0323, 0x0302, 0x0041, 0x0306, 0x0301, 0x0061,
+    0x0306, 0x0301, 0x0041, 0x0306, 0x0300, 0x0061, 0x0306, 0x0300, 0x0041, 0x0306,
+    0x0309, 0x0061, 0x0306, 0x0309, 0x0041, 0x0306, 0x0303, 0x0061, 0x0306, 0x0303,
+    0x0041, 0x0323, 0x0306, 0x0061, 0x0323, 0x0306, 0x0045, 0x0323, 0x0065, 0x0323,
+    0x0045, 0x0309, 0x0065, 0x0309, 0x0045, 0x0303, 0x0065, 0x0303, 0x0045, 0x0302,
+    0x0301, 0x0065, 0x0302, 0x0301, 0x0045, 0x0302, 0x0300, 0x0065, 0x0302, 0x0300,
+    0x0045, 0x0302, 0x0309, 0x0065, 0x0302, 0x0309, 0x0045, 0x0302, 0x0303, 0x0065,
+    0x0302, 0x0303, 0x0045, 0x0323, 0x0302, 0x0065, 0x0323, 0x0302, 0x0049, 0x0309,
+    0x0069, 0x0309, 0x0049, 0x0323, 0x0069, 0x0323, 0x004F, 0x0323, 0x006F, 0x0323,
+    0x004F, 0x0309, 0x006F, 0x0309, 0x004F, 0x0302, 0x0301, 0x006F, 0x0302, 0x0301,
+    0x004F, 0x0302, 0x0300, 0x006F, 0x0302, 0x0300, 0x004F, 0x0302, 0x0309, 0x006F,
+    0x0302, 0x0309, 0x004F, 0x0302, 0x0303, 0x006F, 0x0302, 0x0303, 0x004F, 0x0323,
+    0x0302, 0x006F, 0x0323, 0x0302, 0x004F, 0x031B, 0x0301, 0x006F, 0x031B, 0x0301,
+    0x004F, 0x031B, 0x0300, 0x006F, 0x031B, 0x0300, 0x004F, 0x031B, 0x0309, 0x006F,
+    0x031B, 0x0309, 0x004F, 0x031B, 0x0303, 0x006F, 0x031B, 0x0303, 0x004F, 0x031B,
+    0x0323, 0x006F, 0x031B, 0x0323, 0x0055, 0x0323, 0x0075, 0x0323, 0x0055, 0x0309,
+    0x0075, 0x0309, 0x0055, 0x031B, 0x0301, 0x0075, 0x031B, 0x0301, 0x0055, 0x031B,
+    0x0300, 0x0075, 0x031B, 0x0300, 0x0055, 0x031B, 0x0309, 0x0075, 0x031B, 0x0309,
+    0x0055, 0x031B, 0x0303, 0x0075, 0x031B, 0x0303, 0x0055, 0x031B, 0x0323, 0x0075,
+    0x031B, 0x0323, 0x0059, 0x0300, 0x0079, 0x0300, 0x0059, 0x0323, 0x0079, 0x0323,
+    0x0059, 0x0309, 0x0079, 0x0309, 0x0059, 0x0303, 0x0079, 0x0303, 0x03B1, 0x0313,
+    0x03B1, 0x0314, 0x03B1, 0x0313, 0x0300, 0x03B1, 0x0314, 0x0300, 0x03B1, 0x0313,
+    0x0301, 0x03B1, 0x0314, 0x0301, 0x03B1, 0x0313, 0x0342, 0x03B1, 0x0314, 0x0342,
+    0x0391, 0x0313, 0x0391, 0x0314, 0x0391, 0x0313, 0x0300, 0x0391, 0x0314, 0x0300,
+    0x0391, 0x0313, 0x0301, 0x0391, 0x0314, 0x0301, 0x0391, 0x0313, 0x0342, 0x0391,
+    0x0314, 0x0342, 0x03B5, 0x0313, 0x03B5, 0x0314, 0x03B5, 0x0313, 0x0300, 0x03B5,
+    0x0314, 0x0300, 0x03B5, 0x0313, 0x0301, 0x03B5, 0x0314, 0x0301, 0x0395, 0x0313,
+    0x0395, 0x0314, 0x0395, 0x0313, 0x0300, 0x0395, 0x0314, 0x0300, 0x0395, 0x0313,
+    0x0301, 0x0395, 0x0314, 0x0301, 0x03B7, 0x0313, 0x03B7, 0x0314, 0x03B7, 0x0313,
+    0x0300, 0x03B7, 0x0314, 0x0300, 0x03B7, 0x0313, 0x0301, 0x03B7, 0x0314, 0x0301,
+    0x03B7, 0x0313, 0x0342, 0x03B7, 0x0314, 0x0342, 0x0397, 0x0313, 0x0397, 0x0314,
+    0x0397, 0x0313, 0x0300, 0x0397, 0x0314, 0x0300, 0x0397, 0x0313, 0x0301, 0x0397,
+    0x0314, 0x0301, 0x0397, 0x0313, 0x0342, 0x0397, 0x0314, 0x0342, 0x03B9, 0x0313,
+    0x03B9, 0x0314, 0x03B9, 0x0313, 0x0300, 0x03B9, 0x0314, 0x0300, 0x03B9, 0x0313,
+    0x0301, 0x03B9, 0x0314, 0x0301, 0x03B9, 0x0313, 0x0342, 0x03B9, 0x0314, 0x0342,
+    0x0399, 0x0313, 0x0399, 0x0314, 0x0399, 0x0313, 0x0300, 0x0399, 0x0314, 0x0300,
+    0x0399, 0x0313, 0x0301, 0x0399, 0x0314, 0x0301, 0x0399, 0x0313, 0x0342, 0x0399,
+    0x0314, 0x0342, 0x03BF, 0x0313, 0x03BF, 0x0314, 0x03BF, 0x0313, 0x0300, 0x03BF,
+    0x0314, 0x0300, 0x03BF, 0x0313, 0x0301, 0x03BF, 0x0314, 0x0301, 0x039F, 0x0313,
+    0x039F, 0x0314, 0x039F, 0x0313, 0x0300, 0x039F, 0x0314, 0x0300, 0x039F, 0x0313,
+    0x0301, 0x039F, 0x0314, 0x0301, 0x03C5, 0x0313, 0x03C5, 0x0314, 0x03C5, 0x0313,
+    0x0300, 0x03C5, 0x0314, 0x0300, 0x03C5, 0x0313, 0x0301, 0x03C5, 0x0314, 0x0301,
+    0x03C5, 0x0313, 0x0342, 0x03C5, 0x0314, 0x0342, 0x03A5, 0x0314, 0x03A5, 0x0314,
+    0x0300, 0x03A5, 0x0314, 0x0301, 0x03A5, 0x0314, 0x0342, 0x03C9, 0x0313, 0x03C9,
+    0x0314, 0x03C9, 0x0313, 0x0300, 0x03C9, 0x0314, 0x0300, 0x03C9, 0x0313, 0x0301,
+    0x03C9, 0x0314, 0x0301, 0x03C9, 0x0313, 0x0342, 0x03C9, 0x0314, 0x0342, 0x03A9,
+    0x0313, 0x03A9, 0x0314, 0x03A9, 0x0313, 0x0300, 0x03A9, 0x0314, 0x0300, 0x03A9,
+    0x0313, 0x0301, 0x03A9, 0x0314, 0x0301, 0x03A9, 0x0313, 0x0342, 0x03A9, 0x0314,
+    0x0342, 0x03B1, 0x0300, 0x03B5, 0x0300, 0x03B7, 0x0300, 0x03B9, 0x0300, 0x03BF,
+    0x0300, 0x03C5, 0x0300, 0x03C9, 0x0300, 0x03B1, 0x0313, 0x0345, 0x03B1, 0x0314,
+    0x0345, 0x03B1, 0x0313, 0x0300, 0x0345, 0x03B1, 0x0314, 0x0300, 0x0345, 0x03B1,
+    0x0313, 0x0301, 0x0345, 0x03B1, 0x0314, 0x0301, 0x0345, 0x03B1, 0x0313, 0x0342,
+    0x0345, 0x03B1, 0x0314, 0x0342, 0x0345, 0x0391, 0x0313, 0x0345, 0x0391, 0x0314,
+    0x0345, 0x0391, 0x0313, 0x0300, 0x0345, 0x0391, 0x0314, 0x0300, 0x0345, 0x0391,
+    0x0313, 0x0301, 0x0345, 0x0391, 0x0314, 0x0301, 0x0345, 0x0391, 0x0313, 0x0342,
+    0x0345, 0x0391, 0x0314, 0x0342, 0x0345, 0x03B7, 0x0313, 0x0345, 0x03B7, 0x0314,
+    0x0345, 0x03B7, 0x0313, 0x0300, 0x0345, 0x03B7, 0x0314, 0x0300, 0x0345, 0x03B7,
+    0x0313, 0x0301, 0x0345, 0x03B7, 0x0314, 0x0301, 0x0345, 0x03B7, 0x0313, 0x0342,
+    0x0345, 0x03B7, 0x0314, 0x0342, 0x0345, 0x0397, 0x0313, 0x0345, 0x0397, 0x0314,
+    0x0345, 0x0397, 0x0313, 0x0300, 0x0345, 0x0397, 0x0314, 0x0300, 0x0345, 0x0397,
+    0x0313, 0x0301, 0x0345, 0x0397, 0x0314, 0x0301, 0x0345, 0x0397, 0x0313, 0x0342,
+    0x0345, 0x0397, 0x0314, 0x0342, 0x0345, 0x03C9, 0x0313, 0x0345, 0x03C9, 0x0314,
+    0x0345, 0x03C9, 0x0313, 0x0300, 0x0345, 0x03C9, 0x0314, 0x0300, 0x0345, 0x03C9,
+    0x0313, 0x0301, 0x0345, 0x03C9, 0x0314, 0x0301, 0x0345, 0x03C9, 0x0313, 0x0342,
+    0x0345, 0x03C9, 0x0314, 0x0342, 0x0345, 0x03A9, 0x0313, 0x0345, 0x03A9, 0x0314,
+    0x0345, 0x03A9, 0x0313, 0x0300, 0x0345, 0x03A9, 0x0314, 0x0300, 0x0345, 0x03A9,
+    0x0313, 0x0301, 0x0345, 0x03A9, 0x0314, 0x0301, 0x0345, 0x03A9, 0x0313, 0x0342,
+    0x0345, 0x03A9, 0x0314, 0x0342, 0x0345, 0x03B1, 0x0306, 0x03B1, 0x0304, 0x03B1,
+    0x0300, 0x0345, 0x03B1, 0x0345, 0x03B1, 0x0301, 0x0345, 0x03B1, 0x0342, 0x03B1,
+    0x0342, 0x0345, 0x0391, 0x0306, 0x0391, 0x0304, 0x0391, 0x0300, 0x0391, 0x0345,
+    0x00A8, 0x0342, 0x03B7, 0x0300, 0x0345, 0x03B7, 0x0345, 0x03B7, 0x0301, 0x0345,
+    0x03B7, 0x0342, 0x03B7, 0x0342, 0x0345, 0x0395, 0x0300, 0x0397, 0x0300, 0x0397,
+    0x0345, 0x1FBF, 0x0300, 0x1FBF, 0x0301, 0x1FBF, 0x0342, 0x03B9, 0x0306, 0x03B9,
+    0x0304, 0x03B9, 0x0308, 0x0300, 0x03B9, 0x0342, 0x03B9, 0x0308, 0x0342, 0x0399,
+    0x0306, 0x0399, 0x0304, 0x0399, 0x0300, 0x1FFE, 0x0300, 0x1FFE, 0x0301, 0x1FFE,
+    0x0342, 0x03C5, 0x0306, 0x03C5, 0x0304, 0x03C5, 0x0308, 0x0300, 0x03C1, 0x0313,
+    0x03C1, 0x0314, 0x03C5, 0x0342, 0x03C5, 0x0308, 0x0342, 0x03A5, 0x0306, 0x03A5,
+    0x0304, 0x03A5, 0x0300, 0x03A1, 0x0314, 0x00A8, 0x0300, 0x0060, 0x03C9, 0x0300,
+    0x0345, 0x03C9, 0x0345, 0x03C9, 0x0301, 0x0345, 0x03C9, 0x0342, 0x03C9, 0x0342,
+    0x0345, 0x039F, 0x0300, 0x03A9, 0x0300, 0x03A9, 0x0345, 0x00B4, 0x304B, 0x3099,
+    0x304D, 0x3099, 0x304F, 0x3099, 0x3051, 0x3099, 0x3053, 0x3099, 0x3055, 0x3099,
+    0x3057, 0x3099, 0x3059, 0x3099, 0x305B, 0x3099, 0x305D, 0x3099, 0x305F, 0x3099,
+    0x3061, 0x3099, 0x3064, 0x3099, 0x3066, 0x3099, 0x3068, 0x3099, 0x306F, 0x3099,
+    0x306F, 0x309A, 0x3072, 0x3099, 0x3072, 0x309A, 0x3075, 0x3099, 0x3075, 0x309A,
+    0x3078, 0x3099, 0x3078, 0x309A, 0x307B, 0x3099, 0x307B, 0x309A, 0x3046, 0x3099,
+    0x309D, 0x3099, 0x30AB, 0x3099, 0x30AD, 0x3099, 0x30AF, 0x3099, 0x30B1, 0x3099,
+    0x30B3, 0x3099, 0x30B5, 0x3099, 0x30B7, 0x3099, 0x30B9, 0x3099, 0x30BB, 0x3099,
+    0x30BD, 0x3099, 0x30BF, 0x3099, 0x30C1, 0x3099, 0x30C4, 0x3099, 0x30C6, 0x3099,
+    0x30C8, 0x3099, 0x30CF, 0x3099, 0x30CF, 0x309A, 0x30D2, 0x3099, 0x30D2, 0x309A,
+    0x30D5, 0x3099, 0x30D5, 0x309A, 0x30D8, 0x3099, 0x30D8, 0x309A, 0x30DB, 0x3099,
+    0x30DB, 0x309A, 0x30A6, 0x3099, 0x30EF, 0x3099, 0x30F0, 0x3099, 0x30F1, 0x3099,
+    0x30F2, 0x3099, 0x30FD, 0x3099, 0x05D9, 0x05B4, 0x05F2, 0x05B7, 0x05E9, 0x05C1,
+    0x05E9, 0x05C2, 0x05E9, 0x05BC, 0x05C1, 0x05E9, 0x05BC, 0x05C2, 0x05D0, 0x05B7,
+    0x05D0, 0x05B8, 0x05D0, 0x05BC, 0x05D1, 0x05BC, 0x05D2, 0x05BC, 0x05D3, 0x05BC,
+    0x05D4, 0x05BC, 0x05D5, 0x05BC, 0x05D6, 0x05BC, 0x05D8, 0x05BC, 0x05D9, 0x05BC,
+    0x05DA, 0x05BC, 0x05DB, 0x05BC, 0x05DC, 0x05BC, 0x05DE, 0x05BC, 0x05E0, 0x05BC,
+    0x05E1, 0x05BC, 0x05E3, 0x05BC, 0x05E4, 0x05BC, 0x05E6, 0x05BC, 0x05E7, 0x05BC,
+    0x05E8, 0x05BC, 0x05EA, 0x05BC, 0x05D5, 0x05B9, 0x05D1, 0x05BF, 0x05DB, 0x05BF,
+    0x05E4, 0x05BF,
+};
+
+/*
+ * Canonical combining classes of the BMP from the Unicode 3.2 data, as sorted
+ * ranges of characters sharing a non zero class.
+ */
+static const struct hfsp_combining {
+    u_int16_t   hcb_first;
+    u_int16_t   hcb_last;
+    u_int8_t    hcb_class;
+} hfsp_combining_tab[] = {
+    {0x0300, 0x0314, 230}, {0x0315, 0x0315, 232}, {0x0316, 0x0319, 220}, {0x031A, 0x031A, 232},
+    {0x031B, 0x031B, 216}, {0x031C, 0x0320, 220}, {0x0321, 0x0322, 202}, {0x0323, 0x0326, 220},
+    {0x0327, 0x0328, 202}, {0x0329, 0x0333, 220}, {0x0334, 0x0338,   1}, {0x0339, 0x033C, 220},
+    {0x033D, 0x0344, 230}, {0x0345, 0x0345, 240}, {0x0346, 0x0346, 230}, {0x0347, 0x0349, 220},
+    {0x034A, 0x034C, 230}, {0x034D, 0x034E, 220}, {0x0360, 0x0361, 234}, {0x0362, 0x0362, 233},
+    {0x0363, 0x036F, 230}, {0x0483, 0x0486, 230}, {0x0591, 0x0591, 220}, {0x0592, 0x0595, 230},
+    {0x0596, 0x0596, 220}, {0x0597, 0x0599, 230}, {0x059A, 0x059A, 222}, {0x059B, 0x059B, 220},
+    {0x059C, 0x05A1, 230}, {0x05A3, 0x05A7, 220}, {0x05A8, 0x05A9, 230}, {0x05AA, 0x05AA, 220},
+    {0x05AB, 0x05AC, 230}, {0x05AD, 0x05AD, 222}, {0x05AE, 0x05AE, 228}, {0x05AF, 0x05AF, 230},
+    {0x05B0, 0x05B0,  10}, {0x05B1, 0x05B1,  11}, {0x05B2, 0x05B2,  12}, {0x05B3, 0x05B3,  13},
+    {0x05B4, 0x05B4,  14}, {0x05B5, 0x05B5,  15}, {0x05B6, 0x05B6,  16}, {0x05B7, 0x05B7,  17},
+    {0x05B8, 0x05B8,  18}, {0x05B9, 0x05B9,  19}, {0x05BB, 0x05BB,  20}, {0x05BC, 0x05BC,  21},
+    {0x05BD, 0x05BD,  22}, {0x05BF, 0x05BF,  23}, {0x05C1, 0x05C1,  24}, {0x05C2, 0x05C2,  25},
+    {0x05C4, 0x05C4, 230}, {0x064B, 0x064B,  27}, {0x064C, 0x064C,  28}, {0x064D, 0x064D,  29},
+    {0x064E, 0x064E,  30}, {0x064F, 0x064F,  31}, {0x0650, 0x0650,  32}, {0x0651, 0x0651,  33},
+    {0x0652, 0x0652,  34}, {0x0653, 0x0654, 230}, {0x0655, 0x0655, 220}, {0x0670, 0x0670,  35},
+    {0x06D6, 0x06DC, 230}, {0x06DF, 0x06E2, 230}, {0x06E3, 0x06E3, 220}, {0x06E4, 0x06E4, 230},
+    {0x06E7, 0x06E8, 230}, {0x06EA, 0x06EA, 220}, {0x06EB, 0x06EC, 230}, {0x06ED, 0x06ED, 220},
+    {0x0711, 0x0711,  36}, {0x0730, 0x0730, 230}, {0x0731, 0x0731, 220}, {0x0732, 0x0733, 230},
+    {0x0734, 0x0734, 220}, {0x0735, 0x0736, 230}, {0x0737, 0x0739, 220}, {0x073A, 0x073A, 230},
+    {0x073B, 0x073C, 220}, {0x073D, 0x073D, 230}, {0x073E, 0x073E, 220}, {0x073F, 0x0741, 230},
+    {0x0742, 0x0742, 220}, {0x0743, 0x0743, 230}, {0x0744, 0x0744, 220}, {0x0745, 0x0745, 230},
+    {0x0746, 0x0746, 220}, {0x0747, 0x0747, 230}, {0x0748, 0x0748, 220}, {0x0749, 0x074A, 230},
+    {0x093C, 0x093C,   7}, {0x094D, 0x094D,   9}, {0x0951, 0x0951, 230}, {0x0952, 0x0952, 220},
+    {0x0953, 0x0954, 230}, {0x09BC, 0x09BC,   7}, {0x09CD, 0x09CD,   9}, {0x0A3C, 0x0A3C,   7},
+    {0x0A4D, 0x0A4D,   9}, {0x0ABC, 0x0ABC,   7}, {0x0ACD, 0x0ACD,   9}, {0x0B3C, 0x0B3C,   7},
+    {0x0B4D, 0x0B4D,   9}, {0x0BCD, 0x0BCD,   9}, {0x0C4D, 0x0C4D,   9}, {0x0C55, 0x0C55,  84},
+    {0x0C56, 0x0C56,  91}, {0x0CCD, 0x0CCD,   9}, {0x0D4D, 0x0D4D,   9}, {0x0DCA, 0x0DCA,   9},
+    {0x0E38, 0x0E39, 103}, {0x0E3A, 0x0E3A,   9}, {0x0E48, 0x0E4B, 107}, {0x0EB8, 0x0EB9, 118},
+    {0x0EC8, 0x0ECB, 122}, {0x0F18, 0x0F19, 220}, {0x0F35, 0x0F35, 220}, {0x0F37, 0x0F37, 220},
+    {0x0F39, 0x0F39, 216}, {0x0F71, 0x0F71, 129}, {0x0F72, 0x0F72, 130}, {0x0F74, 0x0F74, 132},
+    {0x0F7A, 0x0F7D, 130}, {0x0F80, 0x0F80, 130}, {0x0F82, 0x0F83, 230}, {0x0F84, 0x0F84,   9},
+    {0x0F86, 0x0F87, 230}, {0x0FC6, 0x0FC6, 220}, {0x1037, 0x1037,   7}, {0x1039, 0x1039,   9},
+    {0x1714, 0x1714,   9}, {0x1734, 0x1734,   9}, {0x17D2, 0x17D2,   9}, {0x18A9, 0x18A9, 228},
+    {0x20D0, 0x20D1, 230}, {0x20D2, 0x20D3,   1}, {0x20D4, 0x20D7, 230}, {0x20D8, 0x20DA,   1},
+    {0x20DB, 0x20DC, 230}, {0x20E1, 0x20E1, 230}, {0x20E5, 0x20E6,   1}, {0x20E7, 0x20E7, 230},
+    {0x20E8, 0x20E8, 220}, {0x20E9, 0x20E9, 230}, {0x20EA, 0x20EA,   1}, {0x302A, 0x302A, 218},
+    {0x302B, 0x302B, 228}, {0x302C, 0x302C, 232}, {0x302D, 0x302D, 222}, {0x302E, 0x302F, 224},
+    {0x3099, 0x309A,   8}, {0xFB1E, 0xFB1E,  26}, {0xFE20, 0xFE23, 230},
+};
+
+#define HFSP_HASZERO64(v)   (((v) - 0x0101010101010101ULL) & ~(v) & 0x8080808080808080ULL)
+
+/*
+ * Canonical combining class of a character, 0 for the starters.
+ */
+static u_int8_t
+hfsp_unicode_combining(u_int16_t c)
+{
+    int lo, hi, mid;
+
+    if (c < 0x0300)
+        return 0;
+
+    lo = 0;
+    hi = nitems(hfsp_combining_tab) - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (c < hfsp_combining_tab[mid].hcb_first)
+            hi = mid - 1;
+        else if (c > hfsp_combining_tab[mid].hcb_last)
+            lo = mid + 1;
+        else
+            return hfsp_combining_tab[mid].hcb_class;
+    }
+    return 0;
+}
+
+/*
+ * Canonical decomposition of a character.
+ * c: The character.
+ * seq: Receive the decomposition, at least 4 characters.
+ * return: The number of characters, 1 if the character does not decompose.
+ */
+static int
+hfsp_unicode_decompose(u_int16_t c, u_int16_t * seq)
+{
+    u_int sindex;
+    int lo, hi, mid, n;
+
+    seq[0] = c;
+    // Nothing decompose below the Latin-1 letters.
+    if (c < 0x00C0)
+        return 1;
+
+    sindex = c - HFSP_HANGUL_SBASE;
+    if (sindex < HFSP_HANGUL_SCOUNT)
+    {
+        seq[0] = HFSP_HANGUL_LBASE + sindex / (HFSP_HANGUL_VCOUNT * HFSP_HANGUL_TCOUNT);
+        seq[1] = HFSP_HANGUL_VBASE + (sindex % (HFSP_HANGUL_VCOUNT * HFSP_HANGUL_TCOUNT)) / HFSP_HANGUL_TCOUNT;
+        if (sindex % HFSP_HANGUL_TCOUNT == 0)
+            return 2;
+        seq[2] = HFSP_HANGUL_TBASE + sindex % HFSP_HANGUL_TCOUNT;
+        return 3;
+    }
+
+    lo = 0;
+    hi = nitems(hfsp_decomp_tab) - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (hfsp_decomp_tab[mid].hdc_char == c)
+        {
+            n = (hfsp_decomp_tab[mid].hdc_seq & 0x3) + 1;
+            memcpy(seq, hfsp_decomp_seq + (hfsp_decomp_tab[mid].hdc_seq >> 2), n * sizeof(*seq));
+            return n;
+        }
+        if (hfsp_decomp_tab[mid].hdc_char < c)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return 1;
+}
+
+/*
+ * Put the combining characters following a starter in canonical order.
+ * The sort is stable so marks of the same class keep their order.
+ */
+static void
+hfsp_unicode_reorder(hfsp_unichar * ustr, int len)
+{
+    u_int16_t c;
+    u_int8_t cls;
+    int i, j;
+
+    for (i = 1; i < len; i++)
+    {
+        c = be16toh(ustr[i]);
+        cls = hfsp_unicode_combining(c);
+        if (cls == 0)
+            continue;
+        for (j = i; j > 0 && hfsp_unicode_combining(be16toh(ustr[j - 1])) > cls; j--)
+            ustr[j] = ustr[j - 1];
+        ustr[j] = htobe16(c);
+    }
+}
+
+int
+hfsp_unicode_from_utf8(const char * str, size_t len, hfsp_unichar * ustr, int maxlen, int * ulenp)
+{
+    const u_char * sp, * end;
+    u_int64_t w;
+    u_int32_t c, min;
+    u_int16_t seq[4];
+    u_int8_t cls, lastcls;
+    int i, n, ulen;
+    bool reorder;
+
+    sp = (const u_char *)str;
+    end = sp + len;
+    ulen = 0;
+    lastcls = 0;
+    reorder = false;
+    while (sp < end)
+    {
+        // Blocks of 8 ASCII characters other than ':' are widened without any table.
+        while (end - sp >= 8 && ulen + 8 <= maxlen)
+        {
+            memcpy(&w, sp, sizeof(w));
+            if ((w & 0x8080808080808080ULL) || HFSP_HASZERO64(w ^ 0x3A3A3A3A3A3A3A3AULL))
+                break;
+            for (i = 0; i < 8; i++)
+                ustr[ulen + i] = htobe16(sp[i]);
+            ulen += 8;
+            sp += 8;
+            lastcls = 0;
+        }
+        if (sp >= end)
+            break;
+
+        c = *(sp++);
+        if (c < 0x80)
+        {
+            if (ulen >= maxlen)
+                return ENAMETOOLONG;
+            ustr[ulen++] = htobe16(c == ':' ? '/' : c);
+            lastcls = 0;
+            continue;
+        }
+
+        if ((c & 0xE0) == 0xC0)
+        {
+            c &= 0x1F;
+            n = 1;
+            min = 0x80;
+        }
+        else if ((c & 0xF0) == 0xE0)
+        {
+            c &= 0x0F;
+            n = 2;
+            min = 0x800;
+        }
+        else if ((c & 0xF8) == 0xF0)
+        {
+            c &= 0x07;
+            n = 3;
+            min = 0x10000;
+        }
+        else
+            return EINVAL;
+
+        if (end - sp < n)
+            return EINVAL;
+        while (n--)
+        {
+            if ((*sp & 0xC0) != 0x80)
+                return EINVAL;
+            c = (c << 6) | (*(sp++) & 0x3F);
+        }
+        if (c < min || (c >= 0xD800 && c < 0xE000) || c > 0x10FFFF)
+            return EINVAL;
+
+        if (c >= 0x10000)
+        {
+            if (ulen + 2 > maxlen)
+                return ENAMETOOLONG;
+            c -= 0x10000;
+            ustr[ulen++] = htobe16(0xD800 + (c >> 10));
+            ustr[ulen++] = htobe16(0xDC00 + (c & 0x3FF));
+            lastcls = 0;
+            continue;
+        }
+
+        if (c == HFSP_UNICODE_NUL)
+            c = 0;
+        n = hfsp_unicode_decompose(c, seq);
+        if (ulen + n > maxlen)
+            return ENAMETOOLONG;
+        for (i = 0; i < n; i++)
+        {
+            cls = hfsp_unicode_combining(seq[i]);
+            if (cls != 0 && cls < lastcls)
+                reorder = true;
+            lastcls = cls;
+            ustr[ulen++] = htobe16(seq[i]);
+        }
+    }
+
+    if (reorder)
+        hfsp_unicode_reorder(ustr, ulen);
+
+    *ulenp = ulen;
+    return 0;
+}
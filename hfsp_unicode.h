@@ -5,7 +5,13 @@
 #ifndef _HFSP_UNICODE_H_
 #define _HFSP_UNICODE_H_
 
-int hfsp_unicode_cmp(struct hfsp_unistr * lstrp, struct hfsp_unistr * rstrp);
+/*
+ * Case insensitive comparison of two BE unicode strings as done by HFS+.
+ * lstr, llen: Left string and its number of characters.
+ * rstr, rlen: Right string and its number of characters.
+ * return: -1, 0 or 1.
+ */
+int hfsp_unicode_cmp(const hfsp_unichar * lstr, int llen, const hfsp_unichar * rstr, int rlen);
 
 /*
  * Fold  case folding of unicode char.
@@ -14,12 +20,42 @@ int hfsp_unicode_cmp(struct hfsp_unistr * lstrp, struct hfsp_unistr * rstrp);
  */
 u_int16_t hfsp_foldcase(u_int16_t ch);
 
+/* NUL is not allowed in a path, it is shown as the SYMBOL FOR NULL */
+#define HFSP_UNICODE_NUL            0x2400
+#define HFSP_UNICODE_REPLACEMENT    0xFFFD
+
+/* hfsp_unicode_to_utf8() flags */
+#define HFSP_UTF8_NFC               0x0001  /* Recompose to precomposed characters */
+
+/*
+ * Convert a BE unicode name to an UTF-8 NUL terminated string. '/' is shown
+ * as ':' and unpaired surrogates as U+FFFD. Runs of ASCII characters are
+ * copied 4 at a time.
+ * ustr, ulen: The name and its number of characters.
+ * buf, size: The destination buffer and its size, including the NUL.
+ * lenp: Length of the string on exit.
+ * flags: HFSP_UTF8_NFC to compose the decomposed characters stored by HFS+.
+ * return: ENAMETOOLONG if the buffer is too small.
+ */
+int hfsp_unicode_to_utf8(const hfsp_unichar * ustr, int ulen, char * buf, size_t size, size_t * lenp,
+                         int flags);
+
+/*
+ * Canonical composition of a base character and a combining character.
+ * return: The composed character, 0 if they do not compose.
+ */
+u_int16_t hfsp_unicode_compose(u_int16_t base, u_int16_t mark);
+
 /*
- * Copy a hfsp_unistr from one to an other.
- * This function assumed that the unistr are allocated.
- * srcp: Source hfsp_unistr from where to copy.
- * dstp: Destination hfsp_unistr to copy to.
+ * Convert an UTF-8 path component to the canonical decomposed form the catalogue
+ * keys are stored in. ':' is stored as '/'. ASCII is widened without any table
+ * lookup, other characters are decomposed and their combining marks put in
+ * canonical order.
+ * str, len: The component.
+ * ustr, maxlen: The destination buffer and its size in characters.
+ * ulenp: Number of BE characters on exit.
+ * return: EINVAL on malformed UTF-8, ENAMETOOLONG if the buffer is too small.
  */
-void hfsp_unicode_copy(struct hfsp_unistr * srcp, struct hfsp_unistr * dstp);
+int hfsp_unicode_from_utf8(const char * str, size_t len, hfsp_unichar * ustr, int maxlen, int * ulenp);
 
 #endif /* _HFSP_UNICODE_H_ */
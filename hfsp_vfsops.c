@@ -11,50 +11,72 @@
 #include <sys/mount.h>
 #include <sys/fcntl.h>
 #include <sys/mutex.h>
+#include <sys/sx.h>
 #include <sys/malloc.h>
 #include <sys/endian.h>
 #include <sys/kobj.h>
 #include <sys/iconv.h>
+#include <sys/sysctl.h>
+#include <sys/syslog.h>
+#include <sys/sbuf.h>
+#include <sys/taskqueue.h>
 
 #include <geom/geom.h>
 #include <geom/geom_vfs.h>
 
 #include "hfsp.h"
 #include "hfsp_unicode.h"
-#include "hfsp_debug.h"
 #include "hfsp_btree.h"
+#include "hfsp_trace.h"
+#include "hfsp_name.h"
+#include "hfsp_link.h"
+#include "hfsp_attr.h"
+#include "hfsp_dir.h"
+#include "hfsp_hotfile.h"
+#include "hfsp_journal.h"
+#include "hfsp_bitmap.h"
+#include "hfsp_jwrite.h"
 
 MALLOC_DEFINE(M_HFSPMNT, "hfsp_mount", "HFS Plus mount structure");
 MALLOC_DEFINE(M_HFSPKEY, "hfsp_record_key", "HFS+ record key");
 
+SYSCTL_NODE(_vfs, OID_AUTO, hfsp, CTLFLAG_RW, 0, "HFS+ filesystem");
+
+/* Largest warmcache manifest file read at mount */
+#define HFSP_MANIFEST_MAXSIZE   (1024 * 1024)
+
+static u_long hfsp_catalogram_max = 512 * 1024 * 1024;
+SYSCTL_ULONG(_vfs_hfsp, OID_AUTO, catalogram_max, CTLFLAG_RW, &hfsp_catalogram_max, 0,
+             "Largest catalog file in bytes loaded in memory by the catalogram option");
+
 static uma_zone_t       uma_inode;
 uma_zone_t       uma_record_key;
+struct taskqueue *      hfsp_taskqueue;
 
 static vfs_mount_t      hfsp_mount;
 static vfs_unmount_t    hfsp_unmount;
 static vfs_statfs_t     hfsp_statfs;
+static vfs_sync_t       hfsp_sync;
 static vfs_init_t       hfsp_init;
 static vfs_uninit_t     hfsp_uninit;
 static vfs_root_t       hfsp_root;
+static vfs_vget_t       hfsp_vget;
+static vfs_fhtovp_t     hfsp_fhtovp;
 
-int hfsp_iget(struct hfspmount * mp, struct HFSPlusForkData * fork, struct hfsp_inode ** ipp);
 void hfsp_freemnt(struct hfspmount * hmp);
-int hfsp_vget(struct mount * mp, hfsp_cnid ino, int flags, struct vnode ** vpp);
 int hfsp_mount_volume(struct vnode * devvp, struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph);
-void udump(char * buff, int size);
-
-void uprint_record(struct hfsp_record * rp);
+static int hfsp_check_header(struct HFSPlusVolumeHeader * hfsph);
 
 static struct vfsops hfsp_vfsops = {
-//    .vfs_fhtovp =   NULL,
+    .vfs_fhtovp =   hfsp_fhtovp,
     .vfs_init =     hfsp_init,
     .vfs_uninit =   hfsp_uninit,
     .vfs_mount =    hfsp_mount,
     .vfs_root =     hfsp_root,
     .vfs_statfs =   hfsp_statfs,
-//    .vfs_sync =     NULL,
+    .vfs_sync =     hfsp_sync,
     .vfs_unmount =  hfsp_unmount,
-//    .vfs_vget =     NULL
+    .vfs_vget =     hfsp_vget
 };
 VFS_SET(hfsp_vfsops, hfsp, 0);
 
@@ -63,7 +85,6 @@ MODULE_DEPEND(hfsp_mod, libiconv, 2, 2, 2);
 static int
 hfsp_init(struct vfsconf * conf)
 {
-    uprintf("HFS+ module initialized\n");
     uma_inode = uma_zcreate("HFS+ inode", sizeof(struct hfsp_inode), NULL, NULL, NULL, NULL,
                             UMA_ALIGN_PTR, 0);
 
@@ -71,27 +92,179 @@ hfsp_init(struct vfsconf * conf)
                                  UMA_ALIGN_PTR, 0);
 
     hfsp_brec_catalogue_read_init();
+    hfsp_trace_init();
+    hfsp_dir_init();
+
+    // The mount time prefetches wait on long series of reads, a second thread
+    // keeps the journal commits from waiting behind them.
+    hfsp_taskqueue = taskqueue_create("hfsp", M_WAITOK, taskqueue_thread_enqueue, &hfsp_taskqueue);
+    taskqueue_start_threads(&hfsp_taskqueue, 2, PVFS, "hfsp taskq");
     return 0;
 }
 
 static int
 hfsp_uninit(struct vfsconf * conf)
 {
+    taskqueue_free(hfsp_taskqueue);
     uma_zdestroy(uma_inode);
     uma_zdestroy(uma_record_key);
-    uprintf("HFS+ module uninitialized\n");
+    hfsp_trace_uninit();
+    hfsp_dir_uninit();
     return 0;
 }
 
+/*
+ * Catalog nodes cached by each mounted volume, one number per line after a
+ * header naming the device. Saved to a file it is given back to the
+ * warmcache mount option.
+ */
+static int
+hfsp_manifest_sysctl(SYSCTL_HANDLER_ARGS)
+{
+    struct mount * mp, * nmp;
+    struct hfsp_btree * btreep;
+    struct sbuf sb;
+    u_int32_t * nums;
+    int count, error, i;
+
+    error = sysctl_wire_old_buffer(req, 0);
+    if (error)
+        return error;
+
+    sbuf_new_for_sysctl(&sb, NULL, 4096, req);
+    mtx_lock(&mountlist_mtx);
+    for (mp = TAILQ_FIRST(&mountlist); mp != NULL; mp = nmp)
+    {
+        if (mp->mnt_op != &hfsp_vfsops || vfs_busy(mp, MBF_NOWAIT | MBF_MNTLSTLOCK))
+        {
+            nmp = TAILQ_NEXT(mp, mnt_list);
+            continue;
+        }
+
+        btreep = VFSTOHFSPMNT(mp)->hm_catalog_bp;
+        if (btreep != NULL)
+        {
+            count = btreep->hb_nodeCount;
+            nums = malloc(max(count, 1) * sizeof(*nums), M_TEMP, M_WAITOK);
+            count = hfsp_btree_cached_nodes(btreep, nums, count);
+            sbuf_printf(&sb, "# %s\n", mp->mnt_stat.f_mntfromname);
+            for (i = 0; i < count; i++)
+                sbuf_printf(&sb, "%u\n", nums[i]);
+            free(nums, M_TEMP);
+        }
+
+        mtx_lock(&mountlist_mtx);
+        nmp = TAILQ_NEXT(mp, mnt_list);
+        vfs_unbusy(mp);
+    }
+    mtx_unlock(&mountlist_mtx);
+
+    error = sbuf_finish(&sb);
+    sbuf_delete(&sb);
+    return error;
+}
+SYSCTL_PROC(_vfs_hfsp, OID_AUTO, manifest, CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+            NULL, 0, hfsp_manifest_sysctl, "A", "Catalog nodes cached by each volume");
+
+/*
+ * Read the catalog nodes of a device from a manifest file. The nodes listed
+ * before any header, or under the header of the device, are kept.
+ * path: The manifest file.
+ * from: The device being mounted.
+ * numsp, countp: The node numbers, allocated in M_TEMP, and their count on exit.
+ */
+static int
+hfsp_manifest_read(const char * path, const char * from, u_int32_t ** numsp, int * countp)
+{
+    struct thread * td;
+    struct nameidata nd;
+    struct vattr va;
+    u_int32_t * nums;
+    char * buf, * p, * end;
+    ssize_t resid;
+    int error, flags, count, match;
+
+    td = curthread;
+    NDINIT(&nd, LOOKUP, FOLLOW, UIO_SYSSPACE, path, td);
+    flags = FREAD;
+    error = vn_open(&nd, &flags, 0, NULL);
+    if (error)
+        return error;
+    NDFREE(&nd, NDF_ONLY_PNBUF);
+
+    buf = NULL;
+    error = VOP_GETATTR(nd.ni_vp, &va, td->td_ucred);
+    if (error == 0 && (nd.ni_vp->v_type != VREG || va.va_size > HFSP_MANIFEST_MAXSIZE))
+        error = EFBIG;
+    if (error == 0)
+    {
+        buf = malloc(va.va_size + 1, M_TEMP, M_WAITOK);
+        error = vn_rdwr(UIO_READ, nd.ni_vp, buf, va.va_size, 0, UIO_SYSSPACE, IO_NODELOCKED,
+                        td->td_ucred, NOCRED, &resid, td);
+    }
+    VOP_UNLOCK(nd.ni_vp, 0);
+    vn_close(nd.ni_vp, FREAD, td->td_ucred, td);
+    if (error)
+    {
+        free(buf, M_TEMP);
+        return error;
+    }
+    buf[va.va_size - resid] = '\0';
+
+    // At most one node every two bytes.
+    nums = malloc((va.va_size / 2 + 1) * sizeof(*nums), M_TEMP, M_WAITOK);
+    count = 0;
+    match = 1;
+    for (p = buf; *p != '\0'; p = end)
+    {
+        end = strchr(p, '\n');
+        if (end == NULL)
+            end = p + strlen(p);
+        else
+            *end++ = '\0';
+
+        if (*p == '#')
+        {
+            for (p++; *p == ' '; p++)
+                continue;
+            match = strcmp(p, from) == 0;
+        }
+        else if (match && *p >= '0' && *p <= '9')
+            nums[count++] = strtoul(p, NULL, 10);
+    }
+    free(buf, M_TEMP);
+
+    if (count == 0)
+    {
+        free(nums, M_TEMP);
+        return ENOENT;
+    }
+    *numsp = nums;
+    *countp = count;
+    return 0;
+}
+
+/*
+ * Prefetch the nodes of the manifest given at mount.
+ */
+static void
+hfsp_warmcache_task(void * arg, int pending)
+{
+    struct hfspmount * hmp;
+
+    hmp = arg;
+    HFSP_TRACE(HFSP_TRACE_INFO, "hfsp_warmcache_task: Prefetching %ju catalog nodes.", hmp->hm_warmCount);
+    hfsp_btree_prefetch(hmp->hm_catalog_bp, hmp->hm_warmNodes, hmp->hm_warmCount);
+}
+
 static int
 hfsp_mount(struct mount *mp)
 {
     struct vfsoptlist * opts;
     struct thread *td;
-    struct vnode *devvp, *vnodecovered;
+    struct vnode *devvp;
     struct nameidata nd, *ndp = &nd;
-    struct vfsopt *opt;
-    char * fromPath;
+    char * fromPath, * manifest;
     int error, len;
     struct buf *bp = NULL;
     struct g_consumer *cp = NULL;
@@ -100,22 +273,17 @@ hfsp_mount(struct mount *mp)
 
     td = curthread;
     opts = mp->mnt_optnew;
-    vnodecovered = mp->mnt_vnodecovered;
-
-    vfs_getopt(opts, "from", (void **)&fromPath, &len);
 
-    uprintf("Mounting device\n");
-    if (vnodecovered != NULL)
+    // Nothing can change on a read only volume but the export list, handled by the caller.
+    if (mp->mnt_flag & MNT_UPDATE)
     {
-        uprintf("Vnodecovered type: %s\n", vnodecovered->v_tag);
+        if (vfs_flagopt(opts, "export", NULL, 0))
+            return 0;
+        return EOPNOTSUPP;
     }
 
-    TAILQ_FOREACH(opt, opts, link) {
-        if (opt->len != 0)
-            uprintf("Option %s value: %s\n", opt->name, opt->value);
-        else
-            uprintf("Empty option %s\n", opt->name);
-    }
+    if (vfs_getopt(opts, "from", (void **)&fromPath, &len) != 0)
+        return EINVAL;
 
     NDINIT(ndp, LOOKUP, FOLLOW | LOCKLEAF, UIO_SYSSPACE, fromPath, td);
     if ((error = namei(ndp)) != 0)
@@ -128,10 +296,6 @@ hfsp_mount(struct mount *mp)
         vput(devvp);
         return error;
     }
-    else
-    {
-        uprintf("Disk device detected\n");
-    }
 
     DROP_GIANT();
     g_topology_lock();
@@ -145,38 +309,104 @@ hfsp_mount(struct mount *mp)
         return error;
     }
 
-    uprintf ("Sector size of %s: %d\nProvider name: %s\nMedia size: %ld\n", fromPath, cp->provider->sectorsize, cp->provider->name, cp->provider->mediasize);
+    HFSP_TRACE(HFSP_TRACE_DEBUG, "hfsp_mount: Sector size %ju, media size %ju.",
+               cp->provider->sectorsize, cp->provider->mediasize);
 
     if ((error = bread(devvp, 2, 512, NOCRED, &bp)) != 0)
         goto out;
 
     bcopy(bp->b_data, &hfsph, sizeof(hfsph));
-    hmp = malloc(sizeof(*hmp), M_HFSPMNT, M_WAITOK | M_ZERO);
     brelse(bp);
     bp = NULL;
+    if ((error = hfsp_check_header(&hfsph)) != 0)
+        goto out;
 
+    hmp = malloc(sizeof(*hmp), M_HFSPMNT, M_WAITOK | M_ZERO);
     hmp->hm_blockSize = be32toh(hfsph.blockSize);
-    hmp->hm_totalBlocks = be32toh(hfsph.totalBlocks);
-    hmp->hm_freeBlocks = be32toh(hfsph.freeBlocks);
     hmp->hm_physBlockSize = cp->provider->sectorsize;
     hmp->hm_dev = devvp->v_rdev;
     hmp->hm_devvp = devvp;
+    hfsp_nametab_init(&hmp->hm_names);
+    hfsp_linkcache_init(&hmp->hm_links);
+    hfsp_attrcache_init(&hmp->hm_attrs);
+    TAILQ_INIT(&hmp->hm_snapLru);
+    sx_init(&hmp->hm_lock, "hfsp_mount");
+
+    // The transactions of a volume not cleanly unmounted are read over the device.
+    if ((error = hfsp_journal_mount(hmp, &hfsph)) != 0)
+        goto out;
+    if (hmp->hm_journal != NULL)
+    {
+        // The volume header is logged as well.
+        if ((error = hfsp_bread_dev(hmp, 2, 512, &bp)) != 0)
+            goto out;
+        bcopy(bp->b_data, &hfsph, sizeof(hfsph));
+        brelse(bp);
+        bp = NULL;
+        if ((error = hfsp_check_header(&hfsph)) != 0)
+            goto out;
+    }
+
+    hmp->hm_signature = be16toh(hfsph.signature);
+    hmp->hm_version = be16toh(hfsph.version);
+    hmp->hm_totalBlocks = be32toh(hfsph.totalBlocks);
+    hmp->hm_freeBlocks = be32toh(hfsph.freeBlocks);
+    hmp->hm_nextAllocation = be32toh(hfsph.nextAllocation);
+    hmp->hm_dataClumpSize = be32toh(hfsph.dataClumpSize);
+    hmp->hm_fileCount = be32toh(hfsph.fileCount);
+    hmp->hm_folderCount = be32toh(hfsph.folderCount);
+    hmp->hm_createDate = be32toh(hfsph.createDate);
+    if (be32toh(hfsph.attributes) & kHFSVolumeJournaledMask)
+        hmp->hm_flags |= HFSP_MNT_JOURNALED;
+    if (vfs_getopt(opts, "nfc", NULL, NULL) == 0)
+        hmp->hm_flags |= HFSP_MNT_NFC;
+    if (vfs_getopt(opts, "catalogram", NULL, NULL) == 0)
+        hmp->hm_flags |= HFSP_MNT_CATALOGRAM;
+
+    if ((error = hfsp_mount_volume(devvp, hmp, &hfsph)) != 0)
+        goto out;
+
+    // Nodes hot at the last mount are read in the background.
+    if (hmp->hm_catalog_bp != NULL &&
+        vfs_getopt(opts, "warmcache", (void **)&manifest, &len) == 0 && len > 0 && manifest[len - 1] == '\0')
+    {
+        error = hfsp_manifest_read(manifest, fromPath, &hmp->hm_warmNodes, &hmp->hm_warmCount);
+        if (error)
+            log(LOG_INFO, "hfsp: %s: warmcache manifest %s not used, error %d\n", fromPath, manifest, error);
+        else
+        {
+            TASK_INIT(&hmp->hm_warmTask, 0, hfsp_warmcache_task, hmp);
+            taskqueue_enqueue(hfsp_taskqueue, &hmp->hm_warmTask);
+        }
+        error = 0;
+    }
+    if (hmp->hm_catalog_bp != NULL && vfs_getopt(opts, "hotfiles", NULL, NULL) == 0)
+        hfsp_hotfile_mount(hmp);
 
-    hfsp_mount_volume(devvp, hmp, &hfsph);
+    // Free space counted from the allocation file rather than trusted from the header.
+    if (vfs_getopt(opts, "bitmap", NULL, NULL) == 0 || vfs_getopt(opts, "verifybitmap", NULL, NULL) == 0)
+    {
+        error = hfsp_bitmap_mount(hmp, &hfsph, vfs_getopt(opts, "verifybitmap", NULL, NULL) == 0);
+        if (error)
+            log(LOG_INFO, "hfsp: %s: allocation file not read, error %d\n", fromPath, error);
+        error = 0;
+    }
+
+    // Metadata of a journaled volume is only written through its journal.
+    if ((error = hfsp_jwrite_mount(hmp, cp, &hfsph)) != 0)
+        goto out;
 
     mp->mnt_data = hmp;
     mp->mnt_stat.f_fsid.val[0] = dev2udev(devvp->v_rdev);
     mp->mnt_stat.f_fsid.val[1] = mp->mnt_vfc->vfc_typenum;
     hmp->hm_cp = cp;
+    dev_ref(hmp->hm_dev);
     MNT_ILOCK(mp);
     mp->mnt_flag |= MNT_LOCAL;
     mp->mnt_kern_flag |= MNTK_LOOKUP_SHARED | MNTK_EXTENDED_SHARED;
     MNT_IUNLOCK(mp);
 
     vfs_mountedfrom(mp, fromPath);
-
-    //error = ENOMEM;
-    //goto out;
     return 0;
 out:
     if (bp)
@@ -198,7 +428,6 @@ int
 hfsp_iget(struct hfspmount * hmp, struct HFSPlusForkData * fork, struct hfsp_inode ** ipp)
 {
     struct hfsp_inode * ip;
-    int i;
 
     ip = uma_zalloc(uma_inode, M_WAITOK | M_ZERO);
     if (ip == NULL)
@@ -207,133 +436,224 @@ hfsp_iget(struct hfspmount * hmp, struct HFSPlusForkData * fork, struct hfsp_ino
         return ENOMEM;
     }
 
-    ip->hi_fork.size = be64toh(fork->logicalSize);
-    ip->hi_fork.totalBlocks = be32toh(fork->totalBlocks);
+    if (fork != NULL)
+        hfsp_fork_decode(&ip->hi_fork, fork);
     ip->hi_mount = hmp;
 
-    for (i = 0; i < HFSP_FIRSTEXTENT_SIZE; i++)
-    {
-        ip->hi_fork.first_extents[i].startBlock = be32toh(fork->extents[i].startBlock);
-        ip->hi_fork.first_extents[i].blockCount = be32toh(fork->extents[i].blockCount);
-    }
-
     *ipp = ip;
     return 0;
 
 }
 
+static int
+hfsp_vget(struct mount * mp, ino_t ino, int flags, struct vnode ** vpp)
+{
+    struct hfspmount * hmp;
+    struct hfsp_record * rp;
+    int error;
+
+    error = vfs_hash_get(mp, ino, flags, curthread, vpp, NULL, NULL);
+    if (error || *vpp != NULL)
+        return error;
+
+    hmp = VFSTOHFSPMNT(mp);
+    rp = NULL;
+    // Listed by a recent readdir, the inode is built without reading the catalogue.
+    error = hfsp_attr_get(hmp, ino, &rp);
+    if (error)
+        error = hfsp_btree_find_cnid(hmp->hm_catalog_bp, ino, &rp);
+    if (error == 0)
+        error = hfsp_vget_record(mp, rp, flags, vpp);
+    else
+        *vpp = NULL;
+
+    if (rp != NULL)
+        hfsp_brec_release_record(&rp);
+    return error;
+}
+
 int
-hfsp_vget(struct mount * mp, hfsp_cnid ino, int flags, struct vnode ** vpp)
+hfsp_vget_record(struct mount * mp, struct hfsp_record * rp, int flags, struct vnode ** vpp)
 {
     struct hfsp_inode * ip;
     struct hfspmount * hmp;
     struct vnode * vp;
-    struct hfsp_record * rp;
     int error;
 
     hmp = VFSTOHFSPMNT(mp);
+
+    // A hard link is presented with the attributes of its indirect node.
+    error = hfsp_link_resolve(hmp, rp);
+    if (error)
+    {
+        *vpp = NULL;
+        return error;
+    }
+
+    error = vfs_hash_get(mp, rp->hr_cnid, flags, curthread, vpp, NULL, NULL);
+    if (error || *vpp != NULL)
+        return error;
+
+    // The new vnode is locked exclusively while it is set up.
+    if ((flags & LK_TYPE_MASK) == LK_SHARED)
+    {
+        flags &= ~LK_TYPE_MASK;
+        flags |= LK_EXCLUSIVE;
+    }
+
     ip = uma_zalloc(uma_inode, M_WAITOK | M_ZERO);
     if (ip == NULL)
     {
+        *vpp = NULL;
         return ENOMEM;
     }
+    ip->hi_mount = hmp;
+    hfsp_inode_fill(ip, rp);
 
     error = getnewvnode("hfsp", mp, &hfsp_vnodeops, &vp);
-
     if (error)
-        goto fail;
+    {
+        hfsp_irelease(ip);
+        *vpp = NULL;
+        return error;
+    }
 
     vp->v_data = ip;
-    ip->hi_mount = hmp;
+    ip->hi_vp = vp;
+    hfsp_vinit(vp, ip);
 
+    lockmgr(vp->v_vnlock, LK_EXCLUSIVE, NULL);
     error = insmntque(vp, mp);
     if (error)
-        goto fail;
-
-    rp = &ip->hi_record;
-    error = hfsp_btree_find_cnid(hmp->hm_catalog_bp, ino, &rp);
-    if (error)
-        goto fail;
+    {
+        hfsp_irelease(ip);
+        *vpp = NULL;
+        return error;
+    }
 
-    hfsp_vinit(vp, ip);
+    error = vfs_hash_insert(vp, ip->hi_cnid, flags, curthread, vpp, NULL, NULL);
+    if (error || *vpp != NULL)
+        return error;
 
     *vpp = vp;
-    return (0);
-
-fail:
-    *vpp = NULL;
-    uma_zfree(uma_inode, ip);
-    return (error);
+    return 0;
 }
 
-int
-hfsp_mount_volume(struct vnode * devvp, struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph)
+/*
+ * Load the catalog in memory for the catalogram option. The volume is still
+ * mounted if it can not be, reading the nodes on demand.
+ */
+static void
+hfsp_catalog_load(struct hfspmount * hmp)
 {
-    struct hfsp_inode * ip;
-    struct hfsp_btree * btreep;
-    struct hfsp_node * np;
-    struct hfsp_record * rp;
-    int error, i;
+    struct timespec start, end;
+    u_int64_t size;
+    int error;
 
-    error = hfsp_iget(hmp, &(hfsph->extentsFile), &ip);
+    size = hmp->hm_catalog_bp->hb_ip->hi_fork.size;
+    nanouptime(&start);
+    error = hfsp_btree_load(hmp->hm_catalog_bp, hfsp_catalogram_max);
+    nanouptime(&end);
     if (error)
     {
-        return error;
+        log(LOG_INFO, "hfsp: %s: catalog of %ju bytes not loaded in memory, error %d\n",
+            devtoname(hmp->hm_dev), (uintmax_t)size, error);
+        return;
     }
-    // Special file use the device vnode
-    ip->hi_vp = hmp->hm_devvp;
 
-    /* We first open the extent special file*/
-    error = hfsp_btree_open(ip, &hmp->hm_extent_bp);
-    if (error)
+    log(LOG_INFO, "hfsp: %s: catalog of %ju bytes loaded in memory in %ju ms\n",
+        devtoname(hmp->hm_dev), (uintmax_t)size,
+        (uintmax_t)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000));
+}
+
+/*
+ * Check the volume header before anything is read from its special files.
+ */
+static int
+hfsp_check_header(struct HFSPlusVolumeHeader * hfsph)
+{
+    u_int32_t blockSize;
+    u_int16_t signature, version;
+
+    signature = be16toh(hfsph->signature);
+    version = be16toh(hfsph->version);
+    blockSize = be32toh(hfsph->blockSize);
+    if (!(signature == kHFSPlusSigWord && version == kHFSPlusVersion) &&
+        !(signature == kHFSXSigWord && version >= kHFSXVersion))
     {
-        return error;
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_check_header: Bad signature %jx, version %jd.", signature, version);
+        return EINVAL;
+    }
+    if (blockSize < DEV_BSIZE || !powerof2(blockSize) || be64toh(hfsph->catalogFile.logicalSize) == 0)
+    {
+        HFSP_TRACE(HFSP_TRACE_ERROR, "hfsp_check_header: Bad block size %ju or empty catalog.", blockSize);
+        return EINVAL;
     }
+    return 0;
+}
 
+int
+hfsp_mount_volume(struct vnode * devvp, struct hfspmount * hmp, struct HFSPlusVolumeHeader * hfsph)
+{
+    struct hfsp_inode * ip;
+    int error;
+
+    // Nothing uses the extents overflow file yet, it is opened on first use.
+    hfsp_fork_decode(&hmp->hm_extentsFork, &hfsph->extentsFile);
+
+    // The root vnode is asked right after the mount, the catalogue can not wait.
     error = hfsp_iget(hmp, &(hfsph->catalogFile), &ip);
     if (error)
     {
         return error;
     }
+    // Special file use the device vnode
     ip->hi_vp = hmp->hm_devvp;
 
     error = hfsp_btree_open(ip, &hmp->hm_catalog_bp);
-
-    btreep = hmp->hm_catalog_bp;
-
-    error = hfsp_get_btnode_from_idx(btreep, btreep->hb_rootNode, &np);
     if (error)
+    {
+        hfsp_irelease(ip);
         return error;
+    }
+    hmp->hm_catalog_bp->hb_flags |= HFSP_BTREE_CATALOG;
 
-    rp = hfsp_brec_alloc();
-    if (rp == NULL)
+    // Names are compared folding case, a case sensitive catalogue would be
+    // searched in the wrong order. The field is only valid on HFSX volumes.
+    if (be16toh(hfsph->signature) == kHFSXSigWord &&
+        hmp->hm_catalog_bp->hb_keyCompareType == kHFSBinaryCompare)
     {
-        error = ENOMEM;
-        return error;
+        log(LOG_ERR, "hfsp: %s: case sensitive HFSX volumes are not supported\n", devtoname(hmp->hm_dev));
+        return EOPNOTSUPP;
     }
 
+    if (hmp->hm_flags & HFSP_MNT_CATALOGRAM)
+        hfsp_catalog_load(hmp);
+    return 0;
+}
+
+int
+hfsp_extent_btree(struct hfspmount * hmp, struct hfsp_btree ** btreepp)
+{
+    struct hfsp_inode * ip;
+    int error;
 
-    for (i = 0;  i < np->hn_numRecords; i++)
+    error = 0;
+    sx_xlock(&hmp->hm_lock);
+    if (hmp->hm_extent_bp == NULL)
     {
-        uprintf("Reading record %d\n", i);
-        error = hfsp_brec_catalogue_read(np, i, &rp);
-        if (!error)
+        error = hfsp_iget(hmp, NULL, &ip);
+        if (error == 0)
         {
-            uprint_record(rp);
+            ip->hi_fork = hmp->hm_extentsFork;
+            ip->hi_vp = hmp->hm_devvp;
+            error = hfsp_btree_open(ip, &hmp->hm_extent_bp);
+            if (error)
+                hfsp_irelease(ip);
         }
     }
-
-    hfsp_release_btnode(np);
-
-    /*uprintf("Search for the root cnid.");
-    error = hfsp_btree_find_cnid(btreep, 2, &rp);
-    if (!error)
-    {
-        uprint_record(rp);
-    }*/
-
-    hfsp_brec_release_record(&rp);
-
+    *btreepp = hmp->hm_extent_bp;
+    sx_xunlock(&hmp->hm_lock);
     return error;
 }
 
@@ -342,37 +662,95 @@ int
 hfsp_statfs(struct mount *mp, struct statfs *sbp)
 {
     struct hfspmount * hfsmp;
-    uprintf("Statfs called.");
+    u_int32_t freeBlocks, used;
 
     hfsmp = VFSTOHFSPMNT(mp);
+    hfsp_bitmap_stat(hfsmp, &freeBlocks, NULL);
+    HFSP_TRACE(HFSP_TRACE_DEBUG, "hfsp_statfs: free blocks %ju", freeBlocks);
 
     sbp->f_bsize = hfsmp->hm_blockSize;
     sbp->f_blocks = hfsmp->hm_totalBlocks;
-    sbp->f_bfree = hfsmp->hm_freeBlocks;
-    sbp->f_files = hfsmp->hm_fileCount;
+    sbp->f_bfree = freeBlocks;
+    sbp->f_bavail = freeBlocks;
+    // A new file needs at least a block and a CNID. df -i shows f_files less
+    // f_ffree as used, the files and folders of the volume.
+    used = hfsmp->hm_fileCount + hfsmp->hm_folderCount;
+    sbp->f_ffree = MIN(0xFFFFFFFFU - used, freeBlocks);
+    sbp->f_files = (uint64_t)used + sbp->f_ffree;
 
     return 0;
 }
 
+/*
+ * Commit the journal transaction, the metadata is written through the journal
+ * only. The syncer does not wait, its next pass finds the transaction committed.
+ */
+static int
+hfsp_sync(struct mount * mp, int waitfor)
+{
+    return hfsp_jwrite_flush(VFSTOHFSPMNT(mp), waitfor == MNT_WAIT);
+}
+
 void
 hfsp_irelease(struct hfsp_inode * ip)
 {
-    if (ip != NULL)
-        uma_zfree(uma_inode, ip);
+    if (ip == NULL)
+        return;
+
+    if (ip->hi_name != NULL)
+        hfsp_name_release(&ip->hi_mount->hm_names, ip->hi_name);
+    hfsp_dir_release(ip);
+    uma_zfree(uma_inode, ip);
 }
 
 void
 hfsp_freemnt(struct hfspmount * hmp)
 {
+    hfsp_jwrite_unmount(hmp);
+    hfsp_bitmap_unmount(hmp);
+    hfsp_hotfile_unmount(hmp);
+    if (hmp->hm_warmNodes != NULL)
+    {
+        taskqueue_drain(hfsp_taskqueue, &hmp->hm_warmTask);
+        free(hmp->hm_warmNodes, M_TEMP);
+    }
     hfsp_btree_close(hmp->hm_extent_bp);
     hfsp_btree_close(hmp->hm_catalog_bp);
+    hfsp_linkcache_destroy(hmp);
+    hfsp_attrcache_destroy(hmp);
+    hfsp_nametab_destroy(&hmp->hm_names);
+    hfsp_journal_unmount(hmp);
+    sx_destroy(&hmp->hm_lock);
     free(hmp, M_HFSPMNT);
 }
 
+static int
+hfsp_fhtovp(struct mount * mp, struct fid * fhp, int flags, struct vnode ** vpp)
+{
+    struct hfsp_fid * hfp;
+    struct vnode * vp;
+    int error;
+
+    hfp = (struct hfsp_fid *)fhp;
+    *vpp = NULL;
+    if (hfp->hf_len != sizeof(*hfp) || hfp->hf_gen != VFSTOHFSPMNT(mp)->hm_createDate)
+        return ESTALE;
+
+    // The vnode hash first, then the thread record of the CNID.
+    error = hfsp_vget(mp, hfp->hf_cnid, flags, &vp);
+    if (error == ENOENT || error == EINVAL)
+        return ESTALE;
+    if (error)
+        return error;
+
+    *vpp = vp;
+    return 0;
+}
+
 static int
 hfsp_root(struct mount * mp, int flags, struct vnode ** vpp)
 {
-    return hfsp_vget(mp, 2, flags, vpp);
+    return hfsp_vget(mp, HFSP_ROOT_FOLDER_CNID, flags, vpp);
 }
 
 static int
@@ -382,19 +760,27 @@ hfsp_unmount(struct mount *mp, int mntflags)
     struct g_consumer * cp;
     struct cdev * devp;
     struct vnode * devvp;
-    uprintf("Unmounted device.\n");
+    int error, flags;
 
     hmp = VFSTOHFSPMNT(mp);
     cp = hmp->hm_cp;
     devvp = hmp->hm_devvp;
     devp = hmp->hm_dev;
 
-    vflush(mp, 0, 0, curthread);
+    // The vnodes reference hmp, nothing is freed while one is busy.
+    flags = 0;
+    if (mntflags & MNT_FORCE)
+        flags |= FORCECLOSE;
+    error = vflush(mp, 0, flags, curthread);
+    if (error)
+        return error;
+
+    // The consumer was saved, hmp is freed.
     hfsp_freemnt(hmp);
 
     DROP_GIANT();
     g_topology_lock();
-    g_vfs_close(hmp->hm_cp);
+    g_vfs_close(cp);
     g_topology_unlock();
     PICKUP_GIANT();
 
@@ -7,38 +7,40 @@
 #include <sys/dirent.h>
 
 #include "hfsp.h"
+#include "hfsp_alloc.h"
 #include "hfsp_btree.h"
 #include "hfsp_debug.h"
+#include "hfsp_trace.h"
+#include "hfsp_link.h"
+#include "hfsp_attr.h"
+#include "hfsp_dir.h"
+#include "hfsp_unicode.h"
 
+static vop_cachedlookup_t hfsp_lookup;
 static vop_reclaim_t    hfsp_reclaim;
 static vop_readdir_t    hfsp_readdir;
 static vop_getattr_t    hfsp_getattr;
 static vop_access_t     hfsp_access;
+static vop_vptofh_t     hfsp_vptofh;
 
 struct vop_vector hfsp_vnodeops = {
     .vop_default = &default_vnodeops,
+    .vop_lookup = vfs_cache_lookup,
+    .vop_cachedlookup = hfsp_lookup,
     .vop_reclaim = hfsp_reclaim,
     .vop_readdir = hfsp_readdir,
     .vop_getattr = hfsp_getattr,
-    .vop_access = hfsp_access
+    .vop_access = hfsp_access,
+    .vop_vptofh = hfsp_vptofh
 };
 
-/* Structure to syntesize the '.' and '..' entry */
-struct hfsp_dot_direntry {
-    u_int32_t   hd_fileNo;      // File number entry
-    u_int16_t   hd_reclen;      // Length of the record. Should be constant.
-    u_int8_t    hd_type;        // file type
-    char        hd_name[3];      // String length
-};
-
-static enum vtype hfsp_record2vtype[] = {VNON, VDIR, VCHR, VNON, VNON};
+static enum vtype hfsp_record2vtype[] = {VNON, VDIR, VREG, VNON, VNON};
 
 int
 hfsp_access(struct vop_access_args * ap)
 {
     struct vnode * vp = ap->a_vp;
     struct hfsp_inode * ip = VTOI(vp);
-    struct hfsp_record * rp = &ip->hi_record;
     accmode_t accmode = ap->a_accmode;
 
     // Disalow write access
@@ -46,7 +48,7 @@ hfsp_access(struct vop_access_args * ap)
         return (EROFS);
     }
 
-    return vaccess(vp->v_type, rp->hr_fileMode, rp->hr_ownerId, rp->hr_groupId, ap->a_accmode, ap->a_cred, NULL);
+    return vaccess(vp->v_type, ip->hi_mode, ip->hi_uid, ip->hi_gid, ap->a_accmode, ap->a_cred, NULL);
 
 }
 
@@ -56,23 +58,41 @@ hfsp_getattr(struct vop_getattr_args *ap)
     struct vattr *vap = ap->a_vap;
     struct vnode *vp = ap->a_vp;
     struct hfsp_inode * ip = VTOI(vp);
-    struct hfsp_record  * recp = &ip->hi_record;
+    struct hfspmount * hmp = ip->hi_mount;
 
-    vap->va_fsid = dev2udev(ip->hi_mount->hm_dev);
-    vap->va_fileid = recp->hr_cnid;
-    if (recp->hr_type == HFSP_FOLDER_RECORD)
+    vap->va_fsid = dev2udev(hmp->hm_dev);
+    vap->va_fileid = ip->hi_cnid;
+    vap->va_uid = ip->hi_uid;
+    vap->va_gid = ip->hi_gid;
+    vap->va_atime.tv_sec = ip->hi_accessDate;
+    vap->va_atime.tv_nsec = 0;
+    vap->va_ctime.tv_sec = ip->hi_changeDate;
+    vap->va_ctime.tv_nsec = 0;
+    vap->va_mtime.tv_sec = ip->hi_modifyDate;
+    vap->va_mtime.tv_nsec = 0;
+    vap->va_birthtime.tv_sec = ip->hi_createDate;
+    vap->va_birthtime.tv_nsec = 0;
+    vap->va_blocksize = hmp->hm_blockSize;
+    vap->va_flags = 0;
+    vap->va_gen = hmp->hm_createDate;
+    vap->va_rdev = NODEV;
+    if (ip->hi_type == HFSP_FOLDER_RECORD)
     {
-        vap->va_atime.tv_sec = recp->hr_folder.hrfo_lstAccessDate;
-        vap->va_atime.tv_nsec = 0;
-        vap->va_ctime.tv_sec = recp->hr_folder.hrfo_lstChangeTime;
-        vap->va_ctime.tv_nsec = 0;
-        vap->va_mtime.tv_sec = recp->hr_folder.hrfo_lstModifyDate;
-        vap->va_mtime.tv_nsec = 0;
-        vap->va_size = 2;//recp->hr_folder.hrfo_valence + 2;
-        vap->va_nlink = recp->hr_linkCount;
-        vap->va_bytes = (recp->hr_folder.hrfo_valence + 2) * HFS_AVERAGE_DIRENTRY_SIZE;
+        vap->va_size = 2;//ip->hi_valence + 2;
+        vap->va_nlink = ip->hi_linkCount;
+        vap->va_bytes = (ip->hi_valence + 2) * HFS_AVERAGE_DIRENTRY_SIZE;
     }
-    vap->va_mode = recp->hr_fileMode & (~S_IFMT);
+    else
+    {
+        vap->va_size = ip->hi_fork.size;
+        // Indirect nodes of hard links keep the number of links.
+        if ((ip->hi_flags & kHFSHasLinkChainMask) && ip->hi_linkCount > 0)
+            vap->va_nlink = ip->hi_linkCount;
+        else
+            vap->va_nlink = 1;
+        vap->va_bytes = (u_int64_t)ip->hi_fork.totalBlocks * hmp->hm_blockSize;
+    }
+    vap->va_mode = ip->hi_mode & (~S_IFMT);
     vap->va_type = vp->v_type;
     return 0;
 }
@@ -86,84 +106,270 @@ hfsp_reclaim(struct vop_reclaim_args * ap)
     vp = ap->a_vp;
     ip = VTOI(vp);
 
+    vfs_hash_remove(vp);
+    hfsp_alloc_release(ip);
     hfsp_irelease(ip);
     vp->v_data = NULL;
     vnode_destroy_vobject(vp);
     return 0;
 }
 
+/* State of a readdir walking the catalogue */
+struct hfsp_readdir_ctx {
+    struct hfspmount *      hrc_mount;
+    struct uio *            hrc_uio;
+    struct hfsp_cookies *   hrc_cookies;
+    off_t                   hrc_cookie;     /* Position of the next record */
+    int                     hrc_utf8Flags;
+    struct dirent           hrc_dirent;
+};
+
+static int
+hfsp_readdir_visit(struct hfsp_record * rp, void * arg)
+{
+    struct hfsp_readdir_ctx * ctxp;
+    struct dirent * dp;
+    off_t pos;
+    int error;
+
+    ctxp = arg;
+    dp = &ctxp->hrc_dirent;
+    pos = HFSP_DIRCOOKIE(rp->hr_nodeOffset >> ctxp->hrc_mount->hm_catalog_bp->hb_nodeShift, rp->hr_recIdx);
+    if (rp->hr_type == HFSP_FOLDER_RECORD || rp->hr_type == HFSP_FILE_RECORD)
+    {
+        if (hfsp_dir_dirent(ctxp->hrc_mount, rp, dp, ctxp->hrc_utf8Flags) != 0)
+            HFSP_TRACE(HFSP_TRACE_WARN, "hfsp_readdir: Skipping entry %jd of node %ju, name too long.",
+                       HFSP_DIRCOOKIE_IDX(pos), HFSP_DIRCOOKIE_NODE(pos));
+        else
+        {
+            if (dp->d_reclen > ctxp->hrc_uio->uio_resid)
+                return EJUSTRETURN;
+            error = uiomove((caddr_t)dp, dp->d_reclen, ctxp->hrc_uio);
+            if (error)
+                return error;
+            if (ctxp->hrc_cookies != NULL)
+                ctxp->hrc_cookies->hc_cookies[ctxp->hrc_cookies->hc_count++] = pos + 1;
+        }
+    }
+    ctxp->hrc_cookie = pos + 1;
+    return 0;
+}
+
 int
 hfsp_readdir(struct vop_readdir_args /* */ *ap)
 {
     struct hfsp_inode * ip;
-    struct vnode * vp;
     struct hfspmount * hmp;
+    struct hfsp_record_key lo, hi;
     struct uio * uio;
-    struct hfsp_record_folder * rfp;
-    struct hfsp_node * np;
-    struct hfsp_dot_direntry dot[2];
+    struct hfsp_readdir_ctx ctx;
+    struct dirent * dp;
+    struct hfsp_cookies cookies, * hcp;
+    off_t cookie;
     int error;
+    bool eof;
 
     uio = ap->a_uio;
     if (uio->uio_offset < 0)
         return EINVAL;
+    if (ap->a_vp->v_type != VDIR)
+        return ENOTDIR;
 
-    vp = ap->a_vp;
     ip = VTOI(ap->a_vp);
-    hmp = VFSTOHFSPMNT(vp->v_mount);
-    rfp = &ip->hi_record.hr_folder;
+    hmp = ip->hi_mount;
+    cookie = uio->uio_offset;
+    eof = false;
+    error = 0;
+    bzero(&ctx, sizeof(ctx));
+    dp = &ctx.hrc_dirent;
+
+    // The NFS server wants the cookie past each entry to resume from it.
+    hcp = NULL;
+    if (ap->a_ncookies != NULL)
+    {
+        cookies.hc_max = uio->uio_resid / HFSP_DIRENT_MINSIZE + 1;
+        cookies.hc_cookies = malloc(cookies.hc_max * sizeof(u_long), M_TEMP, M_WAITOK);
+        cookies.hc_count = 0;
+        hcp = &cookies;
+    }
 
     // We synthesize the '.' and '..'
-    if (uio->uio_offset == 0)
+    while (cookie < HFSP_DIRCOOKIE_FIRST)
     {
-        dot[0].hd_fileNo = ip->hi_record.hr_cnid;
-        dot[0].hd_type = DT_DIR;
-        dot[0].hd_reclen = sizeof(struct hfsp_dot_direntry);
-        dot[0].hd_name[0] = '.';
-        dot[0].hd_name[1] = '\0';
-        dot[0].hd_name[2] = '\0';
-
-
-        dot[1].hd_fileNo = ip->hi_record.hr_parentCnid;
-        dot[1].hd_type = DT_DIR;
-        dot[1].hd_reclen = sizeof(struct hfsp_dot_direntry);
-        dot[1].hd_name[0] = '.';
-        dot[1].hd_name[1] = '.';
-        dot[1].hd_name[2] = '\0';
-
-        error = uiomove((caddr_t)dot, sizeof(dot), uio);
+        dp->d_fileno = cookie == HFSP_DIRCOOKIE_DOT ? ip->hi_cnid : ip->hi_parentCnid;
+        dp->d_type = DT_DIR;
+        dp->d_namlen = cookie + 1;
+        dp->d_name[0] = '.';
+        dp->d_name[1] = cookie == HFSP_DIRCOOKIE_DOT ? '\0' : '.';
+        dp->d_name[2] = '\0';
+        dp->d_reclen = GENERIC_DIRSIZ(dp);
+        if (dp->d_reclen > uio->uio_resid)
+            goto done;
+        error = uiomove((caddr_t)dp, dp->d_reclen, uio);
         if (error)
-            return error;
+            goto done;
+        cookie++;
+        if (hcp != NULL)
+            hcp->hc_cookies[hcp->hc_count++] = cookie;
+    }
 
-        uprintf("Moving uio: %lu, offset: %ld\n", sizeof(dot), uio->uio_offset);
-        udump((caddr_t)dot, sizeof(dot));
+    // Small folders are served from a snapshot, one move per call.
+    error = hfsp_snap_readdir(ip, uio, &cookie, &eof, hcp);
+    if (error != EAGAIN)
+        goto done;
+
+    // Scan the records of the folder, from the thread record or where the last call stopped.
+    ctx.hrc_mount = hmp;
+    ctx.hrc_uio = uio;
+    ctx.hrc_cookies = hcp;
+    ctx.hrc_cookie = cookie;
+    ctx.hrc_utf8Flags = (hmp->hm_flags & HFSP_MNT_NFC) ? HFSP_UTF8_NFC : 0;
+    hfsp_dir_range(ip, &lo, &hi);
+    if (cookie == HFSP_DIRCOOKIE_FIRST)
+        error = hfsp_btree_scan(hmp->hm_catalog_bp, &lo, &hi, 0, hfsp_readdir_visit, &ctx);
+    else
+        error = hfsp_btree_scan_at(hmp->hm_catalog_bp, HFSP_DIRCOOKIE_NODE(cookie), HFSP_DIRCOOKIE_IDX(cookie),
+                                   &hi, 0, hfsp_readdir_visit, &ctx);
+    cookie = ctx.hrc_cookie;
+    if (error == 0)
+        eof = true;
+    else if (error == EJUSTRETURN)
+        error = 0;
+
+done:
+    uio->uio_offset = cookie;
+    if (ap->a_eofflag != NULL)
+        *ap->a_eofflag = eof;
+    if (hcp != NULL)
+    {
+        if (error)
+            free(hcp->hc_cookies, M_TEMP);
+        else
+        {
+            *ap->a_cookies = hcp->hc_cookies;
+            *ap->a_ncookies = hcp->hc_count;
+        }
+    }
+    return error;
+}
+
+int
+hfsp_lookup(struct vop_cachedlookup_args * ap)
+{
+    struct vnode * dvp;
+    struct vnode ** vpp;
+    struct componentname * cnp;
+    struct hfsp_inode * dip;
+    struct hfsp_search_key key;
+    struct hfsp_record * rp;
+    hfsp_cnid cnid;
+    u_int64_t flags;
+    int error, nameiop;
+
+    dvp = ap->a_dvp;
+    vpp = ap->a_vpp;
+    cnp = ap->a_cnp;
+    dip = VTOI(dvp);
+    flags = cnp->cn_flags;
+    nameiop = cnp->cn_nameiop;
+    *vpp = NULL;
+
+    // The volume is read only.
+    if ((flags & ISLASTCN) && (nameiop == DELETE || nameiop == RENAME))
+        return EROFS;
+
+    if (cnp->cn_namelen == 1 && cnp->cn_nameptr[0] == '.')
+    {
+        VREF(dvp);
+        *vpp = dvp;
         return 0;
+    }
 
+    if (flags & ISDOTDOT)
+    {
+        error = vn_vget_ino(dvp, dip->hi_parentCnid, cnp->cn_lkflags, vpp);
+        if (error == 0 && (flags & MAKEENTRY))
+            cache_enter(dvp, *vpp, cnp);
+        return error;
     }
 
-    error = hfsp_get_btnode_from_offset(hmp->hm_catalog_bp, ip->hi_record.hr_nodeOffset, &np);
+    // A name that can not be converted can not be in the catalogue.
+    error = hfsp_search_key_init(&key, dip->hi_cnid, cnp->cn_nameptr, cnp->cn_namelen);
+    if (error == EINVAL)
+        error = ENOENT;
     if (error)
         return error;
 
+    rp = NULL;
+    // A snapshot knows every name of the folder, a live vnode needs no read.
+    error = hfsp_snap_lookup(dip, &key.hsk_key, &cnid);
+    if (error == 0)
+    {
+        error = vfs_hash_get(dvp->v_mount, cnid, cnp->cn_lkflags, curthread, vpp, NULL, NULL);
+        if (error == 0 && *vpp == NULL)
+            error = EAGAIN;
+    }
+    if (error == EAGAIN)
+    {
+        if (hfsp_attr_lookup(dip->hi_mount, &key.hsk_key, &rp) == 0)
+            error = 0;
+        else if (hfsp_dir_absent(dip, &key.hsk_key))
+            error = ENOENT;
+        else
+        {
+            error = hfsp_btree_find_exact(dip->hi_mount->hm_catalog_bp, &key.hsk_key, &rp);
+            if (error == 0 && rp->hr_type != HFSP_FOLDER_RECORD && rp->hr_type != HFSP_FILE_RECORD)
+                error = ENOENT;
+            if (error == ENOENT)
+                hfsp_dir_miss(dip);
+        }
+    }
+    // Hard links are resolved by hfsp_vget_record().
+    if (error == 0 && *vpp == NULL)
+        error = hfsp_vget_record(dvp->v_mount, rp, cnp->cn_lkflags, vpp);
+    if (rp != NULL)
+        hfsp_brec_release_record(&rp);
 
-    while (uio->uio_resid > 0 && uio->uio_offset < rfp->hrfo_valence)
+    if (error == ENOENT)
     {
-        break;
+        if ((flags & ISLASTCN) && nameiop == CREATE)
+            return EROFS;
+        if (flags & MAKEENTRY)
+            cache_enter(dvp, NULL, cnp);
+        return ENOENT;
     }
+    if (error)
+        return error;
 
-    hfsp_release_btnode(np);
-    return EBADF;
+    if (flags & MAKEENTRY)
+        cache_enter(dvp, *vpp, cnp);
+    return 0;
 }
 
 void
 hfsp_vinit(struct vnode * vp, struct hfsp_inode * ip)
 {
     // XXX: Need to discover if it is a FIFO etc.
-    if (ip->hi_record.hr_type < sizeof(hfsp_record2vtype))
-        vp->v_type = hfsp_record2vtype[ip->hi_record.hr_type];
+    if (ip->hi_type >= 0 && ip->hi_type < nitems(hfsp_record2vtype))
+        vp->v_type = hfsp_record2vtype[ip->hi_type];
     else
         vp->v_type = VBAD;
 
     if (ip->hi_cnid == HFSP_ROOT_FOLDER_CNID)
         vp->v_vflag |= VV_ROOT;
 }
+
+int
+hfsp_vptofh(struct vop_vptofh_args * ap)
+{
+    struct hfsp_inode * ip;
+    struct hfsp_fid * hfp;
+
+    ip = VTOI(ap->a_vp);
+    hfp = (struct hfsp_fid *)ap->a_fhp;
+    hfp->hf_len = sizeof(*hfp);
+    hfp->hf_pad = 0;
+    hfp->hf_cnid = ip->hi_cnid;
+    hfp->hf_gen = ip->hi_mount->hm_createDate;
+    return 0;
+}
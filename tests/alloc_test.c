@@ -0,0 +1,416 @@
+/*
+ * Delayed allocation of hfsp_alloc.c over the free extents of hfsp_bitmap.c,
+ * on a volume whose allocation file is held in memory.
+ *
+ * By default, random reserves, assigns, releases and frees on a fragmented
+ * volume. After each step the free extents are compared with the allocation
+ * file, the extents of each fork with the owner of each block, and the blocks
+ * reserved with the forks.
+ *
+ * With -w, four files written sequentially at the same time, as four
+ * processes copying files would. Each file grows by 64KB and is allocated
+ * every 16 writes, as a flush of its buffers would. The extents of each file
+ * are printed: the fewer, the less fragmented.
+ *
+ * usage: alloc_test [seed [iterations]]
+ *        alloc_test -w [clump size in bytes]
+ */
+
+#include "hfsp_bitmap.c"
+#include "hfsp_alloc.c"
+
+#define BLOCK_SIZE      4096
+#define BITMAP_OFFSET   (64 * 1024)     /* Of the allocation file on the disk */
+#define MAX_BLOCKS      (600 * 1000)
+#define FREE            (-1)            /* Owners of the blocks */
+#define USED            (-2)
+#define NFILES          24
+#define NWRITERS        4
+
+#define check(e) do {                                                       \
+    if (!(e))                                                               \
+    {                                                                       \
+        printf("alloc_test: %s failed at line %d\n", #e, __LINE__);         \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+static u_int8_t disk[BITMAP_OFFSET + MAX_BLOCKS / NBBY + BLOCK_SIZE];
+static int owner[MAX_BLOCKS];           /* File of each block, FREE or USED */
+static u_int64_t bitmapSize;
+static struct hfspmount hm;
+static struct hfsp_inode files[NFILES];
+
+struct taskqueue * hfsp_taskqueue;
+
+int
+taskqueue_enqueue(struct taskqueue * queue, struct task * task)
+{
+    hfsp_bitmap_task(&hm, 1);
+    return 0;
+}
+
+void
+taskqueue_drain(struct taskqueue * queue, struct task * task)
+{
+}
+
+int
+hfsp_jwrite_begin(struct hfspmount * hmp)
+{
+    abort();
+}
+
+int
+hfsp_jwrite_end(struct hfspmount * hmp, int error)
+{
+    abort();
+}
+
+int
+hfsp_jwrite_log(struct hfspmount * hmp, daddr_t blkno, const void * data, int size)
+{
+    abort();
+}
+
+int
+hfsp_iget(struct hfspmount * hmp, struct HFSPlusForkData * fork, struct hfsp_inode ** ipp)
+{
+    *ipp = malloc(sizeof(**ipp), M_TEMP, M_WAITOK | M_ZERO);
+    (*ipp)->hi_mount = hmp;
+    (*ipp)->hi_fork.size = bitmapSize;
+    return 0;
+}
+
+void
+hfsp_irelease(struct hfsp_inode * ip)
+{
+    free(ip, M_TEMP);
+}
+
+/*
+ * The allocation file is contiguous.
+ */
+int
+hfsp_bmap_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, daddr_t * blknop, int * sizep,
+                u_int64_t * runp)
+{
+    check(fileOffset + size <= ip->hi_fork.size);
+    *blknop = btodb(BITMAP_OFFSET + fileOffset);
+    *sizep = size;
+    if (runp != NULL)
+        *runp = ip->hi_fork.size - fileOffset;
+    return 0;
+}
+
+int
+hfsp_read_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, void * buf)
+{
+    check(size > 0 && size <= MAXBSIZE);
+    check(fileOffset + size <= ip->hi_fork.size);
+    memcpy(buf, disk + BITMAP_OFFSET + fileOffset, size);
+    return 0;
+}
+
+struct buf *
+getblk(struct vnode * vp, daddr_t blkno, int size, int slpflag, int slptimeo, int flags)
+{
+    struct buf * bp;
+
+    check(size > 0 && size <= MAXBSIZE);
+    bp = malloc(sizeof(*bp), M_TEMP, M_WAITOK | M_ZERO);
+    bp->b_data = malloc(size, M_TEMP, M_WAITOK);
+    bp->b_blkno = blkno;
+    bp->b_bcount = size;
+    return bp;
+}
+
+int
+bwrite(struct buf * bp)
+{
+    check(dbtob(bp->b_blkno) >= BITMAP_OFFSET && bp->b_bcount == BLOCK_SIZE);
+    check(dbtob(bp->b_blkno) + bp->b_bcount <= BITMAP_OFFSET + (off_t)bitmapSize);
+    memcpy(disk + dbtob(bp->b_blkno), bp->b_data, bp->b_bcount);
+    free(bp->b_data, M_TEMP);
+    free(bp, M_TEMP);
+    return 0;
+}
+
+static int
+bit_is_set(u_int32_t block)
+{
+    return (disk[BITMAP_OFFSET + block / NBBY] & (0x80 >> (block % NBBY))) != 0;
+}
+
+/*
+ * Write the owners of the blocks to the allocation file and index it.
+ */
+static void
+mount(u_int32_t totalBlocks, u_int32_t nextAllocation, u_int32_t clumpSize)
+{
+    static struct HFSPlusVolumeHeader vh;
+    static struct g_consumer cp;
+    u_int32_t b;
+
+    bitmapSize = roundup(howmany(totalBlocks, NBBY), BLOCK_SIZE);
+    memset(disk + BITMAP_OFFSET, 0, bitmapSize);
+    for (b = 0; b < bitmapSize * NBBY; b++)
+        if (b >= totalBlocks || owner[b] != FREE)
+            disk[BITMAP_OFFSET + b / NBBY] |= 0x80 >> (b % NBBY);
+
+    cp.acw = 1;
+    hm.hm_cp = &cp;
+    hm.hm_blockSize = BLOCK_SIZE;
+    hm.hm_totalBlocks = totalBlocks;
+    hm.hm_nextAllocation = nextAllocation;
+    hm.hm_dataClumpSize = clumpSize;
+    check(hfsp_bitmap_mount(&hm, &vh, 0) == 0);
+}
+
+/*
+ * Number of extents of a fork.
+ */
+static int
+fork_extents(struct hfsp_inode * ip)
+{
+    int n;
+
+    for (n = 0; n < HFSP_FIRSTEXTENT_SIZE && ip->hi_fork.first_extents[n].blockCount != 0; n++)
+        continue;
+    return n;
+}
+
+static void
+verify(int nfiles)
+{
+    struct hfsp_bitmap * bmp;
+    struct hfsp_fextent * fep;
+    struct hfsp_extent_descriptor * ep;
+    u_int32_t b, nfree, next, largest, extents, reserved, blocks;
+    int i, j, bySize;
+
+    bmp = hm.hm_bitmap;
+    nfree = 0;
+    for (b = 0; b < hm.hm_totalBlocks; b++)
+    {
+        check(bit_is_set(b) == (owner[b] != FREE));
+        if (owner[b] == FREE)
+            nfree++;
+    }
+
+    // The free extents are sorted, merged and cover exactly the free blocks.
+    next = 0;
+    largest = 0;
+    extents = 0;
+    RB_FOREACH(fep, hfsp_fext_start, &bmp->hbm_byStart)
+    {
+        check(fep->hfe_count != 0 && fep->hfe_start >= next);
+        check(extents == 0 || fep->hfe_start > next);
+        for (b = next; b < fep->hfe_start; b++)
+            check(owner[b] != FREE);
+        for (b = fep->hfe_start; b < fep->hfe_start + fep->hfe_count; b++)
+            check(owner[b] == FREE);
+        next = fep->hfe_start + fep->hfe_count;
+        largest = MAX(largest, fep->hfe_count);
+        extents++;
+    }
+    for (b = next; b < hm.hm_totalBlocks; b++)
+        check(owner[b] != FREE);
+    bySize = 0;
+    RB_FOREACH(fep, hfsp_fext_size, &bmp->hbm_bySize)
+        bySize++;
+    check(bySize == extents && extents == bmp->hbm_extents);
+    check(nfree == bmp->hbm_free && largest == bmp->hbm_largest);
+
+    // The extents of the forks are theirs, and only the first are used.
+    reserved = 0;
+    for (i = 0; i < nfiles; i++)
+    {
+        reserved += files[i].hi_delayed;
+        blocks = 0;
+        for (j = 0; j < HFSP_FIRSTEXTENT_SIZE; j++)
+        {
+            ep = &files[i].hi_fork.first_extents[j];
+            check(j <= fork_extents(&files[i]) || ep->blockCount == 0);
+            for (b = ep->startBlock; b < ep->startBlock + ep->blockCount; b++)
+                check(owner[b] == i);
+            blocks += ep->blockCount;
+        }
+        check(blocks == files[i].hi_fork.totalBlocks);
+    }
+    check(reserved == bmp->hbm_reserved);
+}
+
+/*
+ * Record the owner of the blocks an assign added to a fork.
+ * before: The extents of the fork before the assign.
+ */
+static int
+claim(int file, struct hfsp_extent_descriptor * before)
+{
+    struct hfsp_extent_descriptor * ep;
+    u_int32_t b, from;
+    int j, added;
+
+    added = 0;
+    for (j = 0; j < HFSP_FIRSTEXTENT_SIZE; j++)
+    {
+        ep = &files[file].hi_fork.first_extents[j];
+        from = ep->startBlock;
+        if (before[j].blockCount != 0)
+        {
+            // An extent is only extended.
+            check(before[j].startBlock == ep->startBlock);
+            from += before[j].blockCount;
+        }
+        else if (ep->blockCount != 0)
+            added++;
+        for (b = from; b < ep->startBlock + ep->blockCount; b++)
+        {
+            check(owner[b] == FREE);
+            owner[b] = file;
+        }
+    }
+    return added;
+}
+
+/*
+ * Give back the blocks of a run not owned by a file, as a truncate would.
+ */
+static void
+release_run(u_int32_t start, u_int32_t count)
+{
+    check(hfsp_bitmap_mark(&hm, start, count, 0) == 0);
+    hfsp_bitmap_dealloc(&hm, start, count);
+}
+
+static int
+random_test(int seed, int iterations)
+{
+    struct hfsp_extent_descriptor before[HFSP_FIRSTEXTENT_SIZE];
+    struct hfsp_inode * ip;
+    struct hfsp_extent_descriptor * ep;
+    u_int32_t totalBlocks, b, count, delayed;
+    long assigns, extents, efbig, enospc;
+    int iter, i, j, r, used, error;
+
+    // Runs of used and free blocks, a few of them long.
+    totalBlocks = 20000;
+    for (b = 0; b < totalBlocks; )
+    {
+        count = 1 + rand() % (rand() % 4 == 0 ? 400 : 20);
+        used = rand() % 3 == 0;
+        for (; count > 0 && b < totalBlocks; count--, b++)
+            owner[b] = used ? USED : FREE;
+    }
+    mount(totalBlocks, rand() % totalBlocks, BLOCK_SIZE * (1 + rand() % 8));
+    for (i = 0; i < NFILES; i++)
+    {
+        files[i].hi_mount = &hm;
+        files[i].hi_cnid = 16 + i;
+        files[i].hi_fork.clumpSize = rand() % 2 ? BLOCK_SIZE * (rand() % 16) : 0;
+    }
+    verify(NFILES);
+
+    assigns = extents = efbig = enospc = 0;
+    for (iter = 0; iter < iterations; iter++)
+    {
+        i = rand() % NFILES;
+        ip = &files[i];
+        r = rand() % 100;
+        if (r < 50)
+        {
+            error = hfsp_alloc_reserve(ip, ((u_int64_t)ip->hi_fork.totalBlocks + ip->hi_delayed) * BLOCK_SIZE +
+                                       1 + rand() % (BLOCK_SIZE * 64));
+            check(error == 0 || error == ENOSPC);
+            if (error)
+                enospc++;
+        }
+        else if (r < 80)
+        {
+            memcpy(before, ip->hi_fork.first_extents, sizeof(before));
+            delayed = ip->hi_delayed;
+            error = hfsp_alloc_assign(ip);
+            check(error == 0 || error == EFBIG);
+            if (error)
+                efbig++;
+            else
+                check(ip->hi_delayed == 0);
+            if (delayed != 0)
+                assigns++;
+            extents += claim(i, before);
+        }
+        else if (r < 85)
+            hfsp_alloc_release(ip);
+        else if (r < 95)
+        {
+            b = rand() % totalBlocks;
+            for (count = 0; b + count < totalBlocks && owner[b + count] == USED && count < 50; count++)
+                owner[b + count] = FREE;
+            if (count != 0)
+                release_run(b, count);
+        }
+        else
+        {
+            // Truncate the file to nothing.
+            for (j = 0; j < fork_extents(ip); j++)
+            {
+                ep = &ip->hi_fork.first_extents[j];
+                for (b = ep->startBlock; b < ep->startBlock + ep->blockCount; b++)
+                    owner[b] = FREE;
+                release_run(ep->startBlock, ep->blockCount);
+            }
+            bzero(ip->hi_fork.first_extents, sizeof(ip->hi_fork.first_extents));
+            ip->hi_fork.totalBlocks = 0;
+        }
+        verify(NFILES);
+    }
+
+    printf("alloc_test: seed %d: %ld assigns, %ld extents added, %ld refused as EFBIG, %ld as ENOSPC, "
+           "%lu extended in place\n", seed, assigns, extents, efbig, enospc, hfsp_alloc_inplace);
+    return 0;
+}
+
+static int
+writers_test(u_int32_t clumpSize)
+{
+    struct hfsp_extent_descriptor before[HFSP_FIRSTEXTENT_SIZE];
+    u_int32_t totalBlocks, b;
+    int write, i;
+
+    // An empty volume larger than one buffer of its allocation file.
+    totalBlocks = MAX_BLOCKS;
+    for (b = 0; b < totalBlocks; b++)
+        owner[b] = b < 64 ? USED : FREE;
+    mount(totalBlocks, 64, clumpSize);
+    for (i = 0; i < NWRITERS; i++)
+        files[i].hi_mount = &hm;
+
+    for (write = 0; write < NWRITERS * 64; write++)
+    {
+        i = write % NWRITERS;
+        check(hfsp_alloc_reserve(&files[i], (u_int64_t)(write / NWRITERS + 1) * 16 * BLOCK_SIZE) == 0);
+        if (write / NWRITERS % 16 == 15)
+        {
+            memcpy(before, files[i].hi_fork.first_extents, sizeof(before));
+            check(hfsp_alloc_assign(&files[i]) == 0);
+            claim(i, before);
+        }
+    }
+    verify(NWRITERS);
+
+    for (i = 0; i < NWRITERS; i++)
+        printf("alloc_test: clump %u: file %d: %u blocks in %d extents\n", clumpSize, i,
+               files[i].hi_fork.totalBlocks, fork_extents(&files[i]));
+    return 0;
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-w") == 0)
+        return writers_test(argc > 2 ? atoi(argv[2]) : 0);
+
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    return random_test(argc > 1 ? atoi(argv[1]) : 1, argc > 2 ? atoi(argv[2]) : 20000);
+}
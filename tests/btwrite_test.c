@@ -0,0 +1,406 @@
+/*
+ * Random inserts and deletes in a catalog B-tree held in memory, through the
+ * transactions of hfsp_btwrite.c. After each commit or abort the tree is
+ * checked by hfsp_btree_check() and its leaves are compared with a sorted
+ * model of the records.
+ *
+ * usage: btwrite_test [-s] [-v] [seed [iterations]]
+ * -s: Node 37 crosses two extents, it is written piece by piece.
+ * -v: Index keys of variable length, as in the catalog file.
+ */
+
+#include "hfsp_btwrite.c"
+
+#define NODE_SIZE       1024
+#define NODE_SHIFT      10
+#define TOTAL_NODES     6000
+#define SPLIT_NODE      37
+#define SPLIT_GAP       1000            /* Sectors between the two extents */
+#define MODEL_MAX       20000
+
+#define check(e) do {                                                       \
+    if (!(e))                                                               \
+    {                                                                       \
+        printf("btwrite_test: %s failed at line %d\n", #e, __LINE__);       \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+static u_int8_t disk[TOTAL_NODES * NODE_SIZE];
+static u_int64_t splitOffset = (u_int64_t)TOTAL_NODES * NODE_SIZE;
+static long nwrites, nbytes;
+
+/* Record of the model, sorted as the leaves */
+struct model_rec {
+    u_int8_t    mr_key[64];
+    int         mr_len;
+    u_int8_t    mr_tag;                 /* First byte of the data */
+};
+static struct model_rec model[MODEL_MAX], saved[MODEL_MAX];
+static int nmodel, nsaved;
+
+int
+hfsp_unicode_cmp(const hfsp_unichar * lstr, int llen, const hfsp_unichar * rstr, int rlen)
+{
+    int i;
+
+    for (i = 0; i < llen && i < rlen; i++)
+        if (be16toh(lstr[i]) != be16toh(rstr[i]))
+            return be16toh(lstr[i]) < be16toh(rstr[i]) ? -1 : 1;
+    return llen < rlen ? -1 : llen > rlen;
+}
+
+int
+hfsp_get_btnode_from_idx(struct hfsp_btree * btreep, u_int32_t num, struct hfsp_node ** npp)
+{
+    struct hfsp_node * np;
+    struct BTNodeDescriptor * desc;
+
+    check(num < TOTAL_NODES);
+    np = malloc(sizeof(*np) + NODE_SIZE, M_TEMP, M_WAITOK | M_ZERO);
+    np->hn_beginBuf = (u_int8_t *)(np + 1);
+    memcpy(np->hn_beginBuf, disk + num * NODE_SIZE, NODE_SIZE);
+    desc = (struct BTNodeDescriptor *)np->hn_beginBuf;
+    np->hn_kind = desc->kind;
+    np->hn_height = desc->height;
+    np->hn_numRecords = be16toh(desc->numRecords);
+    np->hn_next = be32toh(desc->fLink);
+    np->hn_prev = be32toh(desc->bLink);
+    np->hn_nodeSize = NODE_SIZE;
+    *npp = np;
+    return 0;
+}
+
+void
+hfsp_release_btnode(struct hfsp_node * np)
+{
+    free(np, M_TEMP);
+}
+
+void
+hfsp_btree_update_node(struct hfsp_btree * btreep, u_int32_t num, u_int8_t * data)
+{
+}
+
+/*
+ * The B-tree file has two extents, the second one SPLIT_GAP sectors after the
+ * end of the first.
+ */
+int
+hfsp_bmap_inode(struct hfsp_inode * ip, u_int64_t fileOffset, int size, daddr_t * blknop, int * sizep,
+                u_int64_t * runp)
+{
+    if (fileOffset < splitOffset)
+    {
+        *blknop = btodb(fileOffset);
+        *runp = splitOffset - fileOffset;
+    }
+    else
+    {
+        *blknop = btodb(fileOffset) + SPLIT_GAP;
+        *runp = (u_int64_t)TOTAL_NODES * NODE_SIZE - fileOffset;
+    }
+    *sizep = size;
+    return 0;
+}
+
+static off_t
+disk_offset(daddr_t blkno)
+{
+    if (dbtob(blkno) >= splitOffset + dbtob(SPLIT_GAP))
+        blkno -= SPLIT_GAP;
+    return dbtob(blkno);
+}
+
+int
+hfsp_jwrite_begin(struct hfspmount * hmp)
+{
+    abort();
+}
+
+int
+hfsp_jwrite_end(struct hfspmount * hmp, int error)
+{
+    abort();
+}
+
+int
+hfsp_jwrite_log(struct hfspmount * hmp, daddr_t blkno, const void * data, int size)
+{
+    abort();
+}
+
+struct buf *
+getblk(struct vnode * vp, daddr_t blkno, int size, int slpflag, int slptimeo, int flags)
+{
+    struct buf * bp;
+
+    check(size > 0 && size <= MAXBSIZE);
+    if (flags & GB_NOCREAT)
+        return NULL;
+    bp = malloc(sizeof(*bp), M_TEMP, M_WAITOK | M_ZERO);
+    bp->b_data = malloc(size, M_TEMP, M_WAITOK);
+    bp->b_blkno = blkno;
+    bp->b_bcount = size;
+    return bp;
+}
+
+void
+brelse(struct buf * bp)
+{
+    free(bp->b_data, M_TEMP);
+    free(bp, M_TEMP);
+}
+
+int
+bwrite(struct buf * bp)
+{
+    off_t offset;
+
+    offset = disk_offset(bp->b_blkno);
+    check(offset + bp->b_bcount <= (off_t)sizeof(disk));
+    check(offset >= (off_t)splitOffset || offset + bp->b_bcount <= (off_t)splitOffset);
+    memcpy(disk + offset, bp->b_data, bp->b_bcount);
+    nwrites++;
+    nbytes += bp->b_bcount;
+    brelse(bp);
+    return 0;
+}
+
+void
+bawrite(struct buf * bp)
+{
+    bwrite(bp);
+}
+
+int
+bufobj_wwait(struct bufobj * bo, int slpflag, int timeo)
+{
+    return 0;
+}
+
+/*
+ * A catalog key of a name of up to 11 characters out of 4, in 40 folders.
+ */
+static void
+random_key(u_int8_t * key)
+{
+    int i, len;
+
+    len = rand() % 12;
+    be16enc(key, 6 + 2 * len);
+    be32enc(key + 2, 16 + rand() % 40);
+    be16enc(key + 6, len);
+    for (i = 0; i < len; i++)
+        be16enc(key + 8 + 2 * i, 'a' + rand() % 4);
+}
+
+/*
+ * Index of a key in the model, or of the first record after it.
+ */
+static int
+model_find(const u_int8_t * key, int * exact)
+{
+    int lo, hi, mid, c;
+
+    *exact = 0;
+    for (lo = 0, hi = nmodel - 1; lo <= hi; )
+    {
+        mid = (lo + hi) / 2;
+        c = hfsp_btkey_catalog_cmp(model[mid].mr_key, key);
+        if (c == 0)
+        {
+            *exact = 1;
+            return mid;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/*
+ * Compare the leaves on the disk with the model.
+ */
+static void
+verify(struct hfsp_btree * btreep)
+{
+    u_int8_t * nd;
+    u_int32_t num;
+    int i, r, n, off, next, klen;
+
+    check(hfsp_btree_check(btreep, hfsp_btkey_catalog_cmp) == 0);
+    i = 0;
+    for (num = btreep->hb_firstLeafNode; num != 0; num = be32dec(nd))
+    {
+        nd = disk + num * NODE_SIZE;
+        n = be16dec(nd + 10);
+        for (r = 0; r < n; r++, i++)
+        {
+            off = be16dec(nd + NODE_SIZE - 2 * (r + 1));
+            next = be16dec(nd + NODE_SIZE - 2 * (r + 2));
+            klen = 2 + be16dec(nd + off);
+            check(i < nmodel);
+            check(memcmp(nd + off, model[i].mr_key, klen) == 0);
+            check(next - off == roundup2(roundup2(klen, 2) + model[i].mr_len, 2));
+            check(model[i].mr_len == 0 || nd[off + roundup2(klen, 2)] == model[i].mr_tag);
+        }
+    }
+    check(i == nmodel);
+}
+
+/*
+ * An empty tree: the header node, a map node, no root.
+ */
+static void
+format(struct hfsp_btree * btreep, int varidx)
+{
+    u_int8_t * hdr, * map;
+
+    memset(disk, 0, sizeof(disk));
+    hdr = disk;
+    be32enc(hdr, 1);
+    hdr[8] = HFSP_NODE_HEADER;
+    be16enc(hdr + 10, 3);
+    be16enc(hdr + NODE_SIZE - 2, 14);
+    be16enc(hdr + NODE_SIZE - 4, 120);
+    be16enc(hdr + NODE_SIZE - 6, 248);
+    be16enc(hdr + NODE_SIZE - 8, NODE_SIZE - 8);
+    hdr[248] = 0xc0;                    /* Header and map nodes in use */
+
+    map = disk + NODE_SIZE;
+    map[8] = HFSP_NODE_MAP;
+    be16enc(map + 10, 1);
+    be16enc(map + NODE_SIZE - 2, 14);
+    be16enc(map + NODE_SIZE - 4, NODE_SIZE - 4);
+
+    btreep->hb_nodeSize = NODE_SIZE;
+    btreep->hb_nodeShift = NODE_SHIFT;
+    btreep->hb_totalNodes = TOTAL_NODES;
+    btreep->hb_freeNodes = TOTAL_NODES - 2;
+    btreep->hb_attributes = HFSP_BT_BIGKEYS;
+    btreep->hb_maxKeyLength = 40;
+    if (varidx)
+    {
+        btreep->hb_attributes |= HFSP_BT_VARIDXKEYS;
+        btreep->hb_maxKeyLength = 516;
+    }
+}
+
+int
+main(int argc, char ** argv)
+{
+    static struct hfsp_btree bt;
+    static struct hfsp_inode ip;
+    static struct hfspmount hm;
+    static struct g_consumer cp;
+    static struct vnode devvp;
+    struct hfsp_bttx * txp;
+    u_int8_t key[64], data[120];
+    int seed, iterations, varidx, iter, op, ops, grow, idx, exact, error, len, maxRecords;
+    long total;
+
+    seed = 1;
+    iterations = 20000;
+    varidx = 0;
+    for (argc--, argv++; argc > 0 && argv[0][0] == '-'; argc--, argv++)
+    {
+        if (strcmp(argv[0], "-s") == 0)
+            splitOffset = SPLIT_NODE * NODE_SIZE + NODE_SIZE / 2;
+        else if (strcmp(argv[0], "-v") == 0)
+            varidx = 1;
+        else
+        {
+            printf("usage: btwrite_test [-s] [-v] [seed [iterations]]\n");
+            return 2;
+        }
+    }
+    if (argc > 0)
+        seed = atoi(argv[0]);
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+
+    srand(seed);
+    format(&bt, varidx);
+    cp.acw = 1;
+    hm.hm_cp = &cp;
+    hm.hm_devvp = &devvp;
+    ip.hi_mount = &hm;
+    bt.hb_ip = &ip;
+
+    total = 0;
+    maxRecords = 0;
+    for (iter = 0; iter < iterations; iter++)
+    {
+        memcpy(saved, model, nmodel * sizeof(model[0]));
+        nsaved = nmodel;
+        check(hfsp_bttx_begin(&bt, hfsp_btkey_catalog_cmp, &txp) == 0);
+
+        // Phases of 500 transactions: grow, shrink, then both. The first one
+        // only inserts, it fills a few hundred nodes numbered in a row: their
+        // writes are coalesced up to the largest buffer.
+        grow = (iter / 500) % 3 == 0 ? 60 : (iter / 500) % 3 == 1 ? 20 : 45;
+        ops = 1 + rand() % 60;
+        if (iter == 0)
+        {
+            grow = 100;
+            ops = 2000;
+        }
+        for (op = 0; op < ops; op++, total++)
+        {
+            random_key(key);
+            idx = model_find(key, &exact);
+            if (rand() % 100 < grow)
+            {
+                len = rand() % 100;
+                memset(data, rand(), len);
+                error = hfsp_bttx_insert(txp, key, data, len);
+                check(error == (exact ? EEXIST : 0));
+                if (error == 0)
+                {
+                    check(nmodel < MODEL_MAX);
+                    memmove(&model[idx + 1], &model[idx], (nmodel - idx) * sizeof(model[0]));
+                    memcpy(model[idx].mr_key, key, sizeof(key));
+                    model[idx].mr_len = len;
+                    model[idx].mr_tag = data[0];
+                    nmodel++;
+                }
+            }
+            else
+            {
+                // Most deletes hit a record.
+                if (nmodel > 0 && rand() % 10 != 0)
+                {
+                    idx = rand() % nmodel;
+                    memcpy(key, model[idx].mr_key, sizeof(key));
+                    exact = 1;
+                }
+                error = hfsp_bttx_delete(txp, key);
+                check(error == (exact ? 0 : ENOENT));
+                if (error == 0)
+                {
+                    memmove(&model[idx], &model[idx + 1], (nmodel - idx - 1) * sizeof(model[0]));
+                    nmodel--;
+                }
+            }
+        }
+
+        if (rand() % 10 == 0)
+        {
+            hfsp_bttx_abort(txp);
+            memcpy(model, saved, nsaved * sizeof(model[0]));
+            nmodel = nsaved;
+        }
+        else
+            check(hfsp_bttx_commit(txp) == 0);
+        maxRecords = MAX(maxRecords, nmodel);
+        verify(&bt);
+    }
+
+    printf("btwrite_test: seed %d: %ld operations, %d records, at most %d, depth %u, %u free nodes, "
+           "%ld writes of %ld bytes\n", seed, total, nmodel, maxRecords, bt.hb_treeDepth, bt.hb_freeNodes,
+           nwrites, nbytes);
+    return 0;
+}
@@ -0,0 +1,311 @@
+/*
+ * Random operations logged through the journal writer of hfsp_jwrite.c on a
+ * disk in memory. The task committing the transactions runs at random points,
+ * and after each commit or flush a copy of the disk is replayed by the reader
+ * of hfsp_journal.c as a mount after a crash would: the metadata must be the
+ * one of the last transaction committed. Reads through the transactions must
+ * see the last write.
+ *
+ * usage: jwrite_test [seed [iterations]]
+ */
+
+#include "hfsp_journal.c"
+#include "hfsp_jwrite.c"
+
+#define DISK_SIZE       (4 * 1024 * 1024)
+#define JOURNAL_OFFSET  (64 * 1024)
+#define JOURNAL_SIZE    (256 * 1024)
+#define DATA_OFFSET     (1024 * 1024)
+#define DATA_SIZE       (1024 * 1024 + 16 * 512)
+
+#define check(e) do {                                                       \
+    if (!(e))                                                               \
+    {                                                                       \
+        printf("jwrite_test: %s failed at line %d\n", #e, __LINE__);        \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+/* The disk, what it holds once all is written, once the last commit is replayed */
+static u_int8_t disk[DISK_SIZE], model[DISK_SIZE], committed[DISK_SIZE];
+/* Copy of the disk replayed, bread() reads it while set */
+static u_int8_t crashed[DISK_SIZE];
+static u_int8_t * reading = disk;
+static struct hfsp_jwriter * jwriter;
+static int queued;
+static long nflushes, nwrites, journalBytes;
+
+struct taskqueue * hfsp_taskqueue;
+
+MALLOC_DEFINE(M_HFSPMNT, "hfsp mount", "hfsp mount");
+
+void
+wakeup(void * chan)
+{
+}
+
+int
+taskqueue_enqueue_timeout(struct taskqueue * queue, struct timeout_task * task, int ticks)
+{
+    queued = 1;
+    return 0;
+}
+
+int
+taskqueue_cancel_timeout(struct taskqueue * queue, struct timeout_task * task, u_int * pendp)
+{
+    queued = 0;
+    return 0;
+}
+
+void
+taskqueue_drain_timeout(struct taskqueue * queue, struct timeout_task * task)
+{
+}
+
+struct buf *
+getblk(struct vnode * vp, daddr_t blkno, int size, int slpflag, int slptimeo, int flags)
+{
+    struct buf * bp;
+
+    check(size > 0 && size <= MAXBSIZE && size % DEV_BSIZE == 0);
+    check(dbtob(blkno) + size <= DISK_SIZE);
+    if (flags & GB_NOCREAT)
+        return NULL;
+    bp = malloc(sizeof(*bp), M_TEMP, M_WAITOK | M_ZERO);
+    bp->b_data = malloc(size, M_TEMP, M_WAITOK);
+    bp->b_blkno = blkno;
+    bp->b_bcount = size;
+    return bp;
+}
+
+int
+bread(struct vnode * vp, daddr_t blkno, int size, struct ucred * cred, struct buf ** bpp)
+{
+    *bpp = getblk(vp, blkno, size, 0, 0, 0);
+    memcpy((*bpp)->b_data, reading + dbtob(blkno), size);
+    return 0;
+}
+
+void
+brelse(struct buf * bp)
+{
+    free(bp->b_data, M_TEMP);
+    free(bp, M_TEMP);
+}
+
+int
+bwrite(struct buf * bp)
+{
+    off_t offset;
+
+    offset = dbtob(bp->b_blkno);
+    if (offset >= JOURNAL_OFFSET && offset < JOURNAL_OFFSET + JOURNAL_SIZE)
+        journalBytes += bp->b_bcount;
+    memcpy(disk + offset, bp->b_data, bp->b_bcount);
+    nwrites++;
+    brelse(bp);
+    return 0;
+}
+
+void
+bawrite(struct buf * bp)
+{
+    bwrite(bp);
+}
+
+int
+bufobj_wwait(struct bufobj * bo, int slpflag, int timeo)
+{
+    return 0;
+}
+
+int
+g_io_flush(struct g_consumer * cp)
+{
+    nflushes++;
+    return 0;
+}
+
+/*
+ * Replay the journal of a copy of the disk and compare the metadata with the
+ * last transaction committed.
+ */
+static void
+crash_check(void)
+{
+    static struct hfspmount hm;
+    struct HFSPlusVolumeHeader vh;
+
+    memcpy(crashed, disk, DISK_SIZE);
+    reading = crashed;
+    memset(&hm, 0, sizeof(hm));
+    hm.hm_blockSize = 4096;
+    hm.hm_physBlockSize = 512;
+    memcpy(&vh, crashed + 1024, sizeof(vh));
+    check(!(be32toh(vh.attributes) & kHFSVolumeUnmountedMask));
+    check(hfsp_journal_mount(&hm, &vh) == 0);
+    if (hm.hm_journal != NULL)
+    {
+        hfsp_journal_apply(hm.hm_journal, btodb(DATA_OFFSET), crashed + DATA_OFFSET, DATA_SIZE);
+        hfsp_journal_unmount(&hm);
+    }
+    check(memcmp(crashed + DATA_OFFSET, committed + DATA_OFFSET, DATA_SIZE) == 0);
+    reading = disk;
+}
+
+/*
+ * Run the task, as the timeout would.
+ */
+static void
+run_task(void)
+{
+    int commit;
+
+    commit = jwriter->hjw_open->htr_count != 0;
+    if (commit)
+        memcpy(committed, model, DISK_SIZE);
+    queued = 0;
+    hfsp_jwrite_task(jwriter, 1);
+    if (commit)
+        crash_check();
+}
+
+/*
+ * A thread waiting for a commit or a flush, only the task wakes it up.
+ */
+int
+msleep(void * chan, struct mtx * mtx, int pri, const char * wmesg, int timo)
+{
+    // The operations are not concurrent, they never run at a commit.
+    check(chan != &jwriter->hjw_ops);
+    if (jwriter->hjw_open->htr_count != 0)
+        memcpy(committed, model, DISK_SIZE);
+    hfsp_jwrite_task(jwriter, 1);
+    return 0;
+}
+
+/*
+ * A journaled volume, its journal empty.
+ */
+static void
+format(void)
+{
+    struct HFSPlusVolumeHeader * vhp;
+    struct JournalInfoBlock * jibp;
+    struct journal_header * jhp;
+    int i;
+
+    for (i = 0; i < DISK_SIZE; i++)
+        disk[i] = rand();
+    memset(disk, 0, DATA_OFFSET);
+    vhp = (struct HFSPlusVolumeHeader *)(disk + 1024);
+    vhp->attributes = htobe32(kHFSVolumeJournaledMask | kHFSVolumeUnmountedMask);
+    vhp->journalInfoBlock = htobe32(1);
+    jibp = (struct JournalInfoBlock *)(disk + 4096);
+    jibp->flags = htobe32(kJIJournalInFSMask);
+    jibp->offset = htobe64(JOURNAL_OFFSET);
+    jibp->size = htobe64(JOURNAL_SIZE);
+    jhp = (struct journal_header *)(disk + JOURNAL_OFFSET);
+    jhp->magic = JOURNAL_HEADER_MAGIC;
+    jhp->endian = JOURNAL_HEADER_ENDIAN;
+    jhp->start = jhp->end = 512;
+    jhp->size = JOURNAL_SIZE;
+    jhp->blhdr_size = 4096;
+    jhp->jhdr_size = 512;
+    jhp->checksum = 0;
+    jhp->checksum = hfsp_journal_cksum(jhp, JOURNAL_HEADER_CKSUM_SIZE);
+}
+
+int
+main(int argc, char ** argv)
+{
+    static struct hfspmount hm;
+    static struct vnode devvp;
+    static struct g_consumer cp;
+    static struct cdev dev;
+    static u_int8_t buf[MAXBSIZE];
+    struct HFSPlusVolumeHeader vh;
+    struct journal_header * jhp;
+    int seed, iterations, iter, i, n, r, size;
+    long ops;
+    off_t offset;
+
+    seed = argc > 1 ? atoi(argv[1]) : 1;
+    iterations = argc > 2 ? atoi(argv[2]) : 20000;
+    srand(seed);
+    format();
+
+    hm.hm_blockSize = 4096;
+    hm.hm_physBlockSize = 512;
+    hm.hm_devvp = &devvp;
+    hm.hm_dev = &dev;
+    cp.acw = 1;
+    memcpy(&vh, disk + 1024, sizeof(vh));
+    check(hfsp_jwrite_mount(&hm, &cp, &vh) == 0);
+    check(hm.hm_jwriter != NULL);
+    jwriter = hm.hm_jwriter;
+    memcpy(model, disk, DISK_SIZE);
+    memcpy(committed, disk, DISK_SIZE);
+    crash_check();
+
+    ops = 0;
+    for (iter = 0; iter < iterations; iter++)
+    {
+        ticks++;
+        r = rand() % 100;
+        if (r < 60)
+        {
+            // An operation of a few blocks, some of them overlapping.
+            check(hfsp_jwrite_begin(&hm) == 0);
+            n = 1 + rand() % 6;
+            for (i = 0; i < n; i++)
+            {
+                size = DEV_BSIZE * (1 + rand() % 16);
+                offset = DATA_OFFSET + DEV_BSIZE * (rand() % 2048);
+                memset(buf, rand(), size);
+                buf[rand() % size] = rand();
+                check(hfsp_jwrite_log(&hm, btodb(offset), buf, size) == 0);
+                memcpy(model + offset, buf, size);
+            }
+            check(hfsp_jwrite_end(&hm, 0) == 0);
+            ops++;
+        }
+        else if (r < 80)
+        {
+            // A read of the device, through the transactions not yet in place.
+            size = DEV_BSIZE * (1 + rand() % 128);
+            offset = DATA_OFFSET + DEV_BSIZE * (rand() % 2048);
+            memcpy(buf, disk + offset, size);
+            hfsp_jwrite_apply(jwriter, btodb(offset), buf, size);
+            check(memcmp(buf, model + offset, size) == 0);
+        }
+        else if (r < 95)
+        {
+            if (queued)
+                run_task();
+        }
+        else if (r < 97)
+        {
+            memcpy(committed, model, DISK_SIZE);
+            check(hfsp_jwrite_flush(&hm, 1) == 0);
+            check(jwriter->hjw_durable == jwriter->hjw_committed);
+            check(jwriter->hjw_open->htr_count == 0);
+            crash_check();
+        }
+        else
+            crash_check();
+    }
+
+    // Everything in place, the journal empty and the volume clean.
+    hfsp_jwrite_unmount(&hm);
+    check(memcmp(disk + DATA_OFFSET, model + DATA_OFFSET, DATA_SIZE) == 0);
+    memcpy(&vh, disk + 1024, sizeof(vh));
+    check(be32toh(vh.attributes) & kHFSVolumeUnmountedMask);
+    jhp = (struct journal_header *)(disk + JOURNAL_OFFSET);
+    check(jhp->start == jhp->end);
+
+    printf("jwrite_test: seed %d: %ld operations, %lu commits, %ld flushes, %ld writes, %ld bytes to the journal\n",
+           seed, ops, hfsp_jwrite_commits, nflushes, nwrites, journalBytes);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * The kernel functions every test needs, over the libc. This file does not
+ * include kern/kern.h, which renames malloc() and free().
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define M_ZERO  0x0100      /* As in kern/kern.h */
+
+struct malloc_type;
+struct cdev;
+
+int hz = 1000;
+int ticks;
+int desiredvnodes = 1000;
+
+void *
+kern_malloc(size_t size, struct malloc_type * type, int flags)
+{
+    void * p;
+
+    p = malloc(size != 0 ? size : 1);
+    if (p == NULL)
+        abort();
+    if (flags & M_ZERO)
+        memset(p, 0, size);
+    return p;
+}
+
+void
+kern_free(void * p, struct malloc_type * type)
+{
+    free(p);
+}
+
+/*
+ * Messages of the system log, printed only if TESTS_LOG is set.
+ */
+void
+kern_log(int level, const char * fmt, ...)
+{
+    va_list ap;
+
+    if (getenv("TESTS_LOG") == NULL)
+        return;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * Heads of LIST_HEAD() are a single pointer, all NULL once initialized.
+ */
+void *
+hashinit(int elements, struct malloc_type * type, unsigned long * hashmask)
+{
+    unsigned long size;
+
+    for (size = 1; size <= (unsigned long)elements; size <<= 1)
+        continue;
+    size >>= 1;
+    *hashmask = size - 1;
+    return kern_malloc(size * sizeof(void *), type, M_ZERO);
+}
+
+void
+hashdestroy(void * table, struct malloc_type * type, unsigned long hashmask)
+{
+    free(table);
+}
+
+const char *
+devtoname(struct cdev * dev)
+{
+    return "md0";
+}
+
+void
+nanouptime(struct timespec * ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
@@ -0,0 +1,267 @@
+/*
+ * Userland stand-ins of the kernel interfaces used by the sources under test.
+ * Every header of the kernel the sources include resolves to this one. Only
+ * the declarations are here, each test defines the functions it reaches.
+ */
+
+#ifndef _TESTS_KERN_H_
+#define _TESTS_KERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <sys/queue.h>
+
+typedef uint8_t     u_int8_t;
+typedef uint16_t    u_int16_t;
+typedef uint32_t    u_int32_t;
+typedef uint64_t    u_int64_t;
+typedef unsigned char   u_char;
+typedef unsigned short  u_short;
+typedef unsigned int    u_int;
+typedef unsigned long   u_long;
+typedef char *      caddr_t;
+typedef int64_t     off_t;
+typedef int64_t     daddr_t;
+typedef uint32_t    ino_t;
+typedef uint32_t    uid_t;
+typedef uint32_t    gid_t;
+typedef uint16_t    mode_t;
+typedef uint32_t    dev_t;
+typedef int64_t     time_t;
+typedef long        ssize_t;
+
+struct cdev;
+struct mount;
+struct ucred;
+struct vnode;
+
+struct timespec {
+    time_t  tv_sec;
+    long    tv_nsec;
+};
+
+/* errno */
+#define EPERM       1
+#define ENOENT      2
+#define EIO         5
+#define ENOMEM      12
+#define EBUSY       16
+#define EEXIST      17
+#define EINVAL      22
+#define EFBIG       27
+#define ENOSPC      28
+#define EROFS       30
+#define EAGAIN      35
+#define EOPNOTSUPP  45
+#define ENAMETOOLONG 63
+#define EFTYPE      79
+
+/* param */
+#define MAXBSIZE    65536
+#define MAXPHYS     (128 * 1024)
+#define DEV_BSIZE   512
+#define DEV_BSHIFT  9
+#define btodb(b)    ((daddr_t)(b) >> DEV_BSHIFT)
+#define dbtob(d)    ((off_t)(d) << DEV_BSHIFT)
+#define NBBY        8
+#define NOCRED      ((struct ucred *)0)
+#define min(a, b)   ((u_int)(a) < (u_int)(b) ? (u_int)(a) : (u_int)(b))
+#define max(a, b)   ((u_int)(a) > (u_int)(b) ? (u_int)(a) : (u_int)(b))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
+#define roundup(x, y)   ((((x) + ((y) - 1)) / (y)) * (y))
+#define rounddown(x, y) (((x) / (y)) * (y))
+#define roundup2(x, y)  (((x) + ((y) - 1)) & (~((y) - 1)))
+#define howmany(x, y)   (((x) + ((y) - 1)) / (y))
+#define nitems(x)   (sizeof((x)) / sizeof((x)[0]))
+#define powerof2(x) ((((x) - 1) & (x)) == 0)
+#define CTASSERT(x) _Static_assert(x, "compile-time assertion failed")
+#define __predict_false(x)  (x)
+#define __predict_true(x)   (x)
+#define __unused    __attribute__((unused))
+#define __packed    __attribute__((packed))
+#define __printflike(a, b) __attribute__((format(printf, a, b)))
+#define __DECONST(t, v) ((t)(uintptr_t)(const void *)(v))
+#define KASSERT(e, m)
+#define MPASS(e)
+
+/* systm */
+void abort(void);
+#define panic(...)  abort()
+int printf(const char *, ...) __printflike(1, 2);
+int snprintf(char *, size_t, const char *, ...) __printflike(3, 4);
+#define log         kern_log
+void kern_log(int, const char *, ...) __printflike(2, 3);
+#define LOG_ERR     3
+#define LOG_WARNING 4
+#define LOG_NOTICE  5
+#define LOG_INFO    6
+void bcopy(const void *, void *, size_t);
+void bzero(void *, size_t);
+int bcmp(const void *, const void *, size_t);
+void * memcpy(void *, const void *, size_t);
+void * memmove(void *, const void *, size_t);
+void * memset(void *, int, size_t);
+int memcmp(const void *, const void *, size_t);
+size_t strlen(const char *);
+int strcmp(const char *, const char *);
+int ffs(int);
+int fls(int);
+#define bitcount64(x)   ((u_int)__builtin_popcountll(x))
+void qsort(void *, size_t, size_t, int (*)(const void *, const void *));
+extern int hz;
+extern int ticks;
+extern int desiredvnodes;
+const char * devtoname(struct cdev *);
+void nanouptime(struct timespec *);
+
+/* The libc of the tests, the names clashing with the kernel are not declared */
+int rand(void);
+void srand(unsigned);
+int atoi(const char *);
+char * getenv(const char *);
+void exit(int);
+
+/* endian */
+#define be16toh(x)  __builtin_bswap16(x)
+#define be32toh(x)  __builtin_bswap32(x)
+#define be64toh(x)  __builtin_bswap64(x)
+#define htobe16(x)  __builtin_bswap16(x)
+#define htobe32(x)  __builtin_bswap32(x)
+#define htobe64(x)  __builtin_bswap64(x)
+#define le16toh(x)  (x)
+#define le32toh(x)  (x)
+#define le64toh(x)  (x)
+#define bswap16(x)  __builtin_bswap16(x)
+#define bswap32(x)  __builtin_bswap32(x)
+#define bswap64(x)  __builtin_bswap64(x)
+#define be16dec(p)  __builtin_bswap16(*(const uint16_t *)(p))
+#define be32dec(p)  __builtin_bswap32(*(const uint32_t *)(p))
+#define be64dec(p)  __builtin_bswap64(*(const uint64_t *)(p))
+#define be16enc(p, v) (*(uint16_t *)(p) = __builtin_bswap16(v))
+#define be32enc(p, v) (*(uint32_t *)(p) = __builtin_bswap32(v))
+#define be64enc(p, v) (*(uint64_t *)(p) = __builtin_bswap64(v))
+
+/* malloc, see kern.c */
+struct malloc_type {
+    int     mt_unused;
+};
+#define MALLOC_DEFINE(t, s, l)  struct malloc_type t[1]
+#define MALLOC_DECLARE(t)       extern struct malloc_type t[1]
+#define M_WAITOK    0x0001
+#define M_NOWAIT    0x0002
+#define M_ZERO      0x0100
+#define M_TEMP      ((struct malloc_type *)0)
+#define malloc      kern_malloc
+#define free        kern_free
+void * kern_malloc(size_t, struct malloc_type *, int);
+void kern_free(void *, struct malloc_type *);
+void * hashinit(int, struct malloc_type *, u_long *);
+void hashdestroy(void *, struct malloc_type *, u_long);
+
+typedef struct uma_zone * uma_zone_t;
+void * uma_zalloc(uma_zone_t, int);
+void uma_zfree(uma_zone_t, void *);
+
+/* Locks, a test runs in a single thread */
+struct mtx {
+    int     mtx_unused;
+};
+struct sx {
+    int     sx_unused;
+};
+#define MTX_DEF     0
+#define mtx_init(m, n, t, o)    ((void)(m))
+#define mtx_destroy(m)          ((void)(m))
+#define mtx_lock(m)             ((void)(m))
+#define mtx_unlock(m)           ((void)(m))
+#define mtx_assert(m, w)
+#define sx_init(s, n)           ((void)(s))
+#define sx_destroy(s)           ((void)(s))
+#define sx_xlock(s)             ((void)(s))
+#define sx_xunlock(s)           ((void)(s))
+#define sx_slock(s)             ((void)(s))
+#define sx_sunlock(s)           ((void)(s))
+#define PRIBIO      16
+#define PVFS        80
+int msleep(void *, struct mtx *, int, const char *, int);
+void wakeup(void *);
+
+#define atomic_add_int(p, v)        __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_subtract_int(p, v)   __atomic_sub_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_add_long(p, v)       __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_subtract_long(p, v)  __atomic_sub_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_load_acq_int(p)      (*(p))
+#define atomic_store_rel_int(p, v)  (*(p) = (v))
+#define atomic_cmpset_int(p, o, n)  __sync_bool_compare_and_swap((p), (o), (n))
+#define atomic_cmpset_ptr(p, o, n)  __sync_bool_compare_and_swap((p), (o), (n))
+
+/* sysctl, the variables are only read by the tests */
+#define SYSCTL_DECL(n)  extern int sysctl_##n##_unused
+#define SYSCTL_NODE(p, n, name, f, h, d) int sysctl_##p##_##name##_unused
+#define SYSCTL_INT(p, n, name, f, v, d, desc)   SYSCTL_DECL(p##_##name)
+#define SYSCTL_UINT(p, n, name, f, v, d, desc)  SYSCTL_DECL(p##_##name)
+#define SYSCTL_LONG(p, n, name, f, v, d, desc)  SYSCTL_DECL(p##_##name)
+#define SYSCTL_ULONG(p, n, name, f, v, d, desc) SYSCTL_DECL(p##_##name)
+#define SYSCTL_PROC(p, n, name, f, a1, a2, h, fmt, d) SYSCTL_DECL(p##_##name)
+struct sysctl_req;
+struct sysctl_oid;
+#define SYSCTL_HANDLER_ARGS struct sysctl_oid * oidp, void * arg1, intmax_t arg2, struct sysctl_req * req
+int sysctl_handle_int(SYSCTL_HANDLER_ARGS);
+
+/* taskqueue, each test runs the tasks it enqueues */
+struct task {
+    int     ta_unused;
+};
+struct timeout_task {
+    struct task t;
+};
+struct taskqueue;
+typedef void task_fn_t(void * context, int pending);
+#define TASK_INIT(t, p, f, c)               ((void)(f))
+#define TIMEOUT_TASK_INIT(q, t, p, f, c)    ((void)(f))
+int taskqueue_enqueue(struct taskqueue *, struct task *);
+void taskqueue_drain(struct taskqueue *, struct task *);
+int taskqueue_enqueue_timeout(struct taskqueue *, struct timeout_task *, int);
+int taskqueue_cancel_timeout(struct taskqueue *, struct timeout_task *, u_int *);
+void taskqueue_drain_timeout(struct taskqueue *, struct timeout_task *);
+
+/* buf, bufobj, vnode, the device is the memory of the test */
+struct cdev {
+    int     si_unused;
+};
+struct bufobj {
+    int     bo_unused;
+};
+struct vnode {
+    struct bufobj   v_bufobj;
+};
+struct buf {
+    caddr_t b_data;
+    long    b_bcount;
+    daddr_t b_blkno;
+    int     b_flags;
+};
+#define B_INVAL     0x00002000
+#define B_NOCACHE   0x00008000
+#define B_RELBUF    0x00400000
+#define GB_NOCREAT  0x0001
+int bread(struct vnode *, daddr_t, int, struct ucred *, struct buf **);
+void breada(struct vnode *, daddr_t *, int *, int, struct ucred *);
+struct buf * getblk(struct vnode *, daddr_t, int, int, int, int);
+void brelse(struct buf *);
+int bwrite(struct buf *);
+void bawrite(struct buf *);
+#define BO_LOCK(bo)     ((void)(bo))
+#define BO_UNLOCK(bo)   ((void)(bo))
+int bufobj_wwait(struct bufobj *, int, int);
+
+/* geom */
+struct g_consumer {
+    int     acr, acw, ace;
+};
+int g_io_flush(struct g_consumer *);
+
+#endif /* _TESTS_KERN_H_ */
@@ -0,0 +1 @@
+#include "../kern.h"
@@ -0,0 +1,124 @@
+/*
+ * The red-black tree interface of <sys/tree.h> over a sorted doubly linked
+ * list. The tests only need the order, not the logarithmic cost.
+ */
+
+#ifndef _TESTS_SYS_TREE_H_
+#define _TESTS_SYS_TREE_H_
+
+#define RB_HEAD(name, type)                                                 \
+struct name {                                                               \
+    struct type *   rbh_root;                                               \
+}
+
+#define RB_ENTRY(type)                                                      \
+struct {                                                                    \
+    struct type *   rbe_next;                                               \
+    struct type *   rbe_prev;                                               \
+}
+
+#define RB_INIT(head)   ((head)->rbh_root = NULL)
+#define RB_EMPTY(head)  ((head)->rbh_root == NULL)
+
+#define RB_GENERATE(name, type, field, cmp)                                 \
+    RB_GENERATE_STATIC(name, type, field, cmp)
+
+#define RB_GENERATE_STATIC(name, type, field, cmp)                          \
+static __unused struct type *                                               \
+name##_RB_INSERT(struct name * head, struct type * elm)                     \
+{                                                                           \
+    struct type ** pp, * prev;                                              \
+    int c;                                                                  \
+                                                                            \
+    c = 1;                                                                  \
+    prev = NULL;                                                            \
+    for (pp = &head->rbh_root; *pp != NULL; pp = &(*pp)->field.rbe_next)    \
+    {                                                                       \
+        if ((c = cmp(*pp, elm)) >= 0)                                       \
+            break;                                                          \
+        prev = *pp;                                                         \
+    }                                                                       \
+    if (*pp != NULL && c == 0)                                              \
+        return *pp;                                                         \
+    elm->field.rbe_next = *pp;                                              \
+    elm->field.rbe_prev = prev;                                             \
+    if (*pp != NULL)                                                        \
+        (*pp)->field.rbe_prev = elm;                                        \
+    *pp = elm;                                                              \
+    return NULL;                                                            \
+}                                                                           \
+                                                                            \
+static __unused struct type *                                               \
+name##_RB_REMOVE(struct name * head, struct type * elm)                     \
+{                                                                           \
+    if (elm->field.rbe_prev != NULL)                                        \
+        elm->field.rbe_prev->field.rbe_next = elm->field.rbe_next;          \
+    else                                                                    \
+        head->rbh_root = elm->field.rbe_next;                               \
+    if (elm->field.rbe_next != NULL)                                        \
+        elm->field.rbe_next->field.rbe_prev = elm->field.rbe_prev;          \
+    return elm;                                                             \
+}                                                                           \
+                                                                            \
+static __unused struct type *                                               \
+name##_RB_NFIND(struct name * head, struct type * elm)                      \
+{                                                                           \
+    struct type * x;                                                        \
+                                                                            \
+    for (x = head->rbh_root; x != NULL; x = x->field.rbe_next)              \
+        if (cmp(x, elm) >= 0)                                               \
+            return x;                                                       \
+    return NULL;                                                            \
+}                                                                           \
+                                                                            \
+static __unused struct type *                                               \
+name##_RB_FIND(struct name * head, struct type * elm)                       \
+{                                                                           \
+    struct type * x;                                                        \
+                                                                            \
+    x = name##_RB_NFIND(head, elm);                                         \
+    return x != NULL && cmp(x, elm) == 0 ? x : NULL;                        \
+}                                                                           \
+                                                                            \
+static __unused struct type *                                               \
+name##_RB_MINMAX(struct name * head, int val)                               \
+{                                                                           \
+    struct type * x;                                                        \
+                                                                            \
+    x = head->rbh_root;                                                     \
+    if (val > 0 && x != NULL)                                               \
+        while (x->field.rbe_next != NULL)                                   \
+            x = x->field.rbe_next;                                          \
+    return x;                                                               \
+}                                                                           \
+                                                                            \
+static __unused struct type *                                               \
+name##_RB_NEXT(struct type * elm)                                           \
+{                                                                           \
+    return elm->field.rbe_next;                                             \
+}                                                                           \
+                                                                            \
+static __unused struct type *                                               \
+name##_RB_PREV(struct type * elm)                                           \
+{                                                                           \
+    return elm->field.rbe_prev;                                             \
+}
+
+#define RB_INSERT(name, x, y)   name##_RB_INSERT(x, y)
+#define RB_REMOVE(name, x, y)   name##_RB_REMOVE(x, y)
+#define RB_FIND(name, x, y)     name##_RB_FIND(x, y)
+#define RB_NFIND(name, x, y)    name##_RB_NFIND(x, y)
+#define RB_NEXT(name, x, y)     name##_RB_NEXT(y)
+#define RB_PREV(name, x, y)     name##_RB_PREV(y)
+#define RB_MIN(name, x)         name##_RB_MINMAX(x, -1)
+#define RB_MAX(name, x)         name##_RB_MINMAX(x, 1)
+
+#define RB_FOREACH(x, name, head)                                           \
+    for ((x) = RB_MIN(name, head); (x) != NULL; (x) = name##_RB_NEXT(x))
+
+#define RB_FOREACH_SAFE(x, name, head, y)                                   \
+    for ((x) = RB_MIN(name, head);                                          \
+         (x) != NULL && ((y) = name##_RB_NEXT(x), 1);                       \
+         (x) = (y))
+
+#endif /* _TESTS_SYS_TREE_H_ */
@@ -0,0 +1,121 @@
+/*
+ * Conversions of hfsp_unicode.c between the names of the catalogue and UTF-8.
+ * Every composition pair must be undone by the decomposition table, and every
+ * character of the BMP, stored decomposed and listed with or without NFC, must
+ * convert back to the name stored, or a name listed could not be looked up.
+ *
+ * usage: unicode_test
+ */
+
+#include "hfsp_unicode.c"
+
+#define check(e) do {                                                       \
+    if (!(e))                                                               \
+    {                                                                       \
+        printf("unicode_test: %s failed at line %d\n", #e, __LINE__);       \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+/*
+ * UTF-8 of a single character.
+ */
+static size_t
+utf8(u_int16_t c, char * buf)
+{
+    if (c < 0x80)
+    {
+        buf[0] = c;
+        return 1;
+    }
+    if (c < 0x800)
+    {
+        buf[0] = 0xC0 | (c >> 6);
+        buf[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    buf[0] = 0xE0 | (c >> 12);
+    buf[1] = 0x80 | ((c >> 6) & 0x3F);
+    buf[2] = 0x80 | (c & 0x3F);
+    return 3;
+}
+
+/*
+ * List a stored name and look it up again: the name converted back must be
+ * the one stored.
+ * ustr, ulen: The name stored, BE.
+ * flags: The flags of hfsp_unicode_to_utf8().
+ * return: The number of characters of the name listed.
+ */
+static int
+round_trip(const hfsp_unichar * ustr, int ulen, int flags)
+{
+    hfsp_unichar back[16];
+    char buf[64];
+    size_t len;
+    int blen, n;
+
+    check(hfsp_unicode_to_utf8(ustr, ulen, buf, sizeof(buf), &len, flags) == 0);
+    check(hfsp_unicode_from_utf8(buf, len, back, nitems(back), &blen) == 0);
+    check(blen == ulen && memcmp(back, ustr, ulen * sizeof(*ustr)) == 0);
+
+    n = 0;
+    while (len > 0)
+    {
+        n += (buf[len - 1] & 0xC0) != 0x80;
+        len--;
+    }
+    return n;
+}
+
+int
+main(int argc, char ** argv)
+{
+    const struct hfsp_compose_pair * pair;
+    hfsp_unichar ustr[8];
+    u_int16_t seq[4], base[4], mark;
+    char buf[4];
+    u_int c;
+    int m, k, i, n, nbase, ulen, pairs, composed;
+
+    // Each pair decomposes back to the decomposition of its base and its mark.
+    pairs = 0;
+    for (m = 0; m < nitems(hfsp_compose_marks); m++)
+    {
+        mark = hfsp_compose_marks[m].hcm_mark;
+        check(m == 0 || hfsp_compose_marks[m - 1].hcm_mark < mark);
+        check(hfsp_compose_marks[m].hcm_start == pairs);
+        for (k = 0; k < hfsp_compose_marks[m].hcm_count; k++, pairs++)
+        {
+            pair = &hfsp_compose_pairs[pairs];
+            check(k == 0 || pair[-1].hcp_base < pair->hcp_base);
+            check(hfsp_unicode_compose(pair->hcp_base, mark) == pair->hcp_composed);
+            n = hfsp_unicode_decompose(pair->hcp_composed, seq);
+            nbase = hfsp_unicode_decompose(pair->hcp_base, base);
+            base[nbase++] = mark;
+            check(n == nbase && memcmp(seq, base, n * sizeof(*seq)) == 0);
+
+            // Stored decomposed, listed as the composed character.
+            for (i = 0; i < n; i++)
+                ustr[i] = htobe16(seq[i]);
+            check(round_trip(ustr, n, HFSP_UTF8_NFC) == 1);
+        }
+    }
+    check(pairs == nitems(hfsp_compose_pairs));
+
+    // Every character of the BMP, as the catalogue stores it.
+    composed = 0;
+    for (c = 1; c < 0x10000; c++)
+    {
+        if (c >= 0xD800 && c < 0xE000)
+            continue;
+        check(hfsp_unicode_from_utf8(buf, utf8(c, buf), ustr, nitems(ustr), &ulen) == 0);
+        check(ulen >= 1 && ulen <= 4);
+        round_trip(ustr, ulen, 0);
+        if (round_trip(ustr, ulen, HFSP_UTF8_NFC) < ulen)
+            composed++;
+    }
+
+    printf("unicode_test: %d pairs, %d characters listed composed\n", pairs, composed);
+    return 0;
+}
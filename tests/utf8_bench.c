@@ -0,0 +1,203 @@
+/*
+ * Throughput of the name converter of hfsp_unicode.c against the one it
+ * replaced, in bytes of catalogue names converted per second. The old
+ * converter is copied below as it was in hfsp_debug.c. It stops early on
+ * names that are not ASCII, so it is only timed on ASCII names.
+ *
+ * usage: utf8_bench [milliseconds per run]
+ */
+
+#include "hfsp_unicode.c"
+
+/* Names as listed, stored decomposed in the catalogue */
+static const char * short_names[] = {
+    "README", "Makefile", "main.c", ".DS_Store", "a.out", "Info.plist",
+    "IMG_0042.JPG", "index.html", "tmp", "Desktop", "notes.txt", "lib",
+};
+static const char * long_names[] = {
+    "Screen Shot 2016-03-14 at 10.42.17 AM.png",
+    "com.apple.LaunchServices.QuarantineEventsV2",
+    "Annual Report 2015 - Final Version (reviewed).docx",
+    "libboost_program_options-mt.1.60.0.dylib",
+    "The Quick Brown Fox Jumps Over The Lazy Dog.txt",
+    "2016-02-29 Minutes of the steering committee meeting.pdf",
+};
+static const char * latin_names[] = {
+    "Café.txt", "Résumé.pdf", "Überweisung März.pdf", "Noël à la plage.jpg",
+    "Fotos año nuevo", "Smörgåsbord.doc", "naïve façade.png", "Ærøskøbing",
+};
+
+struct bench_set {
+    const char *    bs_name;
+    const char **   bs_names;
+    int             bs_count;
+    int             bs_ascii;
+};
+
+static const struct bench_set sets[] = {
+    {"short ASCII", short_names, nitems(short_names), 1},
+    {"long ASCII", long_names, nitems(long_names), 1},
+    {"Latin", latin_names, nitems(latin_names), 0},
+};
+
+static struct {
+    hfsp_unichar    ustr[255];
+    int             ulen;
+} stored[16];
+
+static u_int32_t sink;
+
+static struct utf8_table {
+    int cmask;
+    int cval;
+    int shift;
+    long lmask;
+    long lval;
+} utf8_table[] =
+{
+    {0x80,  0x00,   0*6,    0x7F,           0,         /* 1 byte sequence */},
+    {0xE0,  0xC0,   1*6,    0x7FF,          0x80,      /* 2 byte sequence */},
+    {0xF0,  0xE0,   2*6,    0xFFFF,         0x800,     /* 3 byte sequence */},
+    {0xF8,  0xF0,   3*6,    0x1FFFFF,       0x10000,   /* 4 byte sequence */},
+    {0xFC,  0xF8,   4*6,    0x3FFFFFF,      0x200000,  /* 5 byte sequence */},
+    {0xFE,  0xFC,   5*6,    0x7FFFFFFF,     0x4000000, /* 6 byte sequence */},
+    {0,                                                /* end of table    */}
+};
+
+static int
+old_utf8_wctomb(char * sp, u_int16_t wc, int maxLen)
+{
+    long l;
+    int c, nc;
+    struct utf8_table *t;
+
+    if (sp == 0)
+        return 0;
+
+    l = wc;
+    nc = 0;
+    for (t = utf8_table; t->cmask && maxLen; t++, maxLen--)
+    {
+        nc++;
+        if (l <= t->lmask)
+        {
+            c = t->shift;
+            *sp = t->cval | (l >> c);
+            while (c > 0)
+            {
+                c -= 6;
+                sp++;
+                *sp = 0x80 | ((l >> c) & 0x3F);
+            }
+            return nc;
+        }
+    }
+    return -1;
+}
+
+static int
+old_uni2asc(const hfsp_unichar * ustr, int ulen, char * astrp, int len)
+{
+    int left, process, size;
+    u_int16_t c;
+
+    process = 0;
+    left = len;
+    while (process < ulen && left > 0)
+    {
+        c = be16toh(ustr[process]);
+        if (!c || c > 0x7f)
+        {
+            size = old_utf8_wctomb(astrp+process, c ? c : 0x2400, left);
+            if (size != -1)
+            {
+                process +=size;
+                left += size;
+            }
+        }
+        else
+        {
+            astrp[process] = (char)c;
+            left--;
+            process++;
+        }
+    }
+
+    return 0;
+}
+
+static u_int64_t
+now(void)
+{
+    struct timespec ts;
+
+    nanouptime(&ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Convert the names of a set over and over for a while.
+ * converter: 0 for the old one, else the flags of hfsp_unicode_to_utf8() + 1.
+ * return: Bytes of names converted per second.
+ */
+static double
+run(int count, int converter, u_int64_t duration)
+{
+    /* The old converter writes up to 3 bytes per character past its limit */
+    char buf[255 * 3 + 8];
+    u_int64_t start, elapsed, bytes;
+    size_t len;
+    int pass, i;
+
+    bytes = 0;
+    start = now();
+    do
+    {
+        // Enough names between two reads of the clock for them not to count.
+        for (pass = 0; pass < 1000; pass++)
+        {
+            for (i = 0; i < count; i++)
+            {
+                if (converter == 0)
+                {
+                    old_uni2asc(stored[i].ustr, stored[i].ulen, buf, 255);
+                    len = stored[i].ulen;
+                }
+                else if (hfsp_unicode_to_utf8(stored[i].ustr, stored[i].ulen, buf, sizeof(buf), &len,
+                                              converter - 1) != 0)
+                    abort();
+                sink += buf[len - 1];
+                bytes += stored[i].ulen * sizeof(hfsp_unichar);
+            }
+        }
+        elapsed = now() - start;
+    } while (elapsed < duration);
+
+    return bytes * 1e9 / elapsed;
+}
+
+int
+main(int argc, char ** argv)
+{
+    const struct bench_set * set;
+    u_int64_t duration;
+    int s, i;
+
+    duration = (argc > 1 ? atoi(argv[1]) : 500) * 1000000ULL;
+    for (s = 0; s < nitems(sets); s++)
+    {
+        set = &sets[s];
+        for (i = 0; i < set->bs_count; i++)
+            if (hfsp_unicode_from_utf8(set->bs_names[i], strlen(set->bs_names[i]), stored[i].ustr,
+                                       nitems(stored[i].ustr), &stored[i].ulen) != 0)
+                abort();
+        printf("utf8_bench: %-12s", set->bs_name);
+        if (set->bs_ascii)
+            printf(" old %7.1f MB/s,", run(set->bs_count, 0, duration) / 1e6);
+        else
+            printf(" old        -     ,");
+        printf(" new %7.1f MB/s, new with NFC %7.1f MB/s\n", run(set->bs_count, 1, duration) / 1e6,
+               run(set->bs_count, 1 + HFSP_UTF8_NFC, duration) / 1e6);
+    }
+    return 0;
+}